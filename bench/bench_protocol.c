@@ -0,0 +1,999 @@
+/**
+ * @file bench_protocol.c
+ * @brief Microbenchmarks of the protocol module hot paths.
+ *
+ * Usage: bench_protocol [-m min_time_ms] [-p cpu] [-o output] [-b baseline] [-r regression_%] [filter]
+ *
+ * Each benchmark runs until the minimum time and prints a tab-separated line of
+ * name, ns/op, ops/s and allocations/op. The allocations are counted by wrapping
+ * malloc, calloc and realloc at link time. With an output file, the results are
+ * also written there to be used as a later baseline. With a baseline, each result
+ * is compared with the baseline result of the same name, and the exit status is 1
+ * if a benchmark is slower by more than the regression threshold or allocates more.
+ * A filter runs only the benchmarks whose name contains it.
+ */
+#include "protocol.h"
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define BENCH_MIN_TIME_MS_DEFAULT 200
+#define BENCH_REGRESSION_DEFAULT 20.0
+#define BENCH_RESULTS_MAX 64
+#define BENCH_NAME_SIZE 64
+#define BENCH_LINES 10000
+#define BENCH_TICKS 200
+#define BENCH_TICK_FEED_US 500
+#define BENCH_SOCKET_BUFFER_SIZE (1024 * 1024)
+#define BENCH_ENDPOINT_PORTS 8         // listening ports of the stand-in servers
+#define BENCH_ENDPOINT_HOSTS 250       // loopback hosts per second address byte, 127.0.x.1..250
+#define BENCH_ENDPOINT_FEED 1          // endpoints written per feed round, a constant aggregate rate
+#define BENCH_ENDPOINT_FEED_MS 1
+#define BENCH_ENDPOINT_INTERVAL_MS 10
+#define BENCH_ENDPOINT_TICKS 100
+
+// Allocation counter of the wrapped allocation functions
+static atomic_ulong bench_allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&bench_allocations, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    atomic_fetch_add_explicit(&bench_allocations, 1, memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+    atomic_fetch_add_explicit(&bench_allocations, 1, memory_order_relaxed);
+    return __real_realloc(pointer, size);
+}
+
+// Benchmark result
+typedef struct
+{
+    char name[BENCH_NAME_SIZE];
+    double ns_per_op;
+    double ops_per_s;
+    double allocs_per_op;
+} bench_result;
+
+// Benchmark operation, runs the iterations and returns the measured nanoseconds
+typedef long long (*bench_operation)(void *context, long long iterations);
+
+static long long bench_min_time_ns = BENCH_MIN_TIME_MS_DEFAULT * 1000000LL;
+static const char *bench_filter = NULL;
+static bench_result bench_results[BENCH_RESULTS_MAX];
+static int bench_result_count = 0;
+
+static long long bench_now_ns(void)
+{
+    return stats_now_ns();
+}
+
+static void bench_record(const char *name, long long elapsed_ns, long long iterations, unsigned long allocations)
+{
+    if (bench_result_count == BENCH_RESULTS_MAX)
+        return;
+    bench_result *result = &bench_results[bench_result_count++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->ns_per_op = (double)elapsed_ns / iterations;
+    result->ops_per_s = elapsed_ns > 0 ? iterations * 1e9 / elapsed_ns : 0.0;
+    result->allocs_per_op = (double)allocations / iterations;
+    printf("%s\t%.1f\t%.0f\t%.3f\n", result->name, result->ns_per_op, result->ops_per_s, result->allocs_per_op);
+    fflush(stdout);
+}
+
+// Run an operation with growing iteration counts until the minimum time is measured
+static void bench_run(const char *name, bench_operation operation, void *context)
+{
+    if ((bench_filter != NULL) && (strstr(name, bench_filter) == NULL))
+        return;
+    operation(context, 1); // warm-up
+
+    long long iterations = 1;
+    while (1)
+    {
+        unsigned long allocations = atomic_load(&bench_allocations);
+        long long elapsed_ns = operation(context, iterations);
+        allocations = atomic_load(&bench_allocations) - allocations;
+        if ((elapsed_ns >= bench_min_time_ns) || (iterations >= 1000000000LL))
+        {
+            bench_record(name, elapsed_ns, iterations, allocations);
+            return;
+        }
+        long long next = (elapsed_ns > 0) ? (long long)(iterations * 1.2 * bench_min_time_ns / elapsed_ns) : iterations * 100;
+        if (next < iterations * 2)
+            next = iterations * 2;
+        if (next > iterations * 100)
+            next = iterations * 100;
+        iterations = next;
+    }
+}
+
+// Build a channel table named out1, out2, ... with the values set
+static void bench_channels(channel_table *channels, int count)
+{
+    memset(channels, 0, sizeof(*channels));
+    for (int i = 0; i < count; i++)
+    {
+        char name[CHANNEL_NAME_SIZE];
+        char value[CHANNEL_VALUE_SIZE];
+        snprintf(name, sizeof(name), "out%d", i + 1);
+        snprintf(value, sizeof(value), "%.1f", (i * 13 % 100 - 50) / 10.0);
+        channel_table_add(channels, CHANNEL_HOST_DEFAULT, TCP_PORT_OUT1 + i, name);
+        channel_set_value(&channels->states[i], (i % 4 == 3) ? CHANNEL_EMPTY_VALUE : value);
+    }
+}
+
+// The previous parser, replaces "--" by "nan" in a copy of the line for sscanf
+static int parse_report_line_sscanf(const char *line, report_message *message)
+{
+    char *line_float = replaceAll(line, "--", "nan");
+    const char *position = line_float;
+    int length = 0;
+
+    message->count = 0;
+    if (sscanf(position, "{\"timestamp\": %lld%n", &message->timestamp, &length) != 1)
+    {
+        free(line_float);
+        return 0;
+    }
+    position += length;
+    while ((message->count < REPORT_CHANNEL_MAX) &&
+           (sscanf(position, ", \"%*[^\"]\": \"%f\"%n", &message->values[message->count], &length) == 1))
+    {
+        message->count++;
+        position += length;
+    }
+    int result = (message->count > 0) && (*position == '}');
+    free(line_float);
+    return result;
+}
+
+// Report lines of a channel table, one per line, varying values
+typedef struct
+{
+    char *buffer;
+    size_t length;
+    int line_count;
+    char **lines;
+} bench_lines;
+
+static int bench_lines_init(bench_lines *lines, int channel_count, int line_count)
+{
+    channel_table channels;
+    bench_channels(&channels, channel_count);
+    size_t line_size = report_buffer_size(&channels);
+    lines->buffer = malloc(line_size * line_count);
+    lines->lines = malloc(line_count * sizeof(char *));
+    lines->line_count = line_count;
+    if ((lines->buffer == NULL) || (lines->lines == NULL))
+        return -1;
+
+    char *position = lines->buffer;
+    for (int n = 0; n < line_count; n++)
+    {
+        report_timestamp = 1709898396584LL + n * 100LL;
+        for (int i = 0; i < channel_count; i++)
+        {
+            char value[CHANNEL_VALUE_SIZE];
+            if ((n + i) % 4 == 3)
+                snprintf(value, sizeof(value), "%s", CHANNEL_EMPTY_VALUE);
+            else
+                snprintf(value, sizeof(value), "%.1f", ((n * 7 + i * 13) % 100 - 50) / 10.0);
+            channel_set_value(&channels.states[i], value);
+        }
+        lines->lines[n] = position;
+        position += format_report(position, line_size, &channels) + 1; // null-terminated
+    }
+    lines->length = position - lines->buffer;
+    channel_table_free(&channels);
+    return 0;
+}
+
+static void bench_lines_free(bench_lines *lines)
+{
+    free(lines->buffer);
+    free(lines->lines);
+}
+
+// Count the lines the parsers disagree on, NaN equal to NaN
+static int bench_compare_parsers(const bench_lines *lines)
+{
+    report_message expected, actual;
+    int mismatches = 0;
+    for (int n = 0; n < lines->line_count; n++)
+    {
+        int expected_result = parse_report_line_sscanf(lines->lines[n], &expected);
+        int actual_result = parse_report_line(lines->lines[n], &actual);
+        int equal = (expected_result == actual_result) && (expected.timestamp == actual.timestamp) &&
+                    (expected.count == actual.count);
+        for (int i = 0; equal && (i < expected.count); i++)
+            equal = (expected.values[i] == actual.values[i]) || (isnan(expected.values[i]) && isnan(actual.values[i]));
+        mismatches += !equal;
+    }
+    return mismatches;
+}
+
+static long long bench_parse_sscanf(void *context, long long iterations)
+{
+    bench_lines *lines = context;
+    report_message message;
+    long long start_ns = bench_now_ns();
+    for (long long i = 0; i < iterations; i++)
+        parse_report_line_sscanf(lines->lines[i % lines->line_count], &message);
+    return bench_now_ns() - start_ns;
+}
+
+static long long bench_parse_line(void *context, long long iterations)
+{
+    bench_lines *lines = context;
+    report_message message;
+    long long start_ns = bench_now_ns();
+    for (long long i = 0; i < iterations; i++)
+        parse_report_line(lines->lines[i % lines->line_count], &message);
+    return bench_now_ns() - start_ns;
+}
+
+// Newline-separated copy of the lines for the batch parser
+typedef struct
+{
+    char *buffer;
+    size_t length;
+    int line_count;
+} bench_buffer;
+
+static long long bench_parse_buffer(void *context, long long iterations)
+{
+    bench_buffer *buffer = context;
+    report_message messages[64];
+    long long parsed = 0;
+    size_t offset = 0;
+    long long start_ns = bench_now_ns();
+    while (parsed < iterations)
+    {
+        size_t consumed;
+        int capacity = iterations - parsed < 64 ? iterations - parsed : 64;
+        parsed += parse_report_buffer(buffer->buffer + offset, buffer->length - offset, messages, capacity, &consumed);
+        offset = (offset + consumed < buffer->length) ? offset + consumed : 0;
+    }
+    return bench_now_ns() - start_ns;
+}
+
+static long long bench_replace_all(void *context, long long iterations)
+{
+    bench_lines *lines = context;
+    long long start_ns = bench_now_ns();
+    for (long long i = 0; i < iterations; i++)
+        free(replaceAll(lines->lines[i % lines->line_count], "--", "nan"));
+    return bench_now_ns() - start_ns;
+}
+
+static long long bench_format_report(void *context, long long iterations)
+{
+    channel_table *channels = context;
+    size_t size = report_buffer_size(channels);
+    char buffer[size];
+    long long start_ns = bench_now_ns();
+    for (long long i = 0; i < iterations; i++)
+    {
+        report_timestamp = 1709898396584LL + i;
+        format_report(buffer, size, channels);
+    }
+    return bench_now_ns() - start_ns;
+}
+
+// Connected TCP loopback pair, the backlog is discarded without a copy
+static int bench_tcp_pair(int fds[2])
+{
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t length = sizeof(address);
+    int buffer_size = BENCH_SOCKET_BUFFER_SIZE;
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(listen_fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    if ((listen_fd < 0) || (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0) ||
+        (listen(listen_fd, 1) < 0) || (getsockname(listen_fd, (struct sockaddr *)&address, &length) < 0))
+        return -1;
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+    if (connect(fds[0], (struct sockaddr *)&address, sizeof(address)) < 0)
+        return -1;
+    fds[1] = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+    close(listen_fd);
+    return fds[1] >= 0 ? 0 : -1;
+}
+
+// Backlog of value lines written before each read
+typedef struct
+{
+    int fds[2];
+    char *backlog;
+    size_t size;
+    char line[CHANNEL_VALUE_SIZE];
+} bench_read;
+
+// Send the backlog, waiting until it arrives on loopback before the read
+static void bench_send_backlog(bench_read *read)
+{
+    size_t written = 0;
+    while (written < read->size)
+    {
+        ssize_t count = send(read->fds[0], read->backlog + written, read->size - written, MSG_DONTWAIT);
+        if (count <= 0)
+            break;
+        written += count;
+    }
+    int pending = 0;
+    for (int wait = 0; (wait < 1000) && (ioctl(read->fds[1], FIONREAD, &pending) == 0) && ((size_t)pending < written); wait++)
+        sched_yield();
+}
+
+static long long bench_read_last_line(void *context, long long iterations)
+{
+    bench_read *read = context;
+    long long elapsed_ns = 0;
+    for (long long i = 0; i < iterations; i++)
+    {
+        bench_send_backlog(read);
+        long long start_ns = bench_now_ns();
+        read_tcp_last_line(read->fds[1], read->line, sizeof(read->line));
+        elapsed_ns += bench_now_ns() - start_ns;
+    }
+    return elapsed_ns;
+}
+
+// Channel read of every line of a backlog into the aggregates, and the tick taking them
+typedef struct
+{
+    bench_read read;
+    channel_table channels;
+    report_options options;
+    aggregate_table aggregates;
+} bench_aggregate_read;
+
+static long long bench_read_aggregates(void *context, long long iterations)
+{
+    bench_aggregate_read *aggregate_read = context;
+    long long elapsed_ns = 0;
+    for (long long i = 0; i < iterations; i++)
+    {
+        bench_send_backlog(&aggregate_read->read);
+        long long start_ns = bench_now_ns();
+        report_read_channel(&aggregate_read->options, &aggregate_read->channels, 0, EPOLLIN);
+        aggregate_take(&aggregate_read->aggregates, 0);
+        elapsed_ns += bench_now_ns() - start_ns;
+    }
+    return elapsed_ns;
+}
+
+// Batches of samples of a sine folded into the aggregates of a channel
+typedef struct
+{
+    aggregate_table aggregates;
+    aggregate_batch batch;
+} bench_aggregate;
+
+static long long bench_aggregate_update(void *context, long long iterations)
+{
+    bench_aggregate *aggregate = context;
+    long long start_ns = bench_now_ns();
+    for (long long i = 0; i < iterations; i++)
+        aggregate_update(&aggregate->aggregates, 0, &aggregate->batch);
+    aggregate_take(&aggregate->aggregates, 0);
+    return bench_now_ns() - start_ns;
+}
+
+// Report rows of the signal server waveforms at 20 ms, archived and decoded a block at a time
+typedef struct
+{
+    channel_table channels;
+    char values[ARCHIVE_BLOCK_ROWS][3][CHANNEL_VALUE_SIZE];
+    archive_writer writer;
+    uint8_t *blocks;
+    size_t size;
+    archive_block_decoder decoder;
+} bench_archive;
+
+static void bench_archive_rows(bench_archive *archive)
+{
+    for (int row = 0; row < ARCHIVE_BLOCK_ROWS; row++)
+    {
+        double phase = fmod(row * 0.02 * 0.25, 1.0);
+        snprintf(archive->values[row][0], CHANNEL_VALUE_SIZE, "%.1f", 5.0 * sin(2.0 * M_PI * row * 0.02 * 0.5));
+        snprintf(archive->values[row][1], CHANNEL_VALUE_SIZE, "%.1f", 5.0 * (phase < 0.5 ? 2.0 * phase : 2.0 - 2.0 * phase));
+        snprintf(archive->values[row][2], CHANNEL_VALUE_SIZE, "%s", (row / 150) % 2 ? "5.0" : "0.0");
+    }
+}
+
+static long long bench_archive_append(void *context, long long iterations)
+{
+    bench_archive *archive = context;
+    long long start_ns = bench_now_ns();
+    for (long long i = 0; i < iterations; i++)
+    {
+        int row = i % ARCHIVE_BLOCK_ROWS;
+        for (int c = 0; c < 3; c++)
+            channel_set_value(&archive->channels.states[c], archive->values[row][c]);
+        archive_writer_append(&archive->writer, (1709286246830LL + i * 20) * 1000000LL, &archive->channels);
+    }
+    return bench_now_ns() - start_ns;
+}
+
+static long long bench_archive_decode(void *context, long long iterations)
+{
+    bench_archive *archive = context;
+    long long timestamp;
+    float values[3];
+    long long start_ns = bench_now_ns();
+    for (long long i = 0; i < iterations; i++)
+    {
+        archive_block_begin(&archive->decoder, archive->blocks, archive->size);
+        while (archive_block_next(&archive->decoder, &timestamp, values) == 1)
+            ;
+    }
+    return bench_now_ns() - start_ns;
+}
+
+// A frequency and amplitude pair as in a threshold crossing, with two sendto
+static long long bench_send_control(void *context, long long iterations)
+{
+    udp_socket *control_socket = context;
+    control_message frequency = {CONTROL_OPERATION_WRITE, CONTROL_OBJECT_OUT1,
+                                 CONTROL_OBJECT_OUT1_PROPERTY_FREQUENCY_INDEX, CONTROL_OBJECT_OUT1_PROPERTY_FREQUENCY_1_HZ};
+    control_message amplitude = {CONTROL_OPERATION_WRITE, CONTROL_OBJECT_OUT1,
+                                 CONTROL_OBJECT_OUT1_PROPERTY_AMPLITUDE_INDEX, CONTROL_OBJECT_OUT1_PROPERTY_AMPLITUDE_8000};
+    long long start_ns = bench_now_ns();
+    for (long long i = 0; i < iterations; i++)
+    {
+        send_control_message(*control_socket, frequency);
+        send_control_message(*control_socket, amplitude);
+    }
+    return bench_now_ns() - start_ns;
+}
+
+// The same pair queued and sent with one sendmmsg
+static long long bench_send_control_batch(void *context, long long iterations)
+{
+    control_batch *batch = context;
+    control_message frequency = control_message_encode((control_message){CONTROL_OPERATION_WRITE, CONTROL_OBJECT_OUT1,
+                               CONTROL_OBJECT_OUT1_PROPERTY_FREQUENCY_INDEX, CONTROL_OBJECT_OUT1_PROPERTY_FREQUENCY_1_HZ});
+    control_message amplitude = control_message_encode((control_message){CONTROL_OPERATION_WRITE, CONTROL_OBJECT_OUT1,
+                               CONTROL_OBJECT_OUT1_PROPERTY_AMPLITUDE_INDEX, CONTROL_OBJECT_OUT1_PROPERTY_AMPLITUDE_8000});
+    long long start_ns = bench_now_ns();
+    for (long long i = 0; i < iterations; i++)
+    {
+        control_batch_add(batch, &frequency);
+        control_batch_add(batch, &amplitude);
+        control_batch_flush(batch);
+    }
+    return bench_now_ns() - start_ns;
+}
+
+// Rules of the channels with alternating values, the crossing writes queued but not sent
+typedef struct
+{
+    channel_table channels;
+    control_rule_table rules;
+    control_batch batch;
+    int crossing;
+} bench_rules;
+
+static long long bench_control_rules(void *context, long long iterations)
+{
+    bench_rules *rules = context;
+    long long start_ns = bench_now_ns();
+    for (long long i = 0; i < iterations; i++)
+    {
+        if (rules->crossing)
+        {
+            for (int c = 0; c < rules->channels.count; c++)
+                channel_set_value(&rules->channels.states[c], (i + c) & 1 ? "5.0" : "-5.0");
+        }
+        control_rule_table_evaluate(&rules->rules, &rules->channels, &rules->batch);
+        rules->batch.count = 0;
+    }
+    return bench_now_ns() - start_ns;
+}
+
+// Shared-memory report segment of the channels, published and read in the same process
+typedef struct
+{
+    channel_table channels;
+    shm_report_publisher publisher;
+    shm_report_reader reader;
+    float values[3];
+} bench_shm;
+
+static long long bench_shm_publish(void *context, long long iterations)
+{
+    bench_shm *shm = context;
+    long long start_ns = bench_now_ns();
+    for (long long i = 0; i < iterations; i++)
+        shm_report_publish(&shm->publisher, i, &shm->channels);
+    return bench_now_ns() - start_ns;
+}
+
+static long long bench_shm_read(void *context, long long iterations)
+{
+    bench_shm *shm = context;
+    long long timestamp;
+    long long start_ns = bench_now_ns();
+    for (long long i = 0; i < iterations; i++)
+        shm_report_read(&shm->reader, &timestamp, shm->values, NULL);
+    return bench_now_ns() - start_ns;
+}
+
+// Feeder of the channel sockets for the report tick benchmark
+typedef struct
+{
+    int fds[3][2];
+    atomic_int running;
+} bench_feeder;
+
+static void *bench_feed(void *arg)
+{
+    bench_feeder *feeder = arg;
+    while (atomic_load(&feeder->running))
+    {
+        for (int i = 0; i < 3; i++)
+            write(feeder->fds[i][0], "1.5\n", 4);
+        usleep(BENCH_TICK_FEED_US);
+    }
+    return NULL;
+}
+
+// Run the report loop at 1 ms for a fixed count, the tick stage mean as ns/op
+static void bench_report_tick(void)
+{
+    const char *name = "print_report_tick";
+    if ((bench_filter != NULL) && (strstr(name, bench_filter) == NULL))
+        return;
+
+    bench_feeder feeder;
+    channel_table channels = {0};
+    for (int i = 0; i < 3; i++)
+    {
+        char channel_name[CHANNEL_NAME_SIZE];
+        snprintf(channel_name, sizeof(channel_name), "out%d", i + 1);
+        channel_table_add(&channels, CHANNEL_HOST_DEFAULT, TCP_PORT_OUT1 + i, channel_name);
+        if (bench_tcp_pair(feeder.fds[i]) < 0)
+            return;
+        tcp_stream_init(&channels.states[i].stream, feeder.fds[i][1]);
+    }
+    report_stats stats;
+    report_stats_init(&stats, &channels);
+    report_options options;
+    report_options_init(&options, 1, CONTROL_DISABLED);
+    options.count = BENCH_TICKS + 1;
+    options.stats = &stats;
+    FILE *output = fopen("/dev/null", "w");
+    udp_socket no_control = {.sockfd = -1};
+
+    sigset_t all_signals, previous_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &previous_mask);
+    pthread_t thread;
+    atomic_store(&feeder.running, 1);
+    pthread_create(&thread, NULL, bench_feed, &feeder);
+    pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
+
+    unsigned long allocations = atomic_load(&bench_allocations);
+    print_report(output, &options, &channels, no_control);
+    allocations = atomic_load(&bench_allocations) - allocations;
+    atomic_store(&feeder.running, 0);
+    pthread_join(thread, NULL);
+
+    stats_histogram *tick = &stats.stages[STATS_STAGE_TICK];
+    long long ticks = atomic_load(&tick->count);
+    if (ticks > 0)
+        bench_record(name, atomic_load(&tick->sum), ticks, allocations);
+    fclose(output);
+    report_stats_free(&stats);
+    for (int i = 0; i < 3; i++)
+    {
+        close(feeder.fds[i][0]);
+        close(feeder.fds[i][1]);
+    }
+    channel_table_free(&channels);
+}
+
+// Stand-in signal servers of the endpoint benchmark, in a child process with its own descriptors.
+// The servers accept on all the loopback addresses and write a value line to the next endpoints
+// every round, the same data rate for any endpoint count, until the control pipe is closed.
+static void bench_endpoint_servers(int listen_fds[BENCH_ENDPOINT_PORTS], int control_fd, int endpoint_count)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    int *clients = malloc(endpoint_count * sizeof(int));
+    if (clients == NULL)
+        _exit(EXIT_FAILURE);
+    int client_count = 0;
+    int next = 0;
+    long long feed_ns = stats_now_ns();
+    struct pollfd polls[BENCH_ENDPOINT_PORTS + 1];
+    for (int p = 0; p < BENCH_ENDPOINT_PORTS; p++)
+        polls[p] = (struct pollfd){.fd = listen_fds[p], .events = POLLIN};
+    polls[BENCH_ENDPOINT_PORTS] = (struct pollfd){.fd = control_fd, .events = POLLIN};
+    while (1)
+    {
+        if (poll(polls, BENCH_ENDPOINT_PORTS + 1, BENCH_ENDPOINT_FEED_MS) < 0)
+            continue;
+        if (polls[BENCH_ENDPOINT_PORTS].revents)
+            break;
+        for (int p = 0; p < BENCH_ENDPOINT_PORTS; p++)
+        {
+            int fd;
+            while ((client_count < endpoint_count) && ((fd = accept4(listen_fds[p], NULL, NULL, SOCK_NONBLOCK)) >= 0))
+                clients[client_count++] = fd;
+        }
+        if (stats_now_ns() < feed_ns)
+            continue;
+        feed_ns += BENCH_ENDPOINT_FEED_MS * 1000000LL;
+        for (int k = 0; (k < BENCH_ENDPOINT_FEED) && (client_count > 0); k++)
+        {
+            write(clients[next % client_count], "1.5\n", 4);
+            next++;
+        }
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+// Run the sharded pipeline against endpoints on many loopback hosts, the tick stage mean as ns/op
+static void bench_report_endpoints(int endpoint_count)
+{
+    char name[BENCH_NAME_SIZE];
+    snprintf(name, sizeof(name), "print_report_endpoints/%d", endpoint_count);
+    if ((bench_filter != NULL) && (strstr(name, bench_filter) == NULL))
+        return;
+
+    int listen_fds[BENCH_ENDPOINT_PORTS];
+    int ports[BENCH_ENDPOINT_PORTS];
+    for (int p = 0; p < BENCH_ENDPOINT_PORTS; p++)
+    {
+        struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY)};
+        socklen_t length = sizeof(address);
+        listen_fds[p] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if ((listen_fds[p] < 0) || (bind(listen_fds[p], (struct sockaddr *)&address, sizeof(address)) < 0) ||
+            (listen(listen_fds[p], SOMAXCONN) < 0) || (getsockname(listen_fds[p], (struct sockaddr *)&address, &length) < 0))
+            return;
+        ports[p] = ntohs(address.sin_port);
+    }
+    int control_fds[2];
+    if (pipe(control_fds) < 0)
+        return;
+    pid_t server = fork();
+    if (server == 0)
+    {
+        close(control_fds[1]);
+        bench_endpoint_servers(listen_fds, control_fds[0], endpoint_count);
+    }
+    close(control_fds[0]);
+    for (int p = 0; p < BENCH_ENDPOINT_PORTS; p++)
+        close(listen_fds[p]);
+    if (server < 0)
+    {
+        close(control_fds[1]);
+        return;
+    }
+
+    // Each endpoint is a distinct host and port, 127.0.x.y on one of the server ports
+    channel_table channels = {0};
+    for (int i = 0; i < endpoint_count; i++)
+    {
+        char host[CHANNEL_HOST_SIZE];
+        char channel_name[CHANNEL_NAME_SIZE];
+        snprintf(host, sizeof(host), "127.0.%d.%d", i / BENCH_ENDPOINT_HOSTS, i % BENCH_ENDPOINT_HOSTS + 1);
+        snprintf(channel_name, sizeof(channel_name), "e%d", i);
+        channel_table_add(&channels, host, ports[i % BENCH_ENDPOINT_PORTS], channel_name);
+    }
+    channel_table_connect(&channels);
+
+    // One shard per CPU, at least two so the channels are sharded
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    report_stats stats;
+    report_stats_init(&stats, &channels);
+    report_options options;
+    report_options_init(&options, BENCH_ENDPOINT_INTERVAL_MS, CONTROL_DISABLED);
+    options.count = BENCH_ENDPOINT_TICKS + 1;
+    options.stats = &stats;
+    options.pipeline_enable = 1;
+    options.shard_count = cpus > 2 ? (int)(cpus < PIPELINE_SHARDS_MAX ? cpus : PIPELINE_SHARDS_MAX) : 2;
+    options.shard_cpu = 0;
+    FILE *output = fopen("/dev/null", "w");
+    udp_socket no_control = {.sockfd = -1};
+
+    unsigned long allocations = atomic_load(&bench_allocations);
+    print_report(output, &options, &channels, no_control);
+    allocations = atomic_load(&bench_allocations) - allocations;
+
+    stats_histogram *tick = &stats.stages[STATS_STAGE_TICK];
+    long long ticks = atomic_load(&tick->count);
+    if (ticks > 0)
+        bench_record(name, atomic_load(&tick->sum), ticks, allocations);
+    fprintf(stderr, "%s: tick p99 %llu ns max %llu ns\n", name, (unsigned long long)stats_histogram_percentile(tick, 99.0),
+            (unsigned long long)atomic_load(&tick->max));
+    fclose(output);
+    report_stats_free(&stats);
+    channel_table_close(&channels);
+    channel_table_free(&channels);
+    close(control_fds[1]);
+    waitpid(server, NULL, 0);
+}
+
+static void bench_run_all(void)
+{
+    // Parsing and formatting with 3 and 200 channels
+    int channel_counts[] = {3, 200};
+    for (int c = 0; c < 2; c++)
+    {
+        char name[BENCH_NAME_SIZE];
+        bench_lines lines;
+        if (bench_lines_init(&lines, channel_counts[c], BENCH_LINES) < 0)
+            return;
+        if (bench_compare_parsers(&lines) > 0)
+            fprintf(stderr, "parsers disagree on %d channels\n", channel_counts[c]);
+
+        bench_buffer buffer = {malloc(lines.length), lines.length, lines.line_count};
+        memcpy(buffer.buffer, lines.buffer, lines.length);
+        for (size_t i = 0; i < buffer.length; i++)
+        {
+            if (buffer.buffer[i] == '\0')
+                buffer.buffer[i] = '\n';
+        }
+
+        snprintf(name, sizeof(name), "parse_line_sscanf/%d", channel_counts[c]);
+        bench_run(name, bench_parse_sscanf, &lines);
+        snprintf(name, sizeof(name), "parse_report_line/%d", channel_counts[c]);
+        bench_run(name, bench_parse_line, &lines);
+        snprintf(name, sizeof(name), "parse_report_buffer/%d", channel_counts[c]);
+        bench_run(name, bench_parse_buffer, &buffer);
+        snprintf(name, sizeof(name), "replaceAll/%d", channel_counts[c]);
+        bench_run(name, bench_replace_all, &lines);
+
+        channel_table channels;
+        bench_channels(&channels, channel_counts[c]);
+        snprintf(name, sizeof(name), "format_report/%d", channel_counts[c]);
+        bench_run(name, bench_format_report, &channels);
+        channel_table_free(&channels);
+        free(buffer.buffer);
+        bench_lines_free(&lines);
+    }
+
+    // Two rules per channel on 200 channels, without and with threshold crossings
+    static bench_rules rules;
+    bench_channels(&rules.channels, 200);
+    char *list = malloc(200 * 2 * 64);
+    char *position = list;
+    for (int i = 0; i < 200 * 2; i++)
+        position += sprintf(position, "out%d %.1f high %d:255=1000,%d:170=8000 low %d:255=2000\n",
+                            i / 2 + 1, i % 2 ? 1.0 : -1.0, i / 2 + 1, i / 2 + 1, i / 2 + 1);
+    udp_socket no_control = {.sockfd = -1};
+    control_batch_init(&rules.batch, no_control);
+    if (control_rule_table_init(&rules.rules, list, &rules.channels) == 0)
+    {
+        bench_run("control_rules/400", bench_control_rules, &rules);
+        rules.crossing = 1;
+        bench_run("control_rules_crossing/400", bench_control_rules, &rules);
+        control_rule_table_free(&rules.rules);
+    }
+    free(list);
+    channel_table_free(&rules.channels);
+
+    // Latest report publish and lock-free read of the three default channels
+    static bench_shm shm;
+    char shm_name[BENCH_NAME_SIZE];
+    snprintf(shm_name, sizeof(shm_name), "/bench_shm_report_%d", getpid());
+    bench_channels(&shm.channels, 3);
+    if ((shm_report_publisher_open(&shm.publisher, shm_name, &shm.channels) == 0) &&
+        (shm_report_reader_open(&shm.reader, shm_name) == 0))
+    {
+        bench_run("shm_report_publish/3", bench_shm_publish, &shm);
+        bench_run("shm_report_read/3", bench_shm_read, &shm);
+        shm_report_reader_close(&shm.reader);
+    }
+    shm_report_publisher_close(&shm.publisher);
+    channel_table_free(&shm.channels);
+
+    // Reads of backlogs of varied sizes from a TCP loopback socket
+    size_t backlog_sizes[] = {4, 4096, 65536, 262144};
+    for (int b = 0; b < 4; b++)
+    {
+        char name[BENCH_NAME_SIZE];
+        bench_read read;
+        if (bench_tcp_pair(read.fds) < 0)
+            return;
+        read.size = backlog_sizes[b];
+        read.backlog = malloc(read.size);
+        for (size_t i = 0; i < read.size; i += 4)
+            memcpy(read.backlog + i, "1.5\n", 4);
+        snprintf(name, sizeof(name), "read_tcp_last_line/%zu", read.size);
+        bench_run(name, bench_read_last_line, &read);
+        free(read.backlog);
+        close(read.fds[0]);
+        close(read.fds[1]);
+    }
+
+    // Per-sample cost of the aggregates, the kernels alone and with the line parsing of a read
+    static bench_aggregate aggregate;
+    if (aggregate_table_init(&aggregate.aggregates, 1) == 0)
+    {
+        aggregate.batch.count = AGGREGATE_BATCH_SIZE;
+        for (int n = 0; n < AGGREGATE_BATCH_SIZE; n++)
+        {
+            aggregate.batch.values[n] = 8.0f * sinf(n * 0.05f);
+            aggregate.batch.timestamps_ns[n] = 1000000LL * (n + 1);
+        }
+        bench_run("aggregate_update/256", bench_aggregate_update, &aggregate);
+        aggregate_table_free(&aggregate.aggregates);
+    }
+    static bench_aggregate_read aggregate_read;
+    if (bench_tcp_pair(aggregate_read.read.fds) == 0)
+    {
+        aggregate_read.read.size = 65536;
+        aggregate_read.read.backlog = malloc(aggregate_read.read.size);
+        for (size_t i = 0; i < aggregate_read.read.size; i += 4)
+            memcpy(aggregate_read.read.backlog + i, i % 8 ? "1.5\n" : "-2.\n", 4);
+        bench_channels(&aggregate_read.channels, 1);
+        tcp_stream_init(&aggregate_read.channels.states[0].stream, aggregate_read.read.fds[1]);
+        report_options_init(&aggregate_read.options, REPORT_INTERVAL_100MS, CONTROL_DISABLED);
+        if (aggregate_table_init(&aggregate_read.aggregates, 1) == 0)
+        {
+            aggregate_read.options.aggregates = &aggregate_read.aggregates;
+            bench_run("read_channel_aggregates/65536", bench_read_aggregates, &aggregate_read);
+            aggregate_table_free(&aggregate_read.aggregates);
+        }
+        free(aggregate_read.read.backlog);
+        channel_table_free(&aggregate_read.channels);
+        close(aggregate_read.read.fds[0]);
+        close(aggregate_read.read.fds[1]);
+    }
+
+    // Archive rows of three channels, and the decoding of a full block from memory
+    static bench_archive archive;
+    bench_channels(&archive.channels, 3);
+    bench_archive_rows(&archive);
+    FILE *archive_file = open_memstream((char **)&archive.blocks, &archive.size);
+    if ((archive_writer_init(&archive.writer, archive_file, &archive.channels, ARCHIVE_UNIT_MS) == 0) &&
+        (archive_block_decoder_init(&archive.decoder, 3) == 0))
+    {
+        size_t header_size = archive.writer.bytes;
+        bench_run("archive_append/3", bench_archive_append, &archive);
+        fflush(archive_file);
+        // The full blocks after the header, the first decoded
+        archive.size -= header_size;
+        memmove(archive.blocks, archive.blocks + header_size, archive.size);
+        bench_run("archive_decode_block/256", bench_archive_decode, &archive);
+        archive_block_decoder_free(&archive.decoder);
+    }
+    archive_writer_free(&archive.writer);
+    fclose(archive_file);
+    free(archive.blocks);
+    channel_table_free(&archive.channels);
+
+    // Control datagrams to a local socket that does not read them
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t length = sizeof(address);
+    int sink_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    bind(sink_fd, (struct sockaddr *)&address, sizeof(address));
+    getsockname(sink_fd, (struct sockaddr *)&address, &length);
+    udp_socket control_socket = open_udp_control_socket(ntohs(address.sin_port));
+    bench_run("send_control_message/2", bench_send_control, &control_socket);
+    static control_batch batch;
+    control_batch_init(&batch, control_socket);
+    bench_run("control_batch_flush/2", bench_send_control_batch, &batch);
+    close_udp_socket(control_socket);
+    close(sink_fd);
+
+    bench_report_tick();
+
+    // The tick of the sharded pipeline follows the changed channels, not the endpoint count
+    int endpoint_counts[] = {3, 100, 1000, 10000};
+    for (int c = 0; c < 4; c++)
+        bench_report_endpoints(endpoint_counts[c]);
+}
+
+// Compare with the baseline results, returns the number of regressions
+static int bench_compare_baseline(const char *path, double threshold)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    int regressions = 0;
+    char line[256];
+    printf("# name\tns_per_op\tbaseline_ns_per_op\tchange_%%\tallocs_per_op\tbaseline_allocs_per_op\n");
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char name[BENCH_NAME_SIZE];
+        double ns_per_op, ops_per_s, allocs_per_op;
+        if ((line[0] == '#') || (sscanf(line, "%63s %lf %lf %lf", name, &ns_per_op, &ops_per_s, &allocs_per_op) != 4))
+            continue;
+        for (int i = 0; i < bench_result_count; i++)
+        {
+            const bench_result *result = &bench_results[i];
+            if (strcmp(result->name, name) != 0)
+                continue;
+            double change = (result->ns_per_op - ns_per_op) * 100.0 / ns_per_op;
+            int regression = (change > threshold) || (result->allocs_per_op > allocs_per_op + 0.0005);
+            printf("%s\t%.1f\t%.1f\t%+.1f\t%.3f\t%.3f%s\n", name, result->ns_per_op, ns_per_op, change,
+                   result->allocs_per_op, allocs_per_op, regression ? "\tREGRESSION" : "");
+            regressions += regression;
+        }
+    }
+    fclose(file);
+    return regressions;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *output_path = NULL;
+    const char *baseline_path = NULL;
+    double threshold = BENCH_REGRESSION_DEFAULT;
+    int cpu = RT_CPU_NONE;
+    int option;
+
+    while ((option = getopt(argc, argv, "m:p:o:b:r:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'm':
+            bench_min_time_ns = atol(optarg) * 1000000LL;
+            break;
+        case 'p':
+            cpu = atoi(optarg);
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 'b':
+            baseline_path = optarg;
+            break;
+        case 'r':
+            threshold = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-m min_time_ms] [-p cpu] [-o output] [-b baseline] [-r regression_%%] [filter]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc)
+        bench_filter = argv[optind];
+    if ((cpu != RT_CPU_NONE) && (rt_thread_setup(RT_PRIORITY_NONE, cpu) < 0))
+        fprintf(stderr, "cpu %d affinity not set\n", cpu);
+
+    printf("# name\tns_per_op\tops_per_s\tallocs_per_op\n");
+    bench_run_all();
+
+    if (output_path != NULL)
+    {
+        FILE *file = fopen(output_path, "w");
+        if (file == NULL)
+        {
+            perror(output_path);
+            return EXIT_FAILURE;
+        }
+        fprintf(file, "# name\tns_per_op\tops_per_s\tallocs_per_op\n");
+        for (int i = 0; i < bench_result_count; i++)
+            fprintf(file, "%s\t%.1f\t%.0f\t%.3f\n", bench_results[i].name, bench_results[i].ns_per_op,
+                    bench_results[i].ops_per_s, bench_results[i].allocs_per_op);
+        fclose(file);
+    }
+    if (baseline_path != NULL)
+        return bench_compare_baseline(baseline_path, threshold) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
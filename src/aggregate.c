@@ -0,0 +1,245 @@
+/**
+ * @file aggregate.c
+ * @brief This file contains the implementation of the per-interval channel aggregates.
+ */
+#include "protocol.h"
+
+#define AGGREGATE_LANES 8
+
+// Vectors of the GCC extensions, lowered to the widest instructions of the target
+typedef float aggregate_vector __attribute__((vector_size(AGGREGATE_LANES * sizeof(float))));
+typedef int aggregate_mask __attribute__((vector_size(AGGREGATE_LANES * sizeof(int))));
+
+// The kernels are built for AVX2 and the baseline, selected once at load time
+#if defined(__x86_64__)
+#define AGGREGATE_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define AGGREGATE_KERNEL
+#endif
+
+// Minimum, maximum, sum and sum of squares of the values, in vector lanes with a scalar tail
+static AGGREGATE_KERNEL void aggregate_kernel(const float *values, int count, channel_aggregate *aggregate)
+{
+    aggregate_vector lane_min = (aggregate_vector){0} + INFINITY;
+    aggregate_vector lane_max = (aggregate_vector){0} - INFINITY;
+    aggregate_vector lane_sum = {0};
+    aggregate_vector lane_squares = {0};
+    int i = 0;
+    for (; i + AGGREGATE_LANES <= count; i += AGGREGATE_LANES)
+    {
+        aggregate_vector v;
+        memcpy(&v, values + i, sizeof(v));
+        aggregate_mask less = v < lane_min;
+        aggregate_mask greater = v > lane_max;
+        lane_min = (aggregate_vector)(((aggregate_mask)v & less) | ((aggregate_mask)lane_min & ~less));
+        lane_max = (aggregate_vector)(((aggregate_mask)v & greater) | ((aggregate_mask)lane_max & ~greater));
+        lane_sum += v;
+        lane_squares += v * v;
+    }
+
+    float min = INFINITY;
+    float max = -INFINITY;
+    float sum = 0;
+    float sum_squares = 0;
+    for (int lane = 0; lane < AGGREGATE_LANES; lane++)
+    {
+        min = lane_min[lane] < min ? lane_min[lane] : min;
+        max = lane_max[lane] > max ? lane_max[lane] : max;
+        sum += lane_sum[lane];
+        sum_squares += lane_squares[lane];
+    }
+    for (; i < count; i++)
+    {
+        min = values[i] < min ? values[i] : min;
+        max = values[i] > max ? values[i] : max;
+        sum += values[i];
+        sum_squares += values[i] * values[i];
+    }
+    aggregate->count = count;
+    aggregate->min = min;
+    aggregate->max = max;
+    aggregate->sum = sum;
+    aggregate->sum_squares = sum_squares;
+}
+
+// Indexes of the last two rising zero crossings, a negative sample followed by a non-negative one
+static AGGREGATE_KERNEL void aggregate_rising(const float *values, int count, float previous, int *last, int *before_last)
+{
+    *last = -1;
+    *before_last = -1;
+    if ((previous < 0) && (values[0] >= 0))
+        *last = 0;
+
+    // Blocks without a crossing are skipped as a whole, the crossings are rare
+    int i = 1;
+    for (; i + AGGREGATE_LANES <= count; i += AGGREGATE_LANES)
+    {
+        aggregate_vector before, v;
+        memcpy(&before, values + i - 1, sizeof(before));
+        memcpy(&v, values + i, sizeof(v));
+        aggregate_mask rising = (before < 0) & (v >= 0);
+        unsigned long long words[AGGREGATE_LANES * sizeof(int) / sizeof(unsigned long long)];
+        memcpy(words, &rising, sizeof(words));
+        unsigned long long any = 0;
+        for (size_t w = 0; w < sizeof(words) / sizeof(words[0]); w++)
+            any |= words[w];
+        if (any == 0)
+            continue;
+        for (int lane = 0; lane < AGGREGATE_LANES; lane++)
+        {
+            if (rising[lane])
+            {
+                *before_last = *last;
+                *last = i + lane;
+            }
+        }
+    }
+    for (; i < count; i++)
+    {
+        if ((values[i - 1] < 0) && (values[i] >= 0))
+        {
+            *before_last = *last;
+            *last = i;
+        }
+    }
+}
+
+int aggregate_table_init(aggregate_table *table, int channel_count)
+{
+    memset(table, 0, sizeof(*table));
+    int count = channel_count > 0 ? channel_count : 1;
+    table->channels = aligned_alloc(AGGREGATE_CACHE_LINE, count * sizeof(aggregate_channel));
+    table->taken = malloc(count * sizeof(channel_aggregate));
+    if ((table->channels == NULL) || (table->taken == NULL))
+    {
+        aggregate_table_free(table);
+        return -1;
+    }
+    memset(table->channels, 0, count * sizeof(aggregate_channel));
+    for (int i = 0; i < count; i++)
+    {
+        aggregate_channel *aggregate = &table->channels[i];
+        aggregate_reset(&aggregate->open);
+        aggregate_reset(&aggregate->closed);
+        aggregate->closed_window = UINT_MAX;
+        aggregate_reset(&table->taken[i]);
+    }
+    table->channel_count = channel_count;
+    return 0;
+}
+
+void aggregate_table_free(aggregate_table *table)
+{
+    free(table->channels);
+    free(table->taken);
+    table->channels = NULL;
+    table->taken = NULL;
+    table->channel_count = 0;
+}
+
+void aggregate_reset(channel_aggregate *aggregate)
+{
+    aggregate->count = 0;
+    aggregate->min = INFINITY;
+    aggregate->max = -INFINITY;
+    aggregate->frequency = NAN;
+    aggregate->sum = 0;
+    aggregate->sum_squares = 0;
+}
+
+void aggregate_merge(channel_aggregate *aggregate, const channel_aggregate *newer)
+{
+    if (newer->count > 0)
+    {
+        aggregate->count += newer->count;
+        aggregate->min = newer->min < aggregate->min ? newer->min : aggregate->min;
+        aggregate->max = newer->max > aggregate->max ? newer->max : aggregate->max;
+        aggregate->sum += newer->sum;
+        aggregate->sum_squares += newer->sum_squares;
+    }
+    if (!isnan(newer->frequency))
+        aggregate->frequency = newer->frequency;
+}
+
+void aggregate_update(aggregate_table *table, int channel, const aggregate_batch *batch)
+{
+    if (batch->count == 0)
+        return;
+    aggregate_channel *aggregate = &table->channels[channel];
+    channel_aggregate samples;
+    aggregate_kernel(batch->values, batch->count, &samples);
+
+    // The frequency of the newest period, from the last crossing of an earlier batch if needed
+    int last, before_last;
+    aggregate_rising(batch->values, batch->count, aggregate->last, &last, &before_last);
+    samples.frequency = NAN;
+    if (last >= 0)
+    {
+        long long start_ns = (before_last >= 0) ? batch->timestamps_ns[before_last] : aggregate->rising_ns;
+        long long end_ns = batch->timestamps_ns[last];
+        // The lines of a chunk share the arrival time, a period within a chunk is unknown
+        if ((start_ns > 0) && (end_ns > start_ns))
+            samples.frequency = 1e9f / (float)(end_ns - start_ns);
+        aggregate->rising_ns = end_ns;
+    }
+    aggregate->last = batch->values[batch->count - 1];
+
+    // The fence orders the odd sequence before the take count load, and a tick advancing
+    // the count orders it before reading the sequence, so a window is either closed here
+    // or read by the tick after this update
+    unsigned sequence = atomic_load_explicit(&aggregate->sequence, memory_order_relaxed);
+    atomic_store_explicit(&aggregate->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    unsigned taken = atomic_load_explicit(&aggregate->taken, memory_order_relaxed);
+    if (taken != aggregate->window)
+    {
+        float frequency = aggregate->open.frequency;
+        aggregate->closed = aggregate->open;
+        aggregate->closed_window = aggregate->window;
+        aggregate_reset(&aggregate->open);
+        aggregate->open.frequency = frequency;
+        aggregate->window = taken;
+    }
+    aggregate_merge(&aggregate->open, &samples);
+    atomic_store_explicit(&aggregate->sequence, sequence + 2, memory_order_release);
+}
+
+void aggregate_take(aggregate_table *table, int channel)
+{
+    aggregate_channel *aggregate = &table->channels[channel];
+    channel_aggregate *taken = &table->taken[channel];
+    unsigned window = atomic_fetch_add(&aggregate->taken, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (1)
+    {
+        unsigned sequence = atomic_load_explicit(&aggregate->sequence, memory_order_acquire);
+        if (sequence & 1)
+            continue;
+        unsigned open_window = aggregate->window;
+        unsigned closed_window = aggregate->closed_window;
+        channel_aggregate open = aggregate->open;
+        channel_aggregate closed = aggregate->closed;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&aggregate->sequence, memory_order_relaxed) != sequence)
+            continue;
+
+        // Without an update since the last take, the open window was taken already
+        if (open_window == window)
+            *taken = open;
+        else if (closed_window == window)
+            *taken = closed;
+        else
+            aggregate_reset(taken);
+        return;
+    }
+}
+
+double aggregate_mean(const channel_aggregate *aggregate)
+{
+    return aggregate->count > 0 ? aggregate->sum / aggregate->count : NAN;
+}
+
+double aggregate_rms(const channel_aggregate *aggregate)
+{
+    return aggregate->count > 0 ? sqrt(aggregate->sum_squares / aggregate->count) : NAN;
+}
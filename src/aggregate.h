@@ -0,0 +1,130 @@
+/**
+ * @file aggregate.h
+ * @brief Header file for the per-interval channel aggregates.
+ *
+ * The aggregates summarize every received sample of a channel between two reports,
+ * the count, minimum, maximum, mean, RMS and a zero-crossing frequency estimate, where
+ * the report value is only the last line of the interval. The reading thread parses
+ * the lines of a read into a batch, and the batch is folded into the open window of
+ * the channel by vector kernels. The report tick takes the window without locks: the
+ * take count is advanced by the tick, and the reader closes its window when it sees
+ * the new count, so a sample is reported exactly once, in the first report taking it.
+ */
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define AGGREGATE_BATCH_SIZE 256 // samples of a read folded at once
+#define AGGREGATE_CACHE_LINE 64
+
+// Aggregates of the samples of a channel, the sums kept in double over the intervals
+typedef struct
+{
+    unsigned count;
+    float min;
+    float max;
+    float frequency; // Hz, of the last period between rising zero crossings, NaN until known
+    double sum;
+    double sum_squares;
+} channel_aggregate;
+
+// Samples parsed from a read with the arrival timestamps in nanoseconds
+typedef struct
+{
+    int count;
+    float values[AGGREGATE_BATCH_SIZE];
+    long long timestamps_ns[AGGREGATE_BATCH_SIZE];
+} aggregate_batch;
+
+// Aggregate windows of a channel, written by the reading thread and taken by the report tick
+typedef struct
+{
+    _Alignas(AGGREGATE_CACHE_LINE) atomic_uint sequence; // odd while the reader updates the windows
+    atomic_uint taken;        // takes by the report tick
+    unsigned window;          // take count of the open window
+    unsigned closed_window;   // take count of the closed window
+    channel_aggregate open;   // samples since the window started
+    channel_aggregate closed; // the previous window, until the tick takes it
+    float last;               // last sample, its sign for the zero crossings
+    long long rising_ns;      // arrival of the last rising zero crossing, 0 for none
+} aggregate_channel;
+
+// Aggregates of a channel table, with the windows taken by the last tick
+typedef struct
+{
+    int channel_count;
+    aggregate_channel *channels;
+    channel_aggregate *taken; // owned by the report tick
+} aggregate_table;
+
+/**
+ * Initializes the aggregates of the channels.
+ *
+ * @param table The aggregate table to initialize.
+ * @param channel_count The channel count.
+ * @return 0 on success, or -1 on allocation failure.
+ */
+int aggregate_table_init(aggregate_table *table, int channel_count);
+
+/**
+ * Releases the memory of the aggregate table.
+ *
+ * @param table The aggregate table.
+ */
+void aggregate_table_free(aggregate_table *table);
+
+/**
+ * Resets an aggregate to no samples.
+ *
+ * @param aggregate The aggregate.
+ */
+void aggregate_reset(channel_aggregate *aggregate);
+
+/**
+ * Merges the samples of an aggregate into another, the frequency of the newer one kept when known.
+ *
+ * @param aggregate The aggregate merged into.
+ * @param newer The aggregate of the later samples.
+ */
+void aggregate_merge(channel_aggregate *aggregate, const channel_aggregate *newer);
+
+/**
+ * Folds a batch of samples into the open window of a channel.
+ *
+ * Called by the thread reading the channel, one thread per channel at a time.
+ *
+ * @param table The aggregate table.
+ * @param channel The channel index.
+ * @param batch The samples in arrival order.
+ */
+void aggregate_update(aggregate_table *table, int channel, const aggregate_batch *batch);
+
+/**
+ * Takes the samples of a channel not yet taken into table->taken[channel].
+ *
+ * Called by the report tick, concurrently with the updates of the channel.
+ *
+ * @param table The aggregate table.
+ * @param channel The channel index.
+ */
+void aggregate_take(aggregate_table *table, int channel);
+
+/**
+ * Returns the mean of the samples.
+ *
+ * @param aggregate The aggregate.
+ * @return The mean, or NaN without samples.
+ */
+double aggregate_mean(const channel_aggregate *aggregate);
+
+/**
+ * Returns the root mean square of the samples.
+ *
+ * @param aggregate The aggregate.
+ * @return The RMS, or NaN without samples.
+ */
+double aggregate_rms(const channel_aggregate *aggregate);
+
+#endif // AGGREGATE_H
@@ -0,0 +1,534 @@
+/**
+ * @file archive.c
+ * @brief This file contains the implementation of the compressed report archive.
+ */
+#include "protocol.h"
+#include <math.h>
+
+#define ARCHIVE_ALIGNMENT 8
+#define ARCHIVE_ROW_BITS_MAX(channel_count) (4 + 64 + (channel_count) * (2 + 10 + 32))
+
+static void put_le32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = value;
+    buffer[1] = value >> 8;
+    buffer[2] = value >> 16;
+    buffer[3] = value >> 24;
+}
+
+static void put_le64(uint8_t *buffer, uint64_t value)
+{
+    put_le32(buffer, (uint32_t)value);
+    put_le32(buffer + 4, (uint32_t)(value >> 32));
+}
+
+static uint32_t get_le32(const uint8_t *buffer)
+{
+    return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *buffer)
+{
+    return get_le32(buffer) | ((uint64_t)get_le32(buffer + 4) << 32);
+}
+
+static size_t archive_header_size(int channel_count)
+{
+    size_t size = ARCHIVE_FIXED_HEADER_SIZE + channel_count * CHANNEL_NAME_SIZE;
+    return (size + ARCHIVE_ALIGNMENT - 1) & ~(size_t)(ARCHIVE_ALIGNMENT - 1);
+}
+
+// Appends up to 32 bits, most significant first
+static inline void archive_bits_put(archive_bit_writer *stream, uint32_t value, int count)
+{
+    stream->bits = (stream->bits << count) | (value & ((1ULL << count) - 1));
+    stream->bit_count += count;
+    while (stream->bit_count >= 8)
+    {
+        stream->bit_count -= 8;
+        stream->data[stream->length++] = (uint8_t)(stream->bits >> stream->bit_count);
+    }
+}
+
+// Reads up to 32 bits, loading the bytes as they are needed
+static inline int archive_bits_get(archive_bit_reader *stream, int count, uint32_t *value)
+{
+    while (stream->bit_count < count)
+    {
+        if (stream->position == stream->size)
+            return -1;
+        stream->bits = (stream->bits << 8) | stream->data[stream->position++];
+        stream->bit_count += 8;
+    }
+    stream->bit_count -= count;
+    *value = (uint32_t)(stream->bits >> stream->bit_count) & (uint32_t)((1ULL << count) - 1);
+    return 0;
+}
+
+static void archive_block_reset(archive_writer *writer)
+{
+    writer->row_count = 0;
+    writer->stream.length = 0;
+    writer->stream.bits = 0;
+    writer->stream.bit_count = 0;
+    memset(writer->row_bitmaps, 0, writer->channel_count * writer->row_bitmap_size);
+    for (int i = 0; i < writer->channel_count; i++)
+    {
+        writer->channels[i].started = 0;
+        writer->present_counts[i] = 0;
+    }
+}
+
+int archive_writer_init(archive_writer *writer, FILE *file, const channel_table *channels, long long unit_ns)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->file = file;
+    writer->channel_count = channels->count;
+    writer->unit_ns = unit_ns;
+    writer->row_bitmap_size = (ARCHIVE_BLOCK_ROWS + 7) / 8;
+    size_t mask_size = (channels->count + 7) / 8;
+    writer->channels = calloc(channels->count, sizeof(archive_channel));
+    writer->present_counts = calloc(channels->count, sizeof(int));
+    writer->row_bitmaps = malloc(channels->count * writer->row_bitmap_size);
+    writer->block = malloc(ARCHIVE_BLOCK_HEADER_SIZE + 2 * mask_size + channels->count * writer->row_bitmap_size);
+    writer->stream.data = malloc(((size_t)ARCHIVE_ROW_BITS_MAX(channels->count) * ARCHIVE_BLOCK_ROWS + 7) / 8 + 1);
+
+    size_t header_size = archive_header_size(channels->count);
+    uint8_t *header = calloc(1, header_size);
+    if ((writer->channels == NULL) || (writer->present_counts == NULL) || (writer->row_bitmaps == NULL) ||
+        (writer->block == NULL) || (writer->stream.data == NULL) || (header == NULL) || (unit_ns <= 0))
+    {
+        free(header);
+        archive_writer_free(writer);
+        return -1;
+    }
+    memcpy(header, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+    put_le32(header + 8, ARCHIVE_VERSION);
+    put_le32(header + 12, channels->count);
+    put_le32(header + 16, header_size);
+    put_le32(header + 20, (uint32_t)unit_ns);
+    for (int i = 0; i < channels->count; i++)
+        strncpy((char *)header + ARCHIVE_FIXED_HEADER_SIZE + i * CHANNEL_NAME_SIZE, channels->configs[i].name, CHANNEL_NAME_SIZE);
+    archive_block_reset(writer);
+
+    int result = fwrite(header, header_size, 1, file) == 1 ? 0 : -1;
+    writer->bytes = header_size;
+    free(header);
+    if (result < 0)
+        archive_writer_free(writer);
+    return result;
+}
+
+static void archive_put_timestamp(archive_writer *writer, long long timestamp)
+{
+    archive_bit_writer *stream = &writer->stream;
+    if (writer->row_count == 0)
+    {
+        writer->first_timestamp = timestamp;
+        writer->previous_timestamp = timestamp;
+        writer->previous_delta = 0;
+        return;
+    }
+    long long delta = timestamp - writer->previous_timestamp;
+    long long dod = delta - writer->previous_delta;
+    writer->previous_timestamp = timestamp;
+    writer->previous_delta = delta;
+    if (dod == 0)
+        archive_bits_put(stream, 0, 1);
+    else if ((dod >= -63) && (dod <= 64))
+    {
+        archive_bits_put(stream, 0x2, 2);
+        archive_bits_put(stream, (uint32_t)(dod + 63), 7);
+    }
+    else if ((dod >= -255) && (dod <= 256))
+    {
+        archive_bits_put(stream, 0x6, 3);
+        archive_bits_put(stream, (uint32_t)(dod + 255), 9);
+    }
+    else if ((dod >= -2047) && (dod <= 2048))
+    {
+        archive_bits_put(stream, 0xe, 4);
+        archive_bits_put(stream, (uint32_t)(dod + 2047), 12);
+    }
+    else
+    {
+        archive_bits_put(stream, 0xf, 4);
+        archive_bits_put(stream, (uint32_t)((uint64_t)dod >> 32), 32);
+        archive_bits_put(stream, (uint32_t)dod, 32);
+    }
+}
+
+static void archive_put_value(archive_bit_writer *stream, archive_channel *channel, uint32_t value)
+{
+    if (!channel->started)
+    {
+        archive_bits_put(stream, value, 32);
+        channel->value = value;
+        channel->leading = -1;
+        channel->started = 1;
+        return;
+    }
+    uint32_t xor = value ^ channel->value;
+    channel->value = value;
+    if (xor == 0)
+    {
+        archive_bits_put(stream, 0, 1);
+        return;
+    }
+    int leading = __builtin_clz(xor);
+    int trailing = __builtin_ctz(xor);
+    // The meaningful bits fit in the window of the previous XOR
+    if ((channel->leading >= 0) && (leading >= channel->leading) && (trailing >= channel->trailing))
+    {
+        archive_bits_put(stream, 0x2, 2);
+        archive_bits_put(stream, xor >> channel->trailing, 32 - channel->leading - channel->trailing);
+        return;
+    }
+    int length = 32 - leading - trailing;
+    archive_bits_put(stream, 0x3, 2);
+    archive_bits_put(stream, (uint32_t)leading, 5);
+    archive_bits_put(stream, (uint32_t)(length - 1), 5);
+    archive_bits_put(stream, xor >> trailing, length);
+    channel->leading = leading;
+    channel->trailing = trailing;
+}
+
+int archive_writer_append(archive_writer *writer, long long timestamp_ns, const channel_table *channels)
+{
+    long long half = writer->unit_ns / 2;
+    long long timestamp = (timestamp_ns >= 0 ? timestamp_ns + half : timestamp_ns - half) / writer->unit_ns;
+    archive_put_timestamp(writer, timestamp);
+    int row = writer->row_count;
+    for (int i = 0; i < writer->channel_count; i++)
+    {
+        const char *text = channels->states[i].value;
+        char *endptr;
+        float value = strtof(text, &endptr);
+        if ((endptr == text) || isnan(value))
+            continue;
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        archive_put_value(&writer->stream, &writer->channels[i], bits);
+        writer->row_bitmaps[i * writer->row_bitmap_size + row / 8] |= (uint8_t)(1 << (row % 8));
+        writer->present_counts[i]++;
+    }
+    writer->row_count++;
+    writer->rows++;
+    return (writer->row_count == ARCHIVE_BLOCK_ROWS) ? archive_writer_flush(writer) : 0;
+}
+
+int archive_writer_flush(archive_writer *writer)
+{
+    if (writer->row_count == 0)
+        return fflush(writer->file) == 0 ? 0 : -1;
+
+    // The bitmaps of the complete and the empty channels, then the rows of the others
+    archive_bit_writer *stream = &writer->stream;
+    if (stream->bit_count > 0)
+        archive_bits_put(stream, 0, 8 - stream->bit_count);
+    size_t mask_size = (writer->channel_count + 7) / 8;
+    size_t row_bitmap_size = (writer->row_count + 7) / 8;
+    uint8_t *complete = writer->block + ARCHIVE_BLOCK_HEADER_SIZE;
+    uint8_t *empty = complete + mask_size;
+    uint8_t *position = empty + mask_size;
+    memset(complete, 0, 2 * mask_size);
+    for (int i = 0; i < writer->channel_count; i++)
+    {
+        if (writer->present_counts[i] == writer->row_count)
+            complete[i / 8] |= (uint8_t)(1 << (i % 8));
+        else if (writer->present_counts[i] == 0)
+            empty[i / 8] |= (uint8_t)(1 << (i % 8));
+        else
+        {
+            memcpy(position, writer->row_bitmaps + i * writer->row_bitmap_size, row_bitmap_size);
+            position += row_bitmap_size;
+        }
+    }
+    size_t bitmaps_size = position - writer->block;
+    put_le32(writer->block, (uint32_t)(bitmaps_size - ARCHIVE_BLOCK_HEADER_SIZE + stream->length));
+    put_le32(writer->block + 4, (uint32_t)writer->row_count);
+    put_le64(writer->block + 8, (uint64_t)writer->first_timestamp);
+
+    int result = ((fwrite(writer->block, bitmaps_size, 1, writer->file) == 1) &&
+                  (fwrite(stream->data, stream->length, 1, writer->file) == 1) &&
+                  (fflush(writer->file) == 0))
+                     ? 0
+                     : -1;
+    writer->block_offset = writer->bytes;
+    writer->block_timestamp = writer->first_timestamp;
+    writer->bytes += bitmaps_size + stream->length;
+    writer->blocks++;
+    archive_block_reset(writer);
+    return result;
+}
+
+void archive_writer_free(archive_writer *writer)
+{
+    free(writer->channels);
+    free(writer->present_counts);
+    free(writer->row_bitmaps);
+    free(writer->block);
+    free(writer->stream.data);
+    writer->channels = NULL;
+    writer->present_counts = NULL;
+    writer->row_bitmaps = NULL;
+    writer->block = NULL;
+    writer->stream.data = NULL;
+}
+
+int archive_block_decoder_init(archive_block_decoder *decoder, int channel_count)
+{
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->channel_count = channel_count;
+    decoder->row_bitmaps = calloc(channel_count, sizeof(const uint8_t *));
+    decoder->channels = calloc(channel_count, sizeof(archive_channel));
+    if ((decoder->row_bitmaps == NULL) || (decoder->channels == NULL))
+    {
+        archive_block_decoder_free(decoder);
+        return -1;
+    }
+    return 0;
+}
+
+void archive_block_decoder_free(archive_block_decoder *decoder)
+{
+    free(decoder->row_bitmaps);
+    free(decoder->channels);
+    decoder->row_bitmaps = NULL;
+    decoder->channels = NULL;
+}
+
+size_t archive_block_size(const uint8_t *block)
+{
+    return ARCHIVE_BLOCK_HEADER_SIZE + (size_t)get_le32(block);
+}
+
+int archive_block_begin(archive_block_decoder *decoder, const uint8_t *block, size_t size)
+{
+    if ((size < ARCHIVE_BLOCK_HEADER_SIZE) || (size < archive_block_size(block)))
+        return -1;
+    const uint8_t *end = block + archive_block_size(block);
+    decoder->row_count = (int)get_le32(block + 4);
+    decoder->timestamp = (long long)get_le64(block + 8);
+    decoder->row = 0;
+    decoder->delta = 0;
+    size_t mask_size = (decoder->channel_count + 7) / 8;
+    size_t row_bitmap_size = (decoder->row_count + 7) / 8;
+    decoder->complete = block + ARCHIVE_BLOCK_HEADER_SIZE;
+    decoder->empty = decoder->complete + mask_size;
+    const uint8_t *position = decoder->empty + mask_size;
+    if ((decoder->row_count <= 0) || (position > end))
+        return -1;
+    for (int i = 0; i < decoder->channel_count; i++)
+    {
+        decoder->channels[i].started = 0;
+        decoder->row_bitmaps[i] = NULL;
+        if ((decoder->complete[i / 8] | decoder->empty[i / 8]) & (1 << (i % 8)))
+            continue;
+        decoder->row_bitmaps[i] = position;
+        position += row_bitmap_size;
+    }
+    if (position > end)
+        return -1;
+    decoder->stream.data = position;
+    decoder->stream.size = end - position;
+    decoder->stream.position = 0;
+    decoder->stream.bits = 0;
+    decoder->stream.bit_count = 0;
+    return 0;
+}
+
+static int archive_get_timestamp(archive_block_decoder *decoder)
+{
+    archive_bit_reader *stream = &decoder->stream;
+    uint32_t bit, bits;
+    long long dod;
+    if (archive_bits_get(stream, 1, &bit) < 0)
+        return -1;
+    if (bit == 0)
+        return 0;
+    // The ones of the prefix select the width of the delta-of-delta
+    int prefix = 1;
+    while (prefix < 4)
+    {
+        if (archive_bits_get(stream, 1, &bit) < 0)
+            return -1;
+        if (bit == 0)
+            break;
+        prefix++;
+    }
+    switch (prefix)
+    {
+    case 1:
+        if (archive_bits_get(stream, 7, &bits) < 0)
+            return -1;
+        dod = (long long)bits - 63;
+        break;
+    case 2:
+        if (archive_bits_get(stream, 9, &bits) < 0)
+            return -1;
+        dod = (long long)bits - 255;
+        break;
+    case 3:
+        if (archive_bits_get(stream, 12, &bits) < 0)
+            return -1;
+        dod = (long long)bits - 2047;
+        break;
+    default:
+    {
+        uint32_t low;
+        if ((archive_bits_get(stream, 32, &bits) < 0) || (archive_bits_get(stream, 32, &low) < 0))
+            return -1;
+        dod = (long long)(((uint64_t)bits << 32) | low);
+    }
+    }
+    decoder->delta += dod;
+    return 0;
+}
+
+static int archive_get_value(archive_bit_reader *stream, archive_channel *channel, float *value)
+{
+    uint32_t bits;
+    if (!channel->started)
+    {
+        if (archive_bits_get(stream, 32, &bits) < 0)
+            return -1;
+        channel->value = bits;
+        channel->leading = -1;
+        channel->started = 1;
+    }
+    else
+    {
+        uint32_t control;
+        if (archive_bits_get(stream, 1, &control) < 0)
+            return -1;
+        if (control == 1)
+        {
+            if (archive_bits_get(stream, 1, &control) < 0)
+                return -1;
+            if (control == 1)
+            {
+                uint32_t leading, length;
+                if ((archive_bits_get(stream, 5, &leading) < 0) || (archive_bits_get(stream, 5, &length) < 0))
+                    return -1;
+                channel->leading = (int)leading;
+                channel->trailing = 32 - (int)leading - ((int)length + 1);
+                if (channel->trailing < 0)
+                    return -1;
+            }
+            else if (channel->leading < 0)
+                return -1;
+            if (archive_bits_get(stream, 32 - channel->leading - channel->trailing, &bits) < 0)
+                return -1;
+            channel->value ^= bits << channel->trailing;
+        }
+    }
+    memcpy(value, &channel->value, sizeof(*value));
+    return 0;
+}
+
+int archive_block_next(archive_block_decoder *decoder, long long *timestamp, float *values)
+{
+    if (decoder->row == decoder->row_count)
+        return 0;
+    if ((decoder->row > 0) && (archive_get_timestamp(decoder) < 0))
+        return -1;
+    decoder->timestamp += decoder->delta;
+    *timestamp = decoder->timestamp;
+
+    int row = decoder->row;
+    for (int i = 0; i < decoder->channel_count; i++)
+    {
+        uint8_t mask = (uint8_t)(1 << (i % 8));
+        int present = (decoder->row_bitmaps[i] != NULL) ? (decoder->row_bitmaps[i][row / 8] >> (row % 8)) & 1
+                                                        : (decoder->complete[i / 8] & mask) != 0;
+        if (!present)
+            values[i] = NAN;
+        else if (archive_get_value(&decoder->stream, &decoder->channels[i], &values[i]) < 0)
+            return -1;
+    }
+    decoder->row++;
+    return 1;
+}
+
+int archive_reader_open(archive_reader *reader, FILE *file)
+{
+    uint8_t fixed[ARCHIVE_FIXED_HEADER_SIZE];
+
+    memset(reader, 0, sizeof(*reader));
+    reader->file = file;
+    if ((fread(fixed, sizeof(fixed), 1, file) != 1) ||
+        (memcmp(fixed, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE) != 0) ||
+        (get_le32(fixed + 8) != ARCHIVE_VERSION))
+        return -1;
+
+    reader->channel_count = (int)get_le32(fixed + 12);
+    reader->header_size = get_le32(fixed + 16);
+    reader->unit_ns = get_le32(fixed + 20);
+    if ((reader->channel_count <= 0) || (reader->unit_ns <= 0) ||
+        (reader->header_size != archive_header_size(reader->channel_count)))
+        return -1;
+
+    reader->names = calloc(reader->channel_count, CHANNEL_NAME_SIZE);
+    if ((reader->names == NULL) || (archive_block_decoder_init(&reader->decoder, reader->channel_count) < 0))
+    {
+        archive_reader_close(reader);
+        return -1;
+    }
+    size_t padding = reader->header_size - ARCHIVE_FIXED_HEADER_SIZE - reader->channel_count * CHANNEL_NAME_SIZE;
+    if ((fread(reader->names, CHANNEL_NAME_SIZE, reader->channel_count, file) != (size_t)reader->channel_count) ||
+        (fseek(file, padding, SEEK_CUR) != 0))
+    {
+        archive_reader_close(reader);
+        return -1;
+    }
+    for (int i = 0; i < reader->channel_count; i++)
+        reader->names[i][CHANNEL_NAME_SIZE - 1] = '\0';
+    return 0;
+}
+
+// Reads the next block into the block buffer, returns 1 on a block, 0 at the end of the file
+static int archive_reader_block(archive_reader *reader)
+{
+    uint8_t header[ARCHIVE_BLOCK_HEADER_SIZE];
+    size_t read_count = fread(header, 1, sizeof(header), reader->file);
+    if (read_count != sizeof(header))
+        return read_count == 0 ? 0 : -1;
+    size_t size = archive_block_size(header);
+    if (size > reader->block_capacity)
+    {
+        uint8_t *block = realloc(reader->block, size);
+        if (block == NULL)
+            return -1;
+        reader->block = block;
+        reader->block_capacity = size;
+    }
+    memcpy(reader->block, header, sizeof(header));
+    if ((fread(reader->block + sizeof(header), 1, size - sizeof(header), reader->file) != size - sizeof(header)) ||
+        (archive_block_begin(&reader->decoder, reader->block, size) < 0))
+        return -1;
+    return 1;
+}
+
+int archive_reader_next(archive_reader *reader, long long *timestamp_ns, float *values)
+{
+    long long timestamp;
+    int result;
+    while ((result = archive_block_next(&reader->decoder, &timestamp, values)) == 0)
+    {
+        if ((result = archive_reader_block(reader)) <= 0)
+            return result;
+    }
+    if (result == 1)
+        *timestamp_ns = timestamp * reader->unit_ns;
+    return result;
+}
+
+void archive_reader_close(archive_reader *reader)
+{
+    archive_block_decoder_free(&reader->decoder);
+    free(reader->names);
+    free(reader->block);
+    reader->names = NULL;
+    reader->block = NULL;
+}
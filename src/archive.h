@@ -0,0 +1,234 @@
+/**
+ * @file archive.h
+ * @brief Header file for the compressed report archive.
+ *
+ * The archive keeps the reports in a fraction of the JSON or binary report size, with
+ * the compression of regular time series described for the Gorilla database. The rows of
+ * the reports are written in blocks, each decoded on its own:
+ *   - the timestamps as a delta-of-delta, a single bit for a row at the interval,
+ *   - the values per channel as the XOR with the previous value of the channel, a single
+ *     bit for a repeated value and the meaningful bits of the XOR otherwise,
+ *   - the missing "--" values in bitmaps, without bits in the value stream.
+ *
+ * Header layout, all integers little-endian:
+ *   magic "CTARCHIV", uint32 version, uint32 channel_count, uint32 header_size,
+ *   uint32 timestamp unit in nanoseconds, channel_count * char name[CHANNEL_NAME_SIZE],
+ *   zero padding to 8 bytes.
+ *
+ * Block layout:
+ *   uint32 data_size, the bytes after the block header, uint32 row_count,
+ *   int64 first timestamp in units, the bitmap of the complete channels and the bitmap of
+ *   the empty channels, ceil(channel_count / 8) bytes each, a row bitmap of ceil(row_count / 8)
+ *   bytes for each other channel, bit set for a value, then the bit stream of the rows.
+ *
+ * Bit stream, most significant bit first, per row after the first the timestamp delta-of-delta:
+ *   '0' for 0, '10' and 7 bits for -63..64, '110' and 9 bits for -255..256, '1110' and 12 bits
+ *   for -2047..2048, '1111' and 64 bits otherwise, the first delta of a block from 0.
+ * Then for each channel with a value in the row, the float32 bits, raw for the first value
+ * of the channel in the block, otherwise XORed with the previous value:
+ *   '0' for the same value, '10' and the meaningful bits in the window of the previous XOR,
+ *   '11', 5 bits of leading zeros, 5 bits of the meaningful bit count - 1 and the meaningful bits.
+ */
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "channel.h"
+
+#define ARCHIVE_MAGIC "CTARCHIV"
+#define ARCHIVE_MAGIC_SIZE 8
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_FIXED_HEADER_SIZE 24
+#define ARCHIVE_BLOCK_HEADER_SIZE 16
+#define ARCHIVE_BLOCK_ROWS 256         // rows of a full block
+#define ARCHIVE_UNIT_MS 1000000LL      // timestamp unit of the millisecond intervals
+#define ARCHIVE_UNIT_US 1000LL         // timestamp unit of the sub-millisecond intervals
+
+// Bit stream of a block being written
+typedef struct
+{
+    uint8_t *data;
+    size_t length;      // whole bytes written
+    uint64_t bits;      // pending bits, the last bit_count bits
+    int bit_count;
+} archive_bit_writer;
+
+// Bit stream of a block being decoded
+typedef struct
+{
+    const uint8_t *data;
+    size_t size;
+    size_t position;    // next byte to load
+    uint64_t bits;      // loaded bits, the last bit_count bits
+    int bit_count;
+} archive_bit_reader;
+
+// Previous value of a channel and the window of its XOR
+typedef struct
+{
+    uint32_t value;
+    int leading;
+    int trailing;
+    int started;
+} archive_channel;
+
+// Archive writer with the preallocated buffers of a block
+typedef struct
+{
+    FILE *file;
+    int channel_count;
+    long long unit_ns;
+    int row_count;
+    long long first_timestamp;
+    long long previous_timestamp;
+    long long previous_delta;
+    archive_channel *channels;
+    int *present_counts;
+    uint8_t *row_bitmaps;       // channel_count row bitmaps of a full block
+    size_t row_bitmap_size;
+    uint8_t *block;             // block header and bitmaps
+    archive_bit_writer stream;
+    unsigned long long rows;
+    unsigned long long bytes;
+    unsigned long long blocks;
+    unsigned long long block_offset;  // file offset of the last written block
+    long long block_timestamp;        // first timestamp of the last written block in units
+} archive_writer;
+
+// Decoder of the rows of a block in memory
+typedef struct
+{
+    int channel_count;
+    int row_count;
+    int row;
+    long long timestamp;
+    long long delta;
+    const uint8_t *complete;
+    const uint8_t *empty;
+    const uint8_t **row_bitmaps; // per channel, NULL for the complete and empty channels
+    archive_channel *channels;
+    archive_bit_reader stream;
+} archive_block_decoder;
+
+// Streaming archive reader, a block in memory at a time
+typedef struct
+{
+    FILE *file;
+    int channel_count;
+    size_t header_size;
+    long long unit_ns;
+    char (*names)[CHANNEL_NAME_SIZE];
+    uint8_t *block;
+    size_t block_capacity;
+    archive_block_decoder decoder;
+} archive_reader;
+
+/**
+ * Initializes an archive writer and writes the header describing the channels.
+ *
+ * @param writer The archive writer.
+ * @param file The archive file.
+ * @param channels The channel table of the report.
+ * @param unit_ns The timestamp unit in nanoseconds, ARCHIVE_UNIT_MS or ARCHIVE_UNIT_US.
+ * @return 0 on success, or -1 on error, with the writer freed.
+ */
+int archive_writer_init(archive_writer *writer, FILE *file, const channel_table *channels, long long unit_ns);
+
+/**
+ * Appends a row of the channel values to the block, the "--" and non-numeric values as
+ * missing, and writes the block when it is full.
+ *
+ * @param writer The archive writer.
+ * @param timestamp_ns The report timestamp in epoch nanoseconds, rounded to the unit.
+ * @param channels The channel table with the values.
+ * @return 0 on success, or -1 on a write error.
+ */
+int archive_writer_append(archive_writer *writer, long long timestamp_ns, const channel_table *channels);
+
+/**
+ * Writes the rows of a partial block, and flushes the file.
+ *
+ * @param writer The archive writer.
+ * @return 0 on success, or -1 on a write error.
+ */
+int archive_writer_flush(archive_writer *writer);
+
+/**
+ * Releases the block buffers of the writer, the partial block is not written.
+ *
+ * @param writer The archive writer.
+ */
+void archive_writer_free(archive_writer *writer);
+
+/**
+ * Starts the decoding of a block in memory.
+ *
+ * @param decoder The block decoder, its channel buffers allocated by archive_block_decoder_init.
+ * @param block The block, starting with the block header.
+ * @param size The block size, at least the data size of the block header.
+ * @return 0 on success, or -1 on an invalid block.
+ */
+int archive_block_begin(archive_block_decoder *decoder, const uint8_t *block, size_t size);
+
+/**
+ * Decodes the next row of a block.
+ *
+ * @param decoder The block decoder.
+ * @param timestamp The row timestamp in units of the archive.
+ * @param values The values, channel_count floats, NaN for the missing values.
+ * @return 1 on a row decoded, 0 at the end of the block, or -1 on a truncated block.
+ */
+int archive_block_next(archive_block_decoder *decoder, long long *timestamp, float *values);
+
+/**
+ * Allocates the channel buffers of a block decoder.
+ *
+ * @param decoder The block decoder.
+ * @param channel_count The channel count of the archive.
+ * @return 0 on success, or -1 on allocation failure.
+ */
+int archive_block_decoder_init(archive_block_decoder *decoder, int channel_count);
+
+/**
+ * Releases the channel buffers of a block decoder.
+ *
+ * @param decoder The block decoder.
+ */
+void archive_block_decoder_free(archive_block_decoder *decoder);
+
+/**
+ * Returns the size of a block from its header.
+ *
+ * @param block The block header, ARCHIVE_BLOCK_HEADER_SIZE bytes.
+ * @return The block size with the header.
+ */
+size_t archive_block_size(const uint8_t *block);
+
+/**
+ * Opens an archive and reads and validates its header.
+ *
+ * @param reader The archive reader.
+ * @param file The input file positioned at the start of the archive.
+ * @return 0 on success, or -1 on an invalid header.
+ */
+int archive_reader_open(archive_reader *reader, FILE *file);
+
+/**
+ * Reads the next row of the archive, reading the blocks as they are needed.
+ *
+ * @param reader The archive reader.
+ * @param timestamp_ns The row timestamp in epoch nanoseconds.
+ * @param values The values, channel_count floats, NaN for the missing values.
+ * @return 1 on a row read, 0 at the end of the file, or -1 on a truncated or invalid block.
+ */
+int archive_reader_next(archive_reader *reader, long long *timestamp_ns, float *values);
+
+/**
+ * Releases the names and the block buffer of the reader.
+ *
+ * @param reader The archive reader.
+ */
+void archive_reader_close(archive_reader *reader);
+
+#endif // ARCHIVE_H
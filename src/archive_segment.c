@@ -0,0 +1,281 @@
+/**
+ * @file archive_segment.c
+ * @brief This file contains the implementation of the time-indexed archive segments.
+ */
+#include "protocol.h"
+#include <dirent.h>   // scandir
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // mkdir, fstat
+
+static void put_le64(uint8_t *buffer, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+        buffer[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint64_t get_le64(const uint8_t *buffer)
+{
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--)
+        value = (value << 8) | buffer[i];
+    return value;
+}
+
+// Segment names are the microsecond timestamp digits and the extension
+static int archive_segment_filter(const struct dirent *entry)
+{
+    size_t length = strlen(entry->d_name);
+    if ((length != ARCHIVE_SEGMENT_NAME_DIGITS + strlen(ARCHIVE_SEGMENT_EXTENSION)) ||
+        (strcmp(entry->d_name + ARCHIVE_SEGMENT_NAME_DIGITS, ARCHIVE_SEGMENT_EXTENSION) != 0))
+        return 0;
+    for (int i = 0; i < ARCHIVE_SEGMENT_NAME_DIGITS; i++)
+    {
+        if ((entry->d_name[i] < '0') || (entry->d_name[i] > '9'))
+            return 0;
+    }
+    return 1;
+}
+
+static void archive_segment_path(char *path, const char *directory, long long first_us, const char *extension)
+{
+    snprintf(path, ARCHIVE_SEGMENT_PATH_SIZE, "%s/%0*lld%s", directory, ARCHIVE_SEGMENT_NAME_DIGITS, first_us, extension);
+}
+
+int archive_segments_init(archive_segments *segments, const char *directory, long long unit_ns,
+                          long long segment_bytes, int segment_seconds, int retention)
+{
+    memset(segments, 0, sizeof(*segments));
+    segments->directory = directory;
+    segments->unit_ns = unit_ns;
+    segments->segment_bytes = segment_bytes;
+    segments->segment_ns = segment_seconds * 1000000000LL;
+    segments->retention = retention;
+    struct stat status;
+    if ((mkdir(directory, 0755) < 0) && (errno != EEXIST))
+        return -1;
+    if ((stat(directory, &status) < 0) || !S_ISDIR(status.st_mode) ||
+        (segment_bytes <= 0) || (segment_seconds <= 0) || (retention <= 0))
+        return -1;
+    return 0;
+}
+
+// Removes the oldest segments and their indexes beyond the retention count
+static void archive_segments_retain(archive_segments *segments)
+{
+    struct dirent **names;
+    int count = scandir(segments->directory, &names, archive_segment_filter, alphasort);
+    if (count < 0)
+        return;
+    for (int i = 0; i < count; i++)
+    {
+        if (i < count - segments->retention)
+        {
+            char path[ARCHIVE_SEGMENT_PATH_SIZE];
+            long long first_us = atoll(names[i]->d_name);
+            archive_segment_path(path, segments->directory, first_us, ARCHIVE_INDEX_EXTENSION);
+            unlink(path);
+            archive_segment_path(path, segments->directory, first_us, ARCHIVE_SEGMENT_EXTENSION);
+            if (unlink(path) == 0)
+                segments->removed++;
+        }
+        free(names[i]);
+    }
+    free(names);
+}
+
+static int archive_segments_open(archive_segments *segments, long long timestamp_ns, const channel_table *channels)
+{
+    char path[ARCHIVE_SEGMENT_PATH_SIZE];
+    long long first_us = timestamp_ns / 1000;
+    archive_segment_path(path, segments->directory, first_us, ARCHIVE_SEGMENT_EXTENSION);
+    segments->file = fopen(path, "wb");
+    archive_segment_path(path, segments->directory, first_us, ARCHIVE_INDEX_EXTENSION);
+    segments->index = fopen(path, "wb");
+    if ((segments->file == NULL) || (segments->index == NULL) ||
+        (archive_writer_init(&segments->writer, segments->file, channels, segments->unit_ns) < 0))
+    {
+        // No partial segment is left to count in the retention, and the open is retried later
+        if (segments->file != NULL)
+            fclose(segments->file);
+        if (segments->index != NULL)
+            fclose(segments->index);
+        segments->file = NULL;
+        segments->index = NULL;
+        unlink(path);
+        archive_segment_path(path, segments->directory, first_us, ARCHIVE_SEGMENT_EXTENSION);
+        unlink(path);
+        segments->retry_ns = timestamp_ns + ARCHIVE_SEGMENT_RETRY_NS;
+        segments->failures++;
+        return -1;
+    }
+    segments->open = 1;
+    segments->first_ns = timestamp_ns;
+    segments->segments++;
+    archive_segments_retain(segments);
+    return 0;
+}
+
+// Indexes the block written by the last append or flush, if any
+static int archive_segments_index(archive_segments *segments, unsigned long long blocks)
+{
+    if (segments->writer.blocks == blocks)
+        return 0;
+    uint8_t entry[ARCHIVE_INDEX_ENTRY_SIZE];
+    put_le64(entry, (uint64_t)segments->writer.block_timestamp);
+    put_le64(entry + 8, segments->writer.block_offset);
+    return ((fwrite(entry, sizeof(entry), 1, segments->index) == 1) && (fflush(segments->index) == 0)) ? 0 : -1;
+}
+
+int archive_segments_close(archive_segments *segments)
+{
+    if (!segments->open)
+        return 0;
+    unsigned long long blocks = segments->writer.blocks;
+    int result = archive_writer_flush(&segments->writer);
+    if (archive_segments_index(segments, blocks) < 0)
+        result = -1;
+    archive_writer_free(&segments->writer);
+    if ((fclose(segments->file) != 0) || (fclose(segments->index) != 0))
+        result = -1;
+    segments->file = NULL;
+    segments->index = NULL;
+    segments->open = 0;
+    return result;
+}
+
+int archive_segments_append(archive_segments *segments, long long timestamp_ns, const channel_table *channels)
+{
+    int result = 0;
+    if (segments->open && (timestamp_ns - segments->first_ns >= segments->segment_ns))
+        result = archive_segments_close(segments);
+    if (!segments->open && ((timestamp_ns < segments->retry_ns) || (archive_segments_open(segments, timestamp_ns, channels) < 0)))
+        return -1;
+
+    unsigned long long blocks = segments->writer.blocks;
+    if ((archive_writer_append(&segments->writer, timestamp_ns, channels) < 0) ||
+        (archive_segments_index(segments, blocks) < 0))
+        result = -1;
+    // The size is checked at the block ends, a segment exceeds the limit by at most a block
+    if ((long long)segments->writer.bytes >= segments->segment_bytes)
+        result |= archive_segments_close(segments);
+    return result;
+}
+
+// Maps a file for reading, an empty file is mapped as NULL
+static const uint8_t *archive_map(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    *size = 0;
+    if (fd < 0)
+        return NULL;
+    void *data = MAP_FAILED;
+    if ((fstat(fd, &status) == 0) && (status.st_size > 0))
+    {
+        data = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        *size = status.st_size;
+    }
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        *size = 0;
+        return NULL;
+    }
+    return data;
+}
+
+// Offset of the last indexed block starting at or before the range, by a binary search
+static size_t archive_index_search(const uint8_t *index, size_t entry_count, long long from, size_t header_size)
+{
+    size_t low = 0, high = entry_count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if ((long long)get_le64(index + middle * ARCHIVE_INDEX_ENTRY_SIZE) <= from)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return (low == 0) ? header_size : (size_t)get_le64(index + (low - 1) * ARCHIVE_INDEX_ENTRY_SIZE + 8);
+}
+
+// Decodes the rows of the range in a segment, returns the row count, with done set past the range
+static long long archive_segment_query(const char *directory, long long first_us, long long from_ns, long long to_ns,
+                                       archive_query_handler handler, void *context, int *done)
+{
+    char path[ARCHIVE_SEGMENT_PATH_SIZE];
+    archive_reader reader;
+    archive_segment_path(path, directory, first_us, ARCHIVE_SEGMENT_EXTENSION);
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return errno == ENOENT ? 0 : -1; // removed by the retention since the listing
+    int result = archive_reader_open(&reader, file);
+    fclose(file);
+    if (result < 0)
+        return -1;
+
+    size_t size, index_size;
+    const uint8_t *data = archive_map(path, &size);
+    archive_segment_path(path, directory, first_us, ARCHIVE_INDEX_EXTENSION);
+    const uint8_t *index = archive_map(path, &index_size);
+    float *values = malloc(reader.channel_count * sizeof(float));
+    long long rows = 0;
+    if ((data != NULL) && (values != NULL))
+    {
+        // The range start in the units of the segment, rounded down
+        long long from = from_ns / reader.unit_ns;
+        size_t offset = archive_index_search(index, index_size / ARCHIVE_INDEX_ENTRY_SIZE, from, reader.header_size);
+        long long timestamp;
+        while (!*done && (offset + ARCHIVE_BLOCK_HEADER_SIZE <= size) &&
+               (archive_block_begin(&reader.decoder, data + offset, size - offset) == 0))
+        {
+            while (archive_block_next(&reader.decoder, &timestamp, values) == 1)
+            {
+                long long timestamp_ns = timestamp * reader.unit_ns;
+                if (timestamp_ns < from_ns)
+                    continue;
+                if (timestamp_ns > to_ns)
+                {
+                    *done = 1;
+                    break;
+                }
+                handler(context, &reader, timestamp_ns, values);
+                rows++;
+            }
+            offset += archive_block_size(data + offset);
+        }
+    }
+    if (data != NULL)
+        munmap((void *)data, size);
+    if (index != NULL)
+        munmap((void *)index, index_size);
+    free(values);
+    archive_reader_close(&reader);
+    return rows;
+}
+
+long long archive_segments_query(const char *directory, long long from_ns, long long to_ns,
+                                 archive_query_handler handler, void *context)
+{
+    struct dirent **names;
+    int count = scandir(directory, &names, archive_segment_filter, alphasort);
+    if (count < 0)
+        return -1;
+    long long rows = 0;
+    int done = 0;
+    for (int i = 0; i < count; i++)
+    {
+        long long first_us = atoll(names[i]->d_name);
+        // A segment ends before the first report of the next one, within the rounding to a unit
+        long long next_us = (i + 1 < count) ? atoll(names[i + 1]->d_name) : LLONG_MAX;
+        if ((rows >= 0) && !done && (first_us * 1000 <= to_ns) &&
+            ((next_us == LLONG_MAX) || (next_us * 1000 + ARCHIVE_UNIT_MS > from_ns)))
+        {
+            long long segment_rows = archive_segment_query(directory, first_us, from_ns, to_ns, handler, context, &done);
+            rows = (segment_rows < 0) ? -1 : rows + segment_rows;
+        }
+        free(names[i]);
+    }
+    free(names);
+    return rows;
+}
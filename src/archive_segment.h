@@ -0,0 +1,110 @@
+/**
+ * @file archive_segment.h
+ * @brief Header file for the time-indexed archive segments.
+ *
+ * The segments are archive files in a directory, each named by the epoch microsecond
+ * timestamp of its first report, so the names sort by time. A segment is rotated when
+ * it reaches a size or a duration, and the oldest segments beyond the retention count
+ * are removed. Next to each segment, a sparse index has an entry per written block:
+ *   int64 first timestamp of the block in units of the segment, uint64 block offset,
+ * little-endian, 16 bytes each, in the order of the blocks.
+ *
+ * A range query selects the segments by their names, memory-maps each segment and its
+ * index, and binary-searches the index for the first block of the range, so only the
+ * blocks of the range are decoded. The blocks written after the last index entry, of a
+ * segment still being written, are found by following the block sizes.
+ */
+#ifndef ARCHIVE_SEGMENT_H
+#define ARCHIVE_SEGMENT_H
+
+#include "archive.h"
+
+#define ARCHIVE_SEGMENT_EXTENSION ".ctar"
+#define ARCHIVE_INDEX_EXTENSION ".ctix"
+#define ARCHIVE_SEGMENT_NAME_DIGITS 20
+#define ARCHIVE_INDEX_ENTRY_SIZE 16
+#define ARCHIVE_SEGMENT_BYTES (64LL * 1024 * 1024) // default segment size limit
+#define ARCHIVE_SEGMENT_SECONDS 3600               // default segment duration limit
+#define ARCHIVE_SEGMENT_RETENTION 168              // default segment count kept, a week of hours
+#define ARCHIVE_SEGMENT_PATH_SIZE 4096
+#define ARCHIVE_SEGMENT_RETRY_NS 1000000000LL      // reports dropped after a failed segment open
+
+// Segment writer of a directory, a segment open at a time
+typedef struct
+{
+    const char *directory;
+    long long segment_bytes;
+    long long segment_ns;
+    int retention;
+    long long unit_ns;
+    archive_writer writer;
+    FILE *file;
+    FILE *index;
+    int open;
+    long long first_ns;
+    unsigned long long segments;
+    unsigned long long removed;
+    unsigned long long failures; // failed segment opens
+    long long retry_ns;          // next segment open after a failure
+} archive_segments;
+
+/**
+ * Query handler called for each report row of the range.
+ *
+ * @param context The handler context.
+ * @param reader The reader of the segment, with the channel count and names.
+ * @param timestamp_ns The row timestamp in epoch nanoseconds.
+ * @param values The values, NaN for the missing values.
+ */
+typedef void (*archive_query_handler)(void *context, const archive_reader *reader, long long timestamp_ns, const float *values);
+
+/**
+ * Initializes a segment writer of a directory, created if needed. The first segment is
+ * created by the first report.
+ *
+ * @param segments The segment writer.
+ * @param directory The segment directory.
+ * @param unit_ns The timestamp unit in nanoseconds, ARCHIVE_UNIT_MS or ARCHIVE_UNIT_US.
+ * @param segment_bytes The size after which a segment is rotated, at a block end.
+ * @param segment_seconds The duration after which a segment is rotated.
+ * @param retention The count of segments kept, the oldest removed at a rotation.
+ * @return 0 on success, or -1 if the directory is not usable.
+ */
+int archive_segments_init(archive_segments *segments, const char *directory, long long unit_ns,
+                          long long segment_bytes, int segment_seconds, int retention);
+
+/**
+ * Appends a report row to the current segment, rotating the segments by the duration
+ * before the row and by the size after it, and indexes the written blocks. After a
+ * failed segment open, the rows are dropped for ARCHIVE_SEGMENT_RETRY_NS before the
+ * next open.
+ *
+ * @param segments The segment writer.
+ * @param timestamp_ns The report timestamp in epoch nanoseconds.
+ * @param channels The channel table with the values.
+ * @return 0 on success, or -1 on a segment or index error.
+ */
+int archive_segments_append(archive_segments *segments, long long timestamp_ns, const channel_table *channels);
+
+/**
+ * Writes the partial block of the current segment and its index entry, and closes it.
+ *
+ * @param segments The segment writer.
+ * @return 0 on success, or -1 on a write error.
+ */
+int archive_segments_close(archive_segments *segments);
+
+/**
+ * Calls the handler for each report row of a time range in the segments of a directory.
+ *
+ * @param directory The segment directory.
+ * @param from_ns The range start in epoch nanoseconds, included.
+ * @param to_ns The range end in epoch nanoseconds, included.
+ * @param handler The row handler.
+ * @param context The handler context.
+ * @return The count of rows of the range, or -1 if the directory or a segment could not be read.
+ */
+long long archive_segments_query(const char *directory, long long from_ns, long long to_ns,
+                                 archive_query_handler handler, void *context);
+
+#endif // ARCHIVE_SEGMENT_H
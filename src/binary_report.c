@@ -0,0 +1,173 @@
+/**
+ * @file binary_report.c
+ * @brief This file contains the implementation of the binary report format.
+ */
+#include "protocol.h"
+#include <math.h>
+
+#define BINARY_REPORT_ALIGNMENT 8
+
+static void put_le32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = value;
+    buffer[1] = value >> 8;
+    buffer[2] = value >> 16;
+    buffer[3] = value >> 24;
+}
+
+static void put_le64(uint8_t *buffer, uint64_t value)
+{
+    put_le32(buffer, (uint32_t)value);
+    put_le32(buffer + 4, (uint32_t)(value >> 32));
+}
+
+static uint32_t get_le32(const uint8_t *buffer)
+{
+    return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *buffer)
+{
+    return get_le32(buffer) | ((uint64_t)get_le32(buffer + 4) << 32);
+}
+
+static size_t binary_report_header_size(int channel_count)
+{
+    size_t size = BINARY_REPORT_FIXED_HEADER_SIZE + channel_count * CHANNEL_NAME_SIZE;
+    return (size + BINARY_REPORT_ALIGNMENT - 1) & ~(size_t)(BINARY_REPORT_ALIGNMENT - 1);
+}
+
+int binary_report_writer_init(binary_report_writer *writer, FILE *file, const channel_table *channels)
+{
+    writer->file = file;
+    writer->channel_count = channels->count;
+    writer->record_size = BINARY_REPORT_TIMESTAMP_SIZE + channels->count * BINARY_REPORT_VALUE_SIZE;
+    writer->record = malloc(writer->record_size);
+
+    size_t header_size = binary_report_header_size(channels->count);
+    uint8_t *header = calloc(1, header_size);
+    if ((writer->record == NULL) || (header == NULL))
+    {
+        free(header);
+        binary_report_writer_free(writer);
+        return -1;
+    }
+    memcpy(header, BINARY_REPORT_MAGIC, BINARY_REPORT_MAGIC_SIZE);
+    put_le32(header + 8, BINARY_REPORT_VERSION);
+    put_le32(header + 12, channels->count);
+    put_le32(header + 16, header_size);
+    put_le32(header + 20, writer->record_size);
+    for (int i = 0; i < channels->count; i++)
+        strncpy((char *)header + BINARY_REPORT_FIXED_HEADER_SIZE + i * CHANNEL_NAME_SIZE, channels->configs[i].name, CHANNEL_NAME_SIZE);
+
+    int result = fwrite(header, header_size, 1, file) == 1 ? 0 : -1;
+    free(header);
+    return result;
+}
+
+size_t binary_report_encode(binary_report_writer *writer, long long timestamp, const channel_table *channels)
+{
+    put_le64(writer->record, (uint64_t)timestamp);
+    uint8_t *position = writer->record + BINARY_REPORT_TIMESTAMP_SIZE;
+    for (int i = 0; i < writer->channel_count; i++)
+    {
+        const char *text = channels->states[i].value;
+        char *endptr;
+        float value = strtof(text, &endptr);
+        if (endptr == text)
+            value = NAN;
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        put_le32(position, bits);
+        position += BINARY_REPORT_VALUE_SIZE;
+    }
+    return writer->record_size;
+}
+
+int binary_report_write(binary_report_writer *writer, long long timestamp, const channel_table *channels)
+{
+    size_t record_size = binary_report_encode(writer, timestamp, channels);
+    return fwrite(writer->record, record_size, 1, writer->file) == 1 ? 0 : -1;
+}
+
+void binary_report_writer_free(binary_report_writer *writer)
+{
+    free(writer->record);
+    writer->record = NULL;
+}
+
+int binary_report_read_header(FILE *file, binary_report_header *header)
+{
+    uint8_t fixed[BINARY_REPORT_FIXED_HEADER_SIZE];
+
+    memset(header, 0, sizeof(*header));
+    if ((fread(fixed, sizeof(fixed), 1, file) != 1) ||
+        (memcmp(fixed, BINARY_REPORT_MAGIC, BINARY_REPORT_MAGIC_SIZE) != 0) ||
+        (get_le32(fixed + 8) != BINARY_REPORT_VERSION))
+        return -1;
+
+    header->channel_count = get_le32(fixed + 12);
+    header->header_size = get_le32(fixed + 16);
+    header->record_size = get_le32(fixed + 20);
+    if ((header->channel_count <= 0) ||
+        (header->header_size != binary_report_header_size(header->channel_count)) ||
+        (header->record_size != BINARY_REPORT_TIMESTAMP_SIZE + (size_t)header->channel_count * BINARY_REPORT_VALUE_SIZE))
+        return -1;
+
+    header->names = calloc(header->channel_count, CHANNEL_NAME_SIZE);
+    if (header->names == NULL)
+        return -1;
+    size_t padding = header->header_size - BINARY_REPORT_FIXED_HEADER_SIZE - header->channel_count * CHANNEL_NAME_SIZE;
+    if ((fread(header->names, CHANNEL_NAME_SIZE, header->channel_count, file) != (size_t)header->channel_count) ||
+        (fseek(file, padding, SEEK_CUR) != 0))
+    {
+        binary_report_header_free(header);
+        return -1;
+    }
+    for (int i = 0; i < header->channel_count; i++)
+        header->names[i][CHANNEL_NAME_SIZE - 1] = '\0';
+    return 0;
+}
+
+int binary_report_read_record(FILE *file, const binary_report_header *header, long long *timestamp, float *values)
+{
+    uint8_t record[BINARY_REPORT_TIMESTAMP_SIZE + BINARY_REPORT_VALUE_SIZE * 64];
+    uint8_t *buffer = header->record_size <= sizeof(record) ? record : malloc(header->record_size);
+    if (buffer == NULL)
+        return -1;
+
+    size_t read_count = fread(buffer, 1, header->record_size, file);
+    int result = (read_count == header->record_size) ? 1 : (read_count == 0 ? 0 : -1);
+    if (result == 1)
+    {
+        *timestamp = (long long)get_le64(buffer);
+        for (int i = 0; i < header->channel_count; i++)
+        {
+            uint32_t bits = get_le32(buffer + BINARY_REPORT_TIMESTAMP_SIZE + i * BINARY_REPORT_VALUE_SIZE);
+            memcpy(&values[i], &bits, sizeof(bits));
+        }
+    }
+    if (buffer != record)
+        free(buffer);
+    return result;
+}
+
+int format_report_value(char *buffer, size_t size, float value)
+{
+    if (isnan(value))
+        return snprintf(buffer, size, "%s", CHANNEL_EMPTY_VALUE);
+    // Shortest fixed-point text reading back as the same float, e.g. 5.0 and -4.8
+    for (int precision = 1; precision <= 9; precision++)
+    {
+        int length = snprintf(buffer, size, "%.*f", precision, value);
+        if (strtof(buffer, NULL) == value)
+            return length;
+    }
+    return snprintf(buffer, size, "%.9g", value);
+}
+
+void binary_report_header_free(binary_report_header *header)
+{
+    free(header->names);
+    header->names = NULL;
+}
@@ -0,0 +1,122 @@
+/**
+ * @file binary_report.h
+ * @brief Header file for the binary report format.
+ *
+ * The binary report is a compact alternative to the JSON report lines. A header
+ * describes the channels, followed by fixed-size little-endian records of an int64
+ * epoch millisecond timestamp and a float32 value per channel, NaN for missing data.
+ * As the records are fixed-size, the record n is at header_size + n * record_size,
+ * so the files can be memory-mapped and indexed by the record number.
+ *
+ * Header layout, all integers little-endian:
+ *   magic "CTREPORT", uint32 version, uint32 channel_count, uint32 header_size,
+ *   uint32 record_size, channel_count * char name[CHANNEL_NAME_SIZE], zero padding to 8 bytes.
+ */
+#ifndef BINARY_REPORT_H
+#define BINARY_REPORT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "channel.h"
+
+#define BINARY_REPORT_MAGIC "CTREPORT"
+#define BINARY_REPORT_MAGIC_SIZE 8
+#define BINARY_REPORT_VERSION 1
+#define BINARY_REPORT_FIXED_HEADER_SIZE 24
+#define BINARY_REPORT_TIMESTAMP_SIZE 8
+#define BINARY_REPORT_VALUE_SIZE 4
+
+// Binary report writer with a preallocated record buffer
+typedef struct
+{
+    FILE *file;
+    int channel_count;
+    size_t record_size;
+    uint8_t *record;
+} binary_report_writer;
+
+// Binary report header read from a file
+typedef struct
+{
+    int channel_count;
+    size_t header_size;
+    size_t record_size;
+    char (*names)[CHANNEL_NAME_SIZE];
+} binary_report_header;
+
+/**
+ * Initializes a binary report writer and writes the header describing the channels.
+ *
+ * @param writer The binary report writer.
+ * @param file The output file.
+ * @param channels The channel table of the report.
+ * @return 0 on success, or -1 on error.
+ */
+int binary_report_writer_init(binary_report_writer *writer, FILE *file, const channel_table *channels);
+
+/**
+ * Encodes a record of the channel values to the record buffer of the writer, the "--"
+ * and non-numeric values as NaN.
+ *
+ * @param writer The binary report writer.
+ * @param timestamp The report timestamp in epoch milliseconds.
+ * @param channels The channel table with the values.
+ * @return The record size.
+ */
+size_t binary_report_encode(binary_report_writer *writer, long long timestamp, const channel_table *channels);
+
+/**
+ * Writes a record of the channel values, the "--" and non-numeric values as NaN.
+ *
+ * @param writer The binary report writer.
+ * @param timestamp The report timestamp in epoch milliseconds.
+ * @param channels The channel table with the values.
+ * @return 0 on success, or -1 on a write error.
+ */
+int binary_report_write(binary_report_writer *writer, long long timestamp, const channel_table *channels);
+
+/**
+ * Releases the record buffer of the writer.
+ *
+ * @param writer The binary report writer.
+ */
+void binary_report_writer_free(binary_report_writer *writer);
+
+/**
+ * Reads and validates a binary report header.
+ *
+ * @param file The input file positioned at the start of the report.
+ * @param header The header to fill, the names are allocated.
+ * @return 0 on success, or -1 on an invalid header.
+ */
+int binary_report_read_header(FILE *file, binary_report_header *header);
+
+/**
+ * Reads the next record of a binary report.
+ *
+ * @param file The input file positioned at a record.
+ * @param header The report header.
+ * @param timestamp The record timestamp in epoch milliseconds.
+ * @param values The values, header->channel_count floats.
+ * @return 1 on a record read, 0 at the end of the file, or -1 on a truncated record.
+ */
+int binary_report_read_record(FILE *file, const binary_report_header *header, long long *timestamp, float *values);
+
+/**
+ * Formats a float value as the shortest decimal text with at least one decimal, "--" for NaN.
+ *
+ * @param buffer The output buffer.
+ * @param size The output buffer size.
+ * @param value The value.
+ * @return The text length.
+ */
+int format_report_value(char *buffer, size_t size, float value);
+
+/**
+ * Releases the channel names of the header.
+ *
+ * @param header The report header.
+ */
+void binary_report_header_free(binary_report_header *header);
+
+#endif // BINARY_REPORT_H
@@ -0,0 +1,150 @@
+/**
+ * @file capture.c
+ * @brief This file contains the implementation of the full-sample capture.
+ */
+#include "protocol.h"
+
+int capture_init(capture *cap, const channel_table *channels, size_t capacity)
+{
+    memset(cap, 0, sizeof(*cap));
+
+    size_t ring_capacity = 1;
+    while (ring_capacity < capacity)
+        ring_capacity <<= 1;
+
+    cap->rings = aligned_alloc(CAPTURE_CACHE_LINE, channels->count * sizeof(capture_ring));
+    if (cap->rings == NULL)
+        return -1;
+    cap->channel_count = channels->count;
+    cap->channels = channels;
+
+    for (int i = 0; i < cap->channel_count; i++)
+    {
+        capture_ring *ring = &cap->rings[i];
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->tail, 0);
+        atomic_init(&ring->dropped, 0);
+        ring->mask = ring_capacity - 1;
+        ring->samples = calloc(ring_capacity, sizeof(capture_sample));
+        if (ring->samples == NULL)
+        {
+            cap->channel_count = i;
+            capture_free(cap);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int capture_push(capture *cap, int channel, long long timestamp_ns, float value)
+{
+    capture_ring *ring = &cap->rings[channel];
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail > ring->mask)
+    {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return -1;
+    }
+    capture_sample *sample = &ring->samples[head & ring->mask];
+    sample->timestamp_ns = timestamp_ns;
+    sample->value = value;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 0;
+}
+
+// Write a sample as a line to the capture file
+static void capture_write_sample(capture *cap, int channel, const capture_sample *sample)
+{
+    fprintf(cap->file, "%lld,%s,%g\n", sample->timestamp_ns, cap->channels->configs[channel].name, sample->value);
+}
+
+size_t capture_drain(capture *cap)
+{
+    size_t drained = 0;
+    for (int i = 0; i < cap->channel_count; i++)
+    {
+        capture_ring *ring = &cap->rings[i];
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (; tail != head; tail++)
+        {
+            if (cap->handler != NULL)
+                cap->handler(cap->context, i, &ring->samples[tail & ring->mask]);
+            else
+                capture_write_sample(cap, i, &ring->samples[tail & ring->mask]);
+            drained++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    return drained;
+}
+
+unsigned long capture_dropped(capture *cap)
+{
+    unsigned long dropped = 0;
+    for (int i = 0; i < cap->channel_count; i++)
+        dropped += atomic_load_explicit(&cap->rings[i].dropped, memory_order_relaxed);
+    return dropped;
+}
+
+// Consumer thread, drains the rings until stopped
+static void *capture_consumer(void *arg)
+{
+    capture *cap = arg;
+    while (atomic_load_explicit(&cap->running, memory_order_acquire))
+    {
+        if (capture_drain(cap) == 0)
+            usleep(CAPTURE_DRAIN_INTERVAL_US);
+    }
+    capture_drain(cap);
+    if (cap->file != NULL)
+        fflush(cap->file);
+    return NULL;
+}
+
+int capture_start(capture *cap, capture_handler handler, void *context)
+{
+    cap->handler = handler;
+    cap->context = context;
+    atomic_store(&cap->running, 1);
+
+    // The consumer thread blocks all signals, SIGINT is left to the report loop
+    sigset_t all_signals, previous_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &previous_mask);
+    int result = pthread_create(&cap->thread, NULL, capture_consumer, cap);
+    pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
+    if (result != 0)
+    {
+        atomic_store(&cap->running, 0);
+        return -1;
+    }
+    cap->started = 1;
+    return 0;
+}
+
+int capture_start_file(capture *cap, FILE *file)
+{
+    cap->file = file;
+    return capture_start(cap, NULL, NULL);
+}
+
+void capture_stop(capture *cap)
+{
+    if (!cap->started)
+        return;
+    atomic_store_explicit(&cap->running, 0, memory_order_release);
+    pthread_join(cap->thread, NULL);
+    cap->started = 0;
+}
+
+void capture_free(capture *cap)
+{
+    capture_stop(cap);
+    for (int i = 0; i < cap->channel_count; i++)
+        free(cap->rings[i].samples);
+    free(cap->rings);
+    cap->rings = NULL;
+    cap->channel_count = 0;
+}
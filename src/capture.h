@@ -0,0 +1,137 @@
+/**
+ * @file capture.h
+ * @brief Header file for the full-sample capture.
+ *
+ * The capture keeps every parsed sample of every channel with the arrival timestamp.
+ * The report loop pushes the samples into a preallocated lock-free single-producer
+ * single-consumer ring per channel, and a consumer thread drains the rings into a file
+ * or a callback, so the capture never blocks or allocates on the reporting path.
+ */
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "channel.h"
+
+#define CAPTURE_RING_CAPACITY 16384 // samples per channel, power of two
+#define CAPTURE_DRAIN_INTERVAL_US 1000
+#define CAPTURE_CACHE_LINE 64
+
+// Captured sample with the arrival timestamp in epoch nanoseconds
+typedef struct
+{
+    long long timestamp_ns;
+    float value;
+} capture_sample;
+
+// Single-producer single-consumer sample ring, the indexes on separate cache lines
+typedef struct
+{
+    _Alignas(CAPTURE_CACHE_LINE) atomic_size_t head; // next write, owned by the producer
+    _Alignas(CAPTURE_CACHE_LINE) atomic_size_t tail; // next read, owned by the consumer
+    _Alignas(CAPTURE_CACHE_LINE) size_t mask;
+    atomic_ulong dropped;
+    capture_sample *samples;
+} capture_ring;
+
+/**
+ * Capture handler called by the consumer for each drained sample.
+ *
+ * @param context The handler context.
+ * @param channel The channel index.
+ * @param sample The captured sample.
+ */
+typedef void (*capture_handler)(void *context, int channel, const capture_sample *sample);
+
+// Capture of a channel table with a ring per channel and the consumer thread
+typedef struct
+{
+    int channel_count;
+    capture_ring *rings;
+    const channel_table *channels;
+    FILE *file;
+    capture_handler handler;
+    void *context;
+    pthread_t thread;
+    atomic_int running;
+    int started;
+} capture;
+
+/**
+ * Initializes a capture with preallocated rings for the channels of a table.
+ *
+ * @param cap The capture to initialize.
+ * @param channels The channel table, the channel names are used for the file output.
+ * @param capacity The ring capacity in samples, rounded up to a power of two.
+ * @return 0 on success, or -1 on allocation failure.
+ */
+int capture_init(capture *cap, const channel_table *channels, size_t capacity);
+
+/**
+ * Starts the consumer thread draining the rings into a file.
+ *
+ * Each sample is written as a timestamp_ns,channel,value line.
+ *
+ * @param cap The capture.
+ * @param file The capture output file.
+ * @return 0 on success, or -1 if the thread could not be started.
+ */
+int capture_start_file(capture *cap, FILE *file);
+
+/**
+ * Starts the consumer thread draining the rings into a callback.
+ *
+ * @param cap The capture.
+ * @param handler The handler called for each sample on the consumer thread.
+ * @param context The handler context.
+ * @return 0 on success, or -1 if the thread could not be started.
+ */
+int capture_start(capture *cap, capture_handler handler, void *context);
+
+/**
+ * Pushes a sample to the ring of a channel, called by the single producer.
+ *
+ * The sample is dropped and counted if the ring is full.
+ *
+ * @param cap The capture.
+ * @param channel The channel index.
+ * @param timestamp_ns The arrival timestamp in epoch nanoseconds.
+ * @param value The sample value.
+ * @return 0 on success, or -1 if the sample was dropped.
+ */
+int capture_push(capture *cap, int channel, long long timestamp_ns, float value);
+
+/**
+ * Drains all rings once to the consumer output, called by the single consumer.
+ *
+ * @param cap The capture.
+ * @return The number of drained samples.
+ */
+size_t capture_drain(capture *cap);
+
+/**
+ * Returns the number of samples dropped on full rings.
+ *
+ * @param cap The capture.
+ * @return The dropped sample count over all channels.
+ */
+unsigned long capture_dropped(capture *cap);
+
+/**
+ * Stops the consumer thread after draining the remaining samples.
+ *
+ * @param cap The capture.
+ */
+void capture_stop(capture *cap);
+
+/**
+ * Releases the rings of the capture.
+ *
+ * @param cap The capture.
+ */
+void capture_free(capture *cap);
+
+#endif // CAPTURE_H
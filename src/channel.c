@@ -0,0 +1,270 @@
+/**
+ * @file channel.c
+ * @brief This file contains the implementation of the channel table.
+ */
+#include "protocol.h"
+#include <sys/resource.h>
+
+#define CHANNEL_TABLE_INITIAL_CAPACITY 8
+#define CHANNEL_LIST_SEPARATORS ", \t\r\n"
+
+int channel_table_add(channel_table *table, const char *host, int port, const char *name)
+{
+    if ((port <= 0) || (port > 65535) || (strlen(host) >= CHANNEL_HOST_SIZE) || (strlen(name) >= CHANNEL_NAME_SIZE))
+        return -1;
+
+    if (table->count == table->capacity)
+    {
+        int capacity = table->capacity ? table->capacity * 2 : CHANNEL_TABLE_INITIAL_CAPACITY;
+        channel_config *configs = realloc(table->configs, capacity * sizeof(channel_config));
+        if (configs == NULL)
+            return -1;
+        table->configs = configs;
+        channel_state *states = realloc(table->states, capacity * sizeof(channel_state));
+        if (states == NULL)
+            return -1;
+        table->states = states;
+        table->capacity = capacity;
+    }
+
+    int index = table->count++;
+    channel_config *config = &table->configs[index];
+    strcpy(config->host, host);
+    config->port = port;
+    strcpy(config->name, name);
+
+    channel_state *state = &table->states[index];
+    tcp_stream_init(&state->stream, -1);
+    memset(&state->connection, 0, sizeof(state->connection));
+    channel_set_value(state, CHANNEL_EMPTY_VALUE);
+    return index;
+}
+
+// Parse a host:port/name entry, with the host and name optional
+static int channel_table_add_entry(channel_table *table, char *entry)
+{
+    char name[CHANNEL_NAME_SIZE];
+    const char *host = CHANNEL_HOST_DEFAULT;
+    char *port_start = entry;
+
+    char *name_start = strchr(entry, '/');
+    if (name_start != NULL)
+    {
+        *name_start++ = '\0';
+        if ((*name_start == '\0') || (strlen(name_start) >= sizeof(name)))
+            return -1;
+        strcpy(name, name_start);
+    }
+    else
+    {
+        snprintf(name, sizeof(name), "out%d", table->count + 1);
+    }
+
+    char *port_separator = strrchr(entry, ':');
+    if (port_separator != NULL)
+    {
+        *port_separator = '\0';
+        host = entry;
+        port_start = port_separator + 1;
+    }
+
+    char *endptr;
+    long port = strtol(port_start, &endptr, 10);
+    if ((endptr == port_start) || (*endptr != '\0') || (*host == '\0'))
+        return -1;
+
+    return channel_table_add(table, host, (int)port, name) < 0 ? -1 : 0;
+}
+
+int channel_table_init(channel_table *table, const char *list)
+{
+    memset(table, 0, sizeof(*table));
+
+    char *list_copy = strdup(list);
+    if (list_copy == NULL)
+        return -1;
+
+    // Strip the comments before splitting the entries
+    char *comment = list_copy;
+    while ((comment = strchr(comment, '#')) != NULL)
+    {
+        while ((*comment != '\0') && (*comment != '\n'))
+            *comment++ = ' ';
+    }
+
+    int result = 0;
+    char *saveptr;
+    char *entry = strtok_r(list_copy, CHANNEL_LIST_SEPARATORS, &saveptr);
+    while ((entry != NULL) && (result == 0))
+    {
+        result = channel_table_add_entry(table, entry);
+        entry = strtok_r(NULL, CHANNEL_LIST_SEPARATORS, &saveptr);
+    }
+    free(list_copy);
+
+    if ((result < 0) || (table->count == 0))
+    {
+        channel_table_free(table);
+        return -1;
+    }
+    return 0;
+}
+
+int channel_table_load(channel_table *table, const char *path)
+{
+    memset(table, 0, sizeof(*table));
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+
+    char *list = NULL;
+    size_t list_size = 0;
+    FILE *stream = open_memstream(&list, &list_size);
+    if (stream == NULL)
+    {
+        fclose(file);
+        return -1;
+    }
+    char chunk[PROTOCOL_BUFFER_SIZE];
+    size_t read_count;
+    while ((read_count = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        fwrite(chunk, 1, read_count, stream);
+    fclose(stream);
+    fclose(file);
+
+    int result = channel_table_init(table, list);
+    free(list);
+    return result;
+}
+
+int channel_table_find(const channel_table *table, const char *name)
+{
+    for (int i = 0; i < table->count; i++)
+    {
+        if (strcmp(table->configs[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void tcp_stream_init(tcp_stream *stream, int sockfd)
+{
+    stream->sockfd = sockfd;
+    stream->partial_length = 0;
+    stream->bytes = 0;
+    stream->lines = 0;
+    stream->closed = 0;
+    stream->timestamps = 0;
+    stream->receive_ns = 0;
+}
+
+int channel_connect(channel_table *table, int channel)
+{
+    channel_state *state = &table->states[channel];
+    channel_connection *connection = &state->connection;
+    const channel_config *config = &table->configs[channel];
+    if (!connection->resolved && (resolve_tcp_host(config->host, config->port, &connection->address) == 0))
+        connection->resolved = 1;
+    int sockfd = connection->resolved ? connect_to_tcp_address(&connection->address) : -1;
+
+    // The counters continue over the reconnects
+    unsigned long long bytes = state->stream.bytes;
+    unsigned long long lines = state->stream.lines;
+    tcp_stream_init(&state->stream, sockfd);
+    state->stream.bytes = bytes;
+    state->stream.lines = lines;
+    // The kernel timestamps the received segments, read with the data by recvmsg
+    int enable = 1;
+    if ((sockfd >= 0) && table->receive_timestamps &&
+        (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) == 0))
+        state->stream.timestamps = 1;
+    connection->connecting = sockfd >= 0;
+    return sockfd;
+}
+
+int channel_connect_complete(channel_state *state)
+{
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if ((getsockopt(state->stream.sockfd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) || (error != 0))
+        return -1;
+    state->connection.connecting = 0;
+    return 0;
+}
+
+long long channel_disconnect(channel_state *state, long long now_ns, int max_backoff_ms)
+{
+    channel_connection *connection = &state->connection;
+    if (state->stream.sockfd >= 0)
+        close_tcp_socket(state->stream.sockfd);
+    state->stream.sockfd = -1;
+    state->stream.partial_length = 0;
+    state->stream.closed = 0;
+    connection->connecting = 0;
+
+    int delay_ms = connection->backoff_ms > 0 ? connection->backoff_ms : CHANNEL_RECONNECT_MIN_MS;
+    if (delay_ms > max_backoff_ms)
+        delay_ms = max_backoff_ms;
+    connection->backoff_ms = (delay_ms * 2 < max_backoff_ms) ? delay_ms * 2 : max_backoff_ms;
+    connection->retry_ns = now_ns + delay_ms * 1000000LL;
+    return connection->retry_ns;
+}
+
+int channel_table_connect(channel_table *table)
+{
+    // Thousands of endpoints exceed the usual default limit of 1024 descriptors
+    struct rlimit limit;
+    rlim_t needed = (rlim_t)table->count + CHANNEL_FD_RESERVE;
+    if ((getrlimit(RLIMIT_NOFILE, &limit) == 0) && (limit.rlim_cur != RLIM_INFINITY) && (limit.rlim_cur < needed))
+    {
+        limit.rlim_cur = ((limit.rlim_max == RLIM_INFINITY) || (limit.rlim_max > needed)) ? needed : limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    int connected = 0;
+    for (int i = 0; i < table->count; i++)
+    {
+        if (channel_connect(table, i) >= 0)
+            connected++;
+    }
+    return connected;
+}
+
+int channel_set_value(channel_state *state, const char *line)
+{
+    size_t length = strlen(line);
+    if (length >= CHANNEL_VALUE_SIZE)
+        return -1;
+    memcpy(state->value, line, length + 1);
+    state->value_length = (int)length;
+    return 0;
+}
+
+void channel_table_reset_values(channel_table *table)
+{
+    for (int i = 0; i < table->count; i++)
+    {
+        channel_state *state = &table->states[i];
+        memcpy(state->value, CHANNEL_EMPTY_VALUE, sizeof(CHANNEL_EMPTY_VALUE));
+        state->value_length = sizeof(CHANNEL_EMPTY_VALUE) - 1;
+    }
+}
+
+void channel_table_close(channel_table *table)
+{
+    for (int i = 0; i < table->count; i++)
+    {
+        if (table->states[i].stream.sockfd >= 0)
+            close_tcp_socket(table->states[i].stream.sockfd);
+        tcp_stream_init(&table->states[i].stream, -1);
+        table->states[i].connection.connecting = 0;
+    }
+}
+
+void channel_table_free(channel_table *table)
+{
+    free(table->configs);
+    free(table->states);
+    memset(table, 0, sizeof(*table));
+}
@@ -0,0 +1,203 @@
+/**
+ * @file channel.h
+ * @brief Header file for the channel table.
+ *
+ * The channel table holds the TCP signal ports subscribed by the report printer.
+ * The channels are configured at runtime from a list of host:port/name entries and
+ * the per-channel state is kept in a contiguous array, which is iterated on every
+ * read, report and parse.
+ */
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <stdio.h>
+#include <netinet/in.h>
+
+#define CHANNEL_HOST_SIZE 64
+#define CHANNEL_NAME_SIZE 32
+#define CHANNEL_VALUE_SIZE 32
+#define CHANNEL_HOST_DEFAULT "127.0.0.1"
+#define CHANNEL_EMPTY_VALUE "--"
+#define CHANNEL_OUT1 0
+#define CHANNEL_OUT2 1
+#define CHANNEL_OUT3 2
+#define TCP_STREAM_LINE_SIZE CHANNEL_VALUE_SIZE
+#define TCP_STREAM_SKIP_LINE -1
+#define CHANNEL_RECONNECT_MIN_MS 5    // first reconnect delay, doubled on each failure
+#define CHANNEL_RECONNECT_MAX_MS 1000 // reconnect delay limit, lowered to the report interval
+#define CHANNEL_FD_RESERVE 64         // descriptors kept free beside the channel sockets
+#define CHANNELS_DEFAULT "127.0.0.1:4001/out1,127.0.0.1:4002/out2,127.0.0.1:4003/out3"
+
+// Channel configuration, the subscribed host and port and the report key name
+typedef struct
+{
+    char host[CHANNEL_HOST_SIZE];
+    int port;
+    char name[CHANNEL_NAME_SIZE];
+} channel_config;
+
+// TCP stream receive state, the partial line carried over to the next read
+typedef struct
+{
+    int sockfd;
+    int partial_length; // TCP_STREAM_SKIP_LINE when skipping to the next newline
+    char partial[TCP_STREAM_LINE_SIZE + 1];
+    unsigned long long bytes; // received bytes, including the discarded backlog
+    unsigned long long lines; // scanned lines, excluding the discarded backlog
+    int closed;               // the peer closed the connection
+    int timestamps;           // SO_TIMESTAMPNS enabled, the reads return the kernel receive time
+    long long receive_ns;     // kernel receive time of the last read data in epoch nanoseconds, 0 if unknown
+} tcp_stream;
+
+// Connection state of a channel, disconnected while the socket is -1
+typedef struct
+{
+    int connecting;       // non-blocking connect in progress, completed when writable
+    int resolved;         // the address is resolved, only once
+    struct sockaddr_in address;
+    int backoff_ms;       // delay of the next reconnect, 0 after data was received
+    long long retry_ns;   // monotonic time of the next reconnect
+    unsigned long long reconnects;
+} channel_connection;
+
+// Channel state accessed on every read and report, the last line of the interval as value
+typedef struct
+{
+    tcp_stream stream;
+    int value_length;
+    char value[CHANNEL_VALUE_SIZE];
+    long long value_ns; // kernel receive time of the value in epoch nanoseconds, 0 if unknown
+    channel_connection connection;
+} channel_state;
+
+// Channel table with the configuration and the state arrays indexed by the channel index
+typedef struct
+{
+    int count;
+    int capacity;
+    channel_config *configs;
+    channel_state *states;
+    int receive_timestamps; // SO_TIMESTAMPNS on the sockets of the channels
+} channel_table;
+
+/**
+ * Initializes a channel table from a channel list.
+ *
+ * The list entries are separated by commas or white space, and each entry is
+ * host:port/name. The host defaults to 127.0.0.1 and the name to out<index + 1>,
+ * e.g. "4001" equals to "127.0.0.1:4001/out1". Text after '#' to the end of line is a comment.
+ *
+ * @param table The channel table to initialize.
+ * @param list The channel list.
+ * @return 0 on success, or -1 if the list is invalid or empty.
+ */
+int channel_table_init(channel_table *table, const char *list);
+
+/**
+ * Initializes a channel table from a file containing a channel list.
+ *
+ * @param table The channel table to initialize.
+ * @param path The path of the channel list file.
+ * @return 0 on success, or -1 if the file could not be read or the list is invalid.
+ */
+int channel_table_load(channel_table *table, const char *path);
+
+/**
+ * Adds a channel to the end of the channel table.
+ *
+ * @param table The channel table.
+ * @param host The host address of the channel.
+ * @param port The TCP port of the channel.
+ * @param name The report key name of the channel.
+ * @return The index of the added channel, or -1 on error.
+ */
+int channel_table_add(channel_table *table, const char *host, int port, const char *name);
+
+/**
+ * Finds a channel by the report key name.
+ *
+ * @param table The channel table.
+ * @param name The channel name.
+ * @return The channel index, or -1 if not found.
+ */
+int channel_table_find(const channel_table *table, const char *name);
+
+/**
+ * Initializes a TCP stream receive state for a socket.
+ *
+ * @param stream The TCP stream.
+ * @param sockfd The socket file descriptor, or -1 for none.
+ */
+void tcp_stream_init(tcp_stream *stream, int sockfd);
+
+/**
+ * Starts a non-blocking connection of a channel, resolving the host on the first call.
+ * With the receive timestamps of the table, SO_TIMESTAMPNS is enabled on the socket.
+ *
+ * @param table The channel table.
+ * @param channel The channel index.
+ * @return The socket, connecting, or -1 on error.
+ */
+int channel_connect(channel_table *table, int channel);
+
+/**
+ * Completes a non-blocking connection of a channel when its socket is writable.
+ *
+ * @param state The channel state.
+ * @return 0 if connected, or -1 if the connection failed.
+ */
+int channel_connect_complete(channel_state *state);
+
+/**
+ * Closes the socket of a channel and schedules the reconnect with exponential backoff.
+ * The received byte and line counts are kept.
+ *
+ * @param state The channel state.
+ * @param now_ns The monotonic time in nanoseconds.
+ * @param max_backoff_ms The reconnect delay limit in milliseconds.
+ * @return The monotonic time of the reconnect in nanoseconds.
+ */
+long long channel_disconnect(channel_state *state, long long now_ns, int max_backoff_ms);
+
+/**
+ * Starts non-blocking connections to all channels of the table.
+ *
+ * A channel failing to connect has socket -1 and is reported with empty values. The
+ * soft open file limit is raised up to the hard limit when the table needs more sockets.
+ *
+ * @param table The channel table.
+ * @return The number of channels with a socket.
+ */
+int channel_table_connect(channel_table *table);
+
+/**
+ * Resets the channel values to the empty value "--".
+ *
+ * @param table The channel table.
+ */
+void channel_table_reset_values(channel_table *table);
+
+/**
+ * Stores a received line as the channel value.
+ *
+ * @param state The channel state.
+ * @param line The received line.
+ * @return 0 on success, or -1 if the line does not fit in the value.
+ */
+int channel_set_value(channel_state *state, const char *line);
+
+/**
+ * Closes the sockets of all channels of the table.
+ *
+ * @param table The channel table.
+ */
+void channel_table_close(channel_table *table);
+
+/**
+ * Releases the memory of the channel table.
+ *
+ * @param table The channel table.
+ */
+void channel_table_free(channel_table *table);
+
+#endif // CHANNEL_H
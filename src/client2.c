@@ -1,7 +1,14 @@
 #include "protocol.h"
 
-int main()
+int main(int argc, char *argv[])
 {
-    int result = report_stdout(REPORT_INTERVAL_20MS, CONTROL_ENABLED);
+    report_options options;
+    report_options_init(&options, REPORT_INTERVAL_20MS, CONTROL_ENABLED);
+    if (parse_report_options(argc, argv, &options) < 0)
+    {
+        print_report_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+    int result = report_stdout_options(&options);
     return result;
 }
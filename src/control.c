@@ -0,0 +1,486 @@
+/**
+ * @file control.c
+ * @brief This file contains the implementation of the control messages, batches and rules.
+ */
+#include "protocol.h"
+
+#define CONTROL_RULE_SEPARATORS " \t\r"
+#define CONTROL_RULE_CAPACITY_MIN 8
+
+control_message control_message_encode(control_message msg)
+{
+    // Convert fields to big-endian
+    msg.operation = htons(msg.operation);
+    msg.object = htons(msg.object);
+    msg.property = htons(msg.property);
+    msg.value = htons(msg.value);
+    return msg;
+}
+
+void control_batch_init(control_batch *batch, udp_socket udp_control_socket)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->sockfd = udp_control_socket.sockfd;
+    batch->servaddr = udp_control_socket.servaddr;
+    // The headers are set up once, a flush only passes the message count
+    for (int i = 0; i < CONTROL_BATCH_MAX; i++)
+    {
+        batch->iovecs[i].iov_base = &batch->wire[i];
+        batch->iovecs[i].iov_len = sizeof(control_message);
+        batch->headers[i].msg_hdr.msg_name = &batch->servaddr;
+        batch->headers[i].msg_hdr.msg_namelen = sizeof(batch->servaddr);
+        batch->headers[i].msg_hdr.msg_iov = &batch->iovecs[i];
+        batch->headers[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+int control_batch_add(control_batch *batch, const control_message *wire)
+{
+    if (batch->count == CONTROL_BATCH_MAX)
+        return -1;
+    batch->wire[batch->count++] = *wire;
+    return 0;
+}
+
+int control_batch_flush(control_batch *batch)
+{
+    int count = batch->count;
+    int sent = 0;
+    while (sent < count)
+    {
+        int result = sendmmsg(batch->sockfd, &batch->headers[sent], count - sent, 0);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            batch->error = errno;
+            break;
+        }
+        sent += result;
+    }
+    batch->count = 0;
+    batch->unsent += count - sent;
+    return ((sent > 0) || (count == 0)) ? sent : -1;
+}
+
+// Append an encoded write to the rule table messages
+static int control_rule_table_add_message(control_rule_table *table, control_message msg)
+{
+    if (table->message_count == table->message_capacity)
+    {
+        int capacity = table->message_capacity ? table->message_capacity * 2 : CONTROL_RULE_CAPACITY_MIN;
+        control_message *messages = realloc(table->messages, capacity * sizeof(control_message));
+        if (messages == NULL)
+            return -1;
+        table->messages = messages;
+        table->message_capacity = capacity;
+    }
+    table->messages[table->message_count++] = control_message_encode(msg);
+    return 0;
+}
+
+// Parse a 16-bit field, returns the position after the field or NULL
+static const char *control_rule_parse_field(const char *position, char separator, uint16_t *field)
+{
+    char *end;
+    errno = 0;
+    unsigned long value = strtoul(position, &end, 10);
+    if ((end == position) || (errno != 0) || (value > UINT16_MAX) || (*end != separator))
+        return NULL;
+    *field = (uint16_t)value;
+    return end + (separator != '\0');
+}
+
+// Parse the comma-separated object:property=value writes, returns the write count or -1
+static int control_rule_parse_writes(control_rule_table *table, char *writes)
+{
+    int count = 0;
+    char *saveptr;
+    for (char *write = strtok_r(writes, ",", &saveptr); write != NULL; write = strtok_r(NULL, ",", &saveptr))
+    {
+        control_message msg = {.operation = CONTROL_OPERATION_WRITE};
+        const char *position = control_rule_parse_field(write, ':', &msg.object);
+        position = position ? control_rule_parse_field(position, '=', &msg.property) : NULL;
+        position = position ? control_rule_parse_field(position, '\0', &msg.value) : NULL;
+        if ((position == NULL) || (control_rule_table_add_message(table, msg) < 0))
+            return -1;
+        count++;
+    }
+    return count > 0 ? count : -1;
+}
+
+// Compile a rule line, keeping the rules sorted by the source channel
+static int control_rule_table_add_line(control_rule_table *table, char *line, const channel_table *channels)
+{
+    char *saveptr;
+    char *source = strtok_r(line, CONTROL_RULE_SEPARATORS, &saveptr);
+    if (source == NULL)
+        return 0;
+    char *token = strtok_r(NULL, CONTROL_RULE_SEPARATORS, &saveptr);
+    char *end = NULL;
+    int first_message = table->message_count;
+    control_rule rule = {.state = CONTROL_RULE_UNKNOWN, .high_first = first_message, .low_first = first_message};
+    rule.high_threshold = token ? strtof(token, &end) : NAN;
+    if ((token == NULL) || (*end != '\0') || isnan(rule.high_threshold))
+        return -1;
+    rule.low_threshold = rule.high_threshold;
+
+    while ((token = strtok_r(NULL, CONTROL_RULE_SEPARATORS, &saveptr)) != NULL)
+    {
+        char *argument = strtok_r(NULL, CONTROL_RULE_SEPARATORS, &saveptr);
+        if (argument == NULL)
+            return -1;
+        if (strcmp(token, "hysteresis") == 0)
+        {
+            float hysteresis = strtof(argument, &end);
+            if ((*end != '\0') || !(hysteresis >= 0.0f))
+                return -1;
+            rule.low_threshold = rule.high_threshold - hysteresis;
+        }
+        else if ((strcmp(token, "high") == 0) && (rule.high_count == 0))
+        {
+            rule.high_first = table->message_count;
+            rule.high_count = control_rule_parse_writes(table, argument);
+            if (rule.high_count < 0)
+                return -1;
+        }
+        else if ((strcmp(token, "low") == 0) && (rule.low_count == 0))
+        {
+            rule.low_first = table->message_count;
+            rule.low_count = control_rule_parse_writes(table, argument);
+            if (rule.low_count < 0)
+                return -1;
+        }
+        else
+            return -1;
+    }
+    if (rule.high_count + rule.low_count == 0)
+        return -1;
+
+    rule.source = channel_table_find(channels, source);
+    if (rule.source < 0)
+    {
+        table->message_count = first_message;
+        table->skipped++;
+        return 0;
+    }
+    if (table->count == table->capacity)
+    {
+        int capacity = table->capacity ? table->capacity * 2 : CONTROL_RULE_CAPACITY_MIN;
+        control_rule *rules = realloc(table->rules, capacity * sizeof(control_rule));
+        if (rules == NULL)
+            return -1;
+        table->rules = rules;
+        table->capacity = capacity;
+    }
+    int index = table->count++;
+    while ((index > 0) && (table->rules[index - 1].source > rule.source))
+    {
+        table->rules[index] = table->rules[index - 1];
+        index--;
+    }
+    table->rules[index] = rule;
+    table->sources[rule.source] = 1;
+    return 0;
+}
+
+int control_rule_table_init(control_rule_table *table, const char *list, const channel_table *channels)
+{
+    memset(table, 0, sizeof(*table));
+    table->channel_count = channels->count;
+    table->values = calloc(channels->count > 0 ? channels->count : 1, sizeof(float));
+    table->sources = calloc(channels->count > 0 ? channels->count : 1, 1);
+    char *list_copy = strdup(list);
+    if ((table->values == NULL) || (table->sources == NULL) || (list_copy == NULL))
+    {
+        free(list_copy);
+        control_rule_table_free(table);
+        return -1;
+    }
+
+    // Strip the comments before splitting the lines
+    char *comment = list_copy;
+    while ((comment = strchr(comment, '#')) != NULL)
+    {
+        while ((*comment != '\0') && (*comment != '\n'))
+            *comment++ = ' ';
+    }
+
+    int result = 0;
+    char *saveptr;
+    char *line = strtok_r(list_copy, "\n", &saveptr);
+    while ((line != NULL) && (result == 0))
+    {
+        result = control_rule_table_add_line(table, line, channels);
+        line = strtok_r(NULL, "\n", &saveptr);
+    }
+    free(list_copy);
+
+    table->changed = (result == 0) ? malloc((table->count > 0 ? table->count : 1) * sizeof(int)) : NULL;
+    if ((result < 0) || (table->changed == NULL))
+    {
+        control_rule_table_free(table);
+        return -1;
+    }
+    return 0;
+}
+
+int control_rule_table_load(control_rule_table *table, const char *path, const channel_table *channels)
+{
+    memset(table, 0, sizeof(*table));
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+
+    char *list = NULL;
+    size_t list_size = 0;
+    FILE *stream = open_memstream(&list, &list_size);
+    if (stream == NULL)
+    {
+        fclose(file);
+        return -1;
+    }
+    char chunk[PROTOCOL_BUFFER_SIZE];
+    size_t read_count;
+    while ((read_count = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        fwrite(chunk, 1, read_count, stream);
+    fclose(stream);
+    fclose(file);
+
+    int result = control_rule_table_init(table, list, channels);
+    free(list);
+    return result;
+}
+
+// Queue a range of encoded writes, flushing a full batch
+static void control_rule_queue(control_batch *batch, const control_message *messages, int first, int count)
+{
+    for (int i = first; i < first + count; i++)
+    {
+        if (control_batch_add(batch, &messages[i]) < 0)
+        {
+            control_batch_flush(batch);
+            control_batch_add(batch, &messages[i]);
+        }
+    }
+}
+
+int control_rule_table_first(const control_rule_table *table, int source)
+{
+    // The rules are sorted by the source channel
+    int low = 0;
+    int high = table->count;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (table->rules[middle].source < source)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+int control_rule_evaluate(control_rule_table *table, int rule_index, float value, control_batch *batch)
+{
+    control_rule *rule = &table->rules[rule_index];
+    int state = rule->state;
+    if (value >= rule->high_threshold)
+        state = CONTROL_RULE_HIGH;
+    else if ((value < rule->low_threshold) || (state == CONTROL_RULE_UNKNOWN))
+        state = CONTROL_RULE_LOW;
+    if (state == rule->state)
+        return 0;
+    rule->state = state;
+    if (state == CONTROL_RULE_HIGH)
+        control_rule_queue(batch, table->messages, rule->high_first, rule->high_count);
+    else
+        control_rule_queue(batch, table->messages, rule->low_first, rule->low_count);
+    return 1;
+}
+
+int control_rule_table_evaluate(control_rule_table *table, const channel_table *channels, control_batch *batch)
+{
+    // Each source value is parsed once per tick
+    for (int i = 0; i < table->channel_count; i++)
+    {
+        if (!table->sources[i])
+            continue;
+        table->values[i] = parse_channel_value(channels->states[i].value, channels->states[i].value_length);
+    }
+
+    table->changed_count = 0;
+    for (int r = 0; r < table->count; r++)
+    {
+        float value = table->values[table->rules[r].source];
+        if (!isnan(value) && control_rule_evaluate(table, r, value, batch))
+            table->changed[table->changed_count++] = r;
+    }
+    return table->changed_count;
+}
+
+void control_rule_table_free(control_rule_table *table)
+{
+    free(table->rules);
+    free(table->messages);
+    free(table->values);
+    free(table->sources);
+    free(table->changed);
+    memset(table, 0, sizeof(*table));
+}
+
+int control_latency_init(control_latency *latency, const control_rule_table *rules, const channel_table *channels)
+{
+    memset(latency, 0, sizeof(*latency));
+    latency->rules = rules;
+    latency->channels = channels;
+    int channel_count = channels->count > 0 ? channels->count : 1;
+    latency->rule_latencies = calloc(rules->count > 0 ? rules->count : 1, sizeof(control_rule_latency));
+    latency->latency_channels = aligned_alloc(CONTROL_LATENCY_CACHE_LINE, channel_count * sizeof(control_latency_channel));
+    latency->armed = malloc(channel_count * sizeof(int));
+    if ((latency->rule_latencies == NULL) || (latency->latency_channels == NULL) || (latency->armed == NULL))
+    {
+        control_latency_free(latency);
+        return -1;
+    }
+    memset(latency->latency_channels, 0, channel_count * sizeof(control_latency_channel));
+    pthread_mutex_init(&latency->lock, NULL);
+    latency->lock_initialized = 1;
+    return 0;
+}
+
+void control_latency_arrival(control_latency *latency, int channel, long long read_ns)
+{
+    atomic_store_explicit(&latency->latency_channels[channel].arrival_ns, read_ns, memory_order_relaxed);
+}
+
+void control_latency_sample(control_latency *latency, int channel, float value, long long read_ns)
+{
+    control_latency_channel *latency_channel = &latency->latency_channels[channel];
+    if (latency_channel->samples == 2)
+    {
+        float expected = 2.0f * latency_channel->history[1] - latency_channel->history[0];
+        long long effect_ns = atomic_load_explicit(&latency_channel->effect_ns, memory_order_acquire);
+        // Only a read started after the send carries its effect
+        if ((fabsf(value - expected) > CONTROL_LATENCY_JUMP) && (effect_ns < 0) && (read_ns >= -effect_ns))
+            atomic_compare_exchange_strong_explicit(&latency_channel->effect_ns, &effect_ns, read_ns,
+                                                    memory_order_release, memory_order_relaxed);
+    }
+    else
+        latency_channel->samples++;
+    latency_channel->history[0] = latency_channel->history[1];
+    latency_channel->history[1] = value;
+}
+
+void control_latency_arm_rule(control_latency *latency, int rule_index, long long edge_ns, long long send_ns)
+{
+    const control_rule_table *rules = latency->rules;
+    const control_rule *rule = &rules->rules[rule_index];
+    control_rule_latency *rule_latency = &latency->rule_latencies[rule_index];
+    pthread_mutex_lock(&latency->lock);
+    // Without a read of the source value, e.g. values set by a test, there is no edge
+    if ((edge_ns <= 0) || (edge_ns > send_ns))
+        edge_ns = 0;
+    else
+        stats_histogram_record(&rule_latency->stages[CONTROL_LATENCY_EDGE_TO_SEND], send_ns - edge_ns);
+
+    int first = (rule->state == CONTROL_RULE_HIGH) ? rule->high_first : rule->low_first;
+    int count = (rule->state == CONTROL_RULE_HIGH) ? rule->high_count : rule->low_count;
+    int overlapped = 0;
+    for (int i = first; i < first + count; i++)
+    {
+        int channel = ntohs(rules->messages[i].object) - 1;
+        if ((channel < 0) || (channel >= latency->channels->count))
+            continue;
+        control_latency_channel *latency_channel = &latency->latency_channels[channel];
+        if (atomic_load_explicit(&latency_channel->effect_ns, memory_order_relaxed) != 0)
+        {
+            // Several writes of the rule to the same object are one effect
+            if ((latency_channel->rule != rule_index) || (latency_channel->send_ns != send_ns))
+                overlapped = 1;
+            continue;
+        }
+        latency_channel->rule = rule_index;
+        latency_channel->edge_ns = edge_ns;
+        latency_channel->send_ns = send_ns;
+        atomic_store_explicit(&latency_channel->effect_ns, -send_ns, memory_order_release);
+        latency->armed[latency->armed_count++] = channel;
+    }
+    if (overlapped)
+        stats_counter_add(&rule_latency->overlapped, 1);
+    pthread_mutex_unlock(&latency->lock);
+}
+
+void control_latency_arm(control_latency *latency, long long send_ns)
+{
+    const control_rule_table *rules = latency->rules;
+    for (int k = 0; k < rules->changed_count; k++)
+    {
+        int r = rules->changed[k];
+        long long edge_ns = atomic_load_explicit(&latency->latency_channels[rules->rules[r].source].arrival_ns, memory_order_relaxed);
+        control_latency_arm_rule(latency, r, edge_ns, send_ns);
+    }
+}
+
+void control_latency_poll(control_latency *latency, long long now_ns)
+{
+    pthread_mutex_lock(&latency->lock);
+    int k = 0;
+    while (k < latency->armed_count)
+    {
+        control_latency_channel *latency_channel = &latency->latency_channels[latency->armed[k]];
+        control_rule_latency *rule_latency = &latency->rule_latencies[latency_channel->rule];
+        long long effect_ns = atomic_load_explicit(&latency_channel->effect_ns, memory_order_acquire);
+        if (effect_ns > 0)
+        {
+            stats_histogram_record(&rule_latency->stages[CONTROL_LATENCY_SEND_TO_EFFECT], effect_ns - latency_channel->send_ns);
+            if (latency_channel->edge_ns > 0)
+                stats_histogram_record(&rule_latency->stages[CONTROL_LATENCY_EDGE_TO_EFFECT], effect_ns - latency_channel->edge_ns);
+            atomic_store_explicit(&latency_channel->effect_ns, 0, memory_order_relaxed);
+        }
+        else if (now_ns - latency_channel->send_ns < CONTROL_LATENCY_TIMEOUT_MS * 1000000LL)
+        {
+            k++;
+            continue;
+        }
+        // The effect may be marked by the reader while timing out, it is taken on the next poll
+        else if (atomic_compare_exchange_strong_explicit(&latency_channel->effect_ns, &effect_ns, 0,
+                                                         memory_order_relaxed, memory_order_relaxed))
+            stats_counter_add(&rule_latency->missed, 1);
+        else
+            continue;
+        latency->armed[k] = latency->armed[--latency->armed_count];
+    }
+    pthread_mutex_unlock(&latency->lock);
+}
+
+void control_latency_write(const control_latency *latency, FILE *file)
+{
+    static const char *const stage_names[CONTROL_LATENCY_STAGE_COUNT] = {"edge_to_send", "send_to_effect", "edge_to_effect"};
+    const control_rule_table *rules = latency->rules;
+    for (int r = 0; r < rules->count; r++)
+    {
+        const control_rule *rule = &rules->rules[r];
+        const control_rule_latency *rule_latency = &latency->rule_latencies[r];
+        const char *source = latency->channels->configs[rule->source].name;
+        for (int i = 0; i < CONTROL_LATENCY_STAGE_COUNT; i++)
+        {
+            fprintf(file, "control rule %d %s %g %s ", r, source, rule->high_threshold, stage_names[i]);
+            stats_histogram_write(&rule_latency->stages[i], file);
+        }
+        fprintf(file, "control rule %d %s %g missed %llu overlapped %llu\n", r, source, rule->high_threshold,
+                (unsigned long long)atomic_load_explicit(&rule_latency->missed, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&rule_latency->overlapped, memory_order_relaxed));
+    }
+}
+
+void control_latency_free(control_latency *latency)
+{
+    free(latency->rule_latencies);
+    free(latency->latency_channels);
+    free(latency->armed);
+    if (latency->lock_initialized)
+        pthread_mutex_destroy(&latency->lock);
+    memset(latency, 0, sizeof(*latency));
+}
@@ -0,0 +1,339 @@
+/**
+ * @file control.h
+ * @brief Header file for the control messages, batches and rules.
+ *
+ * The control rules map the value of a source channel to property writes. A rule
+ * has a threshold with an optional hysteresis, and the writes sent on entering the
+ * high and the low state. The rule list is compiled against the channel table into
+ * a flat array of rules sorted by the source channel, with the writes encoded to the
+ * wire format in a shared array, and each tick the rules are evaluated in one pass
+ * over the channel values, queueing the writes of the changed rules to a batch.
+ *
+ * The control latency measures the closed loop of each rule at three points of the
+ * monotonic clock: the edge, the read of the source value changing the rule state,
+ * the send of the rule writes, and the effect, the first sample of a written object
+ * channel departing from the linear extrapolation of its last two samples by more
+ * than CONTROL_LATENCY_JUMP, e.g. the out1 regime change of a frequency or amplitude
+ * write. The tick arms the written channels on the send, the reading thread marks
+ * the effect without locks, and the next ticks record the per-rule distributions.
+ *
+ * With the arrival evaluation, the rules of a source channel are evaluated by the
+ * thread reading the channel on each parsed sample, and the writes of a changed rule
+ * sent at once, instead of on the report tick. A channel is read by one thread at a
+ * time, so the state of its rules is not shared.
+ */
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "channel.h"
+#include "stats.h"
+
+#define CONTROL_BATCH_MAX 64 // control messages flushed with one sendmmsg
+#define CONTROL_RULE_UNKNOWN 0
+#define CONTROL_RULE_LOW 1
+#define CONTROL_RULE_HIGH 2
+
+#define CONTROL_LATENCY_JUMP 1.0f        // sample departure from the extrapolation marking an effect
+#define CONTROL_LATENCY_TIMEOUT_MS 1000  // writes without an effect in time are counted as missed
+#define CONTROL_LATENCY_CACHE_LINE 64
+#define CONTROL_LATENCY_EDGE_TO_SEND 0   // source value read to the rule writes sent
+#define CONTROL_LATENCY_SEND_TO_EFFECT 1 // rule writes sent to the effect sample read
+#define CONTROL_LATENCY_EDGE_TO_EFFECT 2 // source value read to the effect sample read
+#define CONTROL_LATENCY_STAGE_COUNT 3
+
+// The out3 threshold controlling the out1 frequency and amplitude, when no rules are given
+#define CONTROL_RULES_DEFAULT "out3 3.0 high 1:255=1000,1:170=8000 low 1:255=2000,1:170=4000"
+
+// Control message with operation, object, property and value
+typedef struct
+{
+    uint16_t operation;
+    uint16_t object;
+    uint16_t property;
+    uint16_t value;
+} control_message;
+
+// Control UDP socket with address
+typedef struct {
+    int sockfd;
+    struct sockaddr_in servaddr;
+} udp_socket;
+
+// Queue of big-endian encoded control messages, flushed with a single sendmmsg
+typedef struct
+{
+    int sockfd;
+    struct sockaddr_in servaddr;
+    int count;
+    int unsent; // messages not sent by the flushes, until reset by the caller
+    int error;  // errno of the last failed sendmmsg, until reset by the caller
+    control_message wire[CONTROL_BATCH_MAX];
+    struct iovec iovecs[CONTROL_BATCH_MAX];
+    struct mmsghdr headers[CONTROL_BATCH_MAX];
+} control_batch;
+
+// Compiled rule, the writes are ranges of the encoded messages of the rule table
+typedef struct
+{
+    float high_threshold; // enters the high state at value >= high_threshold
+    float low_threshold;  // enters the low state at value < low_threshold
+    int source;           // source channel index
+    int state;            // CONTROL_RULE_UNKNOWN, CONTROL_RULE_LOW or CONTROL_RULE_HIGH
+    int high_first;
+    int high_count;
+    int low_first;
+    int low_count;
+} control_rule;
+
+// Rule table compiled against a channel table
+typedef struct
+{
+    int count;
+    int capacity;
+    control_rule *rules;          // sorted by the source channel
+    int message_count;
+    int message_capacity;
+    control_message *messages;    // encoded writes of all the rules
+    int channel_count;
+    float *values;                // source channel values of the tick, NaN if empty
+    unsigned char *sources;       // 1 for the source channels of the rules
+    int skipped;                  // rules of channels not in the channel table
+    int changed_count;
+    int *changed;                 // rules changing state in the last evaluation
+} control_rule_table;
+
+// Latency distributions of a rule, recorded under the lock of the control latency
+typedef struct
+{
+    stats_histogram stages[CONTROL_LATENCY_STAGE_COUNT];
+    atomic_ullong missed;     // writes without an effect before the timeout
+    atomic_ullong overlapped; // writes to a channel still waiting for an earlier effect, not measured
+} control_rule_latency;
+
+// Latency state of a channel, as the source of rules and as a written object
+typedef struct
+{
+    _Alignas(CONTROL_LATENCY_CACHE_LINE) atomic_llong effect_ns; // -send time while armed, the effect read once seen, 0 idle
+    atomic_llong arrival_ns; // read of the last value
+    float history[2];        // last two samples, owned by the reading thread
+    int samples;
+    int rule;                // armed rule and the edge and send times, guarded by the lock
+    long long edge_ns;
+    long long send_ns;
+} control_latency_channel;
+
+// Closed-loop latencies of a rule table, the object of a write is the channel index + 1
+typedef struct control_latency
+{
+    const control_rule_table *rules;
+    const channel_table *channels;
+    control_rule_latency *rule_latencies;
+    control_latency_channel *latency_channels;
+    pthread_mutex_t lock; // arming by the tick or the arrival evaluation, and the poll of the tick
+    int lock_initialized;
+    int armed_count;
+    int *armed; // channels waiting for an effect
+} control_latency;
+
+// Rule evaluation on the arrival of each source sample, in the thread reading the source channel
+typedef struct
+{
+    control_rule_table *rules;
+    udp_socket socket;
+    control_latency *latency; // latency of the rules, or NULL
+} control_arrival;
+
+/**
+ * Encodes a control message to the big-endian wire format.
+ *
+ * @param msg The control message.
+ * @return The encoded control message.
+ */
+control_message control_message_encode(control_message msg);
+
+/**
+ * Initializes an empty control batch of a UDP control socket. The message headers
+ * point to the batch itself, so the batch must not be copied after initialization.
+ *
+ * @param batch The control batch.
+ * @param udp_control_socket The UDP control socket to send the messages on.
+ */
+void control_batch_init(control_batch *batch, udp_socket udp_control_socket);
+
+/**
+ * Queues an encoded control message to a control batch.
+ *
+ * @param batch The control batch.
+ * @param wire The control message encoded with control_message_encode.
+ * @return 0 on success, or -1 if the batch is full.
+ */
+int control_batch_add(control_batch *batch, const control_message *wire);
+
+/**
+ * Sends the queued control messages with sendmmsg and empties the batch. The messages
+ * not sent are added to the unsent count of the batch, and the errno of a failed send
+ * is kept in its error.
+ *
+ * @param batch The control batch.
+ * @return The number of messages sent, or -1 if none could be sent.
+ */
+int control_batch_flush(control_batch *batch);
+
+/**
+ * Compiles a rule list against a channel table.
+ *
+ * Each rule is a line of "source threshold [hysteresis H] high WRITES low WRITES",
+ * where WRITES is a comma-separated list of object:property=value writes, and either
+ * of the high and low parts may be left out. The rule enters the high state when the
+ * source value is >= threshold, and the low state when the value is < threshold - H.
+ * Text after '#' to the end of line is a comment, e.g. the default rule:
+ * "out3 3.0 high 1:255=1000,1:170=8000 low 1:255=2000,1:170=4000"
+ * The rules of source channels not in the channel table are skipped and counted.
+ *
+ * @param table The rule table to initialize.
+ * @param list The rule list.
+ * @param channels The channel table of the source channels.
+ * @return 0 on success, or -1 if the list is invalid.
+ */
+int control_rule_table_init(control_rule_table *table, const char *list, const channel_table *channels);
+
+/**
+ * Compiles a rule list file against a channel table.
+ *
+ * @param table The rule table to initialize.
+ * @param path The path of the rule list file.
+ * @param channels The channel table of the source channels.
+ * @return 0 on success, or -1 if the file could not be read or the list is invalid.
+ */
+int control_rule_table_load(control_rule_table *table, const char *path, const channel_table *channels);
+
+/**
+ * Evaluates the rules on the current channel values, and queues the writes of the
+ * rules changing state to the batch, flushing the batch when full. Empty values do
+ * not change the state.
+ *
+ * @param table The rule table.
+ * @param channels The channel table with the values of the tick.
+ * @param batch The control batch.
+ * @return The number of rules changing state.
+ */
+int control_rule_table_evaluate(control_rule_table *table, const channel_table *channels, control_batch *batch);
+
+/**
+ * Returns the index of the first rule of a source channel.
+ *
+ * @param table The rule table.
+ * @param source The source channel index.
+ * @return The first rule index, or the index of the next source if the channel has no rules.
+ */
+int control_rule_table_first(const control_rule_table *table, int source);
+
+/**
+ * Evaluates a rule on a source value, queueing the writes to the batch on a state change.
+ *
+ * @param table The rule table.
+ * @param rule_index The rule index.
+ * @param value The source value, not NaN.
+ * @param batch The control batch.
+ * @return 1 if the rule changed state, or 0.
+ */
+int control_rule_evaluate(control_rule_table *table, int rule_index, float value, control_batch *batch);
+
+/**
+ * Releases a rule table.
+ *
+ * @param table The rule table.
+ */
+void control_rule_table_free(control_rule_table *table);
+
+/**
+ * Initializes the latency measurement of a compiled rule table.
+ *
+ * @param latency The control latency to initialize.
+ * @param rules The rule table, evaluated by the report tick.
+ * @param channels The channel table of the rules.
+ * @return 0 on success, or -1 on allocation failure.
+ */
+int control_latency_init(control_latency *latency, const control_rule_table *rules, const channel_table *channels);
+
+/**
+ * Records the read of a new channel value, the edge time of the rules of the channel.
+ *
+ * Called by the thread reading the channel.
+ *
+ * @param latency The control latency.
+ * @param channel The channel index.
+ * @param read_ns The monotonic start time of the read.
+ */
+void control_latency_arrival(control_latency *latency, int channel, long long read_ns);
+
+/**
+ * Feeds a sample to the effect detection of a channel, marking an armed channel on
+ * a sample departing from the extrapolation of the previous two.
+ *
+ * Called by the thread reading the channel, for every sample in arrival order.
+ *
+ * @param latency The control latency.
+ * @param channel The channel index.
+ * @param value The sample.
+ * @param read_ns The monotonic start time of the read.
+ */
+void control_latency_sample(control_latency *latency, int channel, float value, long long read_ns);
+
+/**
+ * Records the edge to send latency of a rule changing state, and arms the channels of
+ * its writes for the effect detection.
+ *
+ * Called before the batch with the writes of the rule is flushed.
+ *
+ * @param latency The control latency.
+ * @param rule_index The rule index.
+ * @param edge_ns The monotonic read time of the source value, or 0 if unknown.
+ * @param send_ns The monotonic send time.
+ */
+void control_latency_arm_rule(control_latency *latency, int rule_index, long long edge_ns, long long send_ns);
+
+/**
+ * Arms the rules changed by the last evaluation of the rule table, the edge of each
+ * rule the last read of its source channel.
+ *
+ * Called by the report tick before the batch of the evaluation is flushed.
+ *
+ * @param latency The control latency.
+ * @param send_ns The monotonic send time.
+ */
+void control_latency_arm(control_latency *latency, long long send_ns);
+
+/**
+ * Records the latencies of the effects seen since the last poll, and counts the
+ * armed channels without an effect within CONTROL_LATENCY_TIMEOUT_MS as missed.
+ *
+ * Called by the report tick.
+ *
+ * @param latency The control latency.
+ * @param now_ns The monotonic time.
+ */
+void control_latency_poll(control_latency *latency, long long now_ns);
+
+/**
+ * Writes the latency distributions of each rule, e.g.
+ * "control rule 0 out3 3 edge_to_send count 12 mean_ns ... max_ns 10498\n".
+ *
+ * @param latency The control latency.
+ * @param file The file to write to.
+ */
+void control_latency_write(const control_latency *latency, FILE *file);
+
+/**
+ * Releases the control latency.
+ *
+ * @param latency The control latency.
+ */
+void control_latency_free(control_latency *latency);
+
+#endif // CONTROL_H
@@ -0,0 +1,814 @@
+/**
+ * @file pipeline.c
+ * @brief This file contains the implementation of the multi-threaded report pipeline.
+ */
+#include "protocol.h"
+#include <sys/eventfd.h>
+
+#define REPORT_SLOT_WRITING SIZE_MAX
+#define PIPELINE_EVENT_STOP UINT32_MAX
+#define PIPELINE_EVENT_WAKE (UINT32_MAX - 1)
+#define PIPELINE_PENDING_WAIT_US 1000
+
+// Report slot, the sequence is the queue position of the slot content, the aggregates follow the entries
+typedef struct
+{
+    atomic_size_t sequence;
+    long long timestamp;
+    int count;
+    report_entry entries[];
+} report_slot;
+
+// Offset of the aggregates in a slot, after the entries of the channel count
+static size_t report_slot_aggregates_offset(int channel_count)
+{
+    size_t offset = sizeof(report_slot) + channel_count * sizeof(report_entry);
+    return (offset + _Alignof(channel_aggregate) - 1) & ~(_Alignof(channel_aggregate) - 1);
+}
+
+static channel_aggregate *report_slot_aggregates(const report_queue *queue, report_slot *slot)
+{
+    return (channel_aggregate *)((unsigned char *)slot + report_slot_aggregates_offset(queue->channel_count));
+}
+
+static report_slot *report_queue_slot(const report_queue *queue, size_t position)
+{
+    return (report_slot *)(queue->slots + (position & (queue->capacity - 1)) * queue->slot_size);
+}
+
+int report_queue_init(report_queue *queue, size_t capacity, int channel_count, int aggregates, int policy)
+{
+    memset(queue, 0, sizeof(*queue));
+    queue->capacity = 1;
+    while (queue->capacity < capacity)
+        queue->capacity <<= 1;
+    queue->channel_count = channel_count;
+    queue->policy = policy;
+    queue->aggregates = aggregates;
+    queue->slot_size = aggregates ? report_slot_aggregates_offset(channel_count) + channel_count * sizeof(channel_aggregate)
+                                  : sizeof(report_slot) + channel_count * sizeof(report_entry);
+    queue->slot_size = (queue->slot_size + PIPELINE_CACHE_LINE - 1) & ~(size_t)(PIPELINE_CACHE_LINE - 1);
+    queue->slots = aligned_alloc(PIPELINE_CACHE_LINE, queue->capacity * queue->slot_size);
+    queue->data_fd = eventfd(0, EFD_CLOEXEC);
+    queue->space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((queue->slots == NULL) || (queue->data_fd < 0) || (queue->space_fd < 0))
+    {
+        report_queue_free(queue);
+        return -1;
+    }
+    for (size_t i = 0; i < queue->capacity; i++)
+        atomic_init(&report_queue_slot(queue, i)->sequence, REPORT_SLOT_WRITING);
+    return 0;
+}
+
+int report_queue_push(report_queue *queue, long long timestamp, const report_entry *entries,
+                      const channel_aggregate *aggregates, int count)
+{
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if (head - tail >= queue->capacity)
+    {
+        if (queue->policy == REPORT_OVERFLOW_BLOCK)
+        {
+            // The consumer signals the space_fd on the next pop, unless a slot was freed meanwhile
+            atomic_store(&queue->waiting, 1);
+            tail = atomic_load(&queue->tail);
+            if (head - tail >= queue->capacity)
+                return -1;
+            atomic_store_explicit(&queue->waiting, 0, memory_order_relaxed);
+        }
+        else if (atomic_compare_exchange_strong(&queue->tail, &tail, tail + 1))
+        {
+            // The consumer detects the overwrite from the slot sequence
+            atomic_store_explicit(&queue->dropped, atomic_load_explicit(&queue->dropped, memory_order_relaxed) + 1, memory_order_relaxed);
+        }
+    }
+
+    report_slot *slot = report_queue_slot(queue, head);
+    atomic_store_explicit(&slot->sequence, REPORT_SLOT_WRITING, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->timestamp = timestamp;
+    slot->count = count;
+    memcpy(slot->entries, entries, count * sizeof(report_entry));
+    if (queue->aggregates)
+        memcpy(report_slot_aggregates(queue, slot), aggregates, count * sizeof(channel_aggregate));
+    atomic_store_explicit(&slot->sequence, head, memory_order_release);
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return 0;
+}
+
+void report_queue_signal(report_queue *queue)
+{
+    uint64_t signal = 1;
+    write(queue->data_fd, &signal, sizeof(signal));
+}
+
+int report_queue_pop(report_queue *queue, long long *timestamp, report_entry *entries, channel_aggregate *aggregates, int *count)
+{
+    while (1)
+    {
+        size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        if (tail == head)
+            return 0;
+
+        // A slot dropped by the producer is being rewritten, the tail has moved on
+        report_slot *slot = report_queue_slot(queue, tail);
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != tail)
+            continue;
+        *timestamp = slot->timestamp;
+        int slot_count = slot->count;
+        if ((slot_count < 0) || (slot_count > queue->channel_count))
+            continue;
+        memcpy(entries, slot->entries, slot_count * sizeof(report_entry));
+        if (queue->aggregates && (aggregates != NULL))
+            memcpy(aggregates, report_slot_aggregates(queue, slot), slot_count * sizeof(channel_aggregate));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) != tail)
+            continue;
+        if (!atomic_compare_exchange_strong(&queue->tail, &tail, tail + 1))
+            continue;
+
+        *count = slot_count;
+        if (atomic_exchange(&queue->waiting, 0))
+        {
+            uint64_t signal = 1;
+            write(queue->space_fd, &signal, sizeof(signal));
+        }
+        return 1;
+    }
+}
+
+void report_queue_free(report_queue *queue)
+{
+    free(queue->slots);
+    if (queue->data_fd >= 0)
+        close(queue->data_fd);
+    if (queue->space_fd >= 0)
+        close(queue->space_fd);
+    queue->slots = NULL;
+    queue->data_fd = -1;
+    queue->space_fd = -1;
+}
+
+void report_mailbox_write(report_mailbox *mailbox, const char *value, int length, long long receive_ns)
+{
+    unsigned sequence = atomic_load_explicit(&mailbox->sequence, memory_order_relaxed);
+    atomic_store_explicit(&mailbox->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(mailbox->value.value, value, length + 1);
+    mailbox->value.length = length;
+    mailbox->value.receive_ns = receive_ns;
+    atomic_store_explicit(&mailbox->sequence, sequence + 2, memory_order_release);
+}
+
+unsigned report_mailbox_read(report_mailbox *mailbox, report_value *value)
+{
+    while (1)
+    {
+        unsigned sequence = atomic_load_explicit(&mailbox->sequence, memory_order_acquire);
+        if (sequence & 1)
+            continue;
+        *value = mailbox->value;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&mailbox->sequence, memory_order_relaxed) == sequence)
+            return sequence;
+    }
+}
+
+
+// Publish the value read by a shard, the channel queued to the change ring once until collected
+static void report_shard_publish(report_shard *shard, int channel)
+{
+    report_pipeline *pipeline = shard->pipeline;
+    channel_state *state = &pipeline->channels->states[channel];
+    if (strcmp(state->value, CHANNEL_EMPTY_VALUE) == 0)
+        return;
+    report_mailbox_write(&pipeline->mailboxes[channel], state->value, state->value_length, state->value_ns);
+    channel_set_value(state, CHANNEL_EMPTY_VALUE);
+    if (atomic_exchange(&pipeline->queued[channel], 1))
+        return;
+    report_change_ring *ring = &shard->changes;
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->channels[head & ring->mask] = channel;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Take the channels handed over by another shard, a channel without a socket is reconnected here
+static void report_shard_receive(report_shard *shard, long long *retry_ns)
+{
+    channel_table *channels = shard->pipeline->channels;
+    pthread_mutex_lock(&shard->handover_lock);
+    for (int k = 0; k < shard->handover_count; k++)
+    {
+        int channel = shard->handover[k];
+        channel_state *state = &channels->states[channel];
+        shard->channels[shard->channel_count++] = channel;
+        if ((state->stream.sockfd >= 0) && (report_epoll_add_channel(shard->epoll_fd, channels, channel) < 0))
+            channel_disconnect(state, stats_now_ns(), report_reconnect_max_ms(shard->pipeline->options));
+        if (state->stream.sockfd < 0)
+            *retry_ns = 0;
+    }
+    shard->handover_count = 0;
+    pthread_mutex_unlock(&shard->handover_lock);
+}
+
+// Hand over the most active channels to the requesting shard, about half of the load difference
+static void report_shard_give(report_shard *shard)
+{
+    report_pipeline *pipeline = shard->pipeline;
+    int thief_index = atomic_exchange(&shard->thief, 0) - 1;
+    if (thief_index < 0)
+        return;
+    report_shard *thief = &pipeline->shards[thief_index];
+    long long load_ns = atomic_load_explicit(&shard->load_ns, memory_order_relaxed);
+    long long thief_load_ns = atomic_load_explicit(&thief->load_ns, memory_order_relaxed);
+    unsigned long long total = 0;
+    for (int k = 0; k < shard->channel_count; k++)
+        total += pipeline->channel_events[shard->channels[k]];
+    if ((shard->channel_count < 2) || (load_ns <= thief_load_ns) || (total == 0))
+        return;
+
+    // A channel overshooting the target by half stays, so a single hot channel does not move back and forth
+    unsigned long long target = total * (unsigned long long)(load_ns - thief_load_ns) / (2 * (unsigned long long)load_ns);
+    unsigned long long moved_events = 0;
+    int moved = 0;
+    pthread_mutex_lock(&thief->handover_lock);
+    while ((moved_events < target) && (shard->channel_count > 1))
+    {
+        // The most active channel still fitting under the target, by a scan of the owned channels
+        int k = -1;
+        unsigned events = 0;
+        for (int i = 0; i < shard->channel_count; i++)
+        {
+            unsigned channel_events = pipeline->channel_events[shard->channels[i]];
+            if ((channel_events > events) && (moved_events + channel_events <= target + target / 2))
+            {
+                k = i;
+                events = channel_events;
+            }
+        }
+        if (k < 0)
+            break;
+        int channel = shard->channels[k];
+        channel_state *state = &pipeline->channels->states[channel];
+        if (state->stream.sockfd >= 0)
+            epoll_ctl(shard->epoll_fd, EPOLL_CTL_DEL, state->stream.sockfd, NULL);
+        shard->channels[k] = shard->channels[--shard->channel_count];
+        thief->handover[thief->handover_count++] = channel;
+        moved_events += events;
+        moved++;
+    }
+    pthread_mutex_unlock(&thief->handover_lock);
+    if (moved == 0)
+        return;
+
+    // The load estimate drops until the next window, so the thief does not ask again for the same load
+    atomic_store_explicit(&shard->load_ns, load_ns - (long long)(load_ns * moved_events / total), memory_order_relaxed);
+    uint64_t wake = 1;
+    write(thief->wake_fd, &wake, sizeof(wake));
+    report_stats *stats = pipeline->options->stats;
+    if (stats != NULL)
+        atomic_fetch_add_explicit(&stats->channels_moved, moved, memory_order_relaxed);
+}
+
+// End a load window, publish the load, and ask the busiest shard for channels when much less loaded
+static void report_shard_window(report_shard *shard, long long busy_ns)
+{
+    report_pipeline *pipeline = shard->pipeline;
+    atomic_store_explicit(&shard->load_ns, busy_ns, memory_order_relaxed);
+    for (int k = 0; k < shard->channel_count; k++)
+        pipeline->channel_events[shard->channels[k]] /= 2;
+
+    report_shard *busiest = NULL;
+    long long busiest_ns = 0;
+    for (int s = 0; s < pipeline->shard_count; s++)
+    {
+        long long load_ns = atomic_load_explicit(&pipeline->shards[s].load_ns, memory_order_relaxed);
+        if ((s != shard->index) && (load_ns > busiest_ns))
+        {
+            busiest = &pipeline->shards[s];
+            busiest_ns = load_ns;
+        }
+    }
+    if ((busiest == NULL) || (busiest_ns < PIPELINE_STEAL_MIN_NS) || (busiest_ns <= PIPELINE_STEAL_RATIO * busy_ns))
+        return;
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&busiest->thief, &expected, shard->index + 1))
+    {
+        uint64_t wake = 1;
+        write(busiest->wake_fd, &wake, sizeof(wake));
+    }
+}
+
+// Ingest shard, reads and reconnects the sockets of its channels and publishes the last value of each read
+static void *report_shard_ingest(void *arg)
+{
+    report_shard *shard = arg;
+    report_pipeline *pipeline = shard->pipeline;
+    const report_options *options = pipeline->options;
+    channel_table *channels = pipeline->channels;
+    if ((shard->cpu != RT_CPU_NONE) && (rt_thread_setup(RT_PRIORITY_NONE, shard->cpu) < 0))
+        fprintf(stderr, "pipeline: shard %d affinity not set\n", shard->index);
+
+    struct epoll_event events[REPORT_EVENTS_MAX];
+    long long retry_ns = 0;
+    long long busy_ns = 0;
+    long long window_ns = PIPELINE_STEAL_WINDOW_MS * 1000000LL;
+    long long window_end_ns = stats_now_ns() + window_ns;
+    int running = 1;
+    while (running)
+    {
+        int timeout_ms = report_reconnect_channel_list(options, channels, shard->channels, shard->channel_count,
+                                                       shard->epoll_fd, &retry_ns);
+        // The load windows only matter with another shard to balance with
+        if (pipeline->shard_count > 1)
+        {
+            long long now_ns = stats_now_ns();
+            if (now_ns >= window_end_ns)
+            {
+                report_shard_window(shard, busy_ns);
+                busy_ns = 0;
+                window_end_ns = now_ns + window_ns;
+            }
+            int window_ms = (int)((window_end_ns - now_ns + 999999) / 1000000);
+            if ((timeout_ms < 0) || (window_ms < timeout_ms))
+                timeout_ms = window_ms;
+        }
+        int event_count = epoll_wait(shard->epoll_fd, events, REPORT_EVENTS_MAX, timeout_ms);
+        if (event_count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        long long batch_start_ns = stats_now_ns();
+        for (int e = 0; e < event_count; e++)
+        {
+            uint32_t tag = events[e].data.u32;
+            if (tag == PIPELINE_EVENT_STOP)
+            {
+                running = 0;
+                continue;
+            }
+            if (tag == PIPELINE_EVENT_WAKE)
+            {
+                uint64_t signaled;
+                read(shard->wake_fd, &signaled, sizeof(signaled));
+                report_shard_receive(shard, &retry_ns);
+                continue;
+            }
+            report_channel_event(options, channels, shard->epoll_fd, tag, events[e].events, &retry_ns);
+            pipeline->channel_events[tag]++;
+            report_shard_publish(shard, tag);
+        }
+        busy_ns += stats_now_ns() - batch_start_ns;
+
+        // The channels are handed over between the batches, when no event of them is pending
+        if (atomic_load_explicit(&shard->thief, memory_order_relaxed) != 0)
+            report_shard_give(shard);
+    }
+    return NULL;
+}
+
+// Output thread, formats and writes the queued reports until stopped and drained
+static void *report_pipeline_output(void *arg)
+{
+    report_pipeline *pipeline = arg;
+    const report_options *options = pipeline->options;
+    report_stats *stats = options->stats;
+    channel_table *output = &pipeline->output;
+    report_entry *received = pipeline->received;
+    long long timestamp_ns;
+    int received_count;
+    while (1)
+    {
+        if (!report_queue_pop(&pipeline->queue, &timestamp_ns, received, pipeline->received_aggregates, &received_count))
+        {
+            if (atomic_load(&pipeline->stopping))
+                break;
+            uint64_t signaled;
+            read(pipeline->queue.data_fd, &signaled, sizeof(signaled));
+            continue;
+        }
+        // The delta applies over "--", the channels of the previous report are reset
+        for (int k = 0; k < pipeline->output_changed_count; k++)
+        {
+            channel_set_value(&output->states[pipeline->output_changed[k]], CHANNEL_EMPTY_VALUE);
+            if (pipeline->output_aggregates != NULL)
+                aggregate_reset(&pipeline->output_aggregates[pipeline->output_changed[k]]);
+        }
+        for (int k = 0; k < received_count; k++)
+        {
+            channel_state *state = &output->states[received[k].channel];
+            memcpy(state->value, received[k].value.value, received[k].value.length + 1);
+            state->value_length = received[k].value.length;
+            state->value_ns = received[k].value.receive_ns;
+            pipeline->output_changed[k] = received[k].channel;
+            if (pipeline->output_aggregates != NULL)
+                pipeline->output_aggregates[received[k].channel] = pipeline->received_aggregates[k];
+        }
+        pipeline->output_changed_count = received_count;
+
+        long long format_start_ns = stats ? stats_now_ns() : 0;
+        long long timestamp = report_timestamp_ms(timestamp_ns);
+        int length = (options->format == REPORT_FORMAT_BINARY) ? (int)binary_report_encode(pipeline->binary_writer, timestamp, output)
+                   : options->timestamp_ns_enable ? format_report_at_ns(pipeline->report_buffer, pipeline->report_size, output, timestamp_ns)
+                                                  : format_report_at(pipeline->report_buffer, pipeline->report_size, output, timestamp);
+        if ((options->format == REPORT_FORMAT_JSON) && options->receive_timestamps_enable && (length > 0))
+            length = format_report_ages(pipeline->report_buffer, pipeline->report_size, length, output, timestamp_ns);
+        if ((options->format == REPORT_FORMAT_JSON) && (pipeline->output_aggregates != NULL) && (length > 0))
+            length = format_report_aggregates(pipeline->report_buffer, pipeline->report_size, length, output,
+                                              pipeline->output_aggregates);
+        long long output_start_ns = stats ? stats_now_ns() : 0;
+        if (options->format == REPORT_FORMAT_BINARY)
+            report_sink_write(pipeline->sink, pipeline->binary_writer->record, length);
+        else if (length > 0)
+            report_sink_write_line(pipeline->sink, pipeline->report_buffer, length);
+        if (options->archive != NULL)
+            archive_writer_append(options->archive, timestamp_ns, output);
+        if (options->archive_segments != NULL)
+            archive_segments_append(options->archive_segments, timestamp_ns, output);
+        if (stats != NULL)
+        {
+            long long output_end_ns = stats_now_ns();
+            stats_histogram_record(&stats->stages[STATS_STAGE_FORMAT], output_start_ns - format_start_ns);
+            stats_histogram_record(&stats->stages[STATS_STAGE_OUTPUT], output_end_ns - output_start_ns);
+            // The empty intervals are counted here, off the aggregator tick
+            for (int i = 0; i < output->count; i++)
+            {
+                if (strcmp(output->states[i].value, CHANNEL_EMPTY_VALUE) == 0)
+                    stats_counter_add(&stats->channel_stats[i].empty_intervals, 1);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Value table sharing the channel configurations, with its own values
+static int report_pipeline_table(channel_table *table, const channel_table *channels)
+{
+    table->count = channels->count;
+    table->capacity = channels->count;
+    table->configs = channels->configs;
+    table->states = calloc(channels->count > 0 ? channels->count : 1, sizeof(channel_state));
+    if (table->states == NULL)
+        return -1;
+    channel_table_reset_values(table);
+    return 0;
+}
+
+// Shard with its epoll set, wake eventfd, channel arrays and change ring of the channel count
+static int report_shard_init(report_shard *shard, int count)
+{
+    size_t capacity = 1;
+    while (capacity < (size_t)count)
+        capacity <<= 1;
+    shard->changes.mask = capacity - 1;
+    shard->changes.channels = malloc(capacity * sizeof(int));
+    shard->channels = malloc(count * sizeof(int));
+    shard->handover = malloc(count * sizeof(int));
+    shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    shard->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event stop_event = {.events = EPOLLIN, .data.u32 = PIPELINE_EVENT_STOP};
+    struct epoll_event wake_event = {.events = EPOLLIN, .data.u32 = PIPELINE_EVENT_WAKE};
+    if ((shard->changes.channels == NULL) || (shard->channels == NULL) || (shard->handover == NULL) ||
+        (shard->epoll_fd < 0) || (shard->wake_fd < 0) ||
+        (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->pipeline->stop_fd, &stop_event) < 0) ||
+        (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->wake_fd, &wake_event) < 0))
+        return -1;
+    return 0;
+}
+
+static void report_shard_free(report_shard *shard)
+{
+    if (shard->epoll_fd >= 0)
+        close(shard->epoll_fd);
+    if (shard->wake_fd >= 0)
+        close(shard->wake_fd);
+    shard->epoll_fd = -1;
+    shard->wake_fd = -1;
+    free(shard->changes.channels);
+    free(shard->channels);
+    free(shard->handover);
+    shard->changes.channels = NULL;
+    shard->channels = NULL;
+    shard->handover = NULL;
+    pthread_mutex_destroy(&shard->handover_lock);
+}
+
+int report_pipeline_start(report_pipeline *pipeline, report_sink *sink, const struct report_options *options,
+                          channel_table *channels, binary_report_writer *binary_writer)
+{
+    memset(pipeline, 0, sizeof(*pipeline));
+    pipeline->options = options;
+    pipeline->channels = channels;
+    pipeline->sink = sink;
+    pipeline->binary_writer = binary_writer;
+    pipeline->stop_fd = -1;
+    pipeline->queue.data_fd = -1;
+    pipeline->queue.space_fd = -1;
+
+    // The shards beyond the channel count would stay idle
+    int count = channels->count > 0 ? channels->count : 1;
+    int shard_count = options->shard_count > 0 ? options->shard_count : 1;
+    if (shard_count > count)
+        shard_count = count;
+    pipeline->shards = aligned_alloc(PIPELINE_CACHE_LINE, shard_count * sizeof(report_shard));
+    if (pipeline->shards != NULL)
+    {
+        memset(pipeline->shards, 0, shard_count * sizeof(report_shard));
+        for (int s = 0; s < shard_count; s++)
+        {
+            pipeline->shards[s].pipeline = pipeline;
+            pipeline->shards[s].index = s;
+            pipeline->shards[s].epoll_fd = -1;
+            pipeline->shards[s].wake_fd = -1;
+            pthread_mutex_init(&pipeline->shards[s].handover_lock, NULL);
+        }
+        pipeline->shard_count = shard_count;
+    }
+
+    pipeline->mailboxes = aligned_alloc(PIPELINE_CACHE_LINE, count * sizeof(report_mailbox));
+    pipeline->queued = calloc(count, sizeof(atomic_uchar));
+    pipeline->channel_events = calloc(count, sizeof(unsigned));
+    pipeline->seen = calloc(count, sizeof(unsigned));
+    pipeline->collected = calloc(count, sizeof(unsigned char));
+    pipeline->changed = calloc(3 * count, sizeof(int));
+    pipeline->entries = calloc(3 * count, sizeof(report_entry));
+    pipeline->report_size = report_buffer_size(channels);
+    int aggregates = options->aggregates != NULL;
+    if (aggregates)
+    {
+        pipeline->report_size += report_aggregates_size(channels);
+        pipeline->entry_aggregates = malloc(4 * count * sizeof(channel_aggregate));
+    }
+    if (options->receive_timestamps_enable)
+        pipeline->report_size += report_ages_size(channels);
+    pipeline->report_buffer = malloc(pipeline->report_size);
+    pipeline->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((pipeline->shards == NULL) || (pipeline->mailboxes == NULL) || (pipeline->queued == NULL) ||
+        (pipeline->channel_events == NULL) || (pipeline->seen == NULL) || (pipeline->collected == NULL) ||
+        (pipeline->changed == NULL) || (pipeline->entries == NULL) || (pipeline->report_buffer == NULL) ||
+        (aggregates && (pipeline->entry_aggregates == NULL)) || (pipeline->stop_fd < 0) ||
+        (report_pipeline_table(&pipeline->values, channels) < 0) ||
+        (report_pipeline_table(&pipeline->output, channels) < 0) ||
+        (report_queue_init(&pipeline->queue, options->queue_capacity, channels->count, aggregates, options->overflow_policy) < 0))
+    {
+        report_pipeline_stop(pipeline);
+        return -1;
+    }
+    memset(pipeline->mailboxes, 0, count * sizeof(report_mailbox));
+    pipeline->output_changed = pipeline->changed + count;
+    pipeline->pending_index = pipeline->changed + 2 * count;
+    memset(pipeline->pending_index, 0xff, count * sizeof(int));
+    pipeline->received = pipeline->entries + count;
+    pipeline->pending = pipeline->entries + 2 * count;
+    if (aggregates)
+    {
+        pipeline->received_aggregates = pipeline->entry_aggregates + count;
+        pipeline->pending_aggregates = pipeline->entry_aggregates + 2 * count;
+        pipeline->output_aggregates = pipeline->entry_aggregates + 3 * count;
+        for (int i = 0; i < count; i++)
+            aggregate_reset(&pipeline->output_aggregates[i]);
+    }
+
+    // The channels are assigned round-robin, the shard CPUs follow the first one
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int s = 0; s < shard_count; s++)
+    {
+        report_shard *shard = &pipeline->shards[s];
+        shard->cpu = ((options->shard_cpu != RT_CPU_NONE) && (cpus > 0)) ? (int)((options->shard_cpu + s) % cpus) : RT_CPU_NONE;
+        if (report_shard_init(shard, count) < 0)
+        {
+            report_pipeline_stop(pipeline);
+            return -1;
+        }
+    }
+    for (int i = 0; i < channels->count; i++)
+    {
+        report_shard *shard = &pipeline->shards[i % shard_count];
+        shard->channels[shard->channel_count++] = i;
+        // A channel without a socket is reconnected by its shard
+        if (channels->states[i].stream.sockfd >= 0)
+            report_epoll_add_channel(shard->epoll_fd, channels, i);
+    }
+
+    // The threads block all signals, SIGINT stays with the signalfd of the report loop
+    sigset_t all_signals, previous_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &previous_mask);
+    int shards_started = 0;
+    for (int s = 0; s < shard_count; s++)
+    {
+        report_shard *shard = &pipeline->shards[s];
+        shard->started = pthread_create(&shard->thread, NULL, report_shard_ingest, shard) == 0;
+        shards_started += shard->started;
+    }
+    if (shards_started > 0)
+        pipeline->started |= PIPELINE_STARTED_INGEST;
+    if (pthread_create(&pipeline->output_thread, NULL, report_pipeline_output, pipeline) == 0)
+        pipeline->started |= PIPELINE_STARTED_OUTPUT;
+    pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
+    if ((shards_started != shard_count) || !(pipeline->started & PIPELINE_STARTED_OUTPUT))
+    {
+        report_pipeline_stop(pipeline);
+        return -1;
+    }
+    return 0;
+}
+
+void report_pipeline_collect(report_pipeline *pipeline)
+{
+    for (int s = 0; s < pipeline->shard_count; s++)
+    {
+        report_change_ring *ring = &pipeline->shards[s].changes;
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        for (; tail != head; tail++)
+        {
+            int channel = ring->channels[tail & ring->mask];
+            // The exchange reads the flag set after the value, and a later value queues the channel again
+            atomic_exchange(&pipeline->queued[channel], 0);
+            report_value value;
+            unsigned sequence = report_mailbox_read(&pipeline->mailboxes[channel], &value);
+            if (sequence == pipeline->seen[channel])
+                continue;
+            pipeline->seen[channel] = sequence;
+            channel_state *state = &pipeline->values.states[channel];
+            memcpy(state->value, value.value, value.length + 1);
+            state->value_length = value.length;
+            state->value_ns = value.receive_ns;
+            // A channel moved between the shards may be queued in two rings
+            if (!pipeline->collected[channel])
+            {
+                pipeline->collected[channel] = 1;
+                pipeline->changed[pipeline->changed_count++] = channel;
+                // The samples of a channel are aggregated before its value is published
+                if (pipeline->options->aggregates != NULL)
+                    aggregate_take(pipeline->options->aggregates, channel);
+            }
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+}
+
+void report_pipeline_reset(report_pipeline *pipeline)
+{
+    for (int k = 0; k < pipeline->changed_count; k++)
+    {
+        int channel = pipeline->changed[k];
+        channel_set_value(&pipeline->values.states[channel], CHANNEL_EMPTY_VALUE);
+        pipeline->collected[channel] = 0;
+    }
+    pipeline->changed_count = 0;
+}
+
+// Merge a delta into the held report, a channel keeps one entry with the newest value and the merged aggregates
+static void report_pipeline_hold(report_pipeline *pipeline, const report_entry *entries, int count)
+{
+    for (int k = 0; k < count; k++)
+    {
+        int index = pipeline->pending_index[entries[k].channel];
+        if (index < 0)
+        {
+            index = pipeline->pending_count++;
+            pipeline->pending_index[entries[k].channel] = index;
+            if (pipeline->pending_aggregates != NULL)
+                aggregate_reset(&pipeline->pending_aggregates[index]);
+        }
+        pipeline->pending[index] = entries[k];
+        if (pipeline->pending_aggregates != NULL)
+            aggregate_merge(&pipeline->pending_aggregates[index], &pipeline->entry_aggregates[k]);
+    }
+    pipeline->pending_set = 1;
+}
+
+static void report_pipeline_release(report_pipeline *pipeline)
+{
+    for (int k = 0; k < pipeline->pending_count; k++)
+        pipeline->pending_index[pipeline->pending[k].channel] = -1;
+    pipeline->pending_count = 0;
+    pipeline->pending_set = 0;
+}
+
+int report_pipeline_push(report_pipeline *pipeline, long long timestamp_ns)
+{
+    int count = pipeline->changed_count;
+    report_entry *entries = pipeline->entries;
+    for (int k = 0; k < count; k++)
+    {
+        int channel = pipeline->changed[k];
+        const channel_state *state = &pipeline->values.states[channel];
+        entries[k].channel = channel;
+        entries[k].value.length = state->value_length;
+        entries[k].value.receive_ns = state->value_ns;
+        memcpy(entries[k].value.value, state->value, state->value_length + 1);
+        if (pipeline->entry_aggregates != NULL)
+            pipeline->entry_aggregates[k] = pipeline->options->aggregates->taken[channel];
+    }
+
+    // A held report is queued first, or coalesced with this one, keeping the newest values
+    if (pipeline->pending_set)
+    {
+        if (report_queue_push(&pipeline->queue, pipeline->pending_timestamp, pipeline->pending, pipeline->pending_aggregates, pipeline->pending_count) < 0)
+        {
+            report_pipeline_hold(pipeline, entries, count);
+            pipeline->pending_timestamp = timestamp_ns;
+            pipeline->coalesced++;
+            return -1;
+        }
+        report_pipeline_release(pipeline);
+        pipeline->signal_pending = 1;
+    }
+    if (report_queue_push(&pipeline->queue, timestamp_ns, entries, pipeline->entry_aggregates, count) == 0)
+    {
+        pipeline->signal_pending = 1;
+        return 0;
+    }
+    report_pipeline_hold(pipeline, entries, count);
+    pipeline->pending_timestamp = timestamp_ns;
+    return -1;
+}
+
+void report_pipeline_retry(report_pipeline *pipeline)
+{
+    uint64_t signaled;
+    read(pipeline->queue.space_fd, &signaled, sizeof(signaled));
+    if (pipeline->pending_set && (report_queue_push(&pipeline->queue, pipeline->pending_timestamp, pipeline->pending, pipeline->pending_aggregates, pipeline->pending_count) == 0))
+    {
+        report_pipeline_release(pipeline);
+        report_queue_signal(&pipeline->queue);
+    }
+}
+
+void report_pipeline_signal(report_pipeline *pipeline)
+{
+    if (!pipeline->signal_pending)
+        return;
+    report_queue_signal(&pipeline->queue);
+    pipeline->signal_pending = 0;
+}
+
+void report_pipeline_stop(report_pipeline *pipeline)
+{
+    if (pipeline->started & PIPELINE_STARTED_INGEST)
+    {
+        // The stop eventfd stays signaled, waking every shard
+        uint64_t stop = 1;
+        write(pipeline->stop_fd, &stop, sizeof(stop));
+        for (int s = 0; s < pipeline->shard_count; s++)
+        {
+            if (pipeline->shards[s].started)
+                pthread_join(pipeline->shards[s].thread, NULL);
+            pipeline->shards[s].started = 0;
+        }
+    }
+    if (pipeline->started & PIPELINE_STARTED_OUTPUT)
+    {
+        // The held report is not dropped, the output thread frees a slot
+        while (pipeline->pending_set && (report_queue_push(&pipeline->queue, pipeline->pending_timestamp, pipeline->pending, pipeline->pending_aggregates, pipeline->pending_count) < 0))
+            usleep(PIPELINE_PENDING_WAIT_US);
+        if (pipeline->pending_set)
+            report_pipeline_release(pipeline);
+        atomic_store(&pipeline->stopping, 1);
+        report_queue_signal(&pipeline->queue);
+        pthread_join(pipeline->output_thread, NULL);
+    }
+    pipeline->started = 0;
+
+    for (int s = 0; s < pipeline->shard_count; s++)
+        report_shard_free(&pipeline->shards[s]);
+    if (pipeline->stop_fd >= 0)
+        close(pipeline->stop_fd);
+    pipeline->stop_fd = -1;
+    report_queue_free(&pipeline->queue);
+    free(pipeline->values.states);
+    free(pipeline->output.states);
+    free(pipeline->shards);
+    free(pipeline->mailboxes);
+    free((void *)pipeline->queued);
+    free(pipeline->channel_events);
+    free(pipeline->seen);
+    free(pipeline->collected);
+    free(pipeline->changed);
+    free(pipeline->entries);
+    free(pipeline->entry_aggregates);
+    free(pipeline->report_buffer);
+    pipeline->values.states = NULL;
+    pipeline->output.states = NULL;
+    pipeline->shards = NULL;
+    pipeline->shard_count = 0;
+    pipeline->mailboxes = NULL;
+    pipeline->queued = NULL;
+    pipeline->channel_events = NULL;
+    pipeline->seen = NULL;
+    pipeline->collected = NULL;
+    pipeline->changed = NULL;
+    pipeline->entries = NULL;
+    pipeline->entry_aggregates = NULL;
+    pipeline->received_aggregates = NULL;
+    pipeline->pending_aggregates = NULL;
+    pipeline->output_aggregates = NULL;
+    pipeline->report_buffer = NULL;
+}
@@ -0,0 +1,294 @@
+/**
+ * @file pipeline.h
+ * @brief Header file for the multi-threaded report pipeline.
+ *
+ * The pipeline is an opt-in alternative to the single report loop. Ingest shards,
+ * threads optionally pinned to cores, each own a subset of the channel sockets and
+ * publish the last value of each channel to a mailbox, and the channel index to a
+ * change ring of the shard. The report loop becomes the aggregator, which takes the
+ * changed values of all the shards on the tick, merging them into one report of the
+ * tick timestamp, evaluates the control rules and queues the report as a delta of the
+ * changed channels. An output thread formats and writes the reports. The stages are
+ * connected by lock-free seqlock mailboxes, change rings and a bounded snapshot queue,
+ * so a blocked output never delays the socket reading or the control messages, and the
+ * aggregator work of a tick follows the changed channels, not the channel count.
+ *
+ * The shards measure their busy time in windows of PIPELINE_STEAL_WINDOW_MS. A shard
+ * less loaded than the busiest one by PIPELINE_STEAL_RATIO asks it for channels, and
+ * the busy shard hands over its most active channels between two event batches.
+ */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "channel.h"
+#include "binary_report.h"
+#include "sink.h"
+#include "aggregate.h"
+
+#define REPORT_QUEUE_CAPACITY 64
+#define REPORT_OVERFLOW_DROP_OLDEST 0 // a full queue drops its oldest report
+#define REPORT_OVERFLOW_BLOCK 1       // a full queue holds the report until the output frees a slot
+#define PIPELINE_CACHE_LINE 64
+#define PIPELINE_STARTED_INGEST 1
+#define PIPELINE_STARTED_OUTPUT 2
+#define PIPELINE_SHARDS_MAX 64
+#define PIPELINE_STEAL_WINDOW_MS 100  // shard load measurement window
+#define PIPELINE_STEAL_MIN_NS 1000000 // busy time of a window before a shard hands over channels
+#define PIPELINE_STEAL_RATIO 2        // load of the busiest shard over the load of a stealing shard
+
+struct report_options;
+
+// Channel value of a mailbox or a report entry
+typedef struct
+{
+    int length;
+    char value[CHANNEL_VALUE_SIZE];
+    long long receive_ns; // kernel receive time of the value, 0 if unknown
+} report_value;
+
+// Changed channel of a report delta
+typedef struct
+{
+    int channel;
+    report_value value;
+} report_entry;
+
+// Last value of a channel, written by the owning shard, the sequence odd while writing
+typedef struct
+{
+    _Alignas(PIPELINE_CACHE_LINE) atomic_uint sequence;
+    report_value value;
+} report_mailbox;
+
+// Channels published by a shard since the last collect, single producer single consumer.
+// A channel is queued once until collected, so the capacity of the channel count suffices.
+typedef struct
+{
+    _Alignas(PIPELINE_CACHE_LINE) atomic_size_t head; // next write, owned by the shard
+    _Alignas(PIPELINE_CACHE_LINE) atomic_size_t tail; // next read, owned by the aggregator
+    _Alignas(PIPELINE_CACHE_LINE) size_t mask;
+    int *channels;
+} report_change_ring;
+
+struct report_pipeline;
+
+// Ingest shard, a thread reading the sockets of a subset of the channels
+typedef struct
+{
+    struct report_pipeline *pipeline;
+    int index;
+    int cpu;                // pinned CPU, or RT_CPU_NONE
+    int epoll_fd;
+    int wake_fd;            // eventfd signaled on a steal request or a channel handover
+    pthread_t thread;
+    int started;
+    int *channels;          // owned channel indices, changed only by the shard thread
+    int channel_count;
+    pthread_mutex_t handover_lock;
+    int *handover;          // channels handed over by another shard, guarded by the lock
+    int handover_count;
+    atomic_int thief;       // index + 1 of a shard requesting channels, or 0
+    atomic_llong load_ns;   // busy time of the last window
+    report_change_ring changes;
+} report_shard;
+
+// Bounded single-producer single-consumer queue of report deltas
+typedef struct
+{
+    _Alignas(PIPELINE_CACHE_LINE) atomic_size_t head; // next write, owned by the producer
+    _Alignas(PIPELINE_CACHE_LINE) atomic_size_t tail; // next read, advanced by the consumer and a dropping producer
+    _Alignas(PIPELINE_CACHE_LINE) size_t capacity;
+    int channel_count; // entry capacity of a slot
+    int policy;        // REPORT_OVERFLOW_DROP_OLDEST or REPORT_OVERFLOW_BLOCK
+    int aggregates;    // a slot carries an aggregate for each entry
+    size_t slot_size;
+    unsigned char *slots;
+    atomic_int waiting; // the producer waits for a free slot
+    int data_fd;        // eventfd signaled by the producer after the pushes
+    int space_fd;       // eventfd signaled on a pop when the producer waits
+    atomic_ullong dropped;
+} report_queue;
+
+// Pipeline of a report loop, the ingest shards and the output thread with the values between them
+typedef struct report_pipeline
+{
+    const struct report_options *options;
+    channel_table *channels; // sockets and read state, each channel owned by one shard
+    channel_table values;    // aggregator values, sharing the channel configurations
+    channel_table output;    // output values, sharing the channel configurations
+    report_mailbox *mailboxes;
+    atomic_uchar *queued;    // channel queued in a change ring and not yet collected
+    unsigned *channel_events; // decaying event count of each channel, written by the owning shard
+    unsigned *seen;          // aggregator last seen mailbox sequences
+    unsigned char *collected; // channel changed in the aggregator values of the tick
+    int *changed;            // channels changed in the aggregator values of the tick
+    int changed_count;
+    report_shard *shards;
+    int shard_count;
+    report_queue queue;
+    report_sink *sink;
+    binary_report_writer *binary_writer;
+    size_t report_size;
+    char *report_buffer;
+    int stop_fd;             // eventfd polled by all the shards, left signaled to stop them
+    atomic_int stopping;
+    pthread_t output_thread;
+    int started;             // PIPELINE_STARTED_INGEST and PIPELINE_STARTED_OUTPUT
+    report_entry *entries;   // aggregator delta of the tick
+    report_entry *received;  // output delta, popped from the queue
+    int *output_changed;     // channels set in the output values by the last delta
+    int output_changed_count;
+    channel_aggregate *entry_aggregates;  // aggregates of the entries, the received and the held ones, or NULL
+    channel_aggregate *received_aggregates;
+    channel_aggregate *pending_aggregates;
+    channel_aggregate *output_aggregates; // output aggregates indexed by the channel, or NULL
+    report_entry *pending;   // report held by the block policy while the queue is full
+    int *pending_index;      // entry of each channel in the held report, or -1
+    int pending_count;
+    long long pending_timestamp;
+    int pending_set;
+    unsigned long long coalesced; // held reports replaced by a later tick
+    int signal_pending;      // reports queued since the output thread was last signaled
+} report_pipeline;
+
+/**
+ * Initializes a report queue.
+ *
+ * @param queue The report queue.
+ * @param capacity The report capacity, a power of two.
+ * @param channel_count The channel count, the largest delta.
+ * @param aggregates Nonzero to carry an aggregate with each entry.
+ * @param policy The overflow policy, REPORT_OVERFLOW_DROP_OLDEST or REPORT_OVERFLOW_BLOCK.
+ * @return 0 on success, or -1 on error.
+ */
+int report_queue_init(report_queue *queue, size_t capacity, int channel_count, int aggregates, int policy);
+
+/**
+ * Pushes a report delta, called by the producer, without waking the consumer. With
+ * REPORT_OVERFLOW_DROP_OLDEST a full queue drops the oldest report, and with
+ * REPORT_OVERFLOW_BLOCK the push fails and the space_fd is signaled when the consumer
+ * frees a slot.
+ *
+ * @param queue The report queue.
+ * @param timestamp The report timestamp, in epoch nanoseconds from the pipeline.
+ * @param entries The changed channels of the report, the other channels are "--".
+ * @param aggregates The aggregates of the entries, or NULL for a queue without aggregates.
+ * @param count The entry count, at most the channel count of the queue.
+ * @return 0 on success, or -1 if the queue is full with REPORT_OVERFLOW_BLOCK.
+ */
+int report_queue_push(report_queue *queue, long long timestamp, const report_entry *entries,
+                      const channel_aggregate *aggregates, int count);
+
+/**
+ * Wakes the consumer waiting on the data_fd for the pushed reports.
+ *
+ * @param queue The report queue.
+ */
+void report_queue_signal(report_queue *queue);
+
+/**
+ * Pops the oldest report delta, called by the consumer.
+ *
+ * @param queue The report queue.
+ * @param timestamp The report timestamp, in epoch nanoseconds from the pipeline.
+ * @param entries The changed channels of the report, an array of the channel count.
+ * @param aggregates The aggregates of the entries, an array of the channel count, or NULL.
+ * @param count The entry count.
+ * @return 1 if a report was popped, or 0 if the queue is empty.
+ */
+int report_queue_pop(report_queue *queue, long long *timestamp, report_entry *entries, channel_aggregate *aggregates, int *count);
+
+/**
+ * Releases a report queue.
+ *
+ * @param queue The report queue.
+ */
+void report_queue_free(report_queue *queue);
+
+/**
+ * Writes the value of a mailbox, called by the single writer.
+ *
+ * @param mailbox The mailbox.
+ * @param value The null-terminated value.
+ * @param length The value length, less than CHANNEL_VALUE_SIZE.
+ * @param receive_ns The kernel receive time of the value, or 0 if unknown.
+ */
+void report_mailbox_write(report_mailbox *mailbox, const char *value, int length, long long receive_ns);
+
+/**
+ * Reads the value of a mailbox.
+ *
+ * @param mailbox The mailbox.
+ * @param value The value read.
+ * @return The sequence of the value, changing on each write.
+ */
+unsigned report_mailbox_read(report_mailbox *mailbox, report_value *value);
+
+/**
+ * Starts the ingest shards reading the channel sockets, the channels assigned round-robin,
+ * and the output thread writing the reports to the sink, in the format of the options.
+ *
+ * @param pipeline The pipeline.
+ * @param sink The initialized report sink, written by the output thread until stopped.
+ * @param options The report options with the queue capacity, the overflow policy and the shards.
+ * @param channels The connected channel table, read by the ingest shards until stopped.
+ * @param binary_writer The initialized binary report writer of the binary format.
+ * @return 0 on success, or -1 on error.
+ */
+int report_pipeline_start(report_pipeline *pipeline, report_sink *sink, const struct report_options *options,
+                          channel_table *channels, binary_report_writer *binary_writer);
+
+/**
+ * Takes the values published by the shards since the previous call into the aggregator
+ * values, visiting only the changed channels, and takes the aggregates of the changed channels.
+ *
+ * @param pipeline The pipeline.
+ */
+void report_pipeline_collect(report_pipeline *pipeline);
+
+/**
+ * Resets the changed aggregator values to "--" after the tick.
+ *
+ * @param pipeline The pipeline.
+ */
+void report_pipeline_reset(report_pipeline *pipeline);
+
+/**
+ * Queues a report of the changed aggregator values to the output thread. With the block policy
+ * and a full queue, the report is held until report_pipeline_retry, replacing a report
+ * held from an earlier tick.
+ *
+ * @param pipeline The pipeline.
+ * @param timestamp_ns The report timestamp in epoch nanoseconds.
+ * @return 0 if queued, or -1 if held.
+ */
+int report_pipeline_push(report_pipeline *pipeline, long long timestamp_ns);
+
+/**
+ * Queues the held report when the space_fd of the queue is signaled.
+ *
+ * @param pipeline The pipeline.
+ */
+void report_pipeline_retry(report_pipeline *pipeline);
+
+/**
+ * Wakes the output thread for the reports queued by report_pipeline_push, called at
+ * the end of the tick, so the output thread does not preempt the control on a shared CPU.
+ *
+ * @param pipeline The pipeline.
+ */
+void report_pipeline_signal(report_pipeline *pipeline);
+
+/**
+ * Stops the ingest shards, lets the output thread write the queued reports, and
+ * releases the pipeline.
+ *
+ * @param pipeline The pipeline.
+ */
+void report_pipeline_stop(report_pipeline *pipeline);
+
+#endif // PIPELINE_H
@@ -4,50 +4,447 @@
  */
 #include "protocol.h"
 
-// Control message 1 Hz frequency
-control_message ctrl_msg_o3h_f1hz = {CONTROL_OPERATION_WRITE,
-                                     CONTROL_OBJECT_OUT1,
-                                     CONTROL_OBJECT_OUT1_PROPERTY_FREQUENCY_INDEX,
-                                     CONTROL_OBJECT_OUT1_PROPERTY_FREQUENCY_1_HZ};
-
-// Control message 8000 amplitude
-control_message ctrl_msg_o3h_a8k = {CONTROL_OPERATION_WRITE,
-                                    CONTROL_OBJECT_OUT1,
-                                    CONTROL_OBJECT_OUT1_PROPERTY_AMPLITUDE_INDEX,
-                                    CONTROL_OBJECT_OUT1_PROPERTY_AMPLITUDE_8000};
+// Global variable for report timestamp
+long long report_timestamp;
+long long report_timestamp_ns;
 
-// Control message 2 Hz frequency
-control_message ctrl_msg_o3l_f2hz = {CONTROL_OPERATION_WRITE,
-                                     CONTROL_OBJECT_OUT1,
-                                     CONTROL_OBJECT_OUT1_PROPERTY_FREQUENCY_INDEX,
-                                     CONTROL_OBJECT_OUT1_PROPERTY_FREQUENCY_2_HZ};
+void report_options_init(report_options *options, int interval_ms, int control_enable)
+{
+    options->interval_ns = interval_ms * 1000000LL;
+    options->control_enable = control_enable;
+    options->count = REPORT_COUNT_UNLIMITED;
+    options->format = REPORT_FORMAT_JSON;
+    options->channels = CHANNELS_DEFAULT;
+    options->channels_file = NULL;
+    options->capture_file = NULL;
+    options->capture_capacity = CAPTURE_RING_CAPACITY;
+    options->capture = NULL;
+    options->rt_enable = 0;
+    options->rt_priority = RT_PRIORITY_NONE;
+    options->rt_cpu = RT_CPU_NONE;
+    options->stats_file = NULL;
+    options->stats_socket = NULL;
+    options->stats = NULL;
+    options->control_rules_file = NULL;
+    options->control_rules = NULL;
+    options->pipeline_enable = 0;
+    options->queue_capacity = REPORT_QUEUE_CAPACITY;
+    options->overflow_policy = REPORT_OVERFLOW_DROP_OLDEST;
+    report_sink_config_init(&options->sink);
+    options->shm_name = NULL;
+    options->shard_count = 1;
+    options->shard_cpu = RT_CPU_NONE;
+    options->aggregates_enable = 0;
+    options->aggregates = NULL;
+    options->control_latency_enable = 0;
+    options->control_latency = NULL;
+    options->control_arrival_enable = 0;
+    options->control_arrival = NULL;
+    options->timestamp_ns_enable = 0;
+    options->receive_timestamps_enable = 0;
+    options->archive_file = NULL;
+    options->archive = NULL;
+    options->archive_directory = NULL;
+    options->segment_bytes = ARCHIVE_SEGMENT_BYTES;
+    options->segment_seconds = ARCHIVE_SEGMENT_SECONDS;
+    options->segment_retention = ARCHIVE_SEGMENT_RETENTION;
+    options->archive_segments = NULL;
+}
 
-// Control message 4000 amplitude
-control_message ctrl_msg_o3l_a4k = {CONTROL_OPERATION_WRITE,
-                                    CONTROL_OBJECT_OUT1,
-                                    CONTROL_OBJECT_OUT1_PROPERTY_AMPLITUDE_INDEX,
-                                    CONTROL_OBJECT_OUT1_PROPERTY_AMPLITUDE_4000};
+void print_report_usage(FILE *file, const char *program)
+{
+    fprintf(file, "Usage: %s [options]\n"
+                  "  -c, --channels LIST      channel list of host:port/name entries, default %s\n"
+                  "  -f, --channels-file PATH file with a channel list\n"
+                  "  -i, --interval TIME      report interval, milliseconds or with a ns, us, ms or s suffix, e.g. 500us\n"
+                  "  -n, --count N            report count, -1 for unlimited\n"
+                  "  -o, --format FORMAT      report output format, json or binary\n"
+                  "  -C, --capture PATH       capture every sample of every channel to a file\n"
+                  "      --capture-capacity N capture ring capacity in samples per channel\n"
+                  "      --archive PATH       write the reports to a compressed archive file\n"
+                  "      --archive-dir PATH   write the reports to time-indexed archive segments in a directory\n"
+                  "      --segment-size N     rotate the archive segments at N bytes, default %lld\n"
+                  "      --segment-seconds N  rotate the archive segments after N seconds, default %d\n"
+                  "      --segment-retention N keep the N newest archive segments, default %d\n"
+                  "      --timestamp-ns       epoch nanosecond \"timestamp_ns\" after the millisecond timestamp\n"
+                  "      --receive-timestamps kernel receive time of the values, reported as their \"age_us\"\n"
+                  "      --aggregates         count, min, max, mean, RMS and frequency of every sample per interval\n"
+                  "      --rt                 real-time tick thread aligned to the interval, locked memory\n"
+                  "      --rt-priority N      SCHED_FIFO priority 1..99 of the report, implies --rt\n"
+                  "      --rt-cpu N           CPU of the report threads, implies --rt\n"
+                  "      --stats-file PATH    write the latency and channel statistics to a file on SIGUSR1\n"
+                  "      --stats-socket PATH  serve the statistics on a Unix socket\n"
+                  "      --control-rules PATH file with control rules, default \"%s\"\n"
+                  "      --control-latency    edge, send and effect latency of each control rule on exit and in the stats\n"
+                  "      --control-on-arrival evaluate the control rules on each source sample instead of the report tick\n"
+                  "      --pipeline           ingest and output threads around the report loop\n"
+                  "      --queue-capacity N   pipeline report queue capacity, implies --pipeline\n"
+                  "      --overflow POLICY    full queue policy, drop-oldest or block, implies --pipeline\n"
+                  "      --shards N           pipeline ingest threads sharing the channels, implies --pipeline\n"
+                  "      --shard-cpu N        pin the ingest threads to the CPUs from N, implies --pipeline\n"
+                  "      --sink MODE          report output, stdio, buffered or direct to the file descriptor\n"
+                  "      --flush-bytes N      flush the buffered reports at N bytes, implies --sink buffered\n"
+                  "      --flush-count N      flush the buffered reports at N reports, implies --sink buffered\n"
+                  "      --flush-age MS       flush the buffered reports at MS milliseconds, implies --sink buffered\n"
+                  "      --fsync POLICY       sync a report file, none, flush or close\n"
+                  "      --shm NAME           publish the latest report to a shared-memory segment, e.g. %s\n",
+            program, CHANNELS_DEFAULT, ARCHIVE_SEGMENT_BYTES, ARCHIVE_SEGMENT_SECONDS, ARCHIVE_SEGMENT_RETENTION,
+            CONTROL_RULES_DEFAULT, SHM_REPORT_NAME_DEFAULT);
+}
 
+// A flush limit applies to the sink buffer, the stdio mode is switched to buffered
+static void report_sink_buffered(report_sink_config *config)
+{
+    if (config->mode == REPORT_SINK_STDIO)
+        config->mode = REPORT_SINK_BUFFERED;
+}
 
-// Global variable for reporting SIGINT
-volatile int report_running = 1;
+// Parse a whole decimal option value within a range, returns 0 on success
+static int parse_option_number(const char *text, long long min, long long max, long long *value)
+{
+    char *end;
+    errno = 0;
+    *value = strtoll(text, &end, 10);
+    return ((end == text) || (*end != '\0') || (errno != 0) || (*value < min) || (*value > max)) ? -1 : 0;
+}
 
-// Global variable for timer signal
-volatile int timer_triggered = 0;
+int parse_report_options(int argc, char *argv[], report_options *options)
+{
+    static const struct option long_options[] = {
+        {"channels", required_argument, NULL, 'c'},
+        {"channels-file", required_argument, NULL, 'f'},
+        {"interval", required_argument, NULL, 'i'},
+        {"count", required_argument, NULL, 'n'},
+        {"format", required_argument, NULL, 'o'},
+        {"capture", required_argument, NULL, 'C'},
+        {"capture-capacity", required_argument, NULL, REPORT_OPTION_CAPTURE_CAPACITY},
+        {"archive", required_argument, NULL, REPORT_OPTION_ARCHIVE},
+        {"archive-dir", required_argument, NULL, REPORT_OPTION_ARCHIVE_DIR},
+        {"segment-size", required_argument, NULL, REPORT_OPTION_SEGMENT_SIZE},
+        {"segment-seconds", required_argument, NULL, REPORT_OPTION_SEGMENT_SECONDS},
+        {"segment-retention", required_argument, NULL, REPORT_OPTION_SEGMENT_RETENTION},
+        {"timestamp-ns", no_argument, NULL, REPORT_OPTION_TIMESTAMP_NS},
+        {"receive-timestamps", no_argument, NULL, REPORT_OPTION_RECEIVE_TIMESTAMPS},
+        {"aggregates", no_argument, NULL, REPORT_OPTION_AGGREGATES},
+        {"rt", no_argument, NULL, REPORT_OPTION_RT},
+        {"rt-priority", required_argument, NULL, REPORT_OPTION_RT_PRIORITY},
+        {"rt-cpu", required_argument, NULL, REPORT_OPTION_RT_CPU},
+        {"stats-file", required_argument, NULL, REPORT_OPTION_STATS_FILE},
+        {"stats-socket", required_argument, NULL, REPORT_OPTION_STATS_SOCKET},
+        {"control-rules", required_argument, NULL, REPORT_OPTION_CONTROL_RULES},
+        {"control-latency", no_argument, NULL, REPORT_OPTION_CONTROL_LATENCY},
+        {"control-on-arrival", no_argument, NULL, REPORT_OPTION_CONTROL_ARRIVAL},
+        {"pipeline", no_argument, NULL, REPORT_OPTION_PIPELINE},
+        {"queue-capacity", required_argument, NULL, REPORT_OPTION_QUEUE_CAPACITY},
+        {"overflow", required_argument, NULL, REPORT_OPTION_OVERFLOW},
+        {"sink", required_argument, NULL, REPORT_OPTION_SINK},
+        {"flush-bytes", required_argument, NULL, REPORT_OPTION_FLUSH_BYTES},
+        {"flush-count", required_argument, NULL, REPORT_OPTION_FLUSH_COUNT},
+        {"flush-age", required_argument, NULL, REPORT_OPTION_FLUSH_AGE},
+        {"fsync", required_argument, NULL, REPORT_OPTION_FSYNC},
+        {"shm", required_argument, NULL, REPORT_OPTION_SHM},
+        {"shards", required_argument, NULL, REPORT_OPTION_SHARDS},
+        {"shard-cpu", required_argument, NULL, REPORT_OPTION_SHARD_CPU},
+        {NULL, 0, NULL, 0}};
+    int option;
+    long long value;
 
-// Global variable for report timestamp
-long long report_timestamp;
+    optind = 1;
+    while ((option = getopt_long(argc, argv, "c:f:i:n:o:C:", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'c':
+            options->channels = optarg;
+            break;
+        case 'f':
+            options->channels_file = optarg;
+            break;
+        case 'i':
+            options->interval_ns = parse_report_interval(optarg);
+            if (options->interval_ns <= 0)
+                return -1;
+            break;
+        case 'n':
+            if ((parse_option_number(optarg, REPORT_COUNT_UNLIMITED, INT_MAX, &value) < 0) || (value == 0))
+                return -1;
+            options->count = (int)value;
+            break;
+        case 'o':
+            if (strcmp(optarg, "json") == 0)
+                options->format = REPORT_FORMAT_JSON;
+            else if (strcmp(optarg, "binary") == 0)
+                options->format = REPORT_FORMAT_BINARY;
+            else
+                return -1;
+            break;
+        case 'C':
+            options->capture_file = optarg;
+            break;
+        case REPORT_OPTION_CAPTURE_CAPACITY:
+            if (parse_option_number(optarg, 1, INT_MAX, &value) < 0)
+                return -1;
+            options->capture_capacity = (int)value;
+            break;
+        case REPORT_OPTION_ARCHIVE:
+            options->archive_file = optarg;
+            break;
+        case REPORT_OPTION_ARCHIVE_DIR:
+            options->archive_directory = optarg;
+            break;
+        case REPORT_OPTION_SEGMENT_SIZE:
+            if (parse_option_number(optarg, 1, LLONG_MAX, &value) < 0)
+                return -1;
+            options->segment_bytes = value;
+            break;
+        case REPORT_OPTION_SEGMENT_SECONDS:
+            if (parse_option_number(optarg, 1, INT_MAX, &value) < 0)
+                return -1;
+            options->segment_seconds = (int)value;
+            break;
+        case REPORT_OPTION_SEGMENT_RETENTION:
+            if (parse_option_number(optarg, 1, INT_MAX, &value) < 0)
+                return -1;
+            options->segment_retention = (int)value;
+            break;
+        case REPORT_OPTION_TIMESTAMP_NS:
+            options->timestamp_ns_enable = 1;
+            break;
+        case REPORT_OPTION_RECEIVE_TIMESTAMPS:
+            options->receive_timestamps_enable = 1;
+            break;
+        case REPORT_OPTION_AGGREGATES:
+            options->aggregates_enable = 1;
+            break;
+        case REPORT_OPTION_RT:
+            options->rt_enable = 1;
+            break;
+        case REPORT_OPTION_RT_PRIORITY:
+            options->rt_enable = 1;
+            if (parse_option_number(optarg, sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO), &value) < 0)
+                return -1;
+            options->rt_priority = (int)value;
+            break;
+        case REPORT_OPTION_RT_CPU:
+            options->rt_enable = 1;
+            if (parse_option_number(optarg, 0, CPU_SETSIZE - 1, &value) < 0)
+                return -1;
+            options->rt_cpu = (int)value;
+            break;
+        case REPORT_OPTION_STATS_FILE:
+            options->stats_file = optarg;
+            break;
+        case REPORT_OPTION_STATS_SOCKET:
+            options->stats_socket = optarg;
+            break;
+        case REPORT_OPTION_CONTROL_RULES:
+            options->control_rules_file = optarg;
+            break;
+        case REPORT_OPTION_CONTROL_LATENCY:
+            options->control_latency_enable = 1;
+            break;
+        case REPORT_OPTION_CONTROL_ARRIVAL:
+            options->control_arrival_enable = 1;
+            break;
+        case REPORT_OPTION_PIPELINE:
+            options->pipeline_enable = 1;
+            break;
+        case REPORT_OPTION_QUEUE_CAPACITY:
+            options->pipeline_enable = 1;
+            if (parse_option_number(optarg, 1, INT_MAX, &value) < 0)
+                return -1;
+            options->queue_capacity = (int)value;
+            break;
+        case REPORT_OPTION_OVERFLOW:
+            options->pipeline_enable = 1;
+            if (strcmp(optarg, "drop-oldest") == 0)
+                options->overflow_policy = REPORT_OVERFLOW_DROP_OLDEST;
+            else if (strcmp(optarg, "block") == 0)
+                options->overflow_policy = REPORT_OVERFLOW_BLOCK;
+            else
+                return -1;
+            break;
+        case REPORT_OPTION_SINK:
+            if (strcmp(optarg, "stdio") == 0)
+                options->sink.mode = REPORT_SINK_STDIO;
+            else if (strcmp(optarg, "buffered") == 0)
+                options->sink.mode = REPORT_SINK_BUFFERED;
+            else if (strcmp(optarg, "direct") == 0)
+                options->sink.mode = REPORT_SINK_DIRECT;
+            else
+                return -1;
+            break;
+        case REPORT_OPTION_FLUSH_BYTES:
+            if (parse_option_number(optarg, 1, INT_MAX, &value) < 0)
+                return -1;
+            options->sink.flush_bytes = (size_t)value;
+            if (options->sink.flush_bytes > options->sink.capacity)
+                options->sink.capacity = options->sink.flush_bytes;
+            report_sink_buffered(&options->sink);
+            break;
+        case REPORT_OPTION_FLUSH_COUNT:
+            if (parse_option_number(optarg, 1, INT_MAX, &value) < 0)
+                return -1;
+            options->sink.flush_count = (int)value;
+            report_sink_buffered(&options->sink);
+            break;
+        case REPORT_OPTION_FLUSH_AGE:
+            if (parse_option_number(optarg, 1, INT_MAX, &value) < 0)
+                return -1;
+            options->sink.flush_age_ms = (int)value;
+            report_sink_buffered(&options->sink);
+            break;
+        case REPORT_OPTION_FSYNC:
+            if (strcmp(optarg, "none") == 0)
+                options->sink.fsync_policy = REPORT_SINK_FSYNC_NONE;
+            else if (strcmp(optarg, "flush") == 0)
+                options->sink.fsync_policy = REPORT_SINK_FSYNC_FLUSH;
+            else if (strcmp(optarg, "close") == 0)
+                options->sink.fsync_policy = REPORT_SINK_FSYNC_CLOSE;
+            else
+                return -1;
+            break;
+        case REPORT_OPTION_SHM:
+            options->shm_name = optarg;
+            break;
+        case REPORT_OPTION_SHARDS:
+            options->pipeline_enable = 1;
+            if (parse_option_number(optarg, 1, PIPELINE_SHARDS_MAX, &value) < 0)
+                return -1;
+            options->shard_count = (int)value;
+            break;
+        case REPORT_OPTION_SHARD_CPU:
+            options->pipeline_enable = 1;
+            if (parse_option_number(optarg, 0, CPU_SETSIZE - 1, &value) < 0)
+                return -1;
+            options->shard_cpu = (int)value;
+            break;
+        default:
+            return -1;
+        }
+    }
+    return (optind == argc) ? 0 : -1;
+}
 
 int report_stdout(int interval_ms, int control_enable)
+{
+    report_options options;
+    report_options_init(&options, interval_ms, control_enable);
+    return report_stdout_options(&options);
+}
+
+int report_stdout_options(const report_options *options)
 {
     // Setup TCP sockets
-    int sockfd_out1 = connect_to_tcp_port(TCP_PORT_OUT1);
-    int sockfd_out2 = connect_to_tcp_port(TCP_PORT_OUT2);
-    int sockfd_out3 = connect_to_tcp_port(TCP_PORT_OUT3);
+    channel_table channels;
+    int result = options->channels_file ? channel_table_load(&channels, options->channels_file)
+                                        : channel_table_init(&channels, options->channels);
+    if (result < 0)
+        return -1;
+
+    // The steps set in run_options are released by the unwind, the files declared before its first jump
+    report_options run_options = *options;
+    result = -1; // on a setup error, until the report runs
+    capture sample_capture;
+    FILE *capture_file = NULL;
+    archive_writer archive;
+    FILE *archive_file = NULL;
+
+    // Control rules compiled against the channel table
+    control_rule_table control_rules;
+    if (options->control_rules_file != NULL)
+    {
+        if (control_rule_table_load(&control_rules, options->control_rules_file, &channels) < 0)
+            goto unwind;
+        if (control_rules.skipped > 0)
+            fprintf(stderr, "control: %d rules of unknown channels skipped\n", control_rules.skipped);
+        run_options.control_rules = &control_rules;
+    }
+    else if ((options->control_latency_enable || options->control_arrival_enable) && (options->control_enable > 0))
+    {
+        // The latency and the arrival evaluation use the rule table of the report, the default rule is compiled here
+        if (control_rule_table_init(&control_rules, CONTROL_RULES_DEFAULT, &channels) == 0)
+            run_options.control_rules = &control_rules;
+    }
+
+    // Closed-loop latency of the control rules
+    control_latency latency;
+    if (options->control_latency_enable && (run_options.control_rules != NULL))
+    {
+        if (control_latency_init(&latency, &control_rules, &channels) < 0)
+            goto unwind;
+        run_options.control_latency = &latency;
+    }
+
+    // Per-interval aggregates of every sample
+    aggregate_table aggregates;
+    if (options->aggregates_enable)
+    {
+        if (aggregate_table_init(&aggregates, channels.count) < 0)
+            goto unwind;
+        run_options.aggregates = &aggregates;
+    }
+
+    // Full-sample capture to a file
+    if (options->capture_file != NULL)
+    {
+        capture_file = fopen(options->capture_file, "w");
+        if ((capture_file == NULL) || (capture_init(&sample_capture, &channels, options->capture_capacity) < 0))
+        {
+            if (capture_file != NULL)
+                fclose(capture_file);
+            goto unwind;
+        }
+        if (capture_start_file(&sample_capture, capture_file) < 0)
+        {
+            capture_free(&sample_capture);
+            fclose(capture_file);
+            goto unwind;
+        }
+        run_options.capture = &sample_capture;
+    }
+
+    // Compressed archive of the reports, timestamps in microseconds below a millisecond interval
+    long long archive_unit_ns = (options->interval_ns % ARCHIVE_UNIT_MS == 0) ? ARCHIVE_UNIT_MS : ARCHIVE_UNIT_US;
+    if (options->archive_file != NULL)
+    {
+        archive_file = fopen(options->archive_file, "wb");
+        if ((archive_file == NULL) || (archive_writer_init(&archive, archive_file, &channels, archive_unit_ns) < 0))
+        {
+            if (archive_file != NULL)
+                fclose(archive_file);
+            goto unwind;
+        }
+        run_options.archive = &archive;
+    }
+    archive_segments segments;
+    if (options->archive_directory != NULL)
+    {
+        if (archive_segments_init(&segments, options->archive_directory, archive_unit_ns, options->segment_bytes,
+                                  options->segment_seconds, options->segment_retention) < 0)
+            goto unwind;
+        run_options.archive_segments = &segments;
+    }
+
+    // Statistics dumped on SIGUSR1 or served on a Unix socket
+    report_stats stats;
+    if ((options->stats_file != NULL) || (options->stats_socket != NULL))
+    {
+        if ((report_stats_init(&stats, &channels) < 0) ||
+            (report_stats_start(&stats, options->stats_file, options->stats_socket) < 0))
+        {
+            report_stats_free(&stats);
+            goto unwind;
+        }
+        stats.control_latency = run_options.control_latency;
+        run_options.stats = &stats;
+    }
+    channels.receive_timestamps = options->receive_timestamps_enable;
+    channel_table_connect(&channels);
 
     // UDP Control enable
     udp_socket udp_control_socket;
-    if (control_enable > 0)
+    if (options->control_enable > 0)
     {
         udp_control_socket = open_udp_control_socket(CONTROL_UDP_PORT);
     }
@@ -55,20 +452,76 @@ int report_stdout(int interval_ms, int control_enable)
     {
         udp_control_socket.sockfd = -1;
     }
-    // report with 20 ms interval, terminate with SIGINT
-    int result = print_report(stdout, interval_ms, sockfd_out1, sockfd_out2, sockfd_out3, udp_control_socket, REPORT_COUNT_UNLIMITED);
+    // The rules of the source channels evaluated by the reads
+    control_arrival arrival = {run_options.control_rules, udp_control_socket, run_options.control_latency};
+    if (options->control_arrival_enable && (run_options.control_rules != NULL) && (udp_control_socket.sockfd > 0))
+        run_options.control_arrival = &arrival;
+    // report with the options interval, terminate with SIGINT
+    result = print_report(stdout, &run_options, &channels, udp_control_socket);
     // Close sockets
-    close_tcp_socket(sockfd_out1);
-    close_tcp_socket(sockfd_out2);
-    close_tcp_socket(sockfd_out3);
+    channel_table_close(&channels);
     close_udp_socket(udp_control_socket);
+    if (run_options.control_latency != NULL)
+        control_latency_write(&latency, stderr);
+
+// Released in the reverse order of the setup, only the steps set in run_options
+unwind:
+    if (run_options.stats != NULL)
+        report_stats_free(&stats);
+    if (run_options.archive_segments != NULL)
+        archive_segments_close(&segments);
+    if (run_options.archive != NULL)
+    {
+        // The rows of the last partial block are written on exit
+        archive_writer_flush(&archive);
+        archive_writer_free(&archive);
+        fclose(archive_file);
+    }
+    if (run_options.capture != NULL)
+    {
+        capture_free(&sample_capture);
+        fclose(capture_file);
+    }
+    if (run_options.aggregates != NULL)
+        aggregate_table_free(&aggregates);
+    if (run_options.control_latency != NULL)
+        control_latency_free(&latency);
+    if (run_options.control_rules != NULL)
+        control_rule_table_free(&control_rules);
+    channel_table_free(&channels);
     return result;
 }
 
 int connect_to_tcp_port(int port)
+{
+    return connect_to_tcp_host(CHANNEL_HOST_DEFAULT, port);
+}
+
+int resolve_tcp_host(const char *host, int port, struct sockaddr_in *address)
+{
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &address->sin_addr) != 1)
+    {
+        // Resolve a host name, only once at the connection setup
+        struct addrinfo hints, *addresses;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host, NULL, &hints, &addresses) != 0)
+        {
+            return -1;
+        }
+        address->sin_addr = ((struct sockaddr_in *)addresses->ai_addr)->sin_addr;
+        freeaddrinfo(addresses);
+    }
+    return 0;
+}
+
+int connect_to_tcp_address(const struct sockaddr_in *address)
 {
     int sockfd;
-    struct sockaddr_in serv_addr;
 
     if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
     {
@@ -76,10 +529,6 @@ int connect_to_tcp_port(int port)
         return -1;
     }
 
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(port);
-    serv_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-
     // Set socket to non-blocking mode
     int flags = fcntl(sockfd, F_GETFL, 0);
     if (flags < 0)
@@ -96,7 +545,7 @@ int connect_to_tcp_port(int port)
         return -1;
     }
 
-    if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    if (connect(sockfd, (const struct sockaddr *)address, sizeof(*address)) < 0)
     {
         if (errno != EINPROGRESS)
         {
@@ -109,60 +558,226 @@ int connect_to_tcp_port(int port)
     return sockfd;
 }
 
+int connect_to_tcp_host(const char *host, int port)
+{
+    struct sockaddr_in address;
+    if (resolve_tcp_host(host, port, &address) < 0)
+        return -1;
+    return connect_to_tcp_address(&address);
+}
+
 int read_tcp_last_line(int sockfd, char *buf, int bufsize)
 {
-    static char internal_buffer[PROTOCOL_BUFFER_SIZE];
-    ssize_t read_count = 0;
-    ssize_t bytes_received = 0;
-    // Default data when no data is received
-    buf[0] = '-';
-    buf[1] = '-';
-    buf[2] = '\0';
+    tcp_stream stream;
+    tcp_stream_init(&stream, sockfd);
+    return read_tcp_stream_last_line(&stream, buf, bufsize);
+}
+
+// Receive data, with the kernel receive time from the control message of the same call when enabled
+static ssize_t tcp_stream_recv(tcp_stream *stream, char *chunk, size_t size)
+{
+    if (!stream->timestamps)
+        return recv(stream->sockfd, chunk, size, 0);
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec iov = {.iov_base = chunk, .iov_len = size};
+    struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+    ssize_t read_count = recvmsg(stream->sockfd, &message, 0);
+    if (read_count <= 0)
+        return read_count;
+    for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header))
+    {
+        if ((header->cmsg_level == SOL_SOCKET) && (header->cmsg_type == SCM_TIMESTAMPNS))
+        {
+            struct timespec received;
+            memcpy(&received, CMSG_DATA(header), sizeof(received));
+            stream->receive_ns = received.tv_sec * 1000000000LL + received.tv_nsec;
+        }
+    }
+    return read_count;
+}
+
+// Discard the pending backlog up to the tail, returns -1 on a socket error
+static int tcp_stream_discard_to_tail(tcp_stream *stream, char *chunk)
+{
+    int pending = 0;
+    if ((ioctl(stream->sockfd, FIONREAD, &pending) < 0) || (pending <= TCP_STREAM_CHUNK_SIZE))
+        return 0;
 
-    // Read all data from the socket
-    while ((read_count = recv(sockfd, internal_buffer, PROTOCOL_BUFFER_SIZE - 1, 0)) > 0)
+    ssize_t discard = pending - TCP_STREAM_TAIL_SIZE;
+    // TCP discards with MSG_TRUNC without a copy, other stream sockets fail and are copied
+    ssize_t discarded = recv(stream->sockfd, NULL, discard, MSG_TRUNC);
+    if (discarded < 0)
     {
-        if (read_count > PROTOCOL_BUFFER_SIZE - 1)
+        if (errno != EFAULT)
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+        discarded = 0;
+        while (discarded < discard)
         {
-            // fprintf(stderr, "read count error");
-            return -1;
+            size_t size = discard - discarded < TCP_STREAM_CHUNK_SIZE ? discard - discarded : TCP_STREAM_CHUNK_SIZE;
+            ssize_t read_count = tcp_stream_recv(stream, chunk, size);
+            if (read_count <= 0)
+                break;
+            discarded += read_count;
         }
-        bytes_received = read_count;
-        internal_buffer[bytes_received] = '\0'; // Null-terminate the buffer
     }
-    if (read_count < 0 && errno != EWOULDBLOCK)
+    // The tail starts in the middle of a line
+    if (discarded > 0)
+    {
+        stream->bytes += discarded;
+        stream->partial_length = TCP_STREAM_SKIP_LINE;
+    }
+    return 0;
+}
+
+// Copy a line to the buffer, returns 1 if copied, or 0 if empty or not fitting
+static int tcp_stream_copy_line(char *buf, int bufsize, const char *head, size_t head_length, const char *line, size_t line_length)
+{
+    size_t length = head_length + line_length;
+    if ((length == 0) || (length >= (size_t)bufsize))
+        return 0;
+    memcpy(buf, head, head_length);
+    memcpy(buf + head_length, line, line_length);
+    buf[length] = '\0';
+    return 1;
+}
+
+// Append bytes to the partial line, skipping the line if it becomes too long
+static void tcp_stream_append_partial(tcp_stream *stream, const char *data, size_t length)
+{
+    if (stream->partial_length == TCP_STREAM_SKIP_LINE)
+        return;
+    if (stream->partial_length + length > TCP_STREAM_LINE_SIZE)
+    {
+        stream->partial_length = TCP_STREAM_SKIP_LINE;
+        return;
+    }
+    memcpy(stream->partial + stream->partial_length, data, length);
+    stream->partial_length += length;
+}
+
+// Pass each complete line of a chunk to the handler, returns 1 if a line was copied to the buffer
+static int tcp_stream_handle_lines(tcp_stream *stream, char *chunk, size_t length, char *buf, int bufsize,
+                                   tcp_line_handler handler, void *context)
+{
+    // The kernel receive time saves the clock read
+    long long timestamp_ns = (stream->receive_ns > 0) ? stream->receive_ns : current_timestamp_ns();
+    char *end = chunk + length;
+    char *line_start = chunk;
+    char *last_line = NULL;
+    size_t last_length = 0;
+    int found = 0;
+    char *newline;
+
+    while ((newline = memchr(line_start, '\n', end - line_start)) != NULL)
+    {
+        *newline = '\0';
+        stream->lines++;
+        size_t line_length = newline - line_start;
+        if ((line_start == chunk) && (stream->partial_length != 0))
+        {
+            // The first line of the chunk continues the partial line
+            size_t partial_length = stream->partial_length;
+            tcp_stream_append_partial(stream, line_start, line_length);
+            if ((stream->partial_length != TCP_STREAM_SKIP_LINE) && (partial_length + line_length > 0))
+            {
+                stream->partial[stream->partial_length] = '\0';
+                handler(context, stream->partial, stream->partial_length, timestamp_ns);
+                found |= tcp_stream_copy_line(buf, bufsize, NULL, 0, stream->partial, stream->partial_length);
+            }
+        }
+        else if (line_length > 0)
+        {
+            handler(context, line_start, line_length, timestamp_ns);
+            last_line = line_start;
+            last_length = line_length;
+        }
+        stream->partial_length = 0;
+        line_start = newline + 1;
+    }
+    if (last_line != NULL)
+        found |= tcp_stream_copy_line(buf, bufsize, NULL, 0, last_line, last_length);
+
+    // The bytes after the last newline start the next partial line
+    tcp_stream_append_partial(stream, line_start, end - line_start);
+    return found;
+}
+
+int read_tcp_stream_last_line(tcp_stream *stream, char *buf, int bufsize)
+{
+    return read_tcp_stream_lines(stream, buf, bufsize, NULL, NULL);
+}
+
+int read_tcp_stream_lines(tcp_stream *stream, char *buf, int bufsize, tcp_line_handler handler, void *context)
+{
+    char chunk[TCP_STREAM_CHUNK_SIZE];
+    ssize_t read_count;
+    // Default data when no data is received
+    buf[0] = '-';
+    buf[1] = '-';
+    buf[2] = '\0';
+
+    // Every line is needed by a handler, the backlog is not discarded
+    if ((handler == NULL) && (tcp_stream_discard_to_tail(stream, chunk) < 0))
     {
         // perror("recv");
         return -1;
     }
 
-    // At least two bytes received and a newline is needed for a valid line
-    if (bytes_received)
+    // Read all data from the socket, a short read means the socket was drained
+    do
     {
-        char *line_start = internal_buffer;
-        char *next_newline = line_start;
-        // Find the last line
-        while ((next_newline = strchr(line_start, '\n')) != NULL)
+        read_count = tcp_stream_recv(stream, chunk, sizeof(chunk));
+        if (read_count <= 0)
+            break;
+        stream->bytes += read_count;
+
+        if (handler != NULL)
         {
-            size_t line_length = strcspn(line_start, "\n");
-            if ((line_length > 0) && (line_length < PROTOCOL_BUFFER_SIZE - 1))
+            tcp_stream_handle_lines(stream, chunk, read_count, buf, bufsize, handler, context);
+            continue;
+        }
+
+        const char *end = chunk + read_count;
+        const char *last_newline = memrchr(chunk, '\n', read_count);
+        if (last_newline == NULL)
+        {
+            tcp_stream_append_partial(stream, chunk, read_count);
+            continue;
+        }
+        for (const char *newline = chunk; (newline = memchr(newline, '\n', end - newline)) != NULL; newline++)
+            stream->lines++;
+
+        // Scan backwards for the last non-empty complete line
+        const char *line_end = last_newline;
+        int found = 0;
+        while (!found && (line_end != NULL))
+        {
+            const char *previous_newline = memrchr(chunk, '\n', line_end - chunk);
+            if (previous_newline != NULL)
             {
-                strncpy(buf, line_start, line_length);
-                buf[line_length] = '\0';
-                // printf("%lld Data size: %ld last: %s\n", current_timestamp_ms(), bytes_received, buf);
+                found = tcp_stream_copy_line(buf, bufsize, NULL, 0, previous_newline + 1, line_end - previous_newline - 1);
             }
-            else
+            else if (stream->partial_length != TCP_STREAM_SKIP_LINE)
             {
-                // fprintf(stderr, "line length error");
-                return -1;
+                // The first line of the chunk continues the partial line
+                found = tcp_stream_copy_line(buf, bufsize, stream->partial, stream->partial_length, chunk, line_end - chunk);
             }
-            line_start = next_newline + 1;
-            if (line_start > internal_buffer + PROTOCOL_BUFFER_SIZE - 2)
-                return 0;
+            line_end = previous_newline;
         }
-        return 0; // Data received successfully
+
+        // The bytes after the last newline start the next partial line
+        stream->partial_length = 0;
+        tcp_stream_append_partial(stream, last_newline + 1, end - last_newline - 1);
+    } while (read_count == sizeof(chunk));
+
+    if (read_count == 0)
+        stream->closed = 1;
+    if (read_count < 0 && errno != EWOULDBLOCK && errno != EAGAIN)
+    {
+        // perror("recv");
+        return -1;
     }
-    return 0; // No data received yet, try again later
+    return 0; // Data received successfully, or no data received yet
 }
 
 void close_tcp_socket(int sockfd)
@@ -170,136 +785,218 @@ void close_tcp_socket(int sockfd)
     close(sockfd);
 }
 
-void handle_report_sigint(int sig)
+long long current_timestamp_ns()
 {
-    // fprintf(stderr, "\nReceived SIGINT (signal %d), exit.\n", sig);
-    report_running = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
 }
 
-void timer_handler(int sig, siginfo_t *si, void *uc)
+long long current_timestamp_ms()
 {
-    timer_triggered = 1;
-    report_timestamp = current_timestamp_ms();
+    return report_timestamp_ms(current_timestamp_ns());
 }
 
-long long current_timestamp_ms()
+long long report_timestamp_ms(long long timestamp_ns)
 {
-    struct timeval te;
-    gettimeofday(&te, NULL);                                                               // get current time
-    long long milliseconds = te.tv_sec * 1000LL + (long long)(te.tv_usec + 500L) / 1000LL; // calculate milliseconds
-    return milliseconds;
+    return (timestamp_ns + 500000LL) / 1000000LL;
 }
 
-void format_report(char *report_buffer, size_t buffer_size, char *out1, char *out2, char *out3)
+long long parse_report_interval(const char *text)
 {
-    snprintf(report_buffer, buffer_size, "{\"timestamp\": %lld, \"out1\": \"%s\", \"out2\": \"%s\", \"out3\": \"%s\"}",
-             report_timestamp, out1, out2, out3);
+    static const struct
+    {
+        const char *suffix;
+        long long scale;
+    } units[] = {{"ns", 1LL}, {"us", 1000LL}, {"ms", 1000000LL}, {"s", 1000000000LL}, {"", 1000000LL}};
+    char *end;
+    errno = 0;
+    long long value = strtoll(text, &end, 10);
+    if ((end == text) || (errno != 0) || (value <= 0))
+        return -1;
+    for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++)
+    {
+        if (strcmp(end, units[i].suffix) != 0)
+            continue;
+        return (value <= LLONG_MAX / units[i].scale) ? value * units[i].scale : -1;
+    }
+    return -1;
 }
 
-void setup_timer(timer_t *timer_id, int interval_ms)
+size_t report_buffer_size(const channel_table *channels)
 {
-    struct sigevent sev;
-    struct sigaction sa;
-    struct itimerspec its;
+    size_t size = REPORT_LINE_OVERHEAD + REPORT_TIMESTAMP_NS_SIZE;
+    for (int i = 0; i < channels->count; i++)
+        size += strlen(channels->configs[i].name) + CHANNEL_VALUE_SIZE + 8; // , "name": "value"
+    return size;
+}
 
-    sa.sa_flags = SA_SIGINFO;
-    sa.sa_sigaction = timer_handler;
-    sigemptyset(&sa.sa_mask);
-    if (sigaction(SIGRTMIN, &sa, NULL) == -1)
-    {
-        // perror("sigaction");
-        exit(EXIT_FAILURE);
-    }
+int format_report(char *report_buffer, size_t buffer_size, const channel_table *channels)
+{
+    return format_report_at(report_buffer, buffer_size, channels, report_timestamp);
+}
 
-    sev.sigev_notify = SIGEV_SIGNAL;
-    sev.sigev_signo = SIGRTMIN;
-    sev.sigev_value.sival_ptr = timer_id;
-    if (timer_create(CLOCK_REALTIME, &sev, timer_id) == -1)
+// Append the channel values and the closing brace after the timestamps
+static int report_format_values(char *report_buffer, size_t buffer_size, int length, const channel_table *channels)
+{
+    if ((length < 0) || ((size_t)length >= buffer_size))
+        return -1;
+    size_t position = length;
+    for (int i = 0; i < channels->count; i++)
     {
-        // perror("timer_create");
-        exit(EXIT_FAILURE);
+        const char *name = channels->configs[i].name;
+        const channel_state *state = &channels->states[i];
+        size_t name_length = strlen(name);
+        // , "name": "value" and the closing brace with null-termination
+        if (position + name_length + state->value_length + 12 > buffer_size)
+            return -1;
+        memcpy(report_buffer + position, ", \"", 3);
+        position += 3;
+        memcpy(report_buffer + position, name, name_length);
+        position += name_length;
+        memcpy(report_buffer + position, "\": \"", 4);
+        position += 4;
+        memcpy(report_buffer + position, state->value, state->value_length);
+        position += state->value_length;
+        report_buffer[position++] = '"';
     }
+    if (position + 2 > buffer_size)
+        return -1;
+    report_buffer[position++] = '}';
+    report_buffer[position] = '\0';
+    return (int)position;
+}
+
+int format_report_at(char *report_buffer, size_t buffer_size, const channel_table *channels, long long timestamp)
+{
+    int length = snprintf(report_buffer, buffer_size, "{\"timestamp\": %lld", timestamp);
+    return report_format_values(report_buffer, buffer_size, length, channels);
+}
 
-    its.it_value.tv_sec = 0;
-    its.it_value.tv_nsec = interval_ms * 1000000; // interval_ms in ms
-    its.it_interval.tv_sec = 0;
-    its.it_interval.tv_nsec = interval_ms * 1000000; // interval_ms in ms
+int format_report_at_ns(char *report_buffer, size_t buffer_size, const channel_table *channels, long long timestamp_ns)
+{
+    int length = snprintf(report_buffer, buffer_size, "{\"timestamp\": %lld, \"timestamp_ns\": %lld",
+                          report_timestamp_ms(timestamp_ns), timestamp_ns);
+    return report_format_values(report_buffer, buffer_size, length, channels);
+}
+
+size_t report_ages_size(const channel_table *channels)
+{
+    size_t size = 16; // , "age_us": {}
+    for (int i = 0; i < channels->count; i++)
+        size += strlen(channels->configs[i].name) + REPORT_AGE_SIZE;
+    return size;
+}
 
-    if (timer_settime(*timer_id, 0, &its, NULL) == -1)
+int format_report_ages(char *report_buffer, size_t buffer_size, int length, const channel_table *channels, long long timestamp_ns)
+{
+    // The ages object replaces the closing brace of the report
+    if ((length < 1) || ((size_t)length >= buffer_size))
+        return -1;
+    size_t position = length - 1;
+    int written = snprintf(report_buffer + position, buffer_size - position, ", \"age_us\": {");
+    const char *separator = "";
+    for (int i = 0; (i < channels->count) && (written >= 0) && ((size_t)written < buffer_size - position); i++)
     {
-        // perror("timer_settime");
-        exit(EXIT_FAILURE);
+        position += written;
+        written = 0;
+        const channel_state *state = &channels->states[i];
+        if ((state->value_ns == 0) || (strcmp(state->value, CHANNEL_EMPTY_VALUE) == 0))
+            continue;
+        written = snprintf(report_buffer + position, buffer_size - position, "%s\"%s\": %lld",
+                           separator, channels->configs[i].name, (timestamp_ns - state->value_ns) / 1000);
+        separator = ", ";
     }
+    if ((written < 0) || ((size_t)written >= buffer_size - position))
+        return -1;
+    position += written;
+    if (position + 3 > buffer_size)
+        return -1;
+    memcpy(report_buffer + position, "}}", 3);
+    return (int)position + 2;
 }
 
-int check_timing_and_control(const char *buffer, long interval_ms)
+size_t report_aggregates_size(const channel_table *channels)
 {
-    report_message report_messages[REPORT_COUNT_100];
-    int report_count = 0;
-    char *line;
-    char buffer_copy[REPORT_BUFFER_SIZE];
-
-    // Copy the buffer to a modifiable string
-    strncpy(buffer_copy, buffer, sizeof(buffer_copy));
-    buffer_copy[sizeof(buffer_copy) - 1] = '\0';
+    size_t size = 32; // , "aggregates": {}
+    for (int i = 0; i < channels->count; i++)
+        size += strlen(channels->configs[i].name) + REPORT_AGGREGATE_SIZE;
+    return size;
+}
 
-    // Split the buffer into lines and parse each line
-    line = strtok(buffer_copy, "\n");
-    while (line != NULL)
+int format_report_aggregates(char *report_buffer, size_t buffer_size, int length, const channel_table *channels,
+                             const channel_aggregate *aggregates)
+{
+    // The aggregates object replaces the closing brace of the report
+    if ((length < 1) || ((size_t)length >= buffer_size))
+        return -1;
+    size_t position = length - 1;
+    int written = snprintf(report_buffer + position, buffer_size - position, ", \"aggregates\": {");
+    for (int i = 0; (i < channels->count) && (written >= 0) && ((size_t)written < buffer_size - position); i++)
     {
-        if (parse_report_line(line, &report_messages[report_count]))
-        {
-            report_count++;
-        }
-        line = strtok(NULL, "\n");
+        position += written;
+        const channel_aggregate *aggregate = &aggregates[i];
+        const char *separator = i > 0 ? ", " : "";
+        if (aggregate->count == 0)
+            written = snprintf(report_buffer + position, buffer_size - position, "%s\"%s\": {\"count\": 0}",
+                               separator, channels->configs[i].name);
+        else if (isnan(aggregate->frequency))
+            written = snprintf(report_buffer + position, buffer_size - position,
+                               "%s\"%s\": {\"count\": %u, \"min\": %.6g, \"max\": %.6g, \"mean\": %.6g, \"rms\": %.6g}",
+                               separator, channels->configs[i].name, aggregate->count, aggregate->min, aggregate->max,
+                               aggregate_mean(aggregate), aggregate_rms(aggregate));
+        else
+            written = snprintf(report_buffer + position, buffer_size - position,
+                               "%s\"%s\": {\"count\": %u, \"min\": %.6g, \"max\": %.6g, \"mean\": %.6g, \"rms\": %.6g, \"freq\": %.4g}",
+                               separator, channels->configs[i].name, aggregate->count, aggregate->min, aggregate->max,
+                               aggregate_mean(aggregate), aggregate_rms(aggregate), aggregate->frequency);
     }
+    if ((written < 0) || ((size_t)written >= buffer_size - position))
+        return -1;
+    position += written;
+    if (position + 3 > buffer_size)
+        return -1;
+    memcpy(report_buffer + position, "}}", 3);
+    return (int)position + 2;
+}
 
-    // Variables to track the state of out3
-    int out3_is_5 = 0;
-    int out3_is_0 = 0;
+int setup_timer(long long interval_ns)
+{
+    struct itimerspec its;
 
-    // Condition initialization
-    int out1_control_effect_f1a8_met = 0;
-    int out1_control_effect_f2a4_met = 1;
-    int timing_met = 1;
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0)
+    {
+        // perror("timerfd_create");
+        return -1;
+    }
 
-    // Time between consequent reports
-    long long report_interval_ms = 0;
+    its.it_value.tv_sec = interval_ns / 1000000000LL;
+    its.it_value.tv_nsec = interval_ns % 1000000000LL;
+    its.it_interval = its.it_value;
 
-    // Check the conditions from the reports
-    for (int i = 0; i < report_count - CONTROL_PROPAGATION_DELAY; i++)
+    if (timerfd_settime(timer_fd, 0, &its, NULL) == -1)
     {
-        report_interval_ms = report_messages[i + 1].timestamp;                  // t1
-        report_interval_ms = report_interval_ms - report_messages[i].timestamp; // t0
-        if ((report_interval_ms > interval_ms + 10) || (report_interval_ms < interval_ms - 10))
-        {
-            timing_met = 0;
-            printf("%lld count: %d interval: %ld report: %lld i: %d t1: %lld t0: %lld\n", current_timestamp_ms(), report_count, interval_ms, report_interval_ms, i, report_messages[i + 1].timestamp, report_messages[i].timestamp);
-        }
-
-        if (report_messages[i].out3 == 5.0)
-        {
-            out3_is_5 = 1;
-            out3_is_0 = 0;
-        }
-        else if (report_messages[i].out3 == 0.0)
-        {
-            out3_is_0 = 1;
-            out3_is_5 = 0;
-        }
-        // default amplitude is 5.0, expecting to see larger output when out3 is at 5
-        if (out3_is_5 && ((report_messages[i + CONTROL_PROPAGATION_DELAY].out1 > 5.0) || (report_messages[i + CONTROL_PROPAGATION_DELAY].out1 < -5.0))) 
-        {
-            out1_control_effect_f1a8_met = 1;
-        }
-        // default amplitude is 5.0, not expecting to see larger output when out3 is at 0
-        if (out3_is_0 && ((report_messages[i + CONTROL_PROPAGATION_DELAY].out1 > 5.0) || (report_messages[i + CONTROL_PROPAGATION_DELAY].out1 < -5.0))) // default amplitude is 5.0
-        {
-            out1_control_effect_f2a4_met = 0;
-        }
+        // perror("timerfd_settime");
+        close(timer_fd);
+        return -1;
     }
-    printf("%lld report timing met: %d out1 control effect f1a8 met: %d out1 control effect f2a4 met: %d\n", current_timestamp_ms(), timing_met, out1_control_effect_f1a8_met, out1_control_effect_f2a4_met);
-    return (timing_met && out1_control_effect_f1a8_met && out1_control_effect_f2a4_met) ? 0 : -1;
+    return timer_fd;
+}
+
+int check_timing_and_control(const char *buffer, long interval_ms)
+{
+    report_verifier verifier;
+    if (report_verifier_init(&verifier, interval_ms, report_violation_print, stdout) < 0)
+        return -1;
+
+    // The buffer is verified line by line, without a copy or a report count limit
+    report_verifier_feed(&verifier, buffer, strlen(buffer));
+    int result = report_verifier_finish(&verifier);
+    printf("%lld reports: %lld report timing met: %d out1 control effect f1a8 met: %d out1 control effect f2a4 met: %d\n", current_timestamp_ms(), verifier.reports,
+           verifier.timing_violations == 0, verifier.control_effect_seen, verifier.control_violations == 0);
+    report_verifier_free(&verifier);
+    return result;
 }
 
 
@@ -321,11 +1018,7 @@ udp_socket open_udp_control_socket(int control_udp_port)
 
 int send_control_message(udp_socket udp_control_socket, control_message msg)
 {
-    // Convert fields to big-endian
-    msg.operation = htons(msg.operation);
-    msg.object = htons(msg.object);
-    msg.property = htons(msg.property);
-    msg.value = htons(msg.value);
+    msg = control_message_encode(msg);
     return sendto(udp_control_socket.sockfd, &msg, sizeof(msg), 0, (const struct sockaddr *)&udp_control_socket.servaddr, sizeof(udp_control_socket.servaddr));
 }
 
@@ -372,35 +1065,639 @@ char *replaceAll(const char *str, const char *oldWord, const char *newWord)
     return result;
 }
 
+// Exact powers of ten for the fraction digits of a value
+static const double report_powers_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+                                              1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+
+static const char *report_skip_space(const char *position, const char *end)
+{
+    while ((position < end) && ((*position == ' ') || (*position == '\t')))
+        position++;
+    return position;
+}
+
+// Parse a decimal number of at most 15 digits, returns the position after it, or NULL for the C library
+static const char *report_parse_decimal(const char *position, const char *end, float *value)
+{
+    int negative = 0;
+    if ((position < end) && ((*position == '-') || (*position == '+')))
+        negative = (*position++ == '-');
+    unsigned long long mantissa = 0;
+    int digits = 0;
+    int fraction_digits = 0;
+    while ((position < end) && (*position >= '0') && (*position <= '9'))
+    {
+        mantissa = mantissa * 10 + (*position++ - '0');
+        digits++;
+    }
+    if ((position < end) && (*position == '.'))
+    {
+        position++;
+        while ((position < end) && (*position >= '0') && (*position <= '9'))
+        {
+            mantissa = mantissa * 10 + (*position++ - '0');
+            fraction_digits++;
+        }
+    }
+    digits += fraction_digits;
+    if ((digits == 0) || (digits > 15))
+        return NULL;
+    double result = (double)mantissa / report_powers_of_ten[fraction_digits];
+    *value = (float)(negative ? -result : result);
+    return position;
+}
+
+// Parse the quoted value text up to the closing quote, "--" as NaN
+static const char *report_parse_value(const char *position, const char *end, float *value)
+{
+    const char *start = position;
+    if ((end - position >= 3) && (position[0] == '-') && (position[1] == '-') && (position[2] == '"'))
+    {
+        *value = NAN;
+        return position + 2;
+    }
+
+    position = report_parse_decimal(position, end, value);
+    if ((position != NULL) && (position < end) && (*position == '"'))
+        return position;
+
+    // Exponents, long mantissas, nan and inf by the C library
+    char text[CHANNEL_VALUE_SIZE];
+    const char *quote = memchr(start, '"', end - start);
+    if ((quote == NULL) || (quote == start) || (quote - start >= (long)sizeof(text)))
+        return NULL;
+    memcpy(text, start, quote - start);
+    text[quote - start] = '\0';
+    char *endptr;
+    *value = strtof(text, &endptr);
+    return (*endptr == '\0') ? quote : NULL;
+}
+
+float parse_channel_value(const char *text, size_t length)
+{
+    float value;
+    if (report_parse_decimal(text, text + length, &value) == text + length)
+        return value;
+    // "--", exponents, long mantissas and invalid text by the C library
+    char *endptr;
+    value = strtof(text, &endptr);
+    return ((endptr == text) || (strcmp(text, CHANNEL_EMPTY_VALUE) == 0)) ? NAN : value;
+}
+
+// Parse a line between the line start and end, returns 1 on success
+static int report_parse_line(const char *position, const char *end, report_message *message)
+{
+    static const char timestamp_key[] = "{\"timestamp\":";
+
+    message->count = 0;
+    message->skipped = 0;
+    if ((end - position < (long)sizeof(timestamp_key) - 1) || (memcmp(position, timestamp_key, sizeof(timestamp_key) - 1) != 0))
+        return 0;
+    position = report_skip_space(position + sizeof(timestamp_key) - 1, end);
+
+    int negative = (position < end) && (*position == '-');
+    position += negative;
+    const char *digits_start = position;
+    long long timestamp = 0;
+    while ((position < end) && (*position >= '0') && (*position <= '9'))
+        timestamp = timestamp * 10 + (*position++ - '0');
+    if (position == digits_start)
+        return 0;
+    message->timestamp = negative ? -timestamp : timestamp;
+
+    // The optional high-resolution timestamp follows the millisecond one
+    static const char timestamp_ns_key[] = "\"timestamp_ns\":";
+    message->timestamp_ns = 0;
+    const char *next = report_skip_space(position, end);
+    if ((next < end) && (*next == ','))
+    {
+        next = report_skip_space(next + 1, end);
+        if ((end - next >= (long)sizeof(timestamp_ns_key) - 1) && (memcmp(next, timestamp_ns_key, sizeof(timestamp_ns_key) - 1) == 0))
+        {
+            position = report_skip_space(next + sizeof(timestamp_ns_key) - 1, end);
+            digits_start = position;
+            while ((position < end) && (*position >= '0') && (*position <= '9'))
+                message->timestamp_ns = message->timestamp_ns * 10 + (*position++ - '0');
+            if (position == digits_start)
+                return 0;
+        }
+    }
+
+    // Values as , "name": "value" in the report order
+    for (;;)
+    {
+        position = report_skip_space(position, end);
+        if ((position == end) || (*position != ','))
+            break;
+        position = report_skip_space(position + 1, end);
+        if ((position == end) || (*position != '"'))
+            return 0;
+        const char *name_end = memchr(position + 1, '"', end - position - 1);
+        if (name_end == NULL)
+            return 0;
+        position = report_skip_space(name_end + 1, end);
+        if ((position == end) || (*position != ':'))
+            return 0;
+        position = report_skip_space(position + 1, end);
+        // An object, such as the aggregates, follows the channel values
+        if ((position < end) && (*position == '{'))
+        {
+            while ((end > position) && ((end[-1] == ' ') || (end[-1] == '\t') || (end[-1] == '\r')))
+                end--;
+            return (message->count > 0) && (end[-1] == '}');
+        }
+        if ((position == end) || (*position != '"'))
+            return 0;
+        float value;
+        position = report_parse_value(position + 1, end, &value);
+        if (position == NULL)
+            return 0;
+        position++; // closing quote
+        if (message->count < REPORT_CHANNEL_MAX)
+            message->values[message->count++] = value;
+        else
+            message->skipped++;
+    }
+    position = report_skip_space(position, end);
+    return (message->count > 0) && (position < end) && (*position == '}');
+}
+
 int parse_report_line(const char *line, report_message *message)
 {
-    char *line_float = replaceAll(line, "--", "nan");
-    return sscanf(line_float, "{\"timestamp\": %lld, \"out1\": \"%f\", \"out2\": \"%f\", \"out3\": \"%f\"}",
-                  &message->timestamp, &message->out1, &message->out2, &message->out3) == 4;
+    const char *end = line;
+    while ((*end != '\0') && (*end != '\n'))
+        end++;
+    return report_parse_line(line, end, message);
+}
+
+int parse_report_buffer(const char *buffer, size_t length, report_message *messages, int capacity, size_t *consumed)
+{
+    const char *position = buffer;
+    const char *end = buffer + length;
+    int count = 0;
+
+    while ((position < end) && (count < capacity))
+    {
+        const char *newline = memchr(position, '\n', end - position);
+        const char *line_end = newline ? newline : end;
+        count += report_parse_line(position, line_end, &messages[count]);
+        position = newline ? newline + 1 : end;
+    }
+    if (consumed != NULL)
+        *consumed = position - buffer;
+    return count;
+}
+
+// Register a file descriptor for input events with the given epoll tag
+static int report_epoll_add(int epoll_fd, int fd, uint32_t tag)
+{
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.u32 = tag;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+// Context of a channel for the per-line handler of the report loop
+typedef struct
+{
+    const report_options *options;
+    int channel;
+    aggregate_batch *batch; // samples of the read for the aggregates, or NULL
+    long long read_ns;      // monotonic start of the read for the control latency
+    control_batch *control; // writes of the arrival evaluation of a source channel, or NULL
+    int control_first;      // first rule of the source channel
+} report_line_context;
+
+// Control batch of the thread reading source channels, the report thread or an ingest shard
+static _Thread_local control_batch report_arrival_batch;
+static _Thread_local const control_arrival *report_arrival_batch_owner;
+
+// Returns the empty batch of the thread, its message headers set up once per thread and arrival evaluation
+static control_batch *report_arrival_control(const control_arrival *arrival)
+{
+    control_batch *batch = &report_arrival_batch;
+    if ((report_arrival_batch_owner != arrival) || (batch->sockfd != arrival->socket.sockfd) ||
+        (memcmp(&batch->servaddr, &arrival->socket.servaddr, sizeof(batch->servaddr)) != 0))
+    {
+        control_batch_init(batch, arrival->socket);
+        report_arrival_batch_owner = arrival;
+    }
+    return batch;
+}
+
+// Send the queued writes of the rules, the messages not sent counted in the stats, or logged without them
+static void report_control_flush(report_stats *stats, control_batch *batch)
+{
+    control_batch_flush(batch);
+    int unsent = batch->unsent;
+    if (unsent == 0)
+        return;
+    int error = batch->error;
+    batch->unsent = 0;
+    batch->error = 0;
+    if (stats != NULL)
+        atomic_fetch_add_explicit(&stats->control_unsent, unsent, memory_order_relaxed);
+    else
+        fprintf(stderr, "control: %d messages not sent: %s\n", unsent, strerror(error));
 }
 
-int print_report(FILE *file, int interval_ms, int sockfd_out1, int sockfd_out2, int sockfd_out3, udp_socket udp_control_socket, int count)
+// Evaluate the rules of a source channel on a sample, the writes of the changed rules sent at once
+static void report_control_sample(const report_line_context *line_context, float value)
 {
-    signal(SIGINT, handle_report_sigint);
+    const report_options *options = line_context->options;
+    control_arrival *arrival = options->control_arrival;
+    control_rule_table *rules = arrival->rules;
+    long long control_start_ns = options->stats ? stats_now_ns() : 0;
+    int changed = 0;
+    for (int r = line_context->control_first; (r < rules->count) && (rules->rules[r].source == line_context->channel); r++)
+    {
+        if (!control_rule_evaluate(rules, r, value, line_context->control))
+            continue;
+        if (arrival->latency != NULL)
+            control_latency_arm_rule(arrival->latency, r, line_context->read_ns, stats_now_ns());
+        changed++;
+    }
+    if (changed == 0)
+        return;
+    report_control_flush(options->stats, line_context->control);
+    if (options->stats != NULL)
+        stats_histogram_record_shared(&options->stats->stages[STATS_STAGE_CONTROL], stats_now_ns() - control_start_ns);
+}
 
-    timer_t timer_id;
-    setup_timer(&timer_id, interval_ms);
+// Feed every received line to the per-sample consumers
+static void report_handle_line(void *context, const char *line, size_t length, long long timestamp_ns)
+{
+    report_line_context *line_context = context;
+    float value = parse_channel_value(line, length);
+    if (isnan(value))
+        return;
+    if (line_context->options->capture != NULL)
+        capture_push(line_context->options->capture, line_context->channel, timestamp_ns, value);
+    if (line_context->options->control_latency != NULL)
+        control_latency_sample(line_context->options->control_latency, line_context->channel, value, line_context->read_ns);
+    if (line_context->control != NULL)
+        report_control_sample(line_context, value);
+    aggregate_batch *batch = line_context->batch;
+    if (batch != NULL)
+    {
+        batch->values[batch->count] = value;
+        batch->timestamps_ns[batch->count] = timestamp_ns;
+        if (++batch->count == AGGREGATE_BATCH_SIZE)
+        {
+            aggregate_update(line_context->options->aggregates, line_context->channel, batch);
+            batch->count = 0;
+        }
+    }
+}
 
-    char buffer1[DATA_SIZE], buffer2[DATA_SIZE], buffer3[DATA_SIZE];
-    char report_buffer[REPORT_BUFFER_SIZE];
+int report_read_channel(const report_options *options, channel_table *channels, int channel, uint32_t events)
+{
+    // Drain the socket as data arrives, keeping the last line of the interval
+    char line[CHANNEL_VALUE_SIZE];
+    channel_state *state = &channels->states[channel];
+    report_stats *stats = options->stats;
+    long long read_start_ns = (stats || options->control_latency) ? stats_now_ns() : 0;
+    int control_source = (options->control_arrival != NULL) && options->control_arrival->rules->sources[channel];
+    int result;
+    if ((options->capture != NULL) || (options->aggregates != NULL) || (options->control_latency != NULL) || control_source)
+    {
+        aggregate_batch batch;
+        batch.count = 0;
+        report_line_context line_context = {options, channel, options->aggregates ? &batch : NULL, read_start_ns, NULL, 0};
+        if (control_source)
+        {
+            line_context.control = report_arrival_control(options->control_arrival);
+            line_context.control_first = control_rule_table_first(options->control_arrival->rules, channel);
+        }
+        result = read_tcp_stream_lines(&state->stream, line, sizeof(line), report_handle_line, &line_context);
+        if (batch.count > 0)
+            aggregate_update(options->aggregates, channel, &batch);
+    }
+    else
+    {
+        result = read_tcp_stream_last_line(&state->stream, line, sizeof(line));
+    }
+    if ((result == 0) && (strcmp(line, CHANNEL_EMPTY_VALUE) != 0))
+    {
+        channel_set_value(state, line);
+        state->value_ns = state->stream.receive_ns;
+        if (options->control_latency != NULL)
+            control_latency_arrival(options->control_latency, channel, read_start_ns);
+    }
+    if (stats != NULL)
+    {
+        // The ingest shards share the read histogram
+        if (options->shard_count > 1)
+            stats_histogram_record_shared(&stats->stages[STATS_STAGE_READ], stats_now_ns() - read_start_ns);
+        else
+            stats_histogram_record(&stats->stages[STATS_STAGE_READ], stats_now_ns() - read_start_ns);
+        stats_channel *channel_stats = &stats->channel_stats[channel];
+        atomic_store_explicit(&channel_stats->bytes, state->stream.bytes, memory_order_relaxed);
+        atomic_store_explicit(&channel_stats->lines, state->stream.lines, memory_order_relaxed);
+        if (result < 0)
+            stats_counter_add(&channel_stats->recv_errors, 1);
+    }
+    return ((result < 0) || state->stream.closed || (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))) ? -1 : 0;
+}
+
+int report_epoll_add_channel(int epoll_fd, const channel_table *channels, int channel)
+{
+    const channel_state *state = &channels->states[channel];
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | (state->connection.connecting ? EPOLLOUT : 0);
+    event.data.u32 = (uint32_t)channel;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, state->stream.sockfd, &event);
+}
+
+int report_reconnect_max_ms(const report_options *options)
+{
+    long long interval_ms = options->interval_ns / 1000000LL;
+    if (interval_ms < 1)
+        return 1;
+    return interval_ms < CHANNEL_RECONNECT_MAX_MS ? (int)interval_ms : CHANNEL_RECONNECT_MAX_MS;
+}
+
+int report_epoll_add_channels(int epoll_fd, channel_table *channels)
+{
+    int added = 0;
+    for (int i = 0; i < channels->count; i++)
+    {
+        // A channel without a socket is reconnected by report_reconnect_channels
+        if ((channels->states[i].stream.sockfd >= 0) && (report_epoll_add_channel(epoll_fd, channels, i) == 0))
+            added++;
+    }
+    return added;
+}
+
+int report_channel_event(const report_options *options, channel_table *channels, int epoll_fd, int channel,
+                         uint32_t events, long long *retry_ns)
+{
+    channel_state *state = &channels->states[channel];
+    if (state->connection.connecting)
+    {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            return 0;
+        struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP, .data.u32 = channel};
+        if ((channel_connect_complete(state) < 0) ||
+            (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, state->stream.sockfd, &event) < 0))
+        {
+            long long retry = channel_disconnect(state, stats_now_ns(), report_reconnect_max_ms(options));
+            if (retry < *retry_ns)
+                *retry_ns = retry;
+            return -1;
+        }
+        if (!(events & (EPOLLIN | EPOLLRDHUP)))
+            return 0;
+    }
+
+    // Closing the socket removes it from the epoll set
+    unsigned long long bytes = state->stream.bytes;
+    int result = report_read_channel(options, channels, channel, events);
+    if (state->stream.bytes != bytes)
+        state->connection.backoff_ms = 0;
+    if (result < 0)
+    {
+        long long retry = channel_disconnect(state, stats_now_ns(), report_reconnect_max_ms(options));
+        if (retry < *retry_ns)
+            *retry_ns = retry;
+    }
+    return result;
+}
+
+int report_reconnect_channels(const report_options *options, channel_table *channels, int epoll_fd, long long *retry_ns)
+{
+    return report_reconnect_channel_list(options, channels, NULL, channels->count, epoll_fd, retry_ns);
+}
+
+int report_reconnect_channel_list(const report_options *options, channel_table *channels, const int *list, int list_count,
+                                  int epoll_fd, long long *retry_ns)
+{
+    if (*retry_ns == LLONG_MAX)
+        return -1;
+    long long now_ns = stats_now_ns();
+    if (now_ns >= *retry_ns)
+    {
+        long long next_ns = LLONG_MAX;
+        for (int k = 0; k < list_count; k++)
+        {
+            int i = (list != NULL) ? list[k] : k;
+            channel_state *state = &channels->states[i];
+            if (state->stream.sockfd >= 0)
+                continue;
+            if (state->connection.retry_ns <= now_ns)
+            {
+                state->connection.reconnects++;
+                if (options->stats != NULL)
+                    atomic_store_explicit(&options->stats->channel_stats[i].reconnects, state->connection.reconnects, memory_order_relaxed);
+                if ((channel_connect(channels, i) >= 0) && (report_epoll_add_channel(epoll_fd, channels, i) == 0))
+                    continue;
+                channel_disconnect(state, now_ns, report_reconnect_max_ms(options));
+            }
+            if (state->connection.retry_ns < next_ns)
+                next_ns = state->connection.retry_ns;
+        }
+        *retry_ns = next_ns;
+        if (next_ns == LLONG_MAX)
+            return -1;
+    }
+    return (int)((*retry_ns - now_ns + 999999) / 1000000);
+}
+
+int print_report(FILE *file, const report_options *options, channel_table *channels, udp_socket udp_control_socket)
+{
+    struct epoll_event events[REPORT_EVENTS_MAX];
+    int count = options->count;
+
+    size_t report_size = report_buffer_size(channels);
+    if (options->aggregates != NULL)
+        report_size += report_aggregates_size(channels);
+    if (options->receive_timestamps_enable)
+        report_size += report_ages_size(channels);
+    char *report_buffer = malloc(report_size);
+    if (report_buffer == NULL)
+    {
+        return -1;
+    }
+    // In the real-time mode, the memory is locked and the report buffer prefaulted before the first tick
+    if (options->rt_enable)
+    {
+        if (rt_memory_lock() < 0)
+            fprintf(stderr, "rt: memory not locked\n");
+        memset(report_buffer, 0, report_size);
+        if (rt_thread_setup(options->rt_priority, options->rt_cpu) < 0)
+            fprintf(stderr, "rt: report thread priority or affinity not set\n");
+    }
+    binary_report_writer binary_writer = {0};
+    if ((options->format == REPORT_FORMAT_BINARY) && (binary_report_writer_init(&binary_writer, file, channels) < 0))
+    {
+        free(report_buffer);
+        return -1;
+    }
+    // The reports are written through the sink, flushed by the policy of the options
+    report_sink sink;
+    if (report_sink_init(&sink, file, &options->sink) < 0)
+    {
+        report_sink_free(&sink);
+        binary_report_writer_free(&binary_writer);
+        free(report_buffer);
+        return -1;
+    }
+    // Local readers take the latest report from the shared memory instead of the output
+    shm_report_publisher publisher = {0};
+    if ((options->shm_name != NULL) && (shm_report_publisher_open(&publisher, options->shm_name, channels) < 0))
+    {
+        report_sink_free(&sink);
+        binary_report_writer_free(&binary_writer);
+        free(report_buffer);
+        return -1;
+    }
+
+    // SIGINT is received through a signalfd instead of an asynchronous handler
+    sigset_t sigint_mask, previous_mask;
+    sigemptyset(&sigint_mask);
+    sigaddset(&sigint_mask, SIGINT);
+    if (sigprocmask(SIG_BLOCK, &sigint_mask, &previous_mask) == -1)
+    {
+        shm_report_publisher_close(&publisher);
+        report_sink_free(&sink);
+        binary_report_writer_free(&binary_writer);
+        free(report_buffer);
+        return -1;
+    }
+    int signal_fd = signalfd(-1, &sigint_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    // The real-time tick eventfd is read like the timerfd, an 8-byte expiration count
+    rt_tick tick = {0};
+    int timer_fd = options->rt_enable ? rt_tick_start(&tick, options->interval_ns) : setup_timer(options->interval_ns);
+    if (options->rt_enable && (timer_fd >= 0) && (rt_tick_setup(&tick, options->rt_priority, options->rt_cpu) < 0))
+        fprintf(stderr, "rt: tick thread priority or affinity not set\n");
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if ((signal_fd < 0) || (timer_fd < 0) || (epoll_fd < 0) ||
+        report_epoll_add(epoll_fd, timer_fd, REPORT_EVENT_TIMER) ||
+        report_epoll_add(epoll_fd, signal_fd, REPORT_EVENT_SIGNAL))
+    {
+        close(epoll_fd);
+        if (options->rt_enable)
+            rt_tick_stop(&tick);
+        else
+            close(timer_fd);
+        close(signal_fd);
+        sigprocmask(SIG_SETMASK, &previous_mask, NULL);
+        shm_report_publisher_close(&publisher);
+        report_sink_free(&sink);
+        binary_report_writer_free(&binary_writer);
+        free(report_buffer);
+        return -1;
+    }
+    channel_table_reset_values(channels);
+
+    // In the pipeline mode the sockets are read by the ingest thread, and the reports
+    // written by the output thread, this loop aggregates the values of the mailboxes
+    report_pipeline pipeline = {0};
+    channel_table *report_channels = channels;
+    if (options->pipeline_enable)
+    {
+        if ((report_pipeline_start(&pipeline, &sink, options, channels, &binary_writer) < 0) ||
+            report_epoll_add(epoll_fd, pipeline.queue.space_fd, REPORT_EVENT_SPACE))
+        {
+            report_pipeline_stop(&pipeline);
+            close(epoll_fd);
+            if (options->rt_enable)
+                rt_tick_stop(&tick);
+            else
+                close(timer_fd);
+            close(signal_fd);
+            sigprocmask(SIG_SETMASK, &previous_mask, NULL);
+            shm_report_publisher_close(&publisher);
+            report_sink_free(&sink);
+            binary_report_writer_free(&binary_writer);
+            free(report_buffer);
+            return -1;
+        }
+        report_channels = &pipeline.values;
+    }
+    else
+    {
+        // A channel without a connection is reported as "--", same as a socket without data
+        report_epoll_add_channels(epoll_fd, channels);
+    }
+
+    // Control rules of the options, or the default out3 rule when present in the table
+    control_rule_table default_rules = {0};
+    control_rule_table *control_rules = options->control_rules;
+    if ((control_rules == NULL) && (udp_control_socket.sockfd > 0))
+    {
+        if (control_rule_table_init(&default_rules, CONTROL_RULES_DEFAULT, channels) == 0)
+            control_rules = &default_rules;
+    }
+
+    // The timerfd deadlines follow from the start, the real-time tick passes its deadline
+    report_stats *stats = options->stats;
+    long long interval_ns = options->interval_ns;
+    long long next_deadline_ns = stats_now_ns() + interval_ns;
 
     int first_call = 1;
+    int running = 1;
 
-    double previous_out3_value = -DBL_MAX; // Negative max as initial value
+    // The rule writes are encoded at compile time and the writes of a tick sent together
+    control_batch control;
+    control_batch_init(&control, udp_control_socket);
 
-    while (report_running)
+    // The epoll wait is cut short by the next reconnect of a disconnected channel
+    long long retry_ns = 0;
+    while (running)
     {
-        if (timer_triggered)
+        int timeout_ms = options->pipeline_enable ? -1 : report_reconnect_channels(options, channels, epoll_fd, &retry_ns);
+        int event_count = epoll_wait(epoll_fd, events, REPORT_EVENTS_MAX, timeout_ms);
+        if (event_count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (int e = 0; e < event_count && running; e++)
         {
-            timer_triggered = 0;
-            read_tcp_last_line(sockfd_out1, buffer1, sizeof(buffer1));
-            read_tcp_last_line(sockfd_out2, buffer2, sizeof(buffer2));
-            read_tcp_last_line(sockfd_out3, buffer3, sizeof(buffer3));
+            uint32_t tag = events[e].data.u32;
+            if (tag == REPORT_EVENT_SIGNAL)
+            {
+                struct signalfd_siginfo siginfo;
+                if (read(signal_fd, &siginfo, sizeof(siginfo)) == sizeof(siginfo))
+                    running = 0;
+                continue;
+            }
+            if (tag == REPORT_EVENT_SPACE)
+            {
+                report_pipeline_retry(&pipeline);
+                continue;
+            }
+            if (tag != REPORT_EVENT_TIMER)
+            {
+                report_channel_event(options, channels, epoll_fd, tag, events[e].events, &retry_ns);
+                continue;
+            }
+
+            uint64_t expirations;
+            if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                continue;
+            long long tick_start_ns = 0;
+            if (stats != NULL)
+            {
+                tick_start_ns = stats_now_ns();
+                long long deadline_ns = next_deadline_ns + ((long long)expirations - 1) * interval_ns;
+                if (options->rt_enable)
+                    deadline_ns = atomic_load_explicit(&tick.deadline_ns, memory_order_acquire);
+                next_deadline_ns = deadline_ns + interval_ns;
+                stats_histogram_record(&stats->stages[STATS_STAGE_TIMER_LATENESS], tick_start_ns > deadline_ns ? tick_start_ns - deadline_ns : 0);
+                stats_counter_add(&stats->ticks, 1);
+            }
+            report_timestamp_ns = current_timestamp_ns();
+            report_timestamp = report_timestamp_ms(report_timestamp_ns);
+            if (options->pipeline_enable)
+                report_pipeline_collect(&pipeline);
+            else if (options->aggregates != NULL)
+            {
+                for (int i = 0; i < channels->count; i++)
+                    aggregate_take(options->aggregates, i);
+            }
             if (first_call)
             {
                 first_call = 0;
@@ -410,33 +1707,106 @@ int print_report(FILE *file, int interval_ms, int sockfd_out1, int sockfd_out2,
                 if (count > 0)
                     count--;
                 if (count == 0)
-                    break; // Done
-                format_report(report_buffer, sizeof(report_buffer), buffer1, buffer2, buffer3);
-                fprintf(file, "%s\n", report_buffer);
+                {
+                    running = 0; // Done
+                    break;
+                }
+                if (options->shm_name != NULL)
+                    shm_report_publish(&publisher, report_timestamp, report_channels);
+                if (options->pipeline_enable)
+                {
+                    report_pipeline_push(&pipeline, report_timestamp_ns);
+                }
+                else
+                {
+                    long long format_start_ns = stats ? stats_now_ns() : 0;
+                    int length = (options->format == REPORT_FORMAT_BINARY) ? (int)binary_report_encode(&binary_writer, report_timestamp, channels)
+                                                                            : options->timestamp_ns_enable ? format_report_at_ns(report_buffer, report_size, channels, report_timestamp_ns)
+                                                                                                           : format_report(report_buffer, report_size, channels);
+                    if ((options->format == REPORT_FORMAT_JSON) && options->receive_timestamps_enable && (length > 0))
+                        length = format_report_ages(report_buffer, report_size, length, channels, report_timestamp_ns);
+                    if ((options->format == REPORT_FORMAT_JSON) && (options->aggregates != NULL) && (length > 0))
+                        length = format_report_aggregates(report_buffer, report_size, length, channels, options->aggregates->taken);
+                    long long output_start_ns = stats ? stats_now_ns() : 0;
+                    if (options->format == REPORT_FORMAT_BINARY)
+                        report_sink_write(&sink, binary_writer.record, length);
+                    else if (length > 0)
+                        report_sink_write_line(&sink, report_buffer, length);
+                    if (options->archive != NULL)
+                        archive_writer_append(options->archive, report_timestamp_ns, channels);
+                    if (options->archive_segments != NULL)
+                        archive_segments_append(options->archive_segments, report_timestamp_ns, channels);
+                    if (stats != NULL)
+                    {
+                        long long output_end_ns = stats_now_ns();
+                        stats_histogram_record(&stats->stages[STATS_STAGE_FORMAT], output_start_ns - format_start_ns);
+                        stats_histogram_record(&stats->stages[STATS_STAGE_OUTPUT], output_end_ns - output_start_ns);
+                    }
+                }
+                if (stats != NULL)
+                {
+                    // In the pipeline mode the output thread counts the empty intervals
+                    if (options->pipeline_enable)
+                    {
+                        atomic_store_explicit(&stats->reports_dropped, atomic_load_explicit(&pipeline.queue.dropped, memory_order_relaxed), memory_order_relaxed);
+                        atomic_store_explicit(&stats->reports_coalesced, pipeline.coalesced, memory_order_relaxed);
+                    }
+                    else
+                    {
+                        for (int i = 0; i < channels->count; i++)
+                        {
+                            if (strcmp(channels->states[i].value, CHANNEL_EMPTY_VALUE) == 0)
+                                stats_counter_add(&stats->channel_stats[i].empty_intervals, 1);
+                        }
+                    }
+                }
             }
 
-            // Send control message only if port defined and out3 value crosses threshold
-            if ((strcmp(buffer3, "--") != 0) && (udp_control_socket.sockfd > 0))
+            // Send the control messages of the rules crossing a threshold, only if port defined,
+            // unless the rules are evaluated on the arrival of the source samples
+            if ((control_rules != NULL) && (udp_control_socket.sockfd > 0) && (options->control_arrival == NULL))
             {
-                double out3_value = atof(buffer3);
-                if ( ((previous_out3_value == -DBL_MAX) || (previous_out3_value < 3.0)) && (out3_value >= 3.0))
+                long long control_start_ns = stats ? stats_now_ns() : 0;
+                if (control_rule_table_evaluate(control_rules, report_channels, &control) > 0)
                 {
-                    // TODO missing error handling
-                    send_control_message(udp_control_socket, ctrl_msg_o3h_f1hz);
-                    send_control_message(udp_control_socket, ctrl_msg_o3h_a8k);
-                    previous_out3_value = out3_value;
+                    // The effects are marked from the send, the channels are armed before the flush
+                    if (options->control_latency != NULL)
+                        control_latency_arm(options->control_latency, stats_now_ns());
+                    report_control_flush(stats, &control);
+                    if (stats != NULL)
+                        stats_histogram_record(&stats->stages[STATS_STAGE_CONTROL], stats_now_ns() - control_start_ns);
                 }
-                else if (((previous_out3_value == -DBL_MAX) || (previous_out3_value >= 3.0)) && out3_value < 3.0)
-                {
-                    send_control_message(udp_control_socket, ctrl_msg_o3l_f2hz);
-                    send_control_message(udp_control_socket, ctrl_msg_o3l_a4k);
-                    previous_out3_value = out3_value;
-                }
-                
             }
+            if (options->control_latency != NULL)
+                control_latency_poll(options->control_latency, stats_now_ns());
+
+            // Values are reported once, until new data arrives
+            if (options->pipeline_enable)
+                report_pipeline_reset(&pipeline);
+            else
+                channel_table_reset_values(channels);
+            if (stats != NULL)
+                stats_histogram_record(&stats->stages[STATS_STAGE_TICK], stats_now_ns() - tick_start_ns);
+            if (options->pipeline_enable)
+                report_pipeline_signal(&pipeline);
         }
-        pause(); // Wait for signals
     }
-    timer_delete(timer_id);
+    if (options->pipeline_enable)
+        report_pipeline_stop(&pipeline);
+    close(epoll_fd);
+    if (options->rt_enable)
+    {
+        rt_tick_stop(&tick);
+        rt_memory_unlock();
+    }
+    else
+        close(timer_fd);
+    close(signal_fd);
+    sigprocmask(SIG_SETMASK, &previous_mask, NULL);
+    shm_report_publisher_close(&publisher);
+    report_sink_free(&sink);
+    binary_report_writer_free(&binary_writer);
+    control_rule_table_free(&default_rules);
+    free(report_buffer);
     return 0;
 }
@@ -6,7 +6,7 @@
  * The protocol module is responsible for defining the protocols and data structures
  * used by the application.
  */
-#define _POSIX_C_SOURCE 200809L // clock_gettime
+#define _GNU_SOURCE // clock_gettime, accept4, memrchr
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
@@ -22,7 +22,30 @@
 #include <arpa/inet.h>
 #include <signal.h>
 #include <sys/time.h> // timeval
+#include <sys/ioctl.h>  // FIONREAD
 #include <float.h>    // DBL_MAX
+#include <math.h>     // NAN
+#include <stdint.h>
+#include <limits.h>     // LLONG_MAX
+#include <sys/epoll.h>    // epoll event loop
+#include <sys/timerfd.h>  // report tick timer
+#include <sys/signalfd.h> // SIGINT as a file descriptor
+#include <netdb.h>        // getaddrinfo
+#include <getopt.h>       // getopt_long
+#include <sched.h>        // SCHED_FIFO, CPU_SETSIZE
+#include "channel.h"
+#include "capture.h"
+#include "binary_report.h"
+#include "verify.h"
+#include "rt_tick.h"
+#include "stats.h"
+#include "control.h"
+#include "pipeline.h"
+#include "sink.h"
+#include "shm_report.h"
+#include "aggregate.h"
+#include "archive.h"
+#include "archive_segment.h"
 
 #define TCP_PORT_BAD 1
 #define TCP_PORT_OUT1 4001
@@ -34,6 +57,47 @@
 #define REPORT_INTERVAL_100MS 100
 #define REPORT_INTERVAL_20MS 20
 #define PROTOCOL_BUFFER_SIZE 1024
+#define TCP_STREAM_CHUNK_SIZE 16384
+#define TCP_STREAM_TAIL_SIZE 4096
+#define REPORT_EVENTS_MAX 64
+#define REPORT_CHANNEL_MAX 256
+#define REPORT_LINE_OVERHEAD 64
+#define REPORT_TIMESTAMP_NS_SIZE 40 // , "timestamp_ns": and 19 digits
+#define REPORT_AGGREGATE_SIZE 144 // , "name": {"count": N, ...} of a channel beside the name
+#define REPORT_OPTION_CAPTURE_CAPACITY 256 // long-only command line options after the ASCII range
+#define REPORT_OPTION_RT 257
+#define REPORT_OPTION_RT_PRIORITY 258
+#define REPORT_OPTION_RT_CPU 259
+#define REPORT_OPTION_STATS_FILE 260
+#define REPORT_OPTION_STATS_SOCKET 261
+#define REPORT_OPTION_CONTROL_RULES 262
+#define REPORT_OPTION_PIPELINE 263
+#define REPORT_OPTION_QUEUE_CAPACITY 264
+#define REPORT_OPTION_OVERFLOW 265
+#define REPORT_OPTION_SINK 266
+#define REPORT_OPTION_FLUSH_BYTES 267
+#define REPORT_OPTION_FLUSH_COUNT 268
+#define REPORT_OPTION_FLUSH_AGE 269
+#define REPORT_OPTION_FSYNC 270
+#define REPORT_OPTION_SHM 271
+#define REPORT_OPTION_SHARDS 272
+#define REPORT_OPTION_SHARD_CPU 273
+#define REPORT_OPTION_AGGREGATES 274
+#define REPORT_OPTION_CONTROL_LATENCY 275
+#define REPORT_OPTION_CONTROL_ARRIVAL 276
+#define REPORT_OPTION_TIMESTAMP_NS 277
+#define REPORT_OPTION_RECEIVE_TIMESTAMPS 278
+#define REPORT_OPTION_ARCHIVE 279
+#define REPORT_OPTION_ARCHIVE_DIR 280
+#define REPORT_OPTION_SEGMENT_SIZE 281
+#define REPORT_OPTION_SEGMENT_SECONDS 282
+#define REPORT_OPTION_SEGMENT_RETENTION 283
+#define REPORT_AGE_SIZE 28 // , "name": and the age digits
+#define REPORT_FORMAT_JSON 0
+#define REPORT_FORMAT_BINARY 1
+#define REPORT_EVENT_TIMER UINT32_MAX
+#define REPORT_EVENT_SIGNAL (UINT32_MAX - 1)
+#define REPORT_EVENT_SPACE (UINT32_MAX - 2)
 #define DATA_SIZE 1024
 #define CONTROL_UDP_PORT 4000
 #define VALID_OUT1_DATA_MAX 8.0
@@ -53,30 +117,70 @@
 #define CONTROL_OBJECT_OUT1_PROPERTY_AMPLITUDE_4000 4000 // unscaled, as 8000000 would not fit in 16 bit field
 #define CONTROL_OBJECT_OUT1_PROPERTY_AMPLITUDE_INDEX 170
 
-// Control message with operation, object, property and value
-typedef struct
-{
-    uint16_t operation;
-    uint16_t object;
-    uint16_t property;
-    uint16_t value;
-} control_message;
-
-// Control UDP socket with address
-typedef struct {
-    int sockfd;
-    struct sockaddr_in servaddr;
-} udp_socket;
-
-// Report message with timestamp and 3 float values
+// Report message with timestamp and a float value for each channel in the report order
 typedef struct
 {
     long long timestamp;
-    float out1;
-    float out2;
-    float out3;
+    long long timestamp_ns; // high-resolution timestamp, 0 without the field
+    int count;
+    int skipped; // values beyond REPORT_CHANNEL_MAX, parsed but not stored
+    float values[REPORT_CHANNEL_MAX];
 } report_message;
 
+// Report options, configurable from the client command line
+typedef struct report_options
+{
+    long long interval_ns;     // report interval, whole milliseconds by default
+    int control_enable;
+    int count;
+    int format;                // REPORT_FORMAT_JSON lines or REPORT_FORMAT_BINARY records
+    const char *channels;      // channel list, host:port/name entries
+    const char *channels_file; // file with a channel list, overrides channels
+    const char *capture_file;  // full-sample capture output file, capture disabled if NULL
+    int capture_capacity;      // capture ring capacity in samples per channel
+    capture *capture;          // started full-sample capture fed by print_report, or NULL
+    int rt_enable;             // real-time tick thread and locked memory instead of the timerfd
+    int rt_priority;           // SCHED_FIFO priority of the report and tick threads, or RT_PRIORITY_NONE
+    int rt_cpu;                // CPU of the report and tick threads, or RT_CPU_NONE
+    const char *stats_file;    // statistics dump file written on SIGUSR1, or NULL
+    const char *stats_socket;  // statistics Unix socket path, or NULL
+    report_stats *stats;       // statistics recorded by print_report, or NULL
+    const char *control_rules_file;    // file with control rules, CONTROL_RULES_DEFAULT if NULL
+    control_rule_table *control_rules; // compiled control rules evaluated by print_report, or NULL for the default
+    int pipeline_enable;       // ingest and output threads around the report loop
+    int queue_capacity;        // pipeline report queue capacity, rounded up to a power of two
+    int overflow_policy;       // REPORT_OVERFLOW_DROP_OLDEST or REPORT_OVERFLOW_BLOCK
+    report_sink_config sink;   // report output mode and flush policy
+    const char *shm_name;      // shared-memory segment of the latest report, or NULL
+    int shard_count;           // pipeline ingest shards, up to PIPELINE_SHARDS_MAX
+    int shard_cpu;             // CPU of the first ingest shard, the next shards on the next CPUs, or RT_CPU_NONE
+    int aggregates_enable;     // per-interval aggregates of every sample in the JSON reports
+    aggregate_table *aggregates; // aggregates fed by the channel reads, or NULL
+    int control_latency_enable;  // closed-loop latency of the control rules, written to stderr on exit
+    control_latency *control_latency; // latency of the control_rules fed by the reads and the tick, or NULL
+    int control_arrival_enable;  // control rules evaluated on each source sample instead of the tick
+    control_arrival *control_arrival; // arrival evaluation by the channel reads, or NULL for the tick
+    int timestamp_ns_enable;   // "timestamp_ns" epoch nanoseconds after the millisecond timestamp of the JSON reports
+    int receive_timestamps_enable; // kernel receive times of the values, their "age_us" in the JSON reports
+    const char *archive_file;  // compressed archive of the reports, archive disabled if NULL
+    archive_writer *archive;   // archive written with the reports by print_report, or NULL
+    const char *archive_directory; // directory of the time-indexed archive segments, segments disabled if NULL
+    long long segment_bytes;   // archive segment size limit, rotated at a block end
+    int segment_seconds;       // archive segment duration limit
+    int segment_retention;     // archive segments kept, the oldest removed at a rotation
+    archive_segments *archive_segments; // segments written with the reports by print_report, or NULL
+} report_options;
+
+/**
+ * Line handler called for each complete line read from a TCP stream.
+ *
+ * @param context The handler context.
+ * @param line The null-terminated line without the newline.
+ * @param length The line length.
+ * @param timestamp_ns The arrival timestamp of the line in epoch nanoseconds.
+ */
+typedef void (*tcp_line_handler)(void *context, const char *line, size_t length, long long timestamp_ns);
+
 /**
  * Returns the current timestamp in epoch milliseconds.
  *
@@ -84,17 +188,140 @@ typedef struct
  */
 long long current_timestamp_ms();
 
+// Timestamp of the current report in epoch milliseconds, used by format_report
+extern long long report_timestamp;
+
+// Timestamp of the current report in epoch nanoseconds, report_timestamp rounded from it
+extern long long report_timestamp_ns;
+
+/**
+ * Rounds an epoch nanosecond timestamp to the epoch milliseconds of the report timestamp.
+ *
+ * @param timestamp_ns The timestamp in epoch nanoseconds.
+ * @return The timestamp in epoch milliseconds.
+ */
+long long report_timestamp_ms(long long timestamp_ns);
+
+/**
+ * Parses a report interval, a positive integer with an optional unit suffix of ns, us,
+ * ms or s, milliseconds without a suffix, e.g. "500us", "20" or "5s".
+ *
+ * @param text The interval text.
+ * @return The interval in nanoseconds, or -1 if invalid.
+ */
+long long parse_report_interval(const char *text);
+
 /**
- * Connects to a TCP port.
+ * Initializes report options with the defaults, unlimited report count and the default channels.
+ *
+ * @param options The report options to initialize.
+ * @param interval_ms The report interval in milliseconds.
+ * @param control_enable Flag indicating whether control is enabled or not.
+ */
+void report_options_init(report_options *options, int interval_ms, int control_enable);
+
+/**
+ * Parses the client command line into report options.
+ *
+ * The options are listed by print_report_usage. The numeric values are validated, and
+ * the options of a feature enable it, e.g. --shards implies --pipeline.
+ *
+ * @param argc The argument count.
+ * @param argv The argument vector.
+ * @param options The report options, initialized with report_options_init.
+ * @return 0 on success, or -1 on an invalid command line.
+ */
+int parse_report_options(int argc, char *argv[], report_options *options);
+
+/**
+ * Prints the command line usage of a client.
+ *
+ * @param file The file to print the usage to.
+ * @param program The program name.
+ */
+void print_report_usage(FILE *file, const char *program);
+
+/**
+ * Resolves the IPv4 address of a TCP port on a host.
+ *
+ * @param host The host name or address.
+ * @param port The port number.
+ * @param address The resolved address.
+ * @return 0 on success, or -1 if the host could not be resolved.
+ */
+int resolve_tcp_host(const char *host, int port, struct sockaddr_in *address);
+
+/**
+ * Starts a non-blocking connection to a TCP address. The connection completes when
+ * the socket becomes writable, with the result in SO_ERROR.
+ *
+ * @param address The address to connect to.
+ * @return Returns an socket file descriptor or -1 on error.
+ */
+int connect_to_tcp_address(const struct sockaddr_in *address);
+
+/**
+ * Connects to a TCP port on a host.
+ *
+ * The connection is non-blocking, and the connection completion is revealed at read.
+ *
+ * @param host The host name or address to connect to.
+ * @param port The port number to connect to.
+ * @return Returns an socket file descriptor or -1 on error.
+ */
+int connect_to_tcp_host(const char *host, int port);
+
+/**
+ * Connects to a TCP port on the local host.
  *
  * @param port The port number to connect to.
  * @return Returns an socket file descriptor or -1 on error.
  */
 int connect_to_tcp_port(int port);
 
+/**
+ * Reads the last complete line from a TCP stream.
+ *
+ * The socket is read until drained and the partial line at the end is carried over
+ * to the next call in the stream state. When the pending backlog exceeds the chunk size,
+ * the backlog is discarded up to the tail, without copying when supported by the socket,
+ * and only the tail is scanned for the newest complete line.
+ * Lines not fitting in the buffer are skipped.
+ *
+ * @param stream The TCP stream receive state.
+ * @param buf The buffer to store the read line, "--" if no complete line was received.
+ * @param bufsize The size of the buffer.
+ * @return 0 on success, or -1 if an error occurred.
+ */
+int read_tcp_stream_last_line(tcp_stream *stream, char *buf, int bufsize);
+
+/**
+ * Reads all complete lines from a TCP stream, calling the handler for each line.
+ *
+ * As read_tcp_stream_last_line, except that the backlog is never discarded when a
+ * handler is given, and every complete line is passed to the handler in the stream order.
+ *
+ * @param stream The TCP stream receive state.
+ * @param buf The buffer to store the last read line, "--" if no complete line was received.
+ * @param bufsize The size of the buffer.
+ * @param handler The line handler, or NULL to only read the last line.
+ * @param context The line handler context.
+ * @return 0 on success, or -1 if an error occurred.
+ */
+int read_tcp_stream_lines(tcp_stream *stream, char *buf, int bufsize, tcp_line_handler handler, void *context);
+
+/**
+ * Returns the current timestamp in epoch nanoseconds.
+ *
+ * @return The current timestamp in epoch nanoseconds.
+ */
+long long current_timestamp_ns();
+
 /**
  * Reads the last line from a TCP socket.
  *
+ * Stateless variant of read_tcp_stream_last_line, a line split across calls is not carried over.
+ *
  * @param sockfd The socket file descriptor.
  * @param buf The buffer to store the read line.
  * @param bufsize The size of the buffer.
@@ -136,35 +363,156 @@ int send_control_message(udp_socket udp_control_socket, control_message msg);
 void close_udp_socket(udp_socket udp_control_socket);
 
 /**
- * Sends a report to a file and multiple sockets at a specified interval.
+ * Reads a readable channel socket of the report loop, keeping the last line of the interval
+ * as the channel value, and feeding the capture, the aggregates, the control arrival evaluation,
+ * the control latency and the statistics of the options.
  *
- * This function sends a report to a specified file and multiple sockets at a given interval.
+ * @param options The report options.
+ * @param channels The channel table.
+ * @param channel The channel index.
+ * @param events The epoll events of the socket.
+ * @return 0 on success, or -1 on a socket error or peer close, when the socket should not be polled.
+ */
+int report_read_channel(const report_options *options, channel_table *channels, int channel, uint32_t events);
+
+/**
+ * Adds a channel socket to an epoll set, tagged with the channel index, and polled for
+ * writable while connecting.
+ *
+ * @param epoll_fd The epoll file descriptor.
+ * @param channels The channel table.
+ * @param channel The channel index, of a channel with a socket.
+ * @return 0 on success, or -1 on error.
+ */
+int report_epoll_add_channel(int epoll_fd, const channel_table *channels, int channel);
+
+/**
+ * Adds the channel sockets to an epoll set, tagged with the channel index, and the
+ * connecting sockets also polled for writable.
+ *
+ * @param epoll_fd The epoll file descriptor.
+ * @param channels The channel table.
+ * @return The number of sockets added.
+ */
+int report_epoll_add_channels(int epoll_fd, channel_table *channels);
+
+/**
+ * Handles an epoll event of a channel socket. A connecting socket is completed when
+ * writable, and a connected socket is read with report_read_channel. On a connection
+ * failure, a socket error or a peer close, the socket is closed and the reconnect scheduled.
+ *
+ * @param options The report options.
+ * @param channels The channel table.
+ * @param epoll_fd The epoll file descriptor of the channel sockets.
+ * @param channel The channel index.
+ * @param events The epoll events of the socket.
+ * @param retry_ns The earliest reconnect time, lowered to the scheduled reconnect.
+ * @return 0 on success, or -1 if the channel was disconnected.
+ */
+int report_channel_event(const report_options *options, channel_table *channels, int epoll_fd, int channel,
+                         uint32_t events, long long *retry_ns);
+
+/**
+ * Returns the reconnect delay limit, CHANNEL_RECONNECT_MAX_MS or the report interval,
+ * whichever is shorter, so the data of a reconnected channel resumes within an interval.
+ *
+ * @param options The report options.
+ * @return The reconnect delay limit in milliseconds, at least 1.
+ */
+int report_reconnect_max_ms(const report_options *options);
+
+/**
+ * Starts the reconnects of the disconnected channels that are due, without blocking.
+ * The reconnect delay starts at CHANNEL_RECONNECT_MIN_MS and doubles on each failure up
+ * to CHANNEL_RECONNECT_MAX_MS or the report interval, whichever is shorter.
+ *
+ * @param options The report options.
+ * @param channels The channel table.
+ * @param epoll_fd The epoll file descriptor of the channel sockets.
+ * @param retry_ns The earliest reconnect time, 0 to check all the channels, updated to
+ *                 the next reconnect, or LLONG_MAX if all the channels have a socket.
+ * @return The epoll timeout in milliseconds until the next reconnect, or -1 if none.
+ */
+int report_reconnect_channels(const report_options *options, channel_table *channels, int epoll_fd, long long *retry_ns);
+
+/**
+ * Starts the due reconnects of a subset of the channels, as report_reconnect_channels.
+ *
+ * @param options The report options.
+ * @param channels The channel table.
+ * @param list The channel indices to check.
+ * @param list_count The channel index count.
+ * @param epoll_fd The epoll file descriptor of the channel sockets.
+ * @param retry_ns The earliest reconnect time of the subset, 0 to check all of it.
+ * @return The epoll timeout in milliseconds until the next reconnect, or -1 if none.
+ */
+int report_reconnect_channel_list(const report_options *options, channel_table *channels, const int *list, int list_count,
+                                  int epoll_fd, long long *retry_ns);
+
+/**
+ * Sends a report of the channels to a file at a specified interval.
+ *
+ * The channel sockets, the report timer and SIGINT are waited on in a single epoll set, so the
+ * sockets are drained as soon as data becomes readable and the report is emitted on the
+ * timer expiration. SIGINT is blocked for the duration of the call and terminates the
+ * reporting through a signalfd.
  *
  * @param file The file to which the report will be sent.
- * @param interval_ms The interval, in milliseconds, at which the report will be sent.
- * @param sockfd_out1 The first socket file descriptor to which the report will be sent.
- * @param sockfd_out2 The second socket file descriptor to which the report will be sent.
- * @param sockfd_out3 The third socket file descriptor to which the report will be sent.
- * @param udp_control_socket The UDP control socket to which the report will be sent.
- * @param count The number of reports to be sent.
+ * @param options The report options, the interval in milliseconds and the number of reports to be sent.
+ * @param channels The connected channel table, reported in the table order.
+ * @param udp_control_socket The UDP control socket to which the control messages will be sent.
  * @return Returns 0 on success, -1 on failure.
  */
-int print_report(FILE *file, int interval_ms, int sockfd_out1, int sockfd_out2, int sockfd_out3, udp_socket udp_control_socket, int count);
+int print_report(FILE *file, const report_options *options, channel_table *channels, udp_socket udp_control_socket);
 
 /**
  * Parses a report line and populates the provided report_message structure.
  *
+ * The values are stored in the report order, at most REPORT_CHANNEL_MAX values,
+ * and the "--" values are stored as NaN. The values beyond REPORT_CHANNEL_MAX are
+ * parsed and counted in skipped, so the reports of larger channel tables are
+ * accepted. The parser does not allocate, and the line may end with a newline
+ * instead of the null-termination. An object value, such as the aggregates, ends
+ * the channel values.
+ *
  * @param line The input line to parse.
  * @param message A pointer to the report_message structure to populate.
- * @return Returns 0 on success, or a negative value on failure.
+ * @return Returns 1 on success, or 0 on a malformed line.
  */
 int parse_report_line(const char *line, report_message *message);
 
+/**
+ * Parses a channel value text, with the fast path of the report line parser.
+ *
+ * @param text The null-terminated value text.
+ * @param length The text length.
+ * @return The value, or NaN for "--" or an invalid text.
+ */
+float parse_channel_value(const char *text, size_t length);
+
+/**
+ * Parses the report lines of a buffer into a caller-provided report_message array.
+ *
+ * Malformed lines are skipped. The parsing stops at the end of the buffer, or when the
+ * messages array is full, and the consumed byte count tells where to continue. A last
+ * line without a newline is parsed only if it ends the buffer.
+ *
+ * @param buffer The buffer of report lines, not necessarily null-terminated.
+ * @param length The buffer length in bytes.
+ * @param messages The report_message array to populate.
+ * @param capacity The capacity of the messages array.
+ * @param consumed The number of bytes consumed, or NULL.
+ * @return The number of parsed messages.
+ */
+int parse_report_buffer(const char *buffer, size_t length, report_message *messages, int capacity, size_t *consumed);
+
 /**
  * Checks the timing and control of the given buffer.
  *
  * This function checks the timing and control of the provided buffer
- * based on the specified interval in milliseconds.
+ * based on the specified interval in milliseconds. The buffer is verified
+ * by the streaming verifier, so any number of report lines is checked, and
+ * the violations are printed with the line positions.
  *
  * @param buffer The buffer to check.
  * @param interval_ms The interval in milliseconds.
@@ -173,7 +521,7 @@ int parse_report_line(const char *line, report_message *message);
 int check_timing_and_control(const char *buffer, long interval_ms);
 
 /**
- * Sends periodic reports to the standard output.
+ * Sends periodic reports of the default channels to the standard output.
  *
  * This function sends periodic reports to the standard output at a specified interval.
  *
@@ -186,6 +534,14 @@ int check_timing_and_control(const char *buffer, long interval_ms);
  */
 int report_stdout(int interval_ms, int control_enable);
 
+/**
+ * Sends periodic reports to the standard output with the given report options.
+ *
+ * @param options The report options.
+ * @return Returns 0 on success, or a negative value if an error occurs.
+ */
+int report_stdout_options(const report_options *options);
+
 /**
  * Replaces all occurrences of a specified word in a string with a new word.
  *
@@ -197,44 +553,100 @@ int report_stdout(int interval_ms, int control_enable);
 char *replaceAll(const char *str, const char *oldWord, const char *newWord);
 
 /**
- * @brief Sets up a timer with the specified interval.
+ * @brief Sets up a periodic report timer with the specified interval.
  *
- * This function initializes a timer identified by `timer_id` with the specified `interval_ms`.
+ * The timer is a non-blocking CLOCK_MONOTONIC timerfd, which becomes readable on each
+ * expiration and is meant to be waited on together with the data sockets in an epoll set.
  *
- * @param timer_id Pointer to the timer identifier.
- * @param interval_ms The interval in milliseconds for the timer.
+ * @param interval_ns The interval in nanoseconds for the timer.
+ * @return The timer file descriptor, or -1 if an error occurred.
  */
-void setup_timer(timer_t *timer_id, int interval_ms);
+int setup_timer(long long interval_ns);
 
 /**
- * @brief Handles the timer signal.
+ * Returns the report buffer size needed for a report line of the channel table.
  *
- * This function is the handler for the timer signal. It is called when the timer signal is received.
+ * @param channels The channel table.
+ * @return The report buffer size in bytes.
+ */
+size_t report_buffer_size(const channel_table *channels);
+
+/**
+ * Formats a report of the channel values in the provided report buffer.
  *
- * @param sig The signal number.
- * @param si A pointer to a siginfo_t structure containing information about the signal.
- * @param uc A pointer to a ucontext_t structure containing the user context.
+ * @param report_buffer The report buffer for the formatted report.
+ * @param buffer_size   The size of the buffer.
+ * @param channels      The channel table with the names and values to format.
+ * @return The length of the formatted report, or -1 if the report did not fit in the buffer.
  */
-void timer_handler(int sig, siginfo_t *si, void *uc);
+int format_report(char *report_buffer, size_t buffer_size, const channel_table *channels);
 
 /**
- * Formats a report in the provided report buffer and outputs the formatted report by the specified output variables.
+ * Formats a report of the channel values with a timestamp instead of report_timestamp.
  *
- * @param report_buffer   The report buffer containing the report data.
+ * @param report_buffer The report buffer for the formatted report.
  * @param buffer_size   The size of the buffer.
- * @param out1          The first output variable to store the formatted report.
- * @param out2          The second output variable to store the formatted report.
- * @param out3          The third output variable to store the formatted report.
+ * @param channels      The channel table with the names and values to format.
+ * @param timestamp     The report timestamp in epoch milliseconds.
+ * @return The length of the formatted report, or -1 if the report did not fit in the buffer.
  */
-void format_report(char *report_buffer, size_t buffer_size, char *out1, char *out2, char *out3);
+int format_report_at(char *report_buffer, size_t buffer_size, const channel_table *channels, long long timestamp);
 
 /**
- * @brief Handles the SIGINT signal for reporting.
+ * Formats a report of the channel values with the millisecond timestamp rounded from an
+ * epoch nanosecond timestamp, followed by the nanosecond timestamp as "timestamp_ns".
  *
- * This function is called when the SIGINT signal is received. It is responsible for handling the signal and performing the necessary actions for reporting.
+ * @param report_buffer The report buffer for the formatted report.
+ * @param buffer_size   The size of the buffer.
+ * @param channels      The channel table with the names and values to format.
+ * @param timestamp_ns  The report timestamp in epoch nanoseconds.
+ * @return The length of the formatted report, or -1 if the report did not fit in the buffer.
+ */
+int format_report_at_ns(char *report_buffer, size_t buffer_size, const channel_table *channels, long long timestamp_ns);
+
+/**
+ * Returns the buffer size needed for the value ages of the channel table in a report line.
+ *
+ * @param channels The channel table.
+ * @return The ages size in bytes, added to the report buffer size.
+ */
+size_t report_ages_size(const channel_table *channels);
+
+/**
+ * Appends the ages of the channel values to a formatted report as an "age_us" object,
+ * the microseconds from the kernel receive time of each value to the report timestamp,
+ * only for the channels with a value and a known receive time.
+ *
+ * @param report_buffer The report buffer with the formatted report.
+ * @param buffer_size   The size of the buffer.
+ * @param length        The length of the formatted report.
+ * @param channels      The channel table with the values and their receive times.
+ * @param timestamp_ns  The report timestamp in epoch nanoseconds.
+ * @return The length of the report with the ages, or -1 if they did not fit in the buffer.
+ */
+int format_report_ages(char *report_buffer, size_t buffer_size, int length, const channel_table *channels, long long timestamp_ns);
+
+/**
+ * Returns the buffer size needed for the aggregates of the channel table in a report line.
+ *
+ * @param channels The channel table.
+ * @return The aggregates size in bytes, added to the report buffer size.
+ */
+size_t report_aggregates_size(const channel_table *channels);
+
+/**
+ * Appends the aggregates of the channels to a formatted report as an "aggregates" object,
+ * {"count": N, "min": ..., "max": ..., "mean": ..., "rms": ..., "freq": ...} per channel,
+ * only the count without samples and the frequency only when known.
  *
- * @param sig The signal number.
+ * @param report_buffer The report buffer with the formatted report.
+ * @param buffer_size   The size of the buffer.
+ * @param length        The length of the formatted report.
+ * @param channels      The channel table with the names.
+ * @param aggregates    The aggregates of the channels, indexed by the channel index.
+ * @return The length of the report with the aggregates, or -1 if it did not fit in the buffer.
  */
-void handle_report_sigint(int sig);
+int format_report_aggregates(char *report_buffer, size_t buffer_size, int length, const channel_table *channels,
+                             const channel_aggregate *aggregates);
 
 #endif // PROTOCOL_H
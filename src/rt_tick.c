@@ -0,0 +1,140 @@
+/**
+ * @file rt_tick.c
+ * @brief This file contains the implementation of the real-time report tick.
+ */
+#include "protocol.h"
+#include <sched.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#define RT_NS_PER_S 1000000000LL
+
+static long long rt_monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * RT_NS_PER_S + now.tv_nsec;
+}
+
+// Tick thread, sleeps to the absolute deadlines and signals each expiration
+static void *rt_tick_run(void *arg)
+{
+    rt_tick *tick = arg;
+    long long deadline_ns = (rt_monotonic_ns() / tick->interval_ns + 1) * tick->interval_ns;
+
+    while (atomic_load_explicit(&tick->running, memory_order_acquire))
+    {
+        struct timespec deadline = {deadline_ns / RT_NS_PER_S, deadline_ns % RT_NS_PER_S};
+        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0)
+            continue; // EINTR, the deadline is absolute
+        if (!atomic_load_explicit(&tick->running, memory_order_acquire))
+            break;
+
+        // Missed deadlines are signaled as expirations, the next deadline stays on the boundaries
+        uint64_t expirations = 1;
+        long long late_ns = rt_monotonic_ns() - deadline_ns;
+        if (late_ns >= tick->interval_ns)
+        {
+            expirations += late_ns / tick->interval_ns;
+            atomic_fetch_add_explicit(&tick->overruns, expirations - 1, memory_order_relaxed);
+        }
+        deadline_ns += (long long)expirations * tick->interval_ns;
+        atomic_store_explicit(&tick->deadline_ns, deadline_ns - tick->interval_ns, memory_order_release);
+        write(tick->event_fd, &expirations, sizeof(expirations));
+    }
+    return NULL;
+}
+
+int rt_tick_start(rt_tick *tick, long long interval_ns)
+{
+    memset(tick, 0, sizeof(*tick));
+    tick->interval_ns = interval_ns;
+    tick->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((tick->interval_ns <= 0) || (tick->event_fd < 0))
+    {
+        if (tick->event_fd >= 0)
+            close(tick->event_fd);
+        return -1;
+    }
+    atomic_store(&tick->running, 1);
+
+    // The tick thread blocks all signals, SIGINT is left to the report loop
+    sigset_t all_signals, previous_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &previous_mask);
+    int result = pthread_create(&tick->thread, NULL, rt_tick_run, tick);
+    pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
+    if (result != 0)
+    {
+        close(tick->event_fd);
+        return -1;
+    }
+    tick->started = 1;
+    return tick->event_fd;
+}
+
+// Set the policy and the affinity of a thread
+static int rt_setup(pthread_t thread, int priority, int cpu)
+{
+    if (priority != RT_PRIORITY_NONE)
+    {
+        struct sched_param param = {.sched_priority = priority};
+        if (pthread_setschedparam(thread, SCHED_FIFO, &param) != 0)
+            return -1;
+    }
+    if (cpu != RT_CPU_NONE)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (pthread_setaffinity_np(thread, sizeof(cpus), &cpus) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+int rt_tick_setup(rt_tick *tick, int priority, int cpu)
+{
+    return tick->started ? rt_setup(tick->thread, priority, cpu) : -1;
+}
+
+void rt_tick_stop(rt_tick *tick)
+{
+    if (!tick->started)
+        return;
+    // The tick thread wakes up at the next deadline at the latest
+    atomic_store_explicit(&tick->running, 0, memory_order_release);
+    pthread_join(tick->thread, NULL);
+    close(tick->event_fd);
+    tick->started = 0;
+}
+
+int rt_thread_setup(int priority, int cpu)
+{
+    return rt_setup(pthread_self(), priority, cpu);
+}
+
+// Touch the stack pages below the caller so they are mapped before the first tick
+static void __attribute__((noinline)) rt_prefault_stack(void)
+{
+    volatile char stack[RT_PREFAULT_STACK_SIZE];
+    for (size_t i = 0; i < sizeof(stack); i += 4096)
+        stack[i] = 0;
+}
+
+int rt_memory_lock(void)
+{
+    // The freed heap is kept mapped and the large blocks are not mmapped, no page faults on reuse
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        return -1;
+    rt_prefault_stack();
+    return 0;
+}
+
+void rt_memory_unlock(void)
+{
+    munlockall();
+}
@@ -0,0 +1,83 @@
+/**
+ * @file rt_tick.h
+ * @brief Header file for the real-time report tick.
+ *
+ * The real-time tick is an opt-in alternative to the report timerfd. A dedicated
+ * thread sleeps to absolute CLOCK_MONOTONIC deadlines aligned to the interval
+ * boundaries with clock_nanosleep, so the ticks do not drift, and signals each
+ * expiration through an eventfd read by the report loop like the timerfd. The
+ * threads can be run with a SCHED_FIFO priority and pinned to a CPU, and the
+ * process memory locked and prefaulted, to keep the tick jitter low.
+ */
+#ifndef RT_TICK_H
+#define RT_TICK_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define RT_PRIORITY_NONE 0 // default scheduling, no SCHED_FIFO
+#define RT_CPU_NONE -1     // no CPU affinity
+#define RT_PREFAULT_STACK_SIZE (256 * 1024)
+
+// Real-time tick thread signaling the expirations through an eventfd
+typedef struct
+{
+    long long interval_ns;
+    int event_fd;
+    pthread_t thread;
+    atomic_int running;
+    atomic_llong deadline_ns;   // CLOCK_MONOTONIC deadline of the last signaled tick
+    atomic_ullong overruns;     // deadlines passed before the tick thread woke up
+    int started;
+} rt_tick;
+
+/**
+ * Starts the tick thread, the first tick on the next interval boundary of CLOCK_MONOTONIC.
+ *
+ * @param tick The tick to start.
+ * @param interval_ns The tick interval in nanoseconds.
+ * @return The eventfd, readable as an 8-byte expiration count like a timerfd, or -1 on error.
+ */
+int rt_tick_start(rt_tick *tick, long long interval_ns);
+
+/**
+ * Sets the SCHED_FIFO priority and the CPU affinity of the tick thread.
+ *
+ * @param tick The started tick.
+ * @param priority The SCHED_FIFO priority, or RT_PRIORITY_NONE to keep the policy.
+ * @param cpu The CPU, or RT_CPU_NONE to keep the affinity.
+ * @return 0 on success, or -1 if not permitted or invalid.
+ */
+int rt_tick_setup(rt_tick *tick, int priority, int cpu);
+
+/**
+ * Stops the tick thread and closes the eventfd.
+ *
+ * @param tick The tick.
+ */
+void rt_tick_stop(rt_tick *tick);
+
+/**
+ * Sets the SCHED_FIFO priority and the CPU affinity of the calling thread.
+ *
+ * @param priority The SCHED_FIFO priority, or RT_PRIORITY_NONE to keep the policy.
+ * @param cpu The CPU, or RT_CPU_NONE to keep the affinity.
+ * @return 0 on success, or -1 if not permitted or invalid.
+ */
+int rt_thread_setup(int priority, int cpu);
+
+/**
+ * Locks the current and future process memory, keeps the freed heap mapped,
+ * and prefaults the stack of the calling thread.
+ *
+ * @return 0 on success, or -1 if the memory could not be locked.
+ */
+int rt_memory_lock(void);
+
+/**
+ * Unlocks the process memory.
+ */
+void rt_memory_unlock(void);
+
+#endif // RT_TICK_H
@@ -0,0 +1,155 @@
+/**
+ * @file shm_report.c
+ * @brief This file contains the implementation of the shared-memory latest report.
+ */
+#include "protocol.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+int shm_report_publisher_open(shm_report_publisher *publisher, const char *name, const channel_table *channels)
+{
+    memset(publisher, 0, sizeof(*publisher));
+    if (strlen(name) >= sizeof(publisher->name))
+        return -1;
+    size_t values_offset = sizeof(shm_report_segment);
+    size_t names_offset = values_offset + channels->count * sizeof(float);
+    size_t size = names_offset + channels->count * CHANNEL_NAME_SIZE;
+
+    // The segment is replaced, a previous segment stays mapped by its readers
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        // perror("shm_open");
+        return -1;
+    }
+    void *mapping = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        // perror("mmap");
+        shm_unlink(name);
+        return -1;
+    }
+
+    shm_report_segment *segment = mapping;
+    segment->version = SHM_REPORT_VERSION;
+    segment->channel_count = channels->count;
+    segment->size = size;
+    segment->values_offset = values_offset;
+    segment->names_offset = names_offset;
+    atomic_init(&segment->sequence, 0);
+    float *values = (float *)((char *)mapping + values_offset);
+    char(*names)[CHANNEL_NAME_SIZE] = (char(*)[CHANNEL_NAME_SIZE])((char *)mapping + names_offset);
+    for (int i = 0; i < channels->count; i++)
+    {
+        values[i] = NAN;
+        snprintf(names[i], CHANNEL_NAME_SIZE, "%s", channels->configs[i].name);
+    }
+    atomic_thread_fence(memory_order_release);
+    memcpy(segment->magic, SHM_REPORT_MAGIC, SHM_REPORT_MAGIC_SIZE);
+
+    strcpy(publisher->name, name);
+    publisher->segment = segment;
+    publisher->values = values;
+    publisher->channel_count = channels->count;
+    publisher->size = size;
+    return 0;
+}
+
+void shm_report_publish(shm_report_publisher *publisher, long long timestamp, const channel_table *channels)
+{
+    shm_report_segment *segment = publisher->segment;
+    unsigned long long sequence = atomic_load_explicit(&segment->sequence, memory_order_relaxed);
+    atomic_store_explicit(&segment->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    segment->timestamp = timestamp;
+    for (int i = 0; i < publisher->channel_count; i++)
+        publisher->values[i] = parse_channel_value(channels->states[i].value, channels->states[i].value_length);
+    atomic_store_explicit(&segment->sequence, sequence + 2, memory_order_release);
+}
+
+void shm_report_publisher_close(shm_report_publisher *publisher)
+{
+    if (publisher->segment == NULL)
+        return;
+    munmap(publisher->segment, publisher->size);
+    shm_unlink(publisher->name);
+    publisher->segment = NULL;
+    publisher->values = NULL;
+}
+
+int shm_report_reader_open(shm_report_reader *reader, const char *name)
+{
+    memset(reader, 0, sizeof(*reader));
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    struct stat status;
+    void *mapping = MAP_FAILED;
+    if ((fstat(fd, &status) == 0) && ((size_t)status.st_size >= sizeof(shm_report_segment)))
+        mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return -1;
+
+    // The header is complete once the magic is visible
+    const shm_report_segment *segment = mapping;
+    int valid = memcmp(segment->magic, SHM_REPORT_MAGIC, SHM_REPORT_MAGIC_SIZE) == 0;
+    atomic_thread_fence(memory_order_acquire);
+    if (!valid || (segment->version != SHM_REPORT_VERSION) || (segment->size > (uint64_t)status.st_size) ||
+        (segment->names_offset + (uint64_t)segment->channel_count * CHANNEL_NAME_SIZE > segment->size) ||
+        (segment->values_offset + (uint64_t)segment->channel_count * sizeof(float) > segment->names_offset))
+    {
+        munmap(mapping, status.st_size);
+        return -1;
+    }
+    reader->segment = segment;
+    reader->values = (const float *)((const char *)mapping + segment->values_offset);
+    reader->names = (const char(*)[CHANNEL_NAME_SIZE])((const char *)mapping + segment->names_offset);
+    reader->channel_count = segment->channel_count;
+    reader->size = status.st_size;
+    return 0;
+}
+
+int shm_report_read(const shm_report_reader *reader, long long *timestamp, float *values, unsigned long long *sequence)
+{
+    const shm_report_segment *segment = reader->segment;
+    for (int retry = 0; retry < SHM_REPORT_READ_RETRIES; retry++)
+    {
+        unsigned long long start = atomic_load_explicit(&segment->sequence, memory_order_acquire);
+        if (start & 1)
+            continue;
+        *timestamp = segment->timestamp;
+        memcpy(values, reader->values, reader->channel_count * sizeof(float));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&segment->sequence, memory_order_relaxed) != start)
+            continue;
+        if (sequence != NULL)
+            *sequence = start / 2;
+        return start > 0 ? 1 : 0;
+    }
+    return -1;
+}
+
+int shm_report_channel_index(const shm_report_reader *reader, const char *name)
+{
+    for (int i = 0; i < reader->channel_count; i++)
+    {
+        if (strncmp(reader->names[i], name, CHANNEL_NAME_SIZE) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void shm_report_reader_close(shm_report_reader *reader)
+{
+    if (reader->segment == NULL)
+        return;
+    munmap((void *)reader->segment, reader->size);
+    reader->segment = NULL;
+    reader->values = NULL;
+    reader->names = NULL;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file shm_report.h
+ * @brief Header file for the shared-memory latest report.
+ *
+ * The publisher writes each report into a POSIX shared-memory segment, the timestamp
+ * and a float value per channel, NaN for missing data, guarded by a seqlock. The
+ * readers map the segment read-only and take the latest report without locks or
+ * parsing, retrying while the publisher writes. Any number of readers is supported,
+ * and the publisher never waits for them.
+ *
+ * Segment layout, in the native byte order of the host:
+ *   shm_report_segment, float values[channel_count], char names[channel_count][CHANNEL_NAME_SIZE]
+ */
+#ifndef SHM_REPORT_H
+#define SHM_REPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "channel.h"
+
+#define SHM_REPORT_MAGIC "CTSHMREP"
+#define SHM_REPORT_MAGIC_SIZE 8
+#define SHM_REPORT_VERSION 1
+#define SHM_REPORT_NAME_DEFAULT "/ctutorial_report"
+#define SHM_REPORT_NAME_SIZE 256
+#define SHM_REPORT_READ_RETRIES 1000000 // reads of a segment being written before giving up
+#define SHM_REPORT_CACHE_LINE 64
+
+// Segment header, the magic is written last when the segment is ready
+typedef struct
+{
+    char magic[SHM_REPORT_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t channel_count;
+    uint64_t size;         // segment size in bytes
+    uint64_t values_offset;
+    uint64_t names_offset;
+    _Alignas(SHM_REPORT_CACHE_LINE) atomic_ullong sequence; // twice the report count, odd while writing
+    long long timestamp;   // epoch milliseconds of the latest report
+} shm_report_segment;
+
+// Publisher of a segment
+typedef struct
+{
+    char name[SHM_REPORT_NAME_SIZE];
+    shm_report_segment *segment;
+    float *values;
+    int channel_count;
+    size_t size;
+} shm_report_publisher;
+
+// Read-only mapping of a segment
+typedef struct
+{
+    const shm_report_segment *segment;
+    const float *values;
+    const char (*names)[CHANNEL_NAME_SIZE];
+    int channel_count;
+    size_t size;
+} shm_report_reader;
+
+/**
+ * Creates or replaces the shared-memory segment of the channels.
+ *
+ * @param publisher The publisher.
+ * @param name The segment name, starting with a slash, e.g. SHM_REPORT_NAME_DEFAULT.
+ * @param channels The channel table of the reports.
+ * @return 0 on success, or -1 on error.
+ */
+int shm_report_publisher_open(shm_report_publisher *publisher, const char *name, const channel_table *channels);
+
+/**
+ * Publishes a report of the channel values, the "--" and non-numeric values as NaN.
+ *
+ * @param publisher The publisher.
+ * @param timestamp The report timestamp in epoch milliseconds.
+ * @param channels The channel table with the values.
+ */
+void shm_report_publish(shm_report_publisher *publisher, long long timestamp, const channel_table *channels);
+
+/**
+ * Unmaps and removes the segment, the mapped readers keep the last report.
+ *
+ * @param publisher The publisher.
+ */
+void shm_report_publisher_close(shm_report_publisher *publisher);
+
+/**
+ * Maps an existing segment read-only, and validates the header.
+ *
+ * @param reader The reader.
+ * @param name The segment name.
+ * @return 0 on success, or -1 if the segment does not exist or is invalid.
+ */
+int shm_report_reader_open(shm_report_reader *reader, const char *name);
+
+/**
+ * Reads the latest report.
+ *
+ * @param reader The reader.
+ * @param timestamp The report timestamp in epoch milliseconds.
+ * @param values The channel values, an array of the channel count.
+ * @param sequence The report sequence, increasing with each report, or NULL.
+ * @return 1 on success, 0 if no report was published yet, or -1 if the publisher
+ *         did not finish a write in SHM_REPORT_READ_RETRIES reads.
+ */
+int shm_report_read(const shm_report_reader *reader, long long *timestamp, float *values, unsigned long long *sequence);
+
+/**
+ * Finds a channel of the segment by name.
+ *
+ * @param reader The reader.
+ * @param name The channel name.
+ * @return The channel index, or -1 if not found.
+ */
+int shm_report_channel_index(const shm_report_reader *reader, const char *name);
+
+/**
+ * Unmaps the segment.
+ *
+ * @param reader The reader.
+ */
+void shm_report_reader_close(shm_report_reader *reader);
+
+#endif // SHM_REPORT_H
@@ -0,0 +1,167 @@
+/**
+ * @file sink.c
+ * @brief This file contains the implementation of the report output sink.
+ */
+#include "protocol.h"
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+void report_sink_config_init(report_sink_config *config)
+{
+    config->mode = REPORT_SINK_STDIO;
+    config->fsync_policy = REPORT_SINK_FSYNC_NONE;
+    config->capacity = REPORT_SINK_BUFFER_SIZE;
+    config->flush_bytes = REPORT_SINK_BUFFER_SIZE;
+    config->flush_count = 0;
+    config->flush_age_ms = REPORT_SINK_FLUSH_AGE_MS;
+}
+
+int report_sink_init(report_sink *sink, FILE *file, const report_sink_config *config)
+{
+    memset(sink, 0, sizeof(*sink));
+    sink->config = *config;
+    sink->file = file;
+    if ((sink->config.flush_bytes == 0) || (sink->config.flush_bytes > sink->config.capacity))
+        sink->config.flush_bytes = sink->config.capacity;
+
+    fflush(file);
+    sink->fd = fileno(file);
+    struct stat status;
+    sink->sync = (sink->config.fsync_policy != REPORT_SINK_FSYNC_NONE) && (sink->fd >= 0) &&
+                 (fstat(sink->fd, &status) == 0) && S_ISREG(status.st_mode);
+    if ((sink->config.mode == REPORT_SINK_DIRECT) && (sink->fd < 0))
+        return -1;
+    if (sink->config.mode == REPORT_SINK_STDIO)
+        return 0;
+    sink->buffer = malloc(sink->config.capacity > 0 ? sink->config.capacity : 1);
+    if (sink->buffer == NULL)
+        return -1;
+    return 0;
+}
+
+// Write all the parts to the file descriptor, continuing after a partial write
+static int report_sink_writev(int fd, struct iovec *parts, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, parts, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // perror("writev");
+            return -1;
+        }
+        while ((count > 0) && ((size_t)written >= parts->iov_len))
+        {
+            written -= parts->iov_len;
+            parts++;
+            count--;
+        }
+        if (count > 0)
+        {
+            parts->iov_base = (char *)parts->iov_base + written;
+            parts->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+// Write the parts to the output in the mode of the sink, and sync with the flush policy
+static int report_sink_output(report_sink *sink, struct iovec *parts, int count)
+{
+    int result = 0;
+    if (sink->config.mode == REPORT_SINK_DIRECT)
+    {
+        result = report_sink_writev(sink->fd, parts, count);
+    }
+    else
+    {
+        for (int i = 0; (i < count) && (result == 0); i++)
+        {
+            if (fwrite(parts[i].iov_base, 1, parts[i].iov_len, sink->file) != parts[i].iov_len)
+                result = -1;
+        }
+        if ((result == 0) && (fflush(sink->file) != 0))
+            result = -1;
+    }
+    if ((result == 0) && sink->sync && (sink->config.fsync_policy == REPORT_SINK_FSYNC_FLUSH))
+        result = fdatasync(sink->fd);
+    sink->length = 0;
+    sink->count = 0;
+    sink->flushes++;
+    if (result < 0)
+        sink->error = 1;
+    return result;
+}
+
+// Append a report and its tail to the buffer, or write them through in the stdio mode
+static int report_sink_append(report_sink *sink, const void *data, size_t length, const char *tail, size_t tail_length)
+{
+    if (sink->error)
+        return -1;
+    if (sink->config.mode == REPORT_SINK_STDIO)
+    {
+        if ((fwrite(data, 1, length, sink->file) != length) ||
+            (fwrite(tail, 1, tail_length, sink->file) != tail_length))
+            return -1;
+        return 0;
+    }
+
+    // A report not fitting the buffer is written without copying, after the buffered reports
+    if (sink->length + length + tail_length > sink->config.capacity)
+    {
+        struct iovec parts[] = {
+            {.iov_base = sink->buffer, .iov_len = sink->length},
+            {.iov_base = (void *)data, .iov_len = length},
+            {.iov_base = (void *)tail, .iov_len = tail_length}};
+        return report_sink_output(sink, parts, sizeof(parts) / sizeof(parts[0]));
+    }
+    if ((sink->count == 0) && (sink->config.flush_age_ms > 0))
+        sink->first_ns = stats_now_ns();
+    memcpy(sink->buffer + sink->length, data, length);
+    memcpy(sink->buffer + sink->length + length, tail, tail_length);
+    sink->length += length + tail_length;
+    sink->count++;
+
+    if ((sink->length >= sink->config.flush_bytes) ||
+        ((sink->config.flush_count > 0) && (sink->count >= sink->config.flush_count)) ||
+        ((sink->config.flush_age_ms > 0) && (stats_now_ns() - sink->first_ns >= sink->config.flush_age_ms * 1000000LL)))
+        return report_sink_flush(sink);
+    return 0;
+}
+
+int report_sink_write(report_sink *sink, const void *data, size_t length)
+{
+    return report_sink_append(sink, data, length, "", 0);
+}
+
+int report_sink_write_line(report_sink *sink, const char *line, size_t length)
+{
+    return report_sink_append(sink, line, length, "\n", 1);
+}
+
+int report_sink_flush(report_sink *sink)
+{
+    if (sink->error)
+        return -1;
+    if (sink->length == 0)
+        return 0;
+    struct iovec part = {.iov_base = sink->buffer, .iov_len = sink->length};
+    return report_sink_output(sink, &part, 1);
+}
+
+int report_sink_free(report_sink *sink)
+{
+    int result = report_sink_flush(sink);
+    if (sink->sync && (sink->config.fsync_policy == REPORT_SINK_FSYNC_CLOSE))
+    {
+        if ((fflush(sink->file) != 0) || (fsync(sink->fd) < 0))
+            result = -1;
+    }
+    free(sink->buffer);
+    sink->buffer = NULL;
+    sink->length = 0;
+    sink->count = 0;
+    return result;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file sink.h
+ * @brief Header file for the report output sink.
+ *
+ * The sink decides when the reports reach the output. In the stdio mode, each report
+ * is written to the output stream and the stdio buffering applies, as before. In the
+ * buffered and direct modes, the reports are collected into a preallocated buffer,
+ * which is flushed when it reaches a size, a report count or an age. The buffered
+ * mode flushes to the output stream followed by fflush, and the direct mode bypasses
+ * stdio with writev to the file descriptor. For regular files, the fsync policy syncs
+ * the data on each flush or once at close.
+ */
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define REPORT_SINK_STDIO 0    // fwrite per report, buffered by stdio
+#define REPORT_SINK_BUFFERED 1 // sink buffer flushed with fwrite and fflush
+#define REPORT_SINK_DIRECT 2   // sink buffer flushed with writev to the file descriptor
+#define REPORT_SINK_FSYNC_NONE 0
+#define REPORT_SINK_FSYNC_FLUSH 1 // fdatasync after each flush
+#define REPORT_SINK_FSYNC_CLOSE 2 // fsync when the sink is released
+#define REPORT_SINK_BUFFER_SIZE 65536
+#define REPORT_SINK_FLUSH_AGE_MS 1000
+
+// Sink configuration, a zero limit is not checked
+typedef struct
+{
+    int mode;           // REPORT_SINK_STDIO, REPORT_SINK_BUFFERED or REPORT_SINK_DIRECT
+    int fsync_policy;   // REPORT_SINK_FSYNC_NONE, REPORT_SINK_FSYNC_FLUSH or REPORT_SINK_FSYNC_CLOSE
+    size_t capacity;    // buffer size in bytes
+    size_t flush_bytes; // flush at this buffered size, at most the capacity
+    int flush_count;    // flush at this buffered report count
+    int flush_age_ms;   // flush when the oldest buffered report is this old
+} report_sink_config;
+
+// Report sink of an output stream
+typedef struct
+{
+    report_sink_config config;
+    FILE *file;
+    int fd;           // file descriptor of the direct mode and fsync, or -1
+    int sync;         // the file descriptor is a regular file to sync
+    char *buffer;
+    size_t length;
+    int count;
+    long long first_ns; // monotonic time of the oldest buffered report
+    unsigned long long flushes;
+    int error;          // a write failed, the reports after it are dropped
+} report_sink;
+
+/**
+ * Initializes a sink configuration to the stdio mode with the default limits.
+ *
+ * @param config The sink configuration.
+ */
+void report_sink_config_init(report_sink_config *config);
+
+/**
+ * Initializes a sink of an output stream. The output stream is flushed first, so the
+ * reports of the direct mode follow the data already written to the stream.
+ *
+ * @param sink The report sink.
+ * @param file The output stream.
+ * @param config The sink configuration.
+ * @return 0 on success, or -1 on error.
+ */
+int report_sink_init(report_sink *sink, FILE *file, const report_sink_config *config);
+
+/**
+ * Writes a report, flushing the sink when a limit is reached. A report larger than the
+ * free buffer is written together with the buffered reports.
+ *
+ * @param sink The report sink.
+ * @param data The report data.
+ * @param length The report length.
+ * @return 0 on success, or -1 on a write error.
+ */
+int report_sink_write(report_sink *sink, const void *data, size_t length);
+
+/**
+ * Writes a report line, the report followed by a newline.
+ *
+ * @param sink The report sink.
+ * @param line The report line without the newline.
+ * @param length The line length.
+ * @return 0 on success, or -1 on a write error.
+ */
+int report_sink_write_line(report_sink *sink, const char *line, size_t length);
+
+/**
+ * Writes the buffered reports to the output, and syncs them with the flush policy.
+ *
+ * @param sink The report sink.
+ * @return 0 on success, or -1 on a write error.
+ */
+int report_sink_flush(report_sink *sink);
+
+/**
+ * Flushes the sink, syncs the output with the close policy, and releases the buffer.
+ * The output stream is not closed.
+ *
+ * @param sink The report sink.
+ * @return 0 on success, or -1 on a write error.
+ */
+int report_sink_free(report_sink *sink);
+
+#endif // SINK_H
@@ -0,0 +1,296 @@
+/**
+ * @file stats.c
+ * @brief This file contains the implementation of the report loop statistics.
+ */
+#include "protocol.h"
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#define STATS_EVENTS_MAX 4
+#define STATS_EVENT_SIGNAL 0
+#define STATS_EVENT_SOCKET 1
+#define STATS_EVENT_STOP 2
+#define STATS_SEND_TIMEOUT_S 1
+
+static const char *const stats_stage_names[STATS_STAGE_COUNT] = {
+    "timer_lateness", "read", "format", "output", "control", "tick"};
+
+void stats_counter_add(atomic_ullong *counter, uint64_t value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+int stats_histogram_bucket(uint64_t value)
+{
+    if (value < STATS_HISTOGRAM_SUB_COUNT)
+        return (int)value;
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - STATS_HISTOGRAM_SUB_BITS;
+    int sub = (value >> shift) & (STATS_HISTOGRAM_SUB_COUNT - 1);
+    return (shift + 1) * STATS_HISTOGRAM_SUB_COUNT + sub;
+}
+
+// Largest value of a bucket
+static uint64_t stats_bucket_upper(int bucket)
+{
+    if (bucket < STATS_HISTOGRAM_SUB_COUNT)
+        return bucket;
+    int shift = bucket / STATS_HISTOGRAM_SUB_COUNT - 1;
+    uint64_t lower = (uint64_t)(STATS_HISTOGRAM_SUB_COUNT + bucket % STATS_HISTOGRAM_SUB_COUNT) << shift;
+    return lower + ((1ULL << shift) - 1);
+}
+
+void stats_histogram_record(stats_histogram *histogram, uint64_t value)
+{
+    stats_counter_add(&histogram->buckets[stats_histogram_bucket(value)], 1);
+    stats_counter_add(&histogram->count, 1);
+    stats_counter_add(&histogram->sum, value);
+    if (value > atomic_load_explicit(&histogram->max, memory_order_relaxed))
+        atomic_store_explicit(&histogram->max, value, memory_order_relaxed);
+}
+
+void stats_histogram_record_shared(stats_histogram *histogram, uint64_t value)
+{
+    atomic_fetch_add_explicit(&histogram->buckets[stats_histogram_bucket(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+    unsigned long long max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while ((value > max) && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+uint64_t stats_histogram_percentile(const stats_histogram *histogram, double percentile)
+{
+    uint64_t count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    if (count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(percentile / 100.0 * count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+    {
+        seen += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        if (seen >= rank)
+        {
+            uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+            uint64_t upper = stats_bucket_upper(i);
+            return upper < max ? upper : max;
+        }
+    }
+    return atomic_load_explicit(&histogram->max, memory_order_relaxed);
+}
+
+void stats_histogram_write(const stats_histogram *histogram, FILE *file)
+{
+    uint64_t count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    uint64_t sum = atomic_load_explicit(&histogram->sum, memory_order_relaxed);
+    fprintf(file, "count %llu mean_ns %llu p50_ns %llu p90_ns %llu p99_ns %llu p99.9_ns %llu max_ns %llu\n",
+            (unsigned long long)count,
+            (unsigned long long)(count ? sum / count : 0),
+            (unsigned long long)stats_histogram_percentile(histogram, 50.0),
+            (unsigned long long)stats_histogram_percentile(histogram, 90.0),
+            (unsigned long long)stats_histogram_percentile(histogram, 99.0),
+            (unsigned long long)stats_histogram_percentile(histogram, 99.9),
+            (unsigned long long)atomic_load_explicit(&histogram->max, memory_order_relaxed));
+}
+
+long long stats_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int report_stats_init(report_stats *stats, const channel_table *channels)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->signal_fd = -1;
+    stats->listen_fd = -1;
+    stats->stop_fd = -1;
+    stats->channels = channels;
+    stats->channel_count = channels->count;
+    stats->channel_stats = calloc(channels->count > 0 ? channels->count : 1, sizeof(stats_channel));
+    return stats->channel_stats != NULL ? 0 : -1;
+}
+
+void report_stats_write(const report_stats *stats, FILE *file)
+{
+    fprintf(file, "ticks %llu\n", (unsigned long long)atomic_load_explicit(&stats->ticks, memory_order_relaxed));
+    fprintf(file, "queue dropped %llu coalesced %llu\n",
+            (unsigned long long)atomic_load_explicit(&stats->reports_dropped, memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&stats->reports_coalesced, memory_order_relaxed));
+    fprintf(file, "shards moved %llu\n", (unsigned long long)atomic_load_explicit(&stats->channels_moved, memory_order_relaxed));
+    fprintf(file, "control unsent %llu\n", (unsigned long long)atomic_load_explicit(&stats->control_unsent, memory_order_relaxed));
+    for (int i = 0; i < STATS_STAGE_COUNT; i++)
+    {
+        fprintf(file, "stage %s ", stats_stage_names[i]);
+        stats_histogram_write(&stats->stages[i], file);
+    }
+    for (int i = 0; i < stats->channel_count; i++)
+    {
+        const stats_channel *channel = &stats->channel_stats[i];
+        fprintf(file, "channel %s bytes %llu lines %llu empty_intervals %llu recv_errors %llu reconnects %llu\n",
+                stats->channels->configs[i].name,
+                (unsigned long long)atomic_load_explicit(&channel->bytes, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&channel->lines, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&channel->empty_intervals, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&channel->recv_errors, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&channel->reconnects, memory_order_relaxed));
+    }
+    if (stats->control_latency != NULL)
+        control_latency_write(stats->control_latency, file);
+}
+
+// Write a snapshot to the dump file, replacing the previous one
+static void stats_dump_file(report_stats *stats)
+{
+    FILE *file = fopen(stats->file_path, "w");
+    if (file == NULL)
+        return;
+    report_stats_write(stats, file);
+    fclose(file);
+}
+
+// Write a snapshot to a connected client and close the connection
+static void stats_dump_client(report_stats *stats)
+{
+    int client_fd = accept4(stats->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client_fd < 0)
+        return;
+    struct timeval timeout = {STATS_SEND_TIMEOUT_S, 0};
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    FILE *file = fdopen(client_fd, "w");
+    if (file == NULL)
+    {
+        close(client_fd);
+        return;
+    }
+    report_stats_write(stats, file);
+    fclose(file);
+}
+
+// Dump thread, waits for SIGUSR1, client connections and the stop event
+static void *stats_run(void *arg)
+{
+    report_stats *stats = arg;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = {.events = EPOLLIN};
+    int fds[] = {stats->signal_fd, stats->listen_fd, stats->stop_fd};
+    for (int i = 0; i < 3; i++)
+    {
+        event.data.u32 = i;
+        if (fds[i] >= 0)
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &event);
+    }
+
+    int running = (epoll_fd >= 0);
+    while (running)
+    {
+        struct epoll_event events[STATS_EVENTS_MAX];
+        int event_count = epoll_wait(epoll_fd, events, STATS_EVENTS_MAX, -1);
+        for (int e = 0; e < event_count; e++)
+        {
+            if (events[e].data.u32 == STATS_EVENT_SIGNAL)
+            {
+                struct signalfd_siginfo siginfo;
+                if ((read(stats->signal_fd, &siginfo, sizeof(siginfo)) == sizeof(siginfo)) && (stats->file_path != NULL))
+                    stats_dump_file(stats);
+            }
+            else if (events[e].data.u32 == STATS_EVENT_SOCKET)
+                stats_dump_client(stats);
+            else
+                running = 0;
+        }
+    }
+    close(epoll_fd);
+    return NULL;
+}
+
+// Listen on a Unix socket, replacing a stale socket file
+static int stats_listen(const char *path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path))
+        return -1;
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    unlink(path);
+    if ((bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) || (listen(fd, 8) < 0))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int report_stats_start(report_stats *stats, const char *file_path, const char *socket_path)
+{
+    stats->file_path = file_path;
+    stats->socket_path = socket_path;
+
+    // SIGUSR1 stays pending for the signalfd of the dump thread
+    sigset_t sigusr1_mask;
+    sigemptyset(&sigusr1_mask);
+    sigaddset(&sigusr1_mask, SIGUSR1);
+    if (file_path != NULL)
+    {
+        sigprocmask(SIG_BLOCK, &sigusr1_mask, NULL);
+        stats->signal_fd = signalfd(-1, &sigusr1_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    }
+    if (socket_path != NULL)
+        stats->listen_fd = stats_listen(socket_path);
+    stats->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (((file_path != NULL) && (stats->signal_fd < 0)) || ((socket_path != NULL) && (stats->listen_fd < 0)) || (stats->stop_fd < 0))
+    {
+        report_stats_stop(stats);
+        return -1;
+    }
+
+    // The dump thread blocks all signals and reads SIGUSR1 from the signalfd
+    sigset_t all_signals, previous_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &previous_mask);
+    int result = pthread_create(&stats->thread, NULL, stats_run, stats);
+    pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
+    if (result != 0)
+    {
+        report_stats_stop(stats);
+        return -1;
+    }
+    stats->started = 1;
+    return 0;
+}
+
+void report_stats_stop(report_stats *stats)
+{
+    if (stats->started)
+    {
+        uint64_t stop = 1;
+        write(stats->stop_fd, &stop, sizeof(stop));
+        pthread_join(stats->thread, NULL);
+        stats->started = 0;
+    }
+    if (stats->listen_fd >= 0)
+    {
+        close(stats->listen_fd);
+        unlink(stats->socket_path);
+    }
+    if (stats->signal_fd >= 0)
+        close(stats->signal_fd);
+    if (stats->stop_fd >= 0)
+        close(stats->stop_fd);
+    stats->signal_fd = -1;
+    stats->listen_fd = -1;
+    stats->stop_fd = -1;
+}
+
+void report_stats_free(report_stats *stats)
+{
+    report_stats_stop(stats);
+    free(stats->channel_stats);
+    stats->channel_stats = NULL;
+    stats->channel_count = 0;
+}
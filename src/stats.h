@@ -0,0 +1,175 @@
+/**
+ * @file stats.h
+ * @brief Header file for the report loop statistics.
+ *
+ * The report loop records the duration of each hot-path stage into a fixed-bucket
+ * log-linear histogram and counts the per-channel bytes, lines, empty intervals and
+ * receive errors. The report thread is the only writer, with relaxed atomic stores,
+ * and a stats thread dumps a snapshot on demand, to a file on SIGUSR1 or to each
+ * client connecting to a local Unix socket, without pausing the reporting.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "channel.h"
+
+struct control_latency;
+
+#define STATS_HISTOGRAM_SUB_BITS 3 // 8 linear buckets per power of two, 12.5 % resolution
+#define STATS_HISTOGRAM_SUB_COUNT (1 << STATS_HISTOGRAM_SUB_BITS)
+#define STATS_HISTOGRAM_BUCKETS ((64 - STATS_HISTOGRAM_SUB_BITS + 1) * STATS_HISTOGRAM_SUB_COUNT)
+
+// Hot-path stages of the report loop
+#define STATS_STAGE_TIMER_LATENESS 0 // tick handled after the timer deadline
+#define STATS_STAGE_READ 1           // socket read of a channel
+#define STATS_STAGE_FORMAT 2         // report formatting
+#define STATS_STAGE_OUTPUT 3         // report output, fprintf or binary write
+#define STATS_STAGE_CONTROL 4        // control messages sent on a tick
+#define STATS_STAGE_TICK 5           // whole tick from the timer read to the value reset
+#define STATS_STAGE_COUNT 6
+
+// Log-linear histogram of nanosecond durations, exact below STATS_HISTOGRAM_SUB_COUNT
+typedef struct
+{
+    atomic_ullong count;
+    atomic_ullong sum;
+    atomic_ullong max;
+    atomic_ullong buckets[STATS_HISTOGRAM_BUCKETS];
+} stats_histogram;
+
+// Per-channel counters
+typedef struct
+{
+    atomic_ullong bytes;
+    atomic_ullong lines;
+    atomic_ullong empty_intervals; // ticks reporting "--"
+    atomic_ullong recv_errors;
+    atomic_ullong reconnects;
+} stats_channel;
+
+// Report loop statistics and the dump thread
+typedef struct
+{
+    stats_histogram stages[STATS_STAGE_COUNT];
+    atomic_ullong ticks;
+    atomic_ullong reports_dropped;   // pipeline reports dropped by a full queue
+    atomic_ullong reports_coalesced; // pipeline reports held by a full queue and replaced
+    atomic_ullong channels_moved;    // channels handed over between the pipeline ingest shards
+    atomic_ullong control_unsent;    // control messages of the rules not sent by a failed sendmmsg
+    int channel_count;
+    const channel_table *channels;
+    stats_channel *channel_stats;
+    const struct control_latency *control_latency; // per-rule control latencies, or NULL
+
+    const char *file_path;   // dump file on SIGUSR1, or NULL
+    const char *socket_path; // Unix socket path, or NULL
+    int signal_fd;
+    int listen_fd;
+    int stop_fd;
+    pthread_t thread;
+    int started;
+} report_stats;
+
+/**
+ * Adds to a counter, called by the single writer, without a locked instruction.
+ *
+ * @param counter The counter.
+ * @param value The value to add.
+ */
+void stats_counter_add(atomic_ullong *counter, uint64_t value);
+
+/**
+ * Records a value into a histogram, called by the single writer.
+ *
+ * @param histogram The histogram.
+ * @param value The value in nanoseconds.
+ */
+void stats_histogram_record(stats_histogram *histogram, uint64_t value);
+
+/**
+ * Records a value into a histogram shared by several writers, with locked instructions.
+ *
+ * @param histogram The histogram.
+ * @param value The value in nanoseconds.
+ */
+void stats_histogram_record_shared(stats_histogram *histogram, uint64_t value);
+
+/**
+ * Returns the value at a percentile, the upper bound of the bucket.
+ *
+ * @param histogram The histogram.
+ * @param percentile The percentile, 0.0 to 100.0.
+ * @return The value at the percentile, or 0 if empty.
+ */
+uint64_t stats_histogram_percentile(const stats_histogram *histogram, double percentile);
+
+/**
+ * Writes the count, mean, percentiles and maximum of a histogram as one line.
+ *
+ * @param histogram The histogram.
+ * @param file The file to write to.
+ */
+void stats_histogram_write(const stats_histogram *histogram, FILE *file);
+
+/**
+ * Returns the bucket index of a value.
+ *
+ * @param value The value.
+ * @return The bucket index.
+ */
+int stats_histogram_bucket(uint64_t value);
+
+/**
+ * Returns the CLOCK_MONOTONIC time in nanoseconds for the stage durations.
+ *
+ * @return The monotonic time in nanoseconds.
+ */
+long long stats_now_ns(void);
+
+/**
+ * Initializes the statistics of a channel table.
+ *
+ * @param stats The statistics.
+ * @param channels The channel table, the names are used for the dump.
+ * @return 0 on success, or -1 on allocation failure.
+ */
+int report_stats_init(report_stats *stats, const channel_table *channels);
+
+/**
+ * Writes a snapshot of the statistics as text lines.
+ *
+ * @param stats The statistics.
+ * @param file The output file.
+ */
+void report_stats_write(const report_stats *stats, FILE *file);
+
+/**
+ * Starts the dump thread. SIGUSR1 is blocked in the calling thread, and should be
+ * blocked in the other threads, so that it is received by the dump thread.
+ *
+ * @param stats The statistics.
+ * @param file_path The dump file written on SIGUSR1, or NULL.
+ * @param socket_path The Unix socket path, or NULL.
+ * @return 0 on success, or -1 on error.
+ */
+int report_stats_start(report_stats *stats, const char *file_path, const char *socket_path);
+
+/**
+ * Stops the dump thread and removes the Unix socket.
+ *
+ * @param stats The statistics.
+ */
+void report_stats_stop(report_stats *stats);
+
+/**
+ * Stops the dump thread and releases the channel counters.
+ *
+ * @param stats The statistics.
+ */
+void report_stats_free(report_stats *stats);
+
+#endif // STATS_H
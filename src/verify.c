@@ -0,0 +1,384 @@
+/**
+ * @file verify.c
+ * @brief This file contains the implementation of the streaming report verifier.
+ */
+#include "protocol.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define REPORT_VERIFY_READ_SIZE 65536
+#define REPORT_VERIFY_CONTROL_AMPLITUDE 5.0 // default out1 amplitude
+
+_Static_assert(REPORT_VERIFY_HISTORY == CONTROL_PROPAGATION_DELAY + 1, "out3 level history for the propagation delay");
+
+// Pass a violation to the handler
+static void report_verifier_violation(report_verifier *verifier, int type, long long offset,
+                                      long long timestamp, long long interval_ms, float value)
+{
+    if (verifier->handler == NULL)
+        return;
+    report_violation violation = {type, verifier->lines, offset, timestamp, interval_ms, value};
+    verifier->handler(verifier->context, &violation);
+}
+
+// Verify a complete line without the newline
+static void report_verifier_line(report_verifier *verifier, const char *line, size_t length, long long offset)
+{
+    report_message message;
+
+    verifier->lines++;
+    if (length == 0)
+        return;
+    if ((parse_report_buffer(line, length, &message, 1, NULL) != 1) || (message.count <= CHANNEL_OUT3))
+    {
+        verifier->malformed_lines++;
+        report_verifier_violation(verifier, REPORT_VIOLATION_MALFORMED, offset, 0, 0, 0.0f);
+        return;
+    }
+
+    if (verifier->has_previous)
+    {
+        long long interval_ms = message.timestamp - verifier->previous_timestamp;
+        if ((interval_ms > verifier->interval_ms + verifier->tolerance_ms) || (interval_ms < verifier->interval_ms - verifier->tolerance_ms))
+        {
+            verifier->timing_violations++;
+            report_verifier_violation(verifier, REPORT_VIOLATION_TIMING, offset, message.timestamp, interval_ms, 0.0f);
+        }
+    }
+    verifier->previous_timestamp = message.timestamp;
+    verifier->has_previous = 1;
+
+    if (message.values[CHANNEL_OUT3] == 5.0)
+        verifier->level = REPORT_LEVEL_HIGH;
+    else if (message.values[CHANNEL_OUT3] == 0.0)
+        verifier->level = REPORT_LEVEL_LOW;
+    verifier->history[verifier->reports % REPORT_VERIFY_HISTORY] = verifier->level;
+
+    // The out1 effect of the out3 level is seen after the propagation delay
+    if (verifier->reports >= CONTROL_PROPAGATION_DELAY)
+    {
+        int level = verifier->history[(verifier->reports - CONTROL_PROPAGATION_DELAY) % REPORT_VERIFY_HISTORY];
+        float out1 = message.values[CHANNEL_OUT1];
+        int above = (out1 > REPORT_VERIFY_CONTROL_AMPLITUDE) || (out1 < -REPORT_VERIFY_CONTROL_AMPLITUDE);
+        if (above && (level == REPORT_LEVEL_HIGH))
+            verifier->control_effect_seen = 1;
+        else if (above && (level == REPORT_LEVEL_LOW))
+        {
+            verifier->control_violations++;
+            report_verifier_violation(verifier, REPORT_VIOLATION_CONTROL, offset, message.timestamp, 0, out1);
+        }
+    }
+    verifier->reports++;
+}
+
+// Verify the buffered last line, when the input does not end with a newline
+static void report_verifier_flush(report_verifier *verifier)
+{
+    if (verifier->partial_skip)
+    {
+        verifier->lines++;
+        verifier->malformed_lines++;
+        report_verifier_violation(verifier, REPORT_VIOLATION_MALFORMED, verifier->line_offset, 0, 0, 0.0f);
+    }
+    else if (verifier->partial_length > 0)
+        report_verifier_line(verifier, verifier->partial, verifier->partial_length, verifier->line_offset);
+    verifier->partial_length = 0;
+    verifier->partial_skip = 0;
+}
+
+int report_verifier_init(report_verifier *verifier, long interval_ms, report_violation_handler handler, void *context)
+{
+    memset(verifier, 0, sizeof(*verifier));
+    verifier->interval_ms = interval_ms;
+    verifier->tolerance_ms = REPORT_VERIFY_TOLERANCE_MS;
+    verifier->handler = handler;
+    verifier->context = context;
+    verifier->level = REPORT_LEVEL_UNKNOWN;
+    for (int i = 0; i < REPORT_VERIFY_HISTORY; i++)
+        verifier->history[i] = REPORT_LEVEL_UNKNOWN;
+    verifier->partial = malloc(REPORT_VERIFY_LINE_SIZE);
+    return verifier->partial != NULL ? 0 : -1;
+}
+
+void report_verifier_feed(report_verifier *verifier, const char *data, size_t length)
+{
+    const char *position = data;
+    const char *end = data + length;
+
+    while (position < end)
+    {
+        const char *newline = memchr(position, '\n', end - position);
+        size_t piece = (newline ? newline : end) - position;
+        long long offset = verifier->offset + (position - data);
+
+        // Complete lines are verified in place, only a line split across pieces is copied
+        if ((newline != NULL) && (verifier->partial_length == 0) && !verifier->partial_skip)
+            report_verifier_line(verifier, position, piece, offset);
+        else
+        {
+            if ((verifier->partial_length == 0) && !verifier->partial_skip)
+                verifier->line_offset = offset;
+            if (verifier->partial_length + piece > REPORT_VERIFY_LINE_SIZE)
+                verifier->partial_skip = 1;
+            if (!verifier->partial_skip)
+            {
+                memcpy(verifier->partial + verifier->partial_length, position, piece);
+                verifier->partial_length += piece;
+            }
+            if (newline != NULL)
+                report_verifier_flush(verifier);
+        }
+        position += piece + (newline != NULL);
+    }
+    verifier->offset += length;
+}
+
+int report_verifier_finish(report_verifier *verifier)
+{
+    report_verifier_flush(verifier);
+    if (!verifier->control_effect_seen)
+        report_verifier_violation(verifier, REPORT_VIOLATION_NO_CONTROL_EFFECT, verifier->offset, 0, 0, 0.0f);
+    int violations = verifier->timing_violations + verifier->control_violations + verifier->malformed_lines > 0;
+    return (violations || !verifier->control_effect_seen) ? -1 : 0;
+}
+
+void report_verifier_free(report_verifier *verifier)
+{
+    free(verifier->partial);
+    verifier->partial = NULL;
+}
+
+// Chunk of a memory-mapped file verified by a thread
+typedef struct
+{
+    const char *data;
+    size_t length;
+    report_verifier verifier;
+    FILE *violations; // violations of the second pass, replayed in the file order
+    pthread_t thread;
+} report_verify_chunk;
+
+// Write a violation of a chunk to the temporary file of the chunk
+static void report_verify_chunk_violation(void *context, const report_violation *violation)
+{
+    fwrite(violation, sizeof(*violation), 1, (FILE *)context);
+}
+
+static void *report_verify_chunk_run(void *arg)
+{
+    report_verify_chunk *chunk = arg;
+    report_verifier_feed(&chunk->verifier, chunk->data, chunk->length);
+    report_verifier_flush(&chunk->verifier);
+    return NULL;
+}
+
+// Run a pass over the chunks, a thread per chunk with all signals blocked
+static int report_verify_pass(report_verify_chunk *chunks, int count)
+{
+    sigset_t all_signals, previous_mask;
+    int started = 0;
+
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &previous_mask);
+    for (; started < count; started++)
+    {
+        if (pthread_create(&chunks[started].thread, NULL, report_verify_chunk_run, &chunks[started]) != 0)
+            break;
+    }
+    pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
+    for (int i = 0; i < started; i++)
+        pthread_join(chunks[i].thread, NULL);
+    return started == count ? 0 : -1;
+}
+
+// Chain the state after a chunk from the state entering it and the summary of the chunk
+static void report_verify_chain(report_verifier *next, const report_verifier *entering, const report_verifier *summary)
+{
+    next->lines = entering->lines + summary->lines;
+    next->offset = entering->offset + summary->offset;
+    next->reports = entering->reports + summary->reports;
+    next->has_previous = entering->has_previous || summary->has_previous;
+    next->previous_timestamp = summary->has_previous ? summary->previous_timestamp : entering->previous_timestamp;
+    next->level = (summary->level == REPORT_LEVEL_INHERIT) ? entering->level : summary->level;
+    for (long long n = next->reports - REPORT_VERIFY_HISTORY; n < next->reports; n++)
+    {
+        if (n < 0)
+            continue;
+        int level = entering->history[n % REPORT_VERIFY_HISTORY];
+        if (n >= entering->reports)
+        {
+            level = summary->history[(n - entering->reports) % REPORT_VERIFY_HISTORY];
+            if (level == REPORT_LEVEL_INHERIT)
+                level = entering->level;
+        }
+        next->history[n % REPORT_VERIFY_HISTORY] = level;
+    }
+}
+
+// Verify a mapped file on newline-aligned chunks by the threads
+static int report_verify_chunks(const char *data, size_t length, report_verifier *verifier, int threads)
+{
+    report_verify_chunk chunks[REPORT_VERIFY_THREADS_MAX];
+    int result = 0;
+
+    // The chunk boundaries follow a newline
+    size_t start = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        size_t end = (i == threads - 1) ? length : length / threads * (i + 1);
+        if (end < start)
+            end = start;
+        const char *newline = (end < length) ? memchr(data + end, '\n', length - end) : NULL;
+        end = (newline != NULL) ? (size_t)(newline - data) + 1 : length;
+        chunks[i].data = data + start;
+        chunks[i].length = end - start;
+        chunks[i].violations = NULL;
+        start = end;
+    }
+
+    // First pass, each chunk summarized from an inherited state
+    for (int i = 0; i < threads; i++)
+    {
+        report_verifier *summary = &chunks[i].verifier;
+        if (report_verifier_init(summary, verifier->interval_ms, NULL, NULL) < 0)
+        {
+            for (int j = 0; j < i; j++)
+                report_verifier_free(&chunks[j].verifier);
+            return -1;
+        }
+        summary->level = REPORT_LEVEL_INHERIT;
+        for (int j = 0; j < REPORT_VERIFY_HISTORY; j++)
+            summary->history[j] = REPORT_LEVEL_INHERIT;
+    }
+    if (report_verify_pass(chunks, threads) < 0)
+        result = -1;
+
+    // Second pass, each chunk from the chained entering state, the violations to a temporary file
+    report_verifier entering = *verifier;
+    for (int i = 0; (result == 0) && (i < threads); i++)
+    {
+        report_verifier summary = chunks[i].verifier;
+        report_verifier *chunk_verifier = &chunks[i].verifier;
+        chunk_verifier->lines = entering.lines;
+        chunk_verifier->offset = entering.offset;
+        chunk_verifier->reports = entering.reports;
+        chunk_verifier->has_previous = entering.has_previous;
+        chunk_verifier->previous_timestamp = entering.previous_timestamp;
+        chunk_verifier->level = entering.level;
+        memcpy(chunk_verifier->history, entering.history, sizeof(entering.history));
+        chunk_verifier->timing_violations = 0;
+        chunk_verifier->control_violations = 0;
+        chunk_verifier->malformed_lines = 0;
+        chunk_verifier->control_effect_seen = 0;
+        chunk_verifier->tolerance_ms = verifier->tolerance_ms;
+        chunks[i].violations = tmpfile();
+        if (chunks[i].violations == NULL)
+            result = -1;
+        chunk_verifier->handler = report_verify_chunk_violation;
+        chunk_verifier->context = chunks[i].violations;
+        report_verify_chain(&entering, &entering, &summary);
+    }
+    if ((result == 0) && (report_verify_pass(chunks, threads) < 0))
+        result = -1;
+
+    // The violations are replayed in the file order and the counters merged
+    for (int i = 0; i < threads; i++)
+    {
+        report_verifier *chunk_verifier = &chunks[i].verifier;
+        if ((result == 0) && (chunks[i].violations != NULL))
+        {
+            report_violation violation;
+            rewind(chunks[i].violations);
+            while (fread(&violation, sizeof(violation), 1, chunks[i].violations) == 1)
+            {
+                if (verifier->handler != NULL)
+                    verifier->handler(verifier->context, &violation);
+            }
+            verifier->timing_violations += chunk_verifier->timing_violations;
+            verifier->control_violations += chunk_verifier->control_violations;
+            verifier->malformed_lines += chunk_verifier->malformed_lines;
+            verifier->control_effect_seen |= chunk_verifier->control_effect_seen;
+        }
+        if (chunks[i].violations != NULL)
+            fclose(chunks[i].violations);
+        report_verifier_free(chunk_verifier);
+    }
+    if (result == 0)
+    {
+        // The caller continues from the state after the last chunk
+        verifier->lines = entering.lines;
+        verifier->offset = entering.offset;
+        verifier->reports = entering.reports;
+        verifier->has_previous = entering.has_previous;
+        verifier->previous_timestamp = entering.previous_timestamp;
+        verifier->level = entering.level;
+        memcpy(verifier->history, entering.history, sizeof(entering.history));
+    }
+    return result;
+}
+
+int report_verify_fd(int fd, report_verifier *verifier, int threads)
+{
+    struct stat status;
+    if (threads > REPORT_VERIFY_THREADS_MAX)
+        threads = REPORT_VERIFY_THREADS_MAX;
+
+    if ((fstat(fd, &status) == 0) && S_ISREG(status.st_mode) && (status.st_size > 0))
+    {
+        const char *data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            madvise((void *)data, status.st_size, MADV_SEQUENTIAL);
+            int result = 0;
+            if (threads > 1)
+                result = report_verify_chunks(data, status.st_size, verifier, threads);
+            else
+                report_verifier_feed(verifier, data, status.st_size);
+            munmap((void *)data, status.st_size);
+            if (result < 0)
+                return -1;
+            return report_verifier_finish(verifier);
+        }
+    }
+
+    // Pipes and unmappable files are read in pieces
+    char *buffer = malloc(REPORT_VERIFY_READ_SIZE);
+    if (buffer == NULL)
+        return -1;
+    ssize_t read_count;
+    while ((read_count = read(fd, buffer, REPORT_VERIFY_READ_SIZE)) != 0)
+    {
+        if (read_count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            free(buffer);
+            return -1;
+        }
+        report_verifier_feed(verifier, buffer, read_count);
+    }
+    free(buffer);
+    return report_verifier_finish(verifier);
+}
+
+void report_violation_print(void *context, const report_violation *violation)
+{
+    FILE *file = context;
+    switch (violation->type)
+    {
+    case REPORT_VIOLATION_TIMING:
+        fprintf(file, "line %lld offset %lld: timing, interval %lld ms at timestamp %lld\n",
+                violation->line, violation->offset, violation->interval_ms, violation->timestamp);
+        break;
+    case REPORT_VIOLATION_CONTROL:
+        fprintf(file, "line %lld offset %lld: control, out1 %g with out3 low at timestamp %lld\n",
+                violation->line, violation->offset, violation->value, violation->timestamp);
+        break;
+    case REPORT_VIOLATION_MALFORMED:
+        fprintf(file, "line %lld offset %lld: malformed report line\n", violation->line, violation->offset);
+        break;
+    default:
+        fprintf(file, "line %lld offset %lld: no out1 control effect with out3 high\n", violation->line, violation->offset);
+        break;
+    }
+}
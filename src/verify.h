@@ -0,0 +1,138 @@
+/**
+ * @file verify.h
+ * @brief Header file for the streaming report verifier.
+ *
+ * The verifier checks the report timing and the out1 control effects of the out3
+ * level line by line, so a report log of any length is verified in constant memory.
+ * The input is fed in arbitrary pieces, and only a line split across the pieces is
+ * copied. Each violation is passed to a handler with the line number and byte offset.
+ *
+ * A memory-mapped log can be verified by several threads on newline-aligned chunks.
+ * A first pass summarizes each chunk from an inherited state, the summaries are
+ * chained to the entering state of each chunk, and a second pass reports the
+ * violations of the chunks in the file order.
+ */
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define REPORT_VERIFY_LINE_SIZE 32768 // longest verified line, as REPORT_BUFFER_SIZE
+#define REPORT_VERIFY_TOLERANCE_MS 10
+#define REPORT_VERIFY_HISTORY 2       // CONTROL_PROPAGATION_DELAY + 1 out3 levels
+#define REPORT_VERIFY_THREADS_MAX 64
+
+// Violation types
+#define REPORT_VIOLATION_TIMING 0          // report interval off by more than the tolerance
+#define REPORT_VIOLATION_CONTROL 1         // out1 above the default amplitude while out3 is low
+#define REPORT_VIOLATION_MALFORMED 2       // line not parsed as a report with out1..out3
+#define REPORT_VIOLATION_NO_CONTROL_EFFECT 3 // out1 never above the default amplitude while out3 is high
+
+// Levels of out3 for the control check
+#define REPORT_LEVEL_INHERIT -1 // not yet seen in a chunk, taken from the preceding chunk
+#define REPORT_LEVEL_UNKNOWN 0
+#define REPORT_LEVEL_LOW 1
+#define REPORT_LEVEL_HIGH 2
+
+// Violation with the position of the line
+typedef struct
+{
+    int type;
+    long long line;      // line number, from 1
+    long long offset;    // byte offset of the line start
+    long long timestamp; // report timestamp, if parsed
+    long long interval_ms; // interval to the previous report, for the timing violations
+    float value;         // out1 value, for the control violations
+} report_violation;
+
+/**
+ * Violation handler called for each violation in the input order.
+ *
+ * @param context The handler context.
+ * @param violation The violation.
+ */
+typedef void (*report_violation_handler)(void *context, const report_violation *violation);
+
+// Streaming verifier state, the counters and the carried state of the preceding reports
+typedef struct
+{
+    long interval_ms;
+    long tolerance_ms;
+    report_violation_handler handler;
+    void *context;
+
+    long long lines;   // lines started
+    long long offset;  // bytes fed
+    long long reports; // parsed reports
+    long long previous_timestamp;
+    int has_previous;
+    int level;                            // out3 level after the last report
+    int history[REPORT_VERIFY_HISTORY];   // out3 level after the report n, at n % REPORT_VERIFY_HISTORY
+    int control_effect_seen;
+
+    long long timing_violations;
+    long long control_violations;
+    long long malformed_lines;
+
+    long long line_offset;   // offset of the line in the partial buffer
+    size_t partial_length;
+    int partial_skip;        // skipping the rest of a line too long for the buffer
+    char *partial;
+} report_verifier;
+
+/**
+ * Initializes a verifier.
+ *
+ * @param verifier The verifier.
+ * @param interval_ms The expected report interval.
+ * @param handler The violation handler, or NULL to only count the violations.
+ * @param context The handler context.
+ * @return 0 on success, or -1 on allocation failure.
+ */
+int report_verifier_init(report_verifier *verifier, long interval_ms, report_violation_handler handler, void *context);
+
+/**
+ * Verifies the next piece of the input.
+ *
+ * @param verifier The verifier.
+ * @param data The input data, any split of the lines.
+ * @param length The data length in bytes.
+ */
+void report_verifier_feed(report_verifier *verifier, const char *data, size_t length);
+
+/**
+ * Verifies the last line without a newline and checks that the control effect was seen.
+ *
+ * @param verifier The verifier.
+ * @return 0 when no violations were found, or -1 otherwise.
+ */
+int report_verifier_finish(report_verifier *verifier);
+
+/**
+ * Releases the line buffer of the verifier.
+ *
+ * @param verifier The verifier.
+ */
+void report_verifier_free(report_verifier *verifier);
+
+/**
+ * Verifies a file descriptor to the end, a regular file memory-mapped and split
+ * across threads, other files such as pipes read in pieces by a single thread.
+ *
+ * @param fd The input file descriptor.
+ * @param verifier The initialized verifier, holding the result counters on return.
+ * @param threads The number of threads for a memory-mapped file, 1 for none.
+ * @return 0 when no violations were found, -1 on violations or on a read error.
+ */
+int report_verify_fd(int fd, report_verifier *verifier, int threads);
+
+/**
+ * Prints a violation as a line with the position, usable as a violation handler.
+ *
+ * @param context The output FILE.
+ * @param violation The violation.
+ */
+void report_violation_print(void *context, const report_violation *violation);
+
+#endif // VERIFY_H
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // as in protocol.h, before the system headers
 #ifndef TEST_H
 #define TEST_H
 
@@ -0,0 +1,261 @@
+#include "test.h"
+#include "../src/protocol.h"
+#include <pthread.h>
+
+#define TEST_AGGREGATE_UPDATES 200000
+#define TEST_AGGREGATE_REPORTS 20
+#define TEST_AGGREGATE_FEED_US 500
+#define TEST_AGGREGATE_SPIKE 9.0f
+
+static void test_batch_fill(aggregate_batch *batch, const float *values, int count, long long timestamp_ns)
+{
+    batch->count = count;
+    for (int i = 0; i < count; i++)
+    {
+        batch->values[i] = values[i];
+        batch->timestamps_ns[i] = timestamp_ns;
+    }
+}
+
+int test_aggregate_batch(void)
+{
+    // A batch of 21 samples covers the vector lanes and the scalar tail
+    aggregate_table table;
+    int result = aggregate_table_init(&table, 2);
+    ASSERT_EQ("table init", SUCCESS, result);
+    float values[21];
+    for (int i = 0; i < 21; i++)
+        values[i] = (float)(i - 10);
+    values[13] = 8.5f;
+    aggregate_batch batch;
+    test_batch_fill(&batch, values, 21, 1000);
+    aggregate_update(&table, 1, &batch);
+
+    aggregate_take(&table, 1);
+    const channel_aggregate *taken = &table.taken[1];
+    int count = (int)taken->count;
+    ASSERT_EQ("count", 21, count);
+    ASSERT_EQ("min", 1, taken->min == -10.0f);
+    ASSERT_EQ("max", 1, taken->max == 10.0f);
+    ASSERT_EQ("mean", 1, fabs(aggregate_mean(taken) - 5.5 / 21) < 1e-6);
+    ASSERT_EQ("rms", 1, fabs(aggregate_rms(taken) - sqrt((770 - 9 + 72.25) / 21)) < 1e-5);
+
+    // A sample is taken once, and a channel without samples has no mean
+    aggregate_take(&table, 1);
+    count = (int)table.taken[1].count;
+    ASSERT_EQ("taken once", 0, count);
+    ASSERT_EQ("no mean", 1, isnan(aggregate_mean(&table.taken[1])));
+    aggregate_take(&table, 0);
+    count = (int)table.taken[0].count;
+    ASSERT_EQ("other channel", 0, count);
+
+    // The updates between two takes are merged
+    test_batch_fill(&batch, values, 3, 2000);
+    aggregate_update(&table, 1, &batch);
+    aggregate_update(&table, 1, &batch);
+    aggregate_take(&table, 1);
+    count = (int)table.taken[1].count;
+    ASSERT_EQ("merged updates", 6, count);
+    ASSERT_EQ("merged max", 1, table.taken[1].max == -8.0f);
+    aggregate_table_free(&table);
+    return 0;
+}
+
+int test_aggregate_frequency(void)
+{
+    // A 2 Hz sine sampled every millisecond, in batches not aligned with the period
+    aggregate_table table;
+    aggregate_table_init(&table, 1);
+    aggregate_batch batch;
+    batch.count = 0;
+    for (int n = 0; n < 2000; n++)
+    {
+        batch.values[batch.count] = 8.0f * sinf(2 * M_PI * 2.0 * n / 1000.0 + 0.1f);
+        batch.timestamps_ns[batch.count] = 1000000000LL + n * 1000000LL;
+        if (++batch.count == 37)
+        {
+            aggregate_update(&table, 0, &batch);
+            batch.count = 0;
+        }
+    }
+    aggregate_update(&table, 0, &batch);
+    aggregate_take(&table, 0);
+    const channel_aggregate *taken = &table.taken[0];
+    printf("frequency: %.4f Hz rms: %.4f\n", taken->frequency, aggregate_rms(taken));
+    ASSERT_EQ("frequency", 1, fabsf(taken->frequency - 2.0f) < 0.01f);
+    ASSERT_EQ("rms", 1, fabs(aggregate_rms(taken) - 8.0 / sqrt(2)) < 0.01);
+    aggregate_table_free(&table);
+    return 0;
+}
+
+typedef struct
+{
+    aggregate_table *table;
+    atomic_int done;
+} test_aggregate_writer;
+
+static void *test_aggregate_write(void *arg)
+{
+    test_aggregate_writer *writer = arg;
+    float value = 1.0f;
+    aggregate_batch batch;
+    test_batch_fill(&batch, &value, 1, 1);
+    for (int n = 0; n < TEST_AGGREGATE_UPDATES; n++)
+        aggregate_update(writer->table, 0, &batch);
+    atomic_store(&writer->done, 1);
+    return NULL;
+}
+
+int test_aggregate_concurrent(void)
+{
+    // Every sample of a concurrent reader is taken exactly once
+    aggregate_table table;
+    aggregate_table_init(&table, 1);
+    test_aggregate_writer writer = {.table = &table};
+    pthread_t thread;
+    pthread_create(&thread, NULL, test_aggregate_write, &writer);
+    unsigned long long total = 0;
+    int takes = 0;
+    while (!atomic_load(&writer.done))
+    {
+        aggregate_take(&table, 0);
+        total += table.taken[0].count;
+        takes++;
+    }
+    pthread_join(thread, NULL);
+    aggregate_take(&table, 0);
+    total += table.taken[0].count;
+    printf("takes: %d samples: %llu\n", takes, total);
+    ASSERT_EQ("samples taken once", TEST_AGGREGATE_UPDATES, (int)total);
+    aggregate_table_free(&table);
+    return 0;
+}
+
+int test_aggregate_format(void)
+{
+    // The aggregates follow the values, and the report parser stops at the object
+    channel_table channels;
+    channel_table_init(&channels, "4001/out1,4002/out2");
+    channel_set_value(&channels.states[0], "1.5");
+    channel_aggregate aggregates[2];
+    aggregate_reset(&aggregates[0]);
+    aggregate_reset(&aggregates[1]);
+    aggregates[0] = (channel_aggregate){.count = 4, .min = -2.0f, .max = 8.5f, .frequency = 1.0f, .sum = 10.0, .sum_squares = 100.0};
+    size_t size = report_buffer_size(&channels) + report_aggregates_size(&channels);
+    char *buffer = malloc(size);
+    int length = format_report_at(buffer, size, &channels, 1709898396584LL);
+    length = format_report_aggregates(buffer, size, length, &channels, aggregates);
+    ASSERT_STR_EQ("aggregates report",
+                  "{\"timestamp\": 1709898396584, \"out1\": \"1.5\", \"out2\": \"--\", \"aggregates\": "
+                  "{\"out1\": {\"count\": 4, \"min\": -2, \"max\": 8.5, \"mean\": 2.5, \"rms\": 5, \"freq\": 1}, "
+                  "\"out2\": {\"count\": 0}}}",
+                  buffer);
+    ASSERT_EQ("length", (int)strlen(buffer), length);
+    report_message message;
+    int parsed = parse_report_line(buffer, &message);
+    ASSERT_EQ("parsed", 1, parsed);
+    ASSERT_EQ("values", 2, message.count);
+    ASSERT_EQ("out1", 1, message.values[0] == 1.5f);
+
+    // The aggregates do not fit in the report buffer alone
+    length = format_report_at(buffer, size, &channels, 1709898396584LL);
+    length = format_report_aggregates(buffer, length + 16, length, &channels, aggregates);
+    ASSERT_EQ("too small", -1, length);
+    free(buffer);
+    channel_table_free(&channels);
+    return 0;
+}
+
+typedef struct
+{
+    int fds[2];
+    atomic_int running;
+} test_aggregate_feeder;
+
+// A spike among the samples, each interval ending with a sample of 1
+static void *test_aggregate_feed(void *arg)
+{
+    test_aggregate_feeder *feeder = arg;
+    while (atomic_load(&feeder->running))
+    {
+        write(feeder->fds[0], "1.0\n9.0\n1.0\n", 12);
+        usleep(TEST_AGGREGATE_FEED_US);
+    }
+    return NULL;
+}
+
+// Runs a report loop over a socketpair channel, returns the reports with a spike hidden by the value
+static int test_aggregate_report_run(int pipeline_enable, int *reports)
+{
+    static char capture_buffer[REPORT_BUFFER_SIZE * 2];
+    memset(capture_buffer, 0, sizeof(capture_buffer));
+    FILE *stream = fmemopen(capture_buffer, sizeof(capture_buffer), "w");
+    test_aggregate_feeder feeder;
+    channel_table channels = {0};
+    channel_table_add(&channels, CHANNEL_HOST_DEFAULT, TCP_PORT_OUT1, "out1");
+    socketpair(AF_UNIX, SOCK_STREAM, 0, feeder.fds);
+    fcntl(feeder.fds[1], F_SETFL, O_NONBLOCK);
+    tcp_stream_init(&channels.states[0].stream, feeder.fds[1]);
+    aggregate_table aggregates;
+    aggregate_table_init(&aggregates, channels.count);
+    report_options options;
+    report_options_init(&options, REPORT_INTERVAL_20MS, CONTROL_DISABLED);
+    options.count = TEST_AGGREGATE_REPORTS;
+    options.pipeline_enable = pipeline_enable;
+    options.aggregates = &aggregates;
+    udp_socket no_control = {.sockfd = -1};
+
+    sigset_t all_signals, previous_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &previous_mask);
+    pthread_t thread;
+    atomic_store(&feeder.running, 1);
+    pthread_create(&thread, NULL, test_aggregate_feed, &feeder);
+    pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
+    print_report(stream, &options, &channels, no_control);
+    atomic_store(&feeder.running, 0);
+    pthread_join(thread, NULL);
+    fclose(stream);
+
+    int spikes = 0;
+    *reports = 0;
+    report_message message;
+    for (char *line = strtok(capture_buffer, "\n"); line != NULL; line = strtok(NULL, "\n"))
+    {
+        if (!parse_report_line(line, &message))
+            continue;
+        (*reports)++;
+        if ((message.values[0] == 1.0f) && (strstr(line, "\"max\": 9,") != NULL))
+            spikes++;
+    }
+    close(feeder.fds[0]);
+    channel_table_close(&channels);
+    channel_table_free(&channels);
+    aggregate_table_free(&aggregates);
+    return spikes;
+}
+
+int test_aggregate_report(void)
+{
+    // The maximum shows the spike of every interval with data, in the report loop and the pipeline
+    int reports;
+    int spikes = test_aggregate_report_run(0, &reports);
+    printf("report loop: reports %d spikes %d\n", reports, spikes);
+    ASSERT_EQ("reports", TEST_AGGREGATE_REPORTS - 1, reports);
+    ASSERT_EQ("spikes", 1, spikes >= reports / 2);
+    spikes = test_aggregate_report_run(1, &reports);
+    printf("pipeline: reports %d spikes %d\n", reports, spikes);
+    ASSERT_EQ("pipeline reports", TEST_AGGREGATE_REPORTS - 1, reports);
+    ASSERT_EQ("pipeline spikes", 1, spikes >= reports / 2);
+    return 0;
+}
+
+int main(void)
+{
+    RUN_TEST(test_aggregate_batch);
+    RUN_TEST(test_aggregate_frequency);
+    RUN_TEST(test_aggregate_concurrent);
+    RUN_TEST(test_aggregate_format);
+    RUN_TEST(test_aggregate_report);
+    return 0;
+}
@@ -0,0 +1,290 @@
+#include "test.h"
+#include "../src/protocol.h"
+#include <math.h>
+#include <dirent.h>
+
+#define TEST_ARCHIVE_ROWS 1000
+#define TEST_ARCHIVE_FIRST_MS 1709286246830LL
+
+// Sets the waveforms of the signal server at 20 ms on the default channels, out2 missing at times
+static void test_archive_row(channel_table *channels, int row)
+{
+    char value[CHANNEL_VALUE_SIZE];
+    double phase = fmod(row * 0.02 * 0.25, 1.0);
+    snprintf(value, sizeof(value), "%.1f", 5.0 * sin(2.0 * M_PI * row * 0.02 * 0.5));
+    channel_set_value(&channels->states[CHANNEL_OUT1], value);
+    snprintf(value, sizeof(value), "%.1f", 5.0 * (phase < 0.5 ? 2.0 * phase : 2.0 - 2.0 * phase));
+    channel_set_value(&channels->states[CHANNEL_OUT2], (row % 100 < 10) ? CHANNEL_EMPTY_VALUE : value);
+    channel_set_value(&channels->states[CHANNEL_OUT3], (row / 150) % 2 ? "5.0" : "0.0");
+}
+
+// Report timestamps at 20 ms with a late tick and a gap
+static long long test_archive_timestamp_ms(int row)
+{
+    long long timestamp = TEST_ARCHIVE_FIRST_MS + row * 20LL + (row % 37 == 0 ? 1 : 0);
+    return row >= 700 ? timestamp + 3600000LL : timestamp;
+}
+
+// Test the archive rows written and read back with the report values and timestamps
+int test_archive_roundtrip(void)
+{
+    channel_table channels;
+    archive_writer writer;
+    archive_reader reader;
+    static char archive_buffer[64 * 1024];
+    char report_buffer[PROTOCOL_BUFFER_SIZE];
+    char value[CHANNEL_VALUE_SIZE];
+    float values[3];
+    long long timestamp_ns;
+
+    channel_table_init(&channels, CHANNELS_DEFAULT);
+    FILE *stream = fmemopen(archive_buffer, sizeof(archive_buffer), "w+");
+    int result = archive_writer_init(&writer, stream, &channels, ARCHIVE_UNIT_MS);
+    ASSERT_EQ("header write", SUCCESS, result);
+    size_t report_bytes = 0;
+    for (int row = 0; row < TEST_ARCHIVE_ROWS; row++)
+    {
+        test_archive_row(&channels, row);
+        archive_writer_append(&writer, test_archive_timestamp_ms(row) * 1000000LL, &channels);
+        report_bytes += format_report_at(report_buffer, sizeof(report_buffer), &channels, test_archive_timestamp_ms(row)) + 1;
+    }
+    result = archive_writer_flush(&writer);
+    ASSERT_EQ("partial block write", SUCCESS, result);
+    long size = ftell(stream);
+    ASSERT_EQ("archive size", 1, (long)writer.bytes == size);
+    printf("rows: %llu report bytes: %zu archive bytes: %ld ratio: %.1f\n", writer.rows, report_bytes, size, (double)report_bytes / size);
+    ASSERT_EQ("10x smaller than the reports", 1, report_bytes > 10 * (size_t)size);
+    archive_writer_free(&writer);
+
+    rewind(stream);
+    result = archive_reader_open(&reader, stream);
+    ASSERT_EQ("header read", SUCCESS, result);
+    ASSERT_EQ("channel count", 3, reader.channel_count);
+    ASSERT_STR_EQ("channel name", "out3", reader.names[CHANNEL_OUT3]);
+    int mismatches = 0;
+    int row = 0;
+    while ((result = archive_reader_next(&reader, &timestamp_ns, values)) == 1)
+    {
+        test_archive_row(&channels, row);
+        if (timestamp_ns != test_archive_timestamp_ms(row) * 1000000LL)
+            mismatches++;
+        for (int i = 0; i < 3; i++)
+        {
+            format_report_value(value, sizeof(value), values[i]);
+            if (strcmp(value, channels.states[i].value) != 0)
+                mismatches++;
+        }
+        row++;
+    }
+    ASSERT_EQ("end of archive", 0, result);
+    ASSERT_EQ("rows read", TEST_ARCHIVE_ROWS, row);
+    ASSERT_EQ("values and timestamps", 0, mismatches);
+    archive_reader_close(&reader);
+
+    // A block is decoded from memory, and a truncated block is rejected
+    archive_block_decoder decoder;
+    archive_block_decoder_init(&decoder, 3);
+    const uint8_t *block = (const uint8_t *)archive_buffer + reader.header_size;
+    size_t block_size = archive_block_size(block);
+    result = archive_block_begin(&decoder, block, block_size);
+    ASSERT_EQ("block", SUCCESS, result);
+    ASSERT_EQ("block rows", ARCHIVE_BLOCK_ROWS, decoder.row_count);
+    long long timestamp;
+    archive_block_next(&decoder, &timestamp, values);
+    ASSERT_EQ("block timestamp", 1, timestamp == test_archive_timestamp_ms(0));
+    result = archive_block_begin(&decoder, block, block_size - 1);
+    ASSERT_EQ("truncated block", FAILURE, result);
+    archive_block_decoder_free(&decoder);
+
+    fclose(stream);
+    channel_table_free(&channels);
+    return 0;
+}
+
+// Test the microsecond timestamps of a sub-millisecond interval and a channel without values
+int test_archive_microseconds(void)
+{
+    channel_table channels;
+    archive_writer writer;
+    archive_reader reader;
+    char archive_buffer[4096];
+    float values[3];
+    long long timestamp_ns;
+
+    channel_table_init(&channels, CHANNELS_DEFAULT);
+    FILE *stream = fmemopen(archive_buffer, sizeof(archive_buffer), "w+");
+    archive_writer_init(&writer, stream, &channels, ARCHIVE_UNIT_US);
+    long long first_ns = 1709898396584512345LL;
+    channel_set_value(&channels.states[CHANNEL_OUT1], "-4.8");
+    channel_set_value(&channels.states[CHANNEL_OUT3], "1e9");
+    for (int row = 0; row < 10; row++)
+        archive_writer_append(&writer, first_ns + row * 500000LL + row * 37000LL, &channels);
+    archive_writer_flush(&writer);
+    archive_writer_free(&writer);
+
+    rewind(stream);
+    int result = archive_reader_open(&reader, stream);
+    ASSERT_EQ("header read", SUCCESS, result);
+    ASSERT_EQ("unit", 1, reader.unit_ns == ARCHIVE_UNIT_US);
+    for (int row = 0; row < 10; row++)
+    {
+        result = archive_reader_next(&reader, &timestamp_ns, values);
+        ASSERT_EQ("row", 1, result);
+        ASSERT_EQ("rounded timestamp", 1, timestamp_ns == (first_ns + row * 537000LL + 500) / 1000 * 1000);
+        ASSERT_EQ("value", 1, values[CHANNEL_OUT1] == -4.8f);
+        ASSERT_EQ("missing value", 1, isnan(values[CHANNEL_OUT2]));
+        ASSERT_EQ("exponent value", 1, values[CHANNEL_OUT3] == 1e9f);
+    }
+    result = archive_reader_next(&reader, &timestamp_ns, values);
+    ASSERT_EQ("end of archive", 0, result);
+    archive_reader_close(&reader);
+    fclose(stream);
+
+    // The writer is freed when the header is not written
+    stream = fmemopen(archive_buffer, sizeof(archive_buffer), "r");
+    result = archive_writer_init(&writer, stream, &channels, ARCHIVE_UNIT_MS);
+    ASSERT_EQ("header not written", -1, result);
+    ASSERT_EQ("writer freed", 1, (writer.channels == NULL) && (writer.stream.data == NULL));
+    fclose(stream);
+    channel_table_free(&channels);
+    return 0;
+}
+
+// Rows of a query checked against the written rows
+typedef struct
+{
+    channel_table channels;
+    long long rows;
+    long long first_ns;
+    long long last_ns;
+    int mismatches;
+} test_archive_query;
+
+static void test_archive_query_row(void *context, const archive_reader *reader, long long timestamp_ns, const float *values)
+{
+    test_archive_query *query = context;
+    char value[CHANNEL_VALUE_SIZE];
+    int row = (int)((timestamp_ns / 1000000LL - TEST_ARCHIVE_FIRST_MS) / 20);
+    test_archive_row(&query->channels, row);
+    for (int i = 0; i < reader->channel_count; i++)
+    {
+        format_report_value(value, sizeof(value), values[i]);
+        if (strcmp(value, query->channels.states[i].value) != 0)
+            query->mismatches++;
+    }
+    if ((query->rows > 0) && (timestamp_ns != query->last_ns + 20000000LL))
+        query->mismatches++;
+    query->first_ns = query->rows++ ? query->first_ns : timestamp_ns;
+    query->last_ns = timestamp_ns;
+}
+
+static long long test_archive_query_range(test_archive_query *query, const char *directory, int from_row, int to_row)
+{
+    query->rows = 0;
+    query->mismatches = 0;
+    long long from_ns = (TEST_ARCHIVE_FIRST_MS + from_row * 20LL) * 1000000LL;
+    long long to_ns = (TEST_ARCHIVE_FIRST_MS + to_row * 20LL) * 1000000LL;
+    return archive_segments_query(directory, from_ns, to_ns, test_archive_query_row, query);
+}
+
+// Counts the files of a directory with an extension, and removes them with remove set
+static int test_archive_files(const char *directory, const char *extension, int remove)
+{
+    DIR *dir = opendir(directory);
+    struct dirent *entry;
+    int count = 0;
+    while ((dir != NULL) && ((entry = readdir(dir)) != NULL))
+    {
+        size_t length = strlen(entry->d_name);
+        if ((length < strlen(extension)) || (strcmp(entry->d_name + length - strlen(extension), extension) != 0))
+            continue;
+        count++;
+        if (remove)
+        {
+            char path[ARCHIVE_SEGMENT_PATH_SIZE];
+            snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+            unlink(path);
+        }
+    }
+    if (dir != NULL)
+        closedir(dir);
+    return count;
+}
+
+// Test the segments rotated by size and time, the retention and the range queries
+int test_archive_segments(void)
+{
+    char directory[] = "/tmp/test_archive_XXXXXX";
+    archive_segments segments;
+    test_archive_query query;
+    ASSERT_EQ("directory", 1, mkdtemp(directory) != NULL);
+    channel_table_init(&query.channels, CHANNELS_DEFAULT);
+
+    // Rotated by size, the three newest segments kept
+    int result = archive_segments_init(&segments, directory, ARCHIVE_UNIT_MS, 1024, ARCHIVE_SEGMENT_SECONDS, 3);
+    ASSERT_EQ("init", SUCCESS, result);
+    for (int row = 0; row < 3000; row++)
+    {
+        test_archive_row(&query.channels, row);
+        archive_segments_append(&segments, (TEST_ARCHIVE_FIRST_MS + row * 20LL) * 1000000LL, &query.channels);
+    }
+    result = archive_segments_close(&segments);
+    ASSERT_EQ("close", SUCCESS, result);
+    printf("segments: %llu removed: %llu\n", segments.segments, segments.removed);
+    ASSERT_EQ("rotated by size", 1, segments.segments > 3);
+    ASSERT_EQ("segments kept", 3, test_archive_files(directory, ARCHIVE_SEGMENT_EXTENSION, 0));
+    ASSERT_EQ("indexes kept", 3, test_archive_files(directory, ARCHIVE_INDEX_EXTENSION, 0));
+    ASSERT_EQ("removed", 1, segments.removed == segments.segments - 3);
+
+    long long rows = test_archive_query_range(&query, directory, 2500, 2600);
+    ASSERT_EQ("range rows", 101, (int)rows);
+    ASSERT_EQ("range start", 1, query.first_ns == (TEST_ARCHIVE_FIRST_MS + 2500 * 20LL) * 1000000LL);
+    ASSERT_EQ("range values", 0, query.mismatches);
+    rows = test_archive_query_range(&query, directory, 2990, 100000);
+    ASSERT_EQ("range past the end", 10, (int)rows);
+    rows = test_archive_query_range(&query, directory, 0, 10);
+    ASSERT_EQ("range removed by the retention", 0, (int)rows);
+    rows = test_archive_query_range(&query, directory, 2600, 2500);
+    ASSERT_EQ("empty range", 0, (int)rows);
+    test_archive_files(directory, ARCHIVE_SEGMENT_EXTENSION, 1);
+    test_archive_files(directory, ARCHIVE_INDEX_EXTENSION, 1);
+
+    // Rotated every second, a segment per 50 rows, queried across the segments
+    archive_segments_init(&segments, directory, ARCHIVE_UNIT_MS, ARCHIVE_SEGMENT_BYTES, 1, ARCHIVE_SEGMENT_RETENTION);
+    for (int row = 0; row < 120; row++)
+    {
+        test_archive_row(&query.channels, row);
+        archive_segments_append(&segments, (TEST_ARCHIVE_FIRST_MS + row * 20LL) * 1000000LL, &query.channels);
+    }
+    archive_segments_close(&segments);
+    ASSERT_EQ("rotated by time", 3, test_archive_files(directory, ARCHIVE_SEGMENT_EXTENSION, 0));
+    rows = test_archive_query_range(&query, directory, 0, 119);
+    ASSERT_EQ("all rows", 120, (int)rows);
+    ASSERT_EQ("all values", 0, query.mismatches);
+    rows = test_archive_query_range(&query, directory, 45, 55);
+    ASSERT_EQ("rows across segments", 11, (int)rows);
+    test_archive_files(directory, ARCHIVE_SEGMENT_EXTENSION, 1);
+    test_archive_files(directory, ARCHIVE_INDEX_EXTENSION, 1);
+
+    // A failed segment open, by an invalid unit, leaves no file and is retried after a second
+    archive_segments_init(&segments, directory, 0, ARCHIVE_SEGMENT_BYTES, 1, ARCHIVE_SEGMENT_RETENTION);
+    int failed_rows = 0;
+    for (int row = 0; row < 60; row++)
+        failed_rows += archive_segments_append(&segments, (TEST_ARCHIVE_FIRST_MS + row * 20LL) * 1000000LL, &query.channels) < 0;
+    archive_segments_close(&segments);
+    ASSERT_EQ("rows dropped", 60, failed_rows);
+    ASSERT_EQ("open retried", 1, segments.failures == 2);
+    ASSERT_EQ("no segment left", 0, test_archive_files(directory, ARCHIVE_SEGMENT_EXTENSION, 0));
+    ASSERT_EQ("no index left", 0, test_archive_files(directory, ARCHIVE_INDEX_EXTENSION, 0));
+    rmdir(directory);
+    channel_table_free(&query.channels);
+    return 0;
+}
+
+int main(void)
+{
+    RUN_TEST(test_archive_roundtrip);
+    RUN_TEST(test_archive_microseconds);
+    RUN_TEST(test_archive_segments);
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "test.h"
+#include "../src/protocol.h"
+
+// Test binary report records written and read back with the value text
+int test_binary_report_roundtrip(void)
+{
+    channel_table channels;
+    binary_report_writer writer;
+    binary_report_header header;
+    char report_buffer[PROTOCOL_BUFFER_SIZE];
+    char value[CHANNEL_VALUE_SIZE];
+    float values[3];
+    long long timestamp;
+
+    channel_table_init(&channels, CHANNELS_DEFAULT);
+    FILE *stream = fmemopen(report_buffer, sizeof(report_buffer), "w+");
+    int result = binary_report_writer_init(&writer, stream, &channels);
+    ASSERT_EQ("header write", SUCCESS, result);
+    channel_set_value(&channels.states[CHANNEL_OUT1], "-4.8");
+    channel_set_value(&channels.states[CHANNEL_OUT3], "5.0");
+    binary_report_write(&writer, 1709286246830LL, &channels);
+    channel_table_reset_values(&channels);
+    binary_report_write(&writer, 1709286246850LL, &channels);
+    long size = ftell(stream);
+    binary_report_writer_free(&writer);
+
+    rewind(stream);
+    result = binary_report_read_header(stream, &header);
+    ASSERT_EQ("header read", SUCCESS, result);
+    ASSERT_EQ("channel count", 3, header.channel_count);
+    ASSERT_STR_EQ("channel name", "out3", header.names[CHANNEL_OUT3]);
+    ASSERT_EQ("fixed-size records", (int)(header.header_size + 2 * header.record_size), (int)size);
+
+    // Second record by the record number
+    fseek(stream, header.header_size + header.record_size, SEEK_SET);
+    result = binary_report_read_record(stream, &header, &timestamp, values);
+    ASSERT_EQ("indexed record", 1, result);
+    ASSERT_EQ("indexed timestamp", 1, timestamp == 1709286246850LL);
+    format_report_value(value, sizeof(value), values[CHANNEL_OUT1]);
+    ASSERT_STR_EQ("missing value", "--", value);
+    result = binary_report_read_record(stream, &header, &timestamp, values);
+    ASSERT_EQ("end of records", 0, result);
+
+    fseek(stream, header.header_size, SEEK_SET);
+    binary_report_read_record(stream, &header, &timestamp, values);
+    format_report_value(value, sizeof(value), values[CHANNEL_OUT1]);
+    ASSERT_STR_EQ("negative value", "-4.8", value);
+    format_report_value(value, sizeof(value), values[CHANNEL_OUT3]);
+    ASSERT_STR_EQ("integral value", "5.0", value);
+
+    binary_report_header_free(&header);
+    fclose(stream);
+    channel_table_free(&channels);
+    return 0;
+}
+
+int main(void)
+{
+    RUN_TEST(test_binary_report_roundtrip);
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "test.h"
+#include "../src/protocol.h"
+
+// Samples received by the capture handler
+capture_sample handled_samples[16];
+int handled_channels[16];
+int handled_count = 0;
+
+void test_capture_handler(void *context, int channel, const capture_sample *sample)
+{
+    handled_channels[handled_count] = channel;
+    handled_samples[handled_count++] = *sample;
+}
+
+// Test ring order and overflow without the consumer thread
+int test_capture_ring(void)
+{
+    channel_table channels;
+    capture cap;
+    channel_table_init(&channels, CHANNELS_DEFAULT);
+    int result = capture_init(&cap, &channels, 3);
+    ASSERT_EQ("capture init", SUCCESS, result);
+    cap.handler = test_capture_handler;
+
+    for (int i = 0; i < 5; i++)
+        capture_push(&cap, CHANNEL_OUT2, 1000 + i, (float)i);
+    ASSERT_EQ("dropped on full ring", 1, (int)capture_dropped(&cap));
+    int drained = (int)capture_drain(&cap);
+    ASSERT_EQ("drained samples", 4, drained);
+    ASSERT_EQ("channel", CHANNEL_OUT2, handled_channels[0]);
+    ASSERT_EQ("first timestamp", 1000, (int)handled_samples[0].timestamp_ns);
+    ASSERT_EQ("last timestamp", 1003, (int)handled_samples[3].timestamp_ns);
+    drained = (int)capture_drain(&cap);
+    ASSERT_EQ("drained empty", 0, drained);
+
+    capture_free(&cap);
+    channel_table_free(&channels);
+    return 0;
+}
+
+// Push each stream line to the capture as the report loop does
+void test_capture_line_handler(void *context, const char *line, size_t length, long long timestamp_ns)
+{
+    capture_push(context, CHANNEL_OUT1, timestamp_ns, strtof(line, NULL));
+}
+
+// Test the capture of every line from a stream to a file by the consumer thread
+int test_capture_stream_file(void)
+{
+    channel_table channels;
+    capture cap;
+    char capture_buffer[PROTOCOL_BUFFER_SIZE];
+    char line[CHANNEL_VALUE_SIZE];
+    int sv[2];
+
+    channel_table_init(&channels, CHANNELS_DEFAULT);
+    capture_init(&cap, &channels, CAPTURE_RING_CAPACITY);
+    FILE *stream = fmemopen(capture_buffer, sizeof(capture_buffer), "w");
+    int result = capture_start_file(&cap, stream);
+    ASSERT_EQ("capture start", SUCCESS, result);
+
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+    tcp_stream *tcp = &channels.states[CHANNEL_OUT1].stream;
+    tcp_stream_init(tcp, sv[1]);
+    write(sv[0], "1.5\n-2.", 7);
+    read_tcp_stream_lines(tcp, line, sizeof(line), test_capture_line_handler, &cap);
+    write(sv[0], "5\n3.0\n", 6);
+    read_tcp_stream_lines(tcp, line, sizeof(line), test_capture_line_handler, &cap);
+    ASSERT_STR_EQ("last line", "3.0", line);
+    capture_stop(&cap);
+    fclose(stream);
+
+    // Every sample in the stream order, with the timestamp
+    int count = 0;
+    float values[3];
+    char *saveptr;
+    for (char *row = strtok_r(capture_buffer, "\n", &saveptr); row != NULL && count < 3; row = strtok_r(NULL, "\n", &saveptr))
+    {
+        long long timestamp_ns;
+        char name[CHANNEL_NAME_SIZE];
+        if (sscanf(row, "%lld,%31[^,],%f", &timestamp_ns, name, &values[count]) == 3)
+            count++;
+    }
+    ASSERT_EQ("captured samples", 3, count);
+    ASSERT_EQ("reassembled sample", 1, values[1] == -2.5f);
+    ASSERT_EQ("last sample", 1, values[2] == 3.0f);
+
+    close(sv[0]);
+    close(sv[1]);
+    capture_free(&cap);
+    channel_table_free(&channels);
+    return 0;
+}
+
+int main(void)
+{
+    RUN_TEST(test_capture_ring);
+    RUN_TEST(test_capture_stream_file);
+    return 0;
+}
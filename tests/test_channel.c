@@ -0,0 +1,92 @@
+#include "test.h"
+#include "../src/protocol.h"
+
+// Test channel list parsing with defaults and explicit entries
+int test_channel_table_init(void)
+{
+    channel_table channels;
+    int result = channel_table_init(&channels, "4001, localhost:4002/out2\n10.0.0.1:4003/level # comment\n");
+    ASSERT_EQ("channel list parse", SUCCESS, result);
+    ASSERT_EQ("channel count", 3, channels.count);
+    ASSERT_STR_EQ("default host", CHANNEL_HOST_DEFAULT, channels.configs[0].host);
+    ASSERT_STR_EQ("default name", "out1", channels.configs[0].name);
+    ASSERT_STR_EQ("host name", "localhost", channels.configs[1].host);
+    ASSERT_EQ("port", 4003, channels.configs[2].port);
+    ASSERT_EQ("find by name", 2, channel_table_find(&channels, "level"));
+    ASSERT_STR_EQ("initial value", CHANNEL_EMPTY_VALUE, channels.states[2].value);
+    channel_table_free(&channels);
+
+    result = channel_table_init(&channels, "127.0.0.1:port/out1");
+    ASSERT_EQ("invalid port", FAILURE, result);
+    result = channel_table_init(&channels, " # only a comment");
+    ASSERT_EQ("empty list", FAILURE, result);
+    return 0;
+}
+
+// Test the report format over a channel table and parsing it back
+int test_channel_report_format(void)
+{
+    channel_table channels;
+    char report_buffer[REPORT_BUFFER_SIZE];
+    report_message message;
+
+    char list[REPORT_BUFFER_SIZE] = "";
+    for (int i = 0; i < 200; i++)
+    {
+        char entry[32];
+        snprintf(entry, sizeof(entry), "%d,", 5000 + i);
+        strcat(list, entry);
+    }
+    channel_table_init(&channels, list);
+    ASSERT_EQ("channel count", 200, channels.count);
+    channel_set_value(&channels.states[0], "-4.8");
+    channel_set_value(&channels.states[199], "5.0");
+
+    int length = format_report(report_buffer, report_buffer_size(&channels), &channels);
+    ASSERT_EQ("report fits", 1, length > 0);
+    ASSERT_EQ("report parse", 1, parse_report_line(report_buffer, &message));
+    ASSERT_EQ("parsed count", 200, message.count);
+    ASSERT_EQ("first value", 1, message.values[0] == -4.8f);
+    ASSERT_EQ("empty value", 1, message.values[1] != message.values[1]);
+    ASSERT_EQ("last value", 1, message.values[199] == 5.0f);
+    channel_table_free(&channels);
+    return 0;
+}
+
+// Test the reconnect delays doubling up to the limit, and starting over after data
+int test_channel_reconnect_backoff(void)
+{
+    channel_table channels;
+    channel_table_init(&channels, "127.0.0.1:1/out1");
+    channel_state *state = &channels.states[0];
+    long long expected_ms[] = {CHANNEL_RECONNECT_MIN_MS, 2 * CHANNEL_RECONNECT_MIN_MS, 4 * CHANNEL_RECONNECT_MIN_MS, 30, 30};
+    for (int i = 0; i < 5; i++)
+    {
+        long long retry_ns = channel_disconnect(state, 1000000000LL, 30);
+        ASSERT_EQ("reconnect delay", (int)expected_ms[i], (int)((retry_ns - 1000000000LL) / 1000000));
+    }
+    ASSERT_EQ("disconnected", -1, state->stream.sockfd);
+    state->connection.backoff_ms = 0;
+    long long retry_ns = channel_disconnect(state, 0, 30);
+    ASSERT_EQ("delay after data", CHANNEL_RECONNECT_MIN_MS, (int)(retry_ns / 1000000));
+
+    // The connection to a closed port fails at once or when completed
+    int sockfd = channel_connect(&channels, 0);
+    if (sockfd >= 0)
+    {
+        usleep(10000);
+        int result = channel_connect_complete(state);
+        ASSERT_EQ("refused", -1, result);
+    }
+    channel_table_close(&channels);
+    channel_table_free(&channels);
+    return 0;
+}
+
+int main(void)
+{
+    RUN_TEST(test_channel_table_init);
+    RUN_TEST(test_channel_report_format);
+    RUN_TEST(test_channel_reconnect_backoff);
+    return 0;
+}
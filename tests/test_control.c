@@ -0,0 +1,268 @@
+#include "test.h"
+#include "../src/protocol.h"
+
+int test_control_batch(void)
+{
+    // Local receiver in place of the control port
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t length = sizeof(address);
+    int receiver_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    bind(receiver_fd, (struct sockaddr *)&address, sizeof(address));
+    getsockname(receiver_fd, (struct sockaddr *)&address, &length);
+    udp_socket control_socket = open_udp_control_socket(ntohs(address.sin_port));
+
+    control_batch batch;
+    control_batch_init(&batch, control_socket);
+    int sent = control_batch_flush(&batch);
+    ASSERT_EQ("empty flush", 0, sent);
+    control_message messages[3] = {{CONTROL_OPERATION_WRITE, CONTROL_OBJECT_OUT1, CONTROL_OBJECT_OUT1_PROPERTY_FREQUENCY_INDEX, CONTROL_OBJECT_OUT1_PROPERTY_FREQUENCY_1_HZ},
+                                   {CONTROL_OPERATION_WRITE, CONTROL_OBJECT_OUT1, CONTROL_OBJECT_OUT1_PROPERTY_AMPLITUDE_INDEX, CONTROL_OBJECT_OUT1_PROPERTY_AMPLITUDE_8000},
+                                   {CONTROL_OPERATION_READ, CONTROL_OBJECT_OUT2, CONTROL_OBJECT_OUT1_PROPERTY_AMPLITUDE_INDEX, 0}};
+    for (int i = 0; i < 3; i++)
+    {
+        control_message wire = control_message_encode(messages[i]);
+        control_batch_add(&batch, &wire);
+    }
+    sent = control_batch_flush(&batch);
+    ASSERT_EQ("batch sent", 3, sent);
+    ASSERT_EQ("batch emptied", 0, batch.count);
+
+    // Each message is a datagram in order, with big-endian fields
+    for (int i = 0; i < 3; i++)
+    {
+        uint8_t datagram[16];
+        ssize_t received = recv(receiver_fd, datagram, sizeof(datagram), MSG_DONTWAIT);
+        ASSERT_EQ("datagram size", (int)sizeof(control_message), (int)received);
+        ASSERT_EQ("operation", messages[i].operation, (datagram[0] << 8) | datagram[1]);
+        ASSERT_EQ("property", messages[i].property, (datagram[4] << 8) | datagram[5]);
+        ASSERT_EQ("value", messages[i].value, (datagram[6] << 8) | datagram[7]);
+    }
+
+    // A full batch refuses more messages
+    control_message wire = control_message_encode(messages[0]);
+    int result = 0;
+    for (int i = 0; i <= CONTROL_BATCH_MAX; i++)
+        result = control_batch_add(&batch, &wire);
+    ASSERT_EQ("full batch", FAILURE, result);
+    sent = control_batch_flush(&batch);
+    ASSERT_EQ("full batch sent", CONTROL_BATCH_MAX, sent);
+    ASSERT_EQ("none unsent", 0, batch.unsent);
+
+    // The messages of a failed send are counted as unsent
+    udp_socket invalid_socket = {-1, control_socket.servaddr};
+    control_batch_init(&batch, invalid_socket);
+    control_batch_add(&batch, &wire);
+    control_batch_add(&batch, &wire);
+    sent = control_batch_flush(&batch);
+    ASSERT_EQ("failed send", FAILURE, sent);
+    ASSERT_EQ("unsent", 2, batch.unsent);
+    ASSERT_EQ("send error", EBADF, batch.error);
+
+    close_udp_socket(control_socket);
+    close(receiver_fd);
+    return 0;
+}
+
+int test_control_rules(void)
+{
+    channel_table channels;
+    channel_table_init(&channels, CHANNELS_DEFAULT);
+    control_rule_table rules;
+    int result = control_rule_table_init(&rules, "# comment\n"
+                                                 "out3 3.0 high 1:255=1000,1:170=8000 low 1:255=2000\n"
+                                                 "out1 0.5 hysteresis 1.0 high 2:14=1 # enable\n"
+                                                 "out9 1.0 high 1:14=0\n",
+                                         &channels);
+    ASSERT_EQ("rules compiled", SUCCESS, result);
+    ASSERT_EQ("rule count", 2, rules.count);
+    ASSERT_EQ("unknown channel skipped", 1, rules.skipped);
+    ASSERT_EQ("sorted by source", CHANNEL_OUT1, rules.rules[0].source);
+    ASSERT_EQ("encoded writes", 4, rules.message_count);
+    ASSERT_EQ("big-endian property", htons(255), rules.messages[0].property);
+
+    control_batch batch;
+    udp_socket no_control = {.sockfd = -1};
+    control_batch_init(&batch, no_control);
+
+    // The first value sets the state, the threshold crossings change it
+    channel_set_value(&channels.states[CHANNEL_OUT1], "0.0");
+    channel_set_value(&channels.states[CHANNEL_OUT3], "4.0");
+    int changed = control_rule_table_evaluate(&rules, &channels, &batch);
+    ASSERT_EQ("initial states", 2, changed);
+    ASSERT_EQ("initial writes", 2, batch.count);
+    ASSERT_EQ("high writes", htons(8000), batch.wire[1].value);
+    batch.count = 0;
+
+    channel_set_value(&channels.states[CHANNEL_OUT3], "3.5");
+    changed = control_rule_table_evaluate(&rules, &channels, &batch);
+    ASSERT_EQ("no crossing", 0, changed);
+    channel_set_value(&channels.states[CHANNEL_OUT3], CHANNEL_EMPTY_VALUE);
+    changed = control_rule_table_evaluate(&rules, &channels, &batch);
+    ASSERT_EQ("empty value", 0, changed);
+    channel_set_value(&channels.states[CHANNEL_OUT3], "2.9");
+    changed = control_rule_table_evaluate(&rules, &channels, &batch);
+    ASSERT_EQ("low crossing", 1, changed);
+    ASSERT_EQ("low writes", 1, batch.count);
+    ASSERT_EQ("low value", htons(2000), batch.wire[0].value);
+    batch.count = 0;
+
+    // The hysteresis keeps the high state down to the threshold - hysteresis
+    channel_set_value(&channels.states[CHANNEL_OUT1], "0.6");
+    changed = control_rule_table_evaluate(&rules, &channels, &batch);
+    ASSERT_EQ("hysteresis high", 1, changed);
+    channel_set_value(&channels.states[CHANNEL_OUT1], "-0.4");
+    changed = control_rule_table_evaluate(&rules, &channels, &batch);
+    ASSERT_EQ("within hysteresis", 0, changed);
+    channel_set_value(&channels.states[CHANNEL_OUT1], "-0.6");
+    changed = control_rule_table_evaluate(&rules, &channels, &batch);
+    ASSERT_EQ("below hysteresis", 1, changed);
+    ASSERT_EQ("no low writes", 1, batch.count);
+    control_rule_table_free(&rules);
+
+    // Invalid rules
+    const char *invalid[] = {"out3", "out3 x high 1:1=1", "out3 1.0", "out3 1.0 high 1:1", "out3 1.0 high 1:1=70000",
+                             "out3 1.0 hysteresis -1 high 1:1=1", "out3 1.0 middle 1:1=1"};
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+        result = control_rule_table_init(&rules, invalid[i], &channels);
+        ASSERT_EQ(invalid[i], FAILURE, result);
+    }
+    channel_table_free(&channels);
+    return 0;
+}
+
+// Feeds samples of one read to the effect detection of a channel
+static void test_latency_read(control_latency *latency, int channel, const float *values, int count, long long read_ns)
+{
+    for (int i = 0; i < count; i++)
+        control_latency_sample(latency, channel, values[i], read_ns);
+}
+
+int test_control_latency(void)
+{
+    channel_table channels;
+    channel_table_init(&channels, CHANNELS_DEFAULT);
+    control_rule_table rules;
+    control_rule_table_init(&rules, CONTROL_RULES_DEFAULT, &channels);
+    control_latency latency;
+    int result = control_latency_init(&latency, &rules, &channels);
+    ASSERT_EQ("latency init", SUCCESS, result);
+    control_batch batch;
+    udp_socket no_control = {.sockfd = -1};
+    control_batch_init(&batch, no_control);
+
+    // The out3 edge read at 1 us, the writes sent at 5 us arm out1, the object 1
+    control_latency_arrival(&latency, CHANNEL_OUT3, 1000);
+    channel_set_value(&channels.states[CHANNEL_OUT3], "4.0");
+    control_rule_table_evaluate(&rules, &channels, &batch);
+    control_latency_arm(&latency, 5000);
+    ASSERT_EQ("out1 armed", 1, latency.armed_count);
+    ASSERT_EQ("armed channel", CHANNEL_OUT1, latency.armed[0]);
+
+    // A jump read before the send is not the effect, a ramp is not a jump
+    const float before[] = {0.0f, 0.5f, 6.0f, 6.5f, 7.0f};
+    test_latency_read(&latency, CHANNEL_OUT1, before, 5, 4000);
+    const float ramp[] = {7.5f, 8.0f, 8.5f};
+    test_latency_read(&latency, CHANNEL_OUT1, ramp, 3, 6000);
+    control_latency_poll(&latency, 7000);
+    ASSERT_EQ("no effect", 1, latency.armed_count);
+    const float jump[] = {9.0f, 2.0f, 2.5f};
+    test_latency_read(&latency, CHANNEL_OUT1, jump, 3, 9000);
+    control_latency_poll(&latency, 10000);
+    ASSERT_EQ("effect taken", 0, latency.armed_count);
+    const control_rule_latency *rule_latency = &latency.rule_latencies[0];
+    ASSERT_EQ("edge to send", 4000, (int)rule_latency->stages[CONTROL_LATENCY_EDGE_TO_SEND].max);
+    ASSERT_EQ("send to effect", 4000, (int)rule_latency->stages[CONTROL_LATENCY_SEND_TO_EFFECT].max);
+    ASSERT_EQ("edge to effect", 8000, (int)rule_latency->stages[CONTROL_LATENCY_EDGE_TO_EFFECT].max);
+
+    // A change while out1 waits for an effect is not measured, and the wait times out
+    channel_set_value(&channels.states[CHANNEL_OUT3], "2.0");
+    control_rule_table_evaluate(&rules, &channels, &batch);
+    control_latency_arm(&latency, 20000);
+    channel_set_value(&channels.states[CHANNEL_OUT3], "4.0");
+    control_rule_table_evaluate(&rules, &channels, &batch);
+    control_latency_arm(&latency, 21000);
+    ASSERT_EQ("overlapped", 1, (int)rule_latency->overlapped);
+    control_latency_poll(&latency, 20000 + CONTROL_LATENCY_TIMEOUT_MS * 1000000LL);
+    ASSERT_EQ("missed", 1, (int)rule_latency->missed);
+    ASSERT_EQ("timed out", 0, latency.armed_count);
+    ASSERT_EQ("edge to send count", 3, (int)rule_latency->stages[CONTROL_LATENCY_EDGE_TO_SEND].count);
+
+    char buffer[1024] = {0};
+    FILE *file = fmemopen(buffer, sizeof(buffer), "w");
+    control_latency_write(&latency, file);
+    fclose(file);
+    printf("%s", buffer);
+    ASSERT_EQ("distribution line", 1, strstr(buffer, "control rule 0 out3 3 send_to_effect count 1 mean_ns 4000") != NULL);
+    ASSERT_EQ("missed line", 1, strstr(buffer, "control rule 0 out3 3 missed 1 overlapped 1\n") != NULL);
+    control_latency_free(&latency);
+    control_rule_table_free(&rules);
+    channel_table_free(&channels);
+    return 0;
+}
+
+int test_control_arrival(void)
+{
+    // Local receiver in place of the control port
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t length = sizeof(address);
+    int receiver_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    bind(receiver_fd, (struct sockaddr *)&address, sizeof(address));
+    getsockname(receiver_fd, (struct sockaddr *)&address, &length);
+    udp_socket control_socket = open_udp_control_socket(ntohs(address.sin_port));
+
+    // An out3 channel with three threshold crossings in one interval
+    channel_table channels = {0};
+    channel_table_add(&channels, CHANNEL_HOST_DEFAULT, TCP_PORT_OUT3, "out3");
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    tcp_stream_init(&channels.states[0].stream, fds[1]);
+    write(fds[0], "4.0\n2.0\n4.0\n", 12);
+
+    control_rule_table rules;
+    control_rule_table_init(&rules, CONTROL_RULES_DEFAULT, &channels);
+    ASSERT_EQ("first rule", 0, control_rule_table_first(&rules, 0));
+    ASSERT_EQ("no rules", 1, control_rule_table_first(&rules, 1));
+    control_latency latency;
+    control_latency_init(&latency, &rules, &channels);
+    control_arrival arrival = {&rules, control_socket, &latency};
+    report_options options;
+    report_options_init(&options, REPORT_INTERVAL_20MS, CONTROL_ENABLED);
+    options.count = 3;
+    options.control_rules = &rules;
+    options.control_latency = &latency;
+    options.control_arrival = &arrival;
+    FILE *output = fopen("/dev/null", "w");
+    int result = print_report(output, &options, &channels, control_socket);
+    fclose(output);
+    ASSERT_EQ("report", SUCCESS, result);
+
+    // Every crossing sends its frequency and amplitude writes, the tick only sees the last value
+    int datagrams = 0;
+    uint8_t datagram[16];
+    while (recv(receiver_fd, datagram, sizeof(datagram), MSG_DONTWAIT) == sizeof(control_message))
+        datagrams++;
+    ASSERT_EQ("writes of every crossing", 6, datagrams);
+    ASSERT_EQ("high state", CONTROL_RULE_HIGH, rules.rules[0].state);
+    ASSERT_EQ("edges measured", 3, (int)latency.rule_latencies[0].stages[CONTROL_LATENCY_EDGE_TO_SEND].count);
+    printf("edge to send max_ns %llu\n", (unsigned long long)latency.rule_latencies[0].stages[CONTROL_LATENCY_EDGE_TO_SEND].max);
+
+    control_latency_free(&latency);
+    control_rule_table_free(&rules);
+    close(fds[0]);
+    channel_table_close(&channels);
+    channel_table_free(&channels);
+    close_udp_socket(control_socket);
+    close(receiver_fd);
+    return 0;
+}
+
+int main(void)
+{
+    RUN_TEST(test_control_batch);
+    RUN_TEST(test_control_rules);
+    RUN_TEST(test_control_latency);
+    RUN_TEST(test_control_arrival);
+    return 0;
+}
@@ -0,0 +1,251 @@
+#include "test.h"
+#include "../src/protocol.h"
+#include <math.h>
+#include <sys/socket.h>
+
+#define TEST_QUEUE_CAPACITY 4
+#define TEST_QUEUE_CHANNELS 3
+#define TEST_SHARD_CHANNELS 4
+#define TEST_SHARD_FEED_US 200
+#define TEST_SHARD_FEED_LINES 1024 // lines of a write, a read load well above PIPELINE_STEAL_MIN_NS
+#define TEST_SHARD_REPORTS 40
+
+static void test_values(report_entry *values, int report)
+{
+    for (int i = 0; i < TEST_QUEUE_CHANNELS; i++)
+    {
+        values[i].channel = i;
+        values[i].value.length = snprintf(values[i].value.value, CHANNEL_VALUE_SIZE, "%d.%d", report, i);
+    }
+}
+
+int test_pipeline_queue_drop_oldest(void)
+{
+    report_queue queue;
+    report_entry values[TEST_QUEUE_CHANNELS];
+    long long timestamp;
+    int count;
+    int result = report_queue_init(&queue, 3, TEST_QUEUE_CHANNELS, 0, REPORT_OVERFLOW_DROP_OLDEST);
+    ASSERT_EQ("queue init", SUCCESS, result);
+    int capacity = (int)queue.capacity;
+    ASSERT_EQ("capacity rounded up", TEST_QUEUE_CAPACITY, capacity);
+
+    // Six pushes on four slots drop the two oldest reports
+    for (int report = 0; report < 6; report++)
+    {
+        test_values(values, report);
+        result = report_queue_push(&queue, 1000 + report, values, NULL, TEST_QUEUE_CHANNELS);
+        ASSERT_EQ("push", SUCCESS, result);
+    }
+    int dropped = (int)atomic_load(&queue.dropped);
+    ASSERT_EQ("dropped", 2, dropped);
+    for (int report = 2; report < 6; report++)
+    {
+        result = report_queue_pop(&queue, &timestamp, values, NULL, &count);
+        ASSERT_EQ("pop", 1, result);
+        ASSERT_EQ("pop order", 1000 + report, (int)timestamp);
+        ASSERT_EQ("pop count", TEST_QUEUE_CHANNELS, count);
+        char expected[CHANNEL_VALUE_SIZE];
+        snprintf(expected, sizeof(expected), "%d.2", report);
+        ASSERT_STR_EQ("pop value", expected, values[2].value.value);
+    }
+    result = report_queue_pop(&queue, &timestamp, values, NULL, &count);
+    ASSERT_EQ("empty", 0, result);
+    report_queue_free(&queue);
+    return 0;
+}
+
+int test_pipeline_queue_block(void)
+{
+    report_queue queue;
+    report_entry values[TEST_QUEUE_CHANNELS];
+    long long timestamp;
+    int count;
+    uint64_t signaled;
+    report_queue_init(&queue, TEST_QUEUE_CAPACITY, TEST_QUEUE_CHANNELS, 0, REPORT_OVERFLOW_BLOCK);
+
+    // A full queue refuses the report and signals the space_fd on the next pop
+    test_values(values, 0);
+    for (int report = 0; report < TEST_QUEUE_CAPACITY; report++)
+        report_queue_push(&queue, report, values, NULL, TEST_QUEUE_CHANNELS);
+    int result = report_queue_push(&queue, TEST_QUEUE_CAPACITY, values, NULL, 1);
+    ASSERT_EQ("full push", -1, result);
+    int waiting = atomic_load(&queue.waiting);
+    ASSERT_EQ("waiting", 1, waiting);
+    ssize_t length = read(queue.space_fd, &signaled, sizeof(signaled));
+    ASSERT_EQ("no space signaled", -1, (int)length);
+    report_queue_pop(&queue, &timestamp, values, NULL, &count);
+    length = read(queue.space_fd, &signaled, sizeof(signaled));
+    ASSERT_EQ("space signaled", (int)sizeof(signaled), (int)length);
+    result = report_queue_push(&queue, TEST_QUEUE_CAPACITY, values, NULL, 1);
+    ASSERT_EQ("push after pop", SUCCESS, result);
+    int dropped = (int)atomic_load(&queue.dropped);
+    ASSERT_EQ("nothing dropped", 0, dropped);
+
+    int popped = 0;
+    while (report_queue_pop(&queue, &timestamp, values, NULL, &count))
+        popped++;
+    ASSERT_EQ("popped", TEST_QUEUE_CAPACITY, popped);
+    ASSERT_EQ("last report", TEST_QUEUE_CAPACITY, (int)timestamp);
+    report_queue_free(&queue);
+    return 0;
+}
+
+int test_pipeline_mailbox(void)
+{
+    static report_mailbox mailbox;
+    report_value value;
+    unsigned first = report_mailbox_read(&mailbox, &value);
+    report_mailbox_write(&mailbox, "4.2", 3, 0);
+    unsigned second = report_mailbox_read(&mailbox, &value);
+    ASSERT_EQ("sequence changed", 1, first != second);
+    ASSERT_STR_EQ("value", "4.2", value.value);
+    ASSERT_EQ("length", 3, value.length);
+    unsigned third = report_mailbox_read(&mailbox, &value);
+    ASSERT_EQ("sequence unchanged", 1, second == third);
+    return 0;
+}
+
+int test_pipeline_report(void)
+{
+    // The pipeline reports are the same as the reports of the single loop
+    static char capture_buffer[REPORT_BUFFER_SIZE];
+    FILE *stream = fmemopen(capture_buffer, sizeof(capture_buffer), "w");
+    channel_table channels;
+    channel_table_init(&channels, CHANNELS_DEFAULT);
+    channel_table_connect(&channels);
+    report_options options;
+    report_options_init(&options, REPORT_INTERVAL_20MS, CONTROL_DISABLED);
+    options.count = 20;
+    options.pipeline_enable = 1;
+    options.overflow_policy = REPORT_OVERFLOW_BLOCK;
+    udp_socket no_control = {.sockfd = -1};
+    int result = print_report(stream, &options, &channels, no_control);
+    channel_table_close(&channels);
+    channel_table_free(&channels);
+    fclose(stream);
+    ASSERT_EQ("pipeline report print", SUCCESS, result);
+
+    report_verifier verifier;
+    report_verifier_init(&verifier, REPORT_INTERVAL_20MS, NULL, NULL);
+    report_verifier_feed(&verifier, capture_buffer, strlen(capture_buffer));
+    report_verifier_finish(&verifier);
+    report_verifier_free(&verifier);
+    ASSERT_EQ("pipeline reports", 19, (int)verifier.reports);
+    ASSERT_EQ("pipeline report timing", 0, (int)verifier.timing_violations);
+
+    // The ingest thread values reach the output thread
+    int out1_values = 0;
+    report_message message;
+    for (char *line = strtok(capture_buffer, "\n"); line != NULL; line = strtok(NULL, "\n"))
+    {
+        if (parse_report_line(line, &message) && !isnan(message.values[0]))
+            out1_values++;
+    }
+    printf("out1 values: %d\n", out1_values);
+    ASSERT_EQ("pipeline out1 values", 1, out1_values > 0);
+    return 0;
+}
+
+typedef struct
+{
+    int fds[TEST_SHARD_CHANNELS][2];
+    atomic_int running;
+} test_shard_feeder;
+
+// Only the even channels receive data, the first shard owns both of them
+static void *test_shard_feed(void *arg)
+{
+    test_shard_feeder *feeder = arg;
+    static char lines[TEST_SHARD_FEED_LINES * 4];
+    for (int n = 0; n < TEST_SHARD_FEED_LINES; n++)
+        memcpy(lines + n * 4, "1.5\n", 4);
+    while (atomic_load(&feeder->running))
+    {
+        for (int i = 0; i < TEST_SHARD_CHANNELS; i += 2)
+            write(feeder->fds[i][0], lines, sizeof(lines));
+        usleep(TEST_SHARD_FEED_US);
+    }
+    return NULL;
+}
+
+int test_pipeline_shards(void)
+{
+    // Two shards of four channels, the idle shard steals a hot channel from the busy one
+    static char capture_buffer[REPORT_BUFFER_SIZE * 2];
+    FILE *stream = fmemopen(capture_buffer, sizeof(capture_buffer), "w");
+    test_shard_feeder feeder;
+    channel_table channels = {0};
+    for (int i = 0; i < TEST_SHARD_CHANNELS; i++)
+    {
+        char name[CHANNEL_NAME_SIZE];
+        snprintf(name, sizeof(name), "out%d", i + 1);
+        channel_table_add(&channels, CHANNEL_HOST_DEFAULT, TCP_PORT_OUT1 + i, name);
+        socketpair(AF_UNIX, SOCK_STREAM, 0, feeder.fds[i]);
+        fcntl(feeder.fds[i][1], F_SETFL, O_NONBLOCK);
+        tcp_stream_init(&channels.states[i].stream, feeder.fds[i][1]);
+    }
+    report_stats stats;
+    report_stats_init(&stats, &channels);
+    report_options options;
+    report_options_init(&options, REPORT_INTERVAL_20MS, CONTROL_DISABLED);
+    options.count = TEST_SHARD_REPORTS;
+    options.pipeline_enable = 1;
+    options.shard_count = 2;
+    options.stats = &stats;
+    udp_socket no_control = {.sockfd = -1};
+
+    sigset_t all_signals, previous_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &previous_mask);
+    pthread_t thread;
+    atomic_store(&feeder.running, 1);
+    pthread_create(&thread, NULL, test_shard_feed, &feeder);
+    pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
+    int result = print_report(stream, &options, &channels, no_control);
+    atomic_store(&feeder.running, 0);
+    pthread_join(thread, NULL);
+    fclose(stream);
+    ASSERT_EQ("sharded report print", SUCCESS, result);
+
+    int moved = (int)atomic_load(&stats.channels_moved);
+    printf("channels moved: %d\n", moved);
+    ASSERT_EQ("channel stolen", 1, moved >= 1);
+
+    // The values of both shards are merged into the reports, also after the move
+    int reports = 0;
+    int merged = 0;
+    int out2_values = 0;
+    report_message message;
+    for (char *line = strtok(capture_buffer, "\n"); line != NULL; line = strtok(NULL, "\n"))
+    {
+        if (!parse_report_line(line, &message) || (message.count != TEST_SHARD_CHANNELS))
+            continue;
+        reports++;
+        if ((reports > TEST_SHARD_REPORTS / 2) && !isnan(message.values[0]) && !isnan(message.values[2]))
+            merged++;
+        if (!isnan(message.values[1]))
+            out2_values++;
+    }
+    printf("reports: %d merged after the move: %d\n", reports, merged);
+    ASSERT_EQ("sharded reports", TEST_SHARD_REPORTS - 1, reports);
+    ASSERT_EQ("merged reports", 1, merged > 0);
+    ASSERT_EQ("idle channel", 0, out2_values);
+
+    report_stats_free(&stats);
+    for (int i = 0; i < TEST_SHARD_CHANNELS; i++)
+        close(feeder.fds[i][0]);
+    channel_table_close(&channels);
+    channel_table_free(&channels);
+    return 0;
+}
+
+int main(void)
+{
+    RUN_TEST(test_pipeline_queue_drop_oldest);
+    RUN_TEST(test_pipeline_queue_block);
+    RUN_TEST(test_pipeline_mailbox);
+    RUN_TEST(test_pipeline_report);
+    RUN_TEST(test_pipeline_shards);
+    return 0;
+}
@@ -15,7 +15,7 @@ udp_socket open_udp_control_socket(int control_udp_port);
 void close_udp_socket(udp_socket udp_control_socket);
 
 // Report printer
-int print_report(FILE *file, int interval_ms, int sockfd_out1, int sockfd_out2, int sockfd_out3, udp_socket udp_control_socket, int count);
+int print_report(FILE *file, const report_options *options, channel_table *channels, udp_socket udp_control_socket);
 
 // Data buffer for assertions
 char data_buffer[DATA_SIZE];
@@ -79,6 +79,177 @@ int test_protocol_read_tcp_last_line(void)
     return 0;
 }
 
+int test_protocol_read_tcp_stream(void)
+{
+    int sv[2];
+    tcp_stream stream;
+    char line[CHANNEL_VALUE_SIZE];
+
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+    tcp_stream_init(&stream, sv[1]);
+
+    // A line split across reads is reassembled from the partial line
+    write(sv[0], "1.5\n-2.", 7);
+    int result = read_tcp_stream_last_line(&stream, line, sizeof(line));
+    ASSERT_EQ("first read", SUCCESS, result);
+    ASSERT_STR_EQ("complete line", "1.5", line);
+    write(sv[0], "5\n", 2);
+    read_tcp_stream_last_line(&stream, line, sizeof(line));
+    ASSERT_STR_EQ("reassembled line", "-2.5", line);
+    read_tcp_stream_last_line(&stream, line, sizeof(line));
+    ASSERT_STR_EQ("empty read", "--", line);
+
+    // A large backlog is discarded up to the tail and the newest line is read
+    char backlog[4 * TCP_STREAM_CHUNK_SIZE];
+    for (size_t i = 0; i < sizeof(backlog); i += 4)
+        memcpy(backlog + i, "0.0\n", 4);
+    memcpy(backlog + sizeof(backlog) - 8, "4.9\n3.", 6);
+    write(sv[0], backlog, sizeof(backlog) - 2);
+    read_tcp_stream_last_line(&stream, line, sizeof(line));
+    ASSERT_STR_EQ("backlog tail line", "4.9", line);
+    write(sv[0], "3\n", 2);
+    read_tcp_stream_last_line(&stream, line, sizeof(line));
+    ASSERT_STR_EQ("backlog partial line", "3.3", line);
+
+    // A line too long for the partial buffer is skipped
+    char long_line[3 * TCP_STREAM_LINE_SIZE];
+    memset(long_line, '1', sizeof(long_line));
+    write(sv[0], long_line, sizeof(long_line));
+    write(sv[0], "\n2.0", 4);
+    read_tcp_stream_last_line(&stream, line, sizeof(line));
+    ASSERT_STR_EQ("long line skipped", "--", line);
+    write(sv[0], "\n", 1);
+    read_tcp_stream_last_line(&stream, line, sizeof(line));
+    ASSERT_STR_EQ("line after long line", "2.0", line);
+
+    close(sv[0]);
+    close(sv[1]);
+    return 0;
+}
+
+int test_protocol_parse_report(void)
+{
+    report_message message;
+    report_message messages[4];
+    size_t consumed;
+
+    // Values in the report order, "--" as NaN, the exponents by the fallback
+    int result = parse_report_line("{\"timestamp\": 1709898396584, \"out1\": \"-4.8\", \"out2\": \"--\", \"out3\": \"1.5e1\"}", &message);
+    ASSERT_EQ("line parsed", 1, result);
+    ASSERT_EQ("timestamp", 1, message.timestamp == 1709898396584LL);
+    ASSERT_EQ("value count", 3, message.count);
+    ASSERT_EQ("negative value", 1, message.values[0] == -4.8f);
+    ASSERT_EQ("missing value", 1, isnan(message.values[1]));
+    ASSERT_EQ("exponent value", 1, message.values[2] == 15.0f);
+    result = parse_report_line("{\"timestamp\": 1, \"out1\": \"4.x\"}", &message);
+    ASSERT_EQ("malformed value", 0, result);
+    result = parse_report_line("{\"timestamp\": 1, \"out1\": \"4.0\"", &message);
+    ASSERT_EQ("unterminated line", 0, result);
+
+    // A buffer is parsed line by line, a malformed line is skipped
+    const char buffer[] = "{\"timestamp\": 1, \"out1\": \"1.0\"}\n"
+                          "garbage\n"
+                          "{\"timestamp\": 2, \"out1\": \"2.0\"}\n"
+                          "{\"timestamp\": 3, \"out1\": \"3.0\"}";
+    result = parse_report_buffer(buffer, strlen(buffer), messages, 4, &consumed);
+    ASSERT_EQ("buffer messages", 3, result);
+    ASSERT_EQ("buffer consumed", (int)strlen(buffer), (int)consumed);
+    ASSERT_EQ("last message", 1, messages[2].timestamp == 3 && messages[2].values[0] == 3.0f);
+    result = parse_report_buffer(buffer, strlen(buffer), messages, 1, &consumed);
+    ASSERT_EQ("full array", 1, result);
+    ASSERT_EQ("partial consume", 1, buffer[consumed] == 'g');
+
+    // The reports of more channels than REPORT_CHANNEL_MAX are accepted, the extra values counted
+    channel_table channels = {0};
+    for (int i = 0; i < REPORT_CHANNEL_MAX + 44; i++)
+    {
+        char name[CHANNEL_NAME_SIZE];
+        snprintf(name, sizeof(name), "out%d", i + 1);
+        channel_table_add(&channels, CHANNEL_HOST_DEFAULT, TCP_PORT_OUT1, name);
+        channel_set_value(&channels.states[i], (i % 2) ? "--" : "2.5");
+    }
+    size_t size = report_buffer_size(&channels);
+    char *report = malloc(size);
+    int length = format_report(report, size, &channels);
+    result = parse_report_line(report, &message);
+    ASSERT_EQ("large report parsed", 1, result);
+    ASSERT_EQ("stored values", REPORT_CHANNEL_MAX, message.count);
+    ASSERT_EQ("skipped values", 44, message.skipped);
+    ASSERT_EQ("last stored value", 1, isnan(message.values[REPORT_CHANNEL_MAX - 1]));
+    result = parse_report_buffer(report, length, messages, 4, &consumed);
+    ASSERT_EQ("large report buffer", 1, result);
+    ASSERT_EQ("large report consumed", length, (int)consumed);
+    free(report);
+    channel_table_free(&channels);
+    return 0;
+}
+
+int test_protocol_report_interval(void)
+{
+    // Milliseconds without a unit, the units down to nanoseconds
+    long long interval_ns = parse_report_interval("20");
+    ASSERT_EQ("milliseconds", 1, interval_ns == 20000000LL);
+    interval_ns = parse_report_interval("500us");
+    ASSERT_EQ("microseconds", 1, interval_ns == 500000LL);
+    interval_ns = parse_report_interval("5s");
+    ASSERT_EQ("seconds", 1, interval_ns == 5000000000LL);
+    interval_ns = parse_report_interval("250000ns");
+    ASSERT_EQ("nanoseconds", 1, interval_ns == 250000LL);
+    const char *invalid[] = {"", "0", "-1ms", "1.5ms", "10 ms", "3min", "99999999999s"};
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+        interval_ns = parse_report_interval(invalid[i]);
+        ASSERT_EQ(invalid[i], 1, interval_ns == -1);
+    }
+
+    // The millisecond timestamp is rounded from the nanosecond one, which follows it
+    channel_table channels;
+    channel_table_init(&channels, "4001/out1");
+    channel_set_value(&channels.states[0], "1.5");
+    size_t size = report_buffer_size(&channels);
+    char *buffer = malloc(size);
+    int length = format_report_at_ns(buffer, size, &channels, 1709898396584512345LL);
+    ASSERT_STR_EQ("nanosecond report", "{\"timestamp\": 1709898396585, \"timestamp_ns\": 1709898396584512345, \"out1\": \"1.5\"}", buffer);
+    ASSERT_EQ("length", (int)strlen(buffer), length);
+    report_message message;
+    int result = parse_report_line(buffer, &message);
+    ASSERT_EQ("parsed", 1, result);
+    ASSERT_EQ("timestamp", 1, message.timestamp == 1709898396585LL);
+    ASSERT_EQ("timestamp_ns", 1, message.timestamp_ns == 1709898396584512345LL);
+    ASSERT_EQ("value", 1, (message.count == 1) && (message.values[0] == 1.5f));
+    format_report_at(buffer, size, &channels, 1709898396585LL);
+    parse_report_line(buffer, &message);
+    ASSERT_EQ("no timestamp_ns", 1, message.timestamp_ns == 0);
+    free(buffer);
+
+    // Reports at a 500 us interval with the nanosecond timestamps
+    report_options options;
+    report_options_init(&options, REPORT_INTERVAL_20MS, CONTROL_DISABLED);
+    options.interval_ns = 500000LL;
+    options.count = 41;
+    options.timestamp_ns_enable = 1;
+    udp_socket no_control = {.sockfd = -1};
+    static char capture_buffer[REPORT_BUFFER_SIZE * 4];
+    FILE *stream = fmemopen(capture_buffer, sizeof(capture_buffer), "w");
+    result = print_report(stream, &options, &channels, no_control);
+    fclose(stream);
+    ASSERT_EQ("report print", SUCCESS, result);
+    int reports = 0;
+    long long first_ns = 0, last_ns = 0;
+    for (char *line = strtok(capture_buffer, "\n"); line != NULL; line = strtok(NULL, "\n"))
+    {
+        if (!parse_report_line(line, &message))
+            continue;
+        first_ns = reports++ ? first_ns : message.timestamp_ns;
+        last_ns = message.timestamp_ns;
+    }
+    printf("reports: %d mean interval: %lld ns\n", reports, reports > 1 ? (last_ns - first_ns) / (reports - 1) : 0);
+    ASSERT_EQ("reports", 40, reports);
+    ASSERT_EQ("sub-millisecond interval", 1, (last_ns - first_ns) / (reports - 1) < 1000000LL);
+    channel_table_free(&channels);
+    return 0;
+}
+
 int test_protocol_print_report(void)
 {
     // setup stream capture
@@ -89,14 +260,16 @@ int test_protocol_print_report(void)
         perror("fmemopen");
         return 1;
     }
-    int sockfd_out1 = connect_to_tcp_port(TCP_PORT_OUT1);
-    int sockfd_out2 = connect_to_tcp_port(TCP_PORT_OUT2);
-    int sockfd_out3 = connect_to_tcp_port(TCP_PORT_OUT3);
+    channel_table channels;
+    channel_table_init(&channels, CHANNELS_DEFAULT);
+    channel_table_connect(&channels);
+    report_options options;
+    report_options_init(&options, REPORT_INTERVAL_100MS, CONTROL_ENABLED);
+    options.count = REPORT_COUNT_100;
     udp_socket control_udp_socket = open_udp_control_socket(CONTROL_UDP_PORT);
-    int result = print_report(stream, REPORT_INTERVAL_100MS, sockfd_out1, sockfd_out2, sockfd_out3, control_udp_socket, REPORT_COUNT_100);
-    close_tcp_socket(sockfd_out1);
-    close_tcp_socket(sockfd_out2);
-    close_tcp_socket(sockfd_out3);
+    int result = print_report(stream, &options, &channels, control_udp_socket);
+    channel_table_close(&channels);
+    channel_table_free(&channels);
     close_udp_socket(control_udp_socket);
     fclose(stream);
     ASSERT_EQ("report print", SUCCESS, result);
@@ -106,9 +279,210 @@ int test_protocol_print_report(void)
     return 0;
 }
 
+// Server of a channel that restarts, 1.5 before and 2.5 after the restart
+typedef struct
+{
+    int port;
+    atomic_int running;
+    long long restart_ms; // epoch milliseconds of the restart
+} test_restart_server;
+
+static int test_listen(int *port)
+{
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(*port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t length = sizeof(address);
+    if ((bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0) || (listen(listen_fd, 1) < 0))
+    {
+        close(listen_fd);
+        return -1;
+    }
+    getsockname(listen_fd, (struct sockaddr *)&address, &length);
+    *port = ntohs(address.sin_port);
+    return listen_fd;
+}
+
+static void *test_restart_serve(void *arg)
+{
+    test_restart_server *server = arg;
+    int port = server->port;
+    for (int phase = 0; phase < 2; phase++)
+    {
+        int listen_fd = test_listen(&port);
+        if (phase == 1)
+            server->restart_ms = current_timestamp_ms();
+        int fd = accept(listen_fd, NULL, NULL);
+        for (int i = 0; (fd >= 0) && atomic_load(&server->running) && ((phase == 1) || (i < 100)); i++)
+        {
+            write(fd, phase ? "2.5\n" : "1.5\n", 4);
+            usleep(2000);
+        }
+        close(fd);
+        close(listen_fd);
+        // The server is down for a few report intervals
+        if (phase == 0)
+            usleep(200000);
+    }
+    return NULL;
+}
+
+int test_protocol_reconnect(void)
+{
+    // The channel reconnects after the server restart, and the data resumes within an interval
+    static char capture_buffer[REPORT_BUFFER_SIZE];
+    FILE *stream = fmemopen(capture_buffer, sizeof(capture_buffer), "w");
+    test_restart_server server = {.port = 0, .running = 1};
+    int listen_fd = test_listen(&server.port);
+    close(listen_fd);
+    pthread_t thread;
+    pthread_create(&thread, NULL, test_restart_serve, &server);
+
+    char list[64];
+    snprintf(list, sizeof(list), "127.0.0.1:%d/out1", server.port);
+    channel_table channels;
+    channel_table_init(&channels, list);
+    usleep(10000);
+    channel_table_connect(&channels);
+    report_options options;
+    report_options_init(&options, REPORT_INTERVAL_20MS, CONTROL_DISABLED);
+    options.count = 40;
+    udp_socket no_control = {.sockfd = -1};
+    int result = print_report(stream, &options, &channels, no_control);
+    unsigned long long reconnects = channels.states[0].connection.reconnects;
+    atomic_store(&server.running, 0);
+    pthread_join(thread, NULL);
+    channel_table_close(&channels);
+    channel_table_free(&channels);
+    fclose(stream);
+    ASSERT_EQ("report print", SUCCESS, result);
+
+    int before = 0, down = 0;
+    long long resumed_ms = 0;
+    report_message message;
+    for (char *line = strtok(capture_buffer, "\n"); line != NULL; line = strtok(NULL, "\n"))
+    {
+        if (!parse_report_line(line, &message))
+            continue;
+        if (message.values[0] == 1.5f)
+            before++;
+        else if (isnan(message.values[0]) && (before > 0) && (resumed_ms == 0))
+            down++;
+        else if ((message.values[0] == 2.5f) && (resumed_ms == 0))
+            resumed_ms = message.timestamp;
+    }
+    long long resume_delay_ms = resumed_ms - server.restart_ms;
+    printf("before: %d down: %d reconnects: %llu resumed after: %lld ms\n", before, down, reconnects, resume_delay_ms);
+    ASSERT_EQ("data before the restart", 1, before > 0);
+    ASSERT_EQ("empty while down", 1, down > 0);
+    ASSERT_EQ("reconnected", 1, reconnects > 0);
+    ASSERT_EQ("data resumed", 1, resumed_ms > 0);
+    // Received within an interval of the restart, and reported at the following tick
+    ASSERT_EQ("resumed within an interval", 1, resume_delay_ms <= 2 * REPORT_INTERVAL_20MS);
+    return 0;
+}
+
+int test_protocol_receive_timestamps(void)
+{
+    // The value carries the kernel receive time of its segment, read with the data
+    int port = 0;
+    int listen_fd = test_listen(&port);
+    ASSERT_EQ("listen", 1, listen_fd >= 0);
+    char list[64];
+    snprintf(list, sizeof(list), "127.0.0.1:%d/out1", port);
+    channel_table channels;
+    channel_table_init(&channels, list);
+    channels.receive_timestamps = 1;
+    channel_state *state = &channels.states[0];
+    int sockfd = channel_connect(&channels, 0);
+    ASSERT_EQ("connect", 1, sockfd >= 0);
+    int server_fd = accept(listen_fd, NULL, NULL);
+    usleep(10000);
+    ASSERT_EQ("connected", 0, channel_connect_complete(state));
+    ASSERT_EQ("timestamps enabled", 1, state->stream.timestamps);
+
+    write(server_fd, "1.5\n", 4);
+    usleep(20000);
+    report_options options;
+    report_options_init(&options, REPORT_INTERVAL_20MS, CONTROL_DISABLED);
+    report_read_channel(&options, &channels, 0, EPOLLIN);
+    long long age_ns = current_timestamp_ns() - state->value_ns;
+    printf("value: %s age: %lld us\n", state->value, age_ns / 1000);
+    ASSERT_STR_EQ("value", "1.5", state->value);
+    ASSERT_EQ("receive time", 1, state->value_ns > 0);
+    // Received before the sleep, not when read
+    ASSERT_EQ("age", 1, (age_ns >= 15000000LL) && (age_ns < 1000000000LL));
+    close(server_fd);
+    close(listen_fd);
+
+    // The ages follow the report values, which are still parsed
+    state->value_ns = 1709898396584000000LL;
+    size_t size = report_buffer_size(&channels) + report_ages_size(&channels);
+    char *buffer = malloc(size);
+    int length = format_report_at_ns(buffer, size, &channels, 1709898396584512345LL);
+    length = format_report_ages(buffer, size, length, &channels, 1709898396584512345LL);
+    ASSERT_STR_EQ("ages", "{\"timestamp\": 1709898396585, \"timestamp_ns\": 1709898396584512345, \"out1\": \"1.5\", \"age_us\": {\"out1\": 512}}", buffer);
+    ASSERT_EQ("length", (int)strlen(buffer), length);
+    report_message message;
+    ASSERT_EQ("parsed", 1, parse_report_line(buffer, &message));
+    ASSERT_EQ("parsed value", 1, (message.count == 1) && (message.values[0] == 1.5f));
+    free(buffer);
+    channel_table_close(&channels);
+    channel_table_free(&channels);
+    return 0;
+}
+
+int test_protocol_options(void)
+{
+    // The report count is -1 for unlimited or positive
+    const char *valid[] = {"-1", "1", "250"};
+    const char *invalid[] = {"", "0", "-2", "abc", "5x", "99999999999"};
+    report_options options;
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++)
+    {
+        char *argv[] = {"client2", "-n", (char *)valid[i], NULL};
+        report_options_init(&options, REPORT_INTERVAL_20MS, CONTROL_DISABLED);
+        int result = parse_report_options(3, argv, &options);
+        ASSERT_EQ(valid[i], SUCCESS, result);
+        ASSERT_EQ("count", atoi(valid[i]), options.count);
+    }
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+        char *argv[] = {"client2", "-n", (char *)invalid[i], NULL};
+        report_options_init(&options, REPORT_INTERVAL_20MS, CONTROL_DISABLED);
+        int result = parse_report_options(3, argv, &options);
+        ASSERT_EQ(invalid[i], FAILURE, result);
+    }
+
+    // The numeric options are whole numbers within their range
+    const char *invalid_options[][2] = {{"--flush-bytes", "12abc"}, {"--flush-count", "0"}, {"--queue-capacity", ""},
+                                        {"--shards", "65"}, {"--shard-cpu", "-1"}, {"--segment-size", "1e6"}};
+    for (size_t i = 0; i < sizeof(invalid_options) / sizeof(invalid_options[0]); i++)
+    {
+        char *argv[] = {"client2", (char *)invalid_options[i][0], (char *)invalid_options[i][1], NULL};
+        report_options_init(&options, REPORT_INTERVAL_20MS, CONTROL_DISABLED);
+        int result = parse_report_options(3, argv, &options);
+        ASSERT_EQ(invalid_options[i][0], FAILURE, result);
+    }
+    char *argv[] = {"client2", "--flush-bytes", "4096", "--shards", "4", NULL};
+    report_options_init(&options, REPORT_INTERVAL_20MS, CONTROL_DISABLED);
+    int result = parse_report_options(5, argv, &options);
+    ASSERT_EQ("numeric options", SUCCESS, result);
+    ASSERT_EQ("flush bytes", 4096, (int)options.sink.flush_bytes);
+    ASSERT_EQ("shards", 4, options.shard_count);
+    return 0;
+}
+
 int main(void)
 {
     RUN_TEST(test_protocol_read_tcp_last_line);
+    RUN_TEST(test_protocol_read_tcp_stream);
+    RUN_TEST(test_protocol_parse_report);
+    RUN_TEST(test_protocol_report_interval);
+    RUN_TEST(test_protocol_options);
     RUN_TEST(test_protocol_print_report);
+    RUN_TEST(test_protocol_reconnect);
+    RUN_TEST(test_protocol_receive_timestamps);
     return 0;
 }
@@ -0,0 +1,83 @@
+#include "test.h"
+#include "../src/protocol.h"
+#include <poll.h>
+
+#define TEST_RT_TICKS 50
+#define TEST_RT_INTERVAL_MS 10
+
+int test_rt_tick_deadlines(void)
+{
+    rt_tick tick;
+    int fd = rt_tick_start(&tick, TEST_RT_INTERVAL_MS * 1000000LL);
+    ASSERT_EQ("tick started", 1, fd >= 0);
+
+    // Each tick is on an interval boundary, the deadlines advance by the expirations
+    long long interval_ns = TEST_RT_INTERVAL_MS * 1000000LL;
+    long long previous_deadline_ns = 0;
+    long long max_late_ns = 0;
+    int misaligned = 0;
+    int skipped = 0;
+    int ticks = 0;
+    while (ticks < TEST_RT_TICKS)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 1000) != 1)
+            break;
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            continue;
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long deadline_ns = atomic_load(&tick.deadline_ns);
+        long long late_ns = now.tv_sec * 1000000000LL + now.tv_nsec - deadline_ns;
+        if (late_ns > max_late_ns)
+            max_late_ns = late_ns;
+        misaligned += (deadline_ns % interval_ns) != 0;
+        if ((previous_deadline_ns != 0) && (deadline_ns - previous_deadline_ns != (long long)expirations * interval_ns))
+            skipped++;
+        previous_deadline_ns = deadline_ns;
+        ticks += expirations;
+    }
+    rt_tick_stop(&tick);
+    printf("ticks: %d max lateness: %lld us overruns: %llu\n", ticks, max_late_ns / 1000, (unsigned long long)atomic_load(&tick.overruns));
+    ASSERT_EQ("ticks", 1, ticks >= TEST_RT_TICKS);
+    ASSERT_EQ("aligned deadlines", 0, misaligned);
+    ASSERT_EQ("consecutive deadlines", 0, skipped);
+    return 0;
+}
+
+int test_rt_tick_report(void)
+{
+    // The report loop runs on the real-time tick with the same output
+    static char capture_buffer[REPORT_BUFFER_SIZE];
+    FILE *stream = fmemopen(capture_buffer, sizeof(capture_buffer), "w");
+    channel_table channels;
+    channel_table_init(&channels, CHANNELS_DEFAULT);
+    channel_table_connect(&channels);
+    report_options options;
+    report_options_init(&options, REPORT_INTERVAL_20MS, CONTROL_DISABLED);
+    options.count = 20;
+    options.rt_enable = 1;
+    udp_socket no_control = {.sockfd = -1};
+    int result = print_report(stream, &options, &channels, no_control);
+    channel_table_close(&channels);
+    channel_table_free(&channels);
+    fclose(stream);
+    ASSERT_EQ("rt report print", SUCCESS, result);
+
+    report_verifier verifier;
+    report_verifier_init(&verifier, REPORT_INTERVAL_20MS, NULL, NULL);
+    report_verifier_feed(&verifier, capture_buffer, strlen(capture_buffer));
+    report_verifier_finish(&verifier);
+    report_verifier_free(&verifier);
+    ASSERT_EQ("rt reports", 19, (int)verifier.reports);
+    ASSERT_EQ("rt report timing", 0, (int)verifier.timing_violations);
+    return 0;
+}
+
+int main(void)
+{
+    RUN_TEST(test_rt_tick_deadlines);
+    RUN_TEST(test_rt_tick_report);
+    return 0;
+}
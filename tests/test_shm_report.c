@@ -0,0 +1,119 @@
+#include "test.h"
+#include "../src/protocol.h"
+
+#define TEST_SHM_REPORTS 200000
+
+int test_shm_report_roundtrip(void)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/test_shm_report_%d", getpid());
+    channel_table channels;
+    channel_table_init(&channels, CHANNELS_DEFAULT);
+    shm_report_publisher publisher;
+    shm_report_reader reader;
+    long long timestamp;
+    float values[3];
+    unsigned long long sequence;
+
+    int result = shm_report_reader_open(&reader, name);
+    ASSERT_EQ("no segment", -1, result);
+    result = shm_report_publisher_open(&publisher, name, &channels);
+    ASSERT_EQ("publisher open", SUCCESS, result);
+    result = shm_report_reader_open(&reader, name);
+    ASSERT_EQ("reader open", SUCCESS, result);
+    ASSERT_EQ("channel count", 3, reader.channel_count);
+    int index = shm_report_channel_index(&reader, "out3");
+    ASSERT_EQ("channel index", 2, index);
+    index = shm_report_channel_index(&reader, "out4");
+    ASSERT_EQ("unknown channel", -1, index);
+    result = shm_report_read(&reader, &timestamp, values, &sequence);
+    ASSERT_EQ("nothing published", 0, result);
+
+    // The values are parsed once by the publisher, "--" as NaN
+    channel_set_value(&channels.states[0], "-4.8");
+    channel_set_value(&channels.states[1], "--");
+    channel_set_value(&channels.states[2], "3.5");
+    shm_report_publish(&publisher, 1709898396584LL, &channels);
+    result = shm_report_read(&reader, &timestamp, values, &sequence);
+    ASSERT_EQ("published", 1, result);
+    ASSERT_EQ("sequence", 1, (int)sequence);
+    ASSERT_EQ("timestamp", 1, timestamp == 1709898396584LL);
+    ASSERT_EQ("out1", 1, values[0] == -4.8f);
+    ASSERT_EQ("out2 NaN", 1, isnan(values[1]));
+    ASSERT_EQ("out3", 1, values[2] == 3.5f);
+
+    // The mapped reader keeps the last report after the segment is removed
+    shm_report_publisher_close(&publisher);
+    result = shm_report_read(&reader, &timestamp, values, &sequence);
+    ASSERT_EQ("read after close", 1, result);
+    shm_report_reader_close(&reader);
+    result = shm_report_reader_open(&reader, name);
+    ASSERT_EQ("segment removed", -1, result);
+    channel_table_free(&channels);
+    return 0;
+}
+
+typedef struct
+{
+    const char *name;
+    atomic_int done;
+    int torn;
+    int reads;
+} test_shm_reader_context;
+
+// Each report has the same value in every channel, a mixed report is a torn read
+static void *test_shm_reader(void *arg)
+{
+    test_shm_reader_context *context = arg;
+    shm_report_reader reader;
+    if (shm_report_reader_open(&reader, context->name) < 0)
+        return NULL;
+    long long timestamp;
+    float values[3];
+    while (!atomic_load(&context->done))
+    {
+        if (shm_report_read(&reader, &timestamp, values, NULL) != 1)
+            continue;
+        context->reads++;
+        if ((values[0] != values[1]) || (values[1] != values[2]) || ((long long)values[0] != timestamp))
+            context->torn++;
+    }
+    shm_report_reader_close(&reader);
+    return NULL;
+}
+
+int test_shm_report_concurrent(void)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/test_shm_report_%d", getpid());
+    channel_table channels;
+    channel_table_init(&channels, CHANNELS_DEFAULT);
+    shm_report_publisher publisher;
+    shm_report_publisher_open(&publisher, name, &channels);
+    test_shm_reader_context context = {.name = name};
+    pthread_t thread;
+    pthread_create(&thread, NULL, test_shm_reader, &context);
+
+    for (int report = 1; report <= TEST_SHM_REPORTS; report++)
+    {
+        char value[CHANNEL_VALUE_SIZE];
+        snprintf(value, sizeof(value), "%d", report % 1000);
+        for (int i = 0; i < channels.count; i++)
+            channel_set_value(&channels.states[i], value);
+        shm_report_publish(&publisher, report % 1000, &channels);
+    }
+    atomic_store(&context.done, 1);
+    pthread_join(thread, NULL);
+    printf("reads: %d torn: %d\n", context.reads, context.torn);
+    ASSERT_EQ("no torn reads", 0, context.torn);
+    shm_report_publisher_close(&publisher);
+    channel_table_free(&channels);
+    return 0;
+}
+
+int main(void)
+{
+    RUN_TEST(test_shm_report_roundtrip);
+    RUN_TEST(test_shm_report_concurrent);
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include "test.h"
+#include "../src/protocol.h"
+#include <sys/stat.h>
+
+#define TEST_SINK_CAPACITY 64
+
+static long test_file_size(int fd)
+{
+    struct stat status;
+    fstat(fd, &status);
+    return (long)status.st_size;
+}
+
+int test_sink_buffered_file(void)
+{
+    // The buffered reports reach the file by count, and the close policy syncs the file
+    FILE *file = tmpfile();
+    report_sink_config config;
+    report_sink_config_init(&config);
+    config.mode = REPORT_SINK_BUFFERED;
+    config.flush_count = 3;
+    config.fsync_policy = REPORT_SINK_FSYNC_CLOSE;
+    report_sink sink;
+    int result = report_sink_init(&sink, file, &config);
+    ASSERT_EQ("sink init", SUCCESS, result);
+    ASSERT_EQ("regular file synced", 1, sink.sync);
+
+    report_sink_write_line(&sink, "report 1", 8);
+    report_sink_write_line(&sink, "report 2", 8);
+    long size = test_file_size(fileno(file));
+    ASSERT_EQ("buffered", 0, (int)size);
+    report_sink_write_line(&sink, "report 3", 8);
+    size = test_file_size(fileno(file));
+    ASSERT_EQ("flushed by count", 27, (int)size);
+    report_sink_write(&sink, "tail", 4);
+    result = report_sink_free(&sink);
+    ASSERT_EQ("sink free", SUCCESS, result);
+    size = test_file_size(fileno(file));
+    ASSERT_EQ("flushed at free", 31, (int)size);
+    int flushes = (int)sink.flushes;
+    ASSERT_EQ("flushes", 2, flushes);
+
+    char content[64] = {0};
+    rewind(file);
+    fread(content, 1, sizeof(content) - 1, file);
+    ASSERT_STR_EQ("content", "report 1\nreport 2\nreport 3\ntail", content);
+    fclose(file);
+    return 0;
+}
+
+int test_sink_direct_pipe(void)
+{
+    // The direct mode writes to the descriptor, flushing by size, and writes a report
+    // larger than the free buffer together with the buffered reports
+    int pipe_fds[2];
+    pipe(pipe_fds);
+    FILE *file = fdopen(pipe_fds[1], "w");
+    report_sink_config config;
+    report_sink_config_init(&config);
+    config.mode = REPORT_SINK_DIRECT;
+    config.capacity = TEST_SINK_CAPACITY;
+    config.flush_bytes = 20;
+    config.flush_age_ms = 0;
+    report_sink sink;
+    int result = report_sink_init(&sink, file, &config);
+    ASSERT_EQ("sink init", SUCCESS, result);
+    ASSERT_EQ("pipe not synced", 0, sink.sync);
+
+    char buffer[256] = {0};
+    fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+    report_sink_write_line(&sink, "0123456789", 10);
+    ssize_t length = read(pipe_fds[0], buffer, sizeof(buffer));
+    ASSERT_EQ("buffered", -1, (int)length);
+    report_sink_write_line(&sink, "abcdefghij", 10);
+    length = read(pipe_fds[0], buffer, sizeof(buffer) - 1);
+    ASSERT_EQ("flushed by size", 22, (int)length);
+
+    char large[100];
+    memset(large, 'x', sizeof(large));
+    report_sink_write_line(&sink, "before", 6);
+    report_sink_write_line(&sink, large, sizeof(large));
+    memset(buffer, 0, sizeof(buffer));
+    length = read(pipe_fds[0], buffer, sizeof(buffer) - 1);
+    ASSERT_EQ("large report written", 108, (int)length);
+    ASSERT_EQ("report order", 0, strncmp(buffer, "before\nxxx", 10));
+    int flushes = (int)sink.flushes;
+    ASSERT_EQ("flushes", 2, flushes);
+    report_sink_free(&sink);
+    fclose(file);
+    close(pipe_fds[0]);
+    return 0;
+}
+
+int test_sink_flush_age(void)
+{
+    // The oldest buffered report flushes the sink when it reaches the age
+    static char capture_buffer[TEST_SINK_CAPACITY];
+    FILE *stream = fmemopen(capture_buffer, sizeof(capture_buffer), "w");
+    report_sink_config config;
+    report_sink_config_init(&config);
+    config.mode = REPORT_SINK_BUFFERED;
+    config.flush_age_ms = 5;
+    report_sink sink;
+    report_sink_init(&sink, stream, &config);
+    report_sink_write_line(&sink, "first", 5);
+    ASSERT_STR_EQ("buffered", "", capture_buffer);
+    usleep(10000);
+    report_sink_write_line(&sink, "second", 6);
+    ASSERT_STR_EQ("flushed by age", "first\nsecond\n", capture_buffer);
+    report_sink_free(&sink);
+    fclose(stream);
+
+    // The direct mode needs a file descriptor
+    stream = fmemopen(capture_buffer, sizeof(capture_buffer), "w");
+    config.mode = REPORT_SINK_DIRECT;
+    int result = report_sink_init(&sink, stream, &config);
+    ASSERT_EQ("direct without descriptor", -1, result);
+    report_sink_free(&sink);
+    fclose(stream);
+    return 0;
+}
+
+int main(void)
+{
+    RUN_TEST(test_sink_buffered_file);
+    RUN_TEST(test_sink_direct_pipe);
+    RUN_TEST(test_sink_flush_age);
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include "test.h"
+#include "../src/protocol.h"
+#include <sys/un.h>
+
+int test_stats_histogram(void)
+{
+    static stats_histogram histogram;
+
+    // Exact below the sub-bucket count, 12.5 % buckets above
+    ASSERT_EQ("small bucket", 7, stats_histogram_bucket(7));
+    ASSERT_EQ("first log bucket", 8, stats_histogram_bucket(8));
+    ASSERT_EQ("same bucket", stats_histogram_bucket(1000), stats_histogram_bucket(1010));
+    ASSERT_EQ("next bucket", stats_histogram_bucket(1000) + 1, stats_histogram_bucket(1024));
+    ASSERT_EQ("last bucket", STATS_HISTOGRAM_BUCKETS - 1, stats_histogram_bucket(UINT64_MAX));
+
+    for (uint64_t value = 1; value <= 1000; value++)
+        stats_histogram_record(&histogram, value * 1000);
+    uint64_t p50 = stats_histogram_percentile(&histogram, 50.0);
+    uint64_t p99 = stats_histogram_percentile(&histogram, 99.0);
+    uint64_t p100 = stats_histogram_percentile(&histogram, 100.0);
+    printf("p50: %llu p99: %llu max: %llu\n", (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)p100);
+    ASSERT_EQ("p50 within a bucket", 1, (p50 >= 500000) && (p50 <= 500000 * 1.125));
+    ASSERT_EQ("p99 within a bucket", 1, (p99 >= 990000) && (p99 <= 1000000));
+    ASSERT_EQ("p100 is max", 1, p100 == 1000000);
+    return 0;
+}
+
+int test_stats_dump(void)
+{
+    channel_table channels;
+    channel_table_init(&channels, CHANNELS_DEFAULT);
+    report_stats stats;
+    char file_path[] = "/tmp/test_stats_file_XXXXXX";
+    char socket_path[64];
+    close(mkstemp(file_path));
+    snprintf(socket_path, sizeof(socket_path), "/tmp/test_stats_%d.sock", getpid());
+
+    report_stats_init(&stats, &channels);
+    int result = report_stats_start(&stats, file_path, socket_path);
+    ASSERT_EQ("stats started", SUCCESS, result);
+    stats_histogram_record(&stats.stages[STATS_STAGE_FORMAT], 1500);
+    stats_counter_add(&stats.channel_stats[CHANNEL_OUT2].empty_intervals, 3);
+
+    // A snapshot is served on each connection
+    char buffer[4096] = {0};
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    strcpy(address.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    result = connect(fd, (struct sockaddr *)&address, sizeof(address));
+    ASSERT_EQ("socket connected", SUCCESS, result);
+    size_t length = 0;
+    ssize_t read_count;
+    while ((read_count = read(fd, buffer + length, sizeof(buffer) - 1 - length)) > 0)
+        length += read_count;
+    close(fd);
+    printf("%s", buffer);
+    ASSERT_EQ("format stage", 1, strstr(buffer, "stage format count 1 mean_ns 1500") != NULL);
+    ASSERT_EQ("channel counters", 1, strstr(buffer, "channel out2 bytes 0 lines 0 empty_intervals 3") != NULL);
+
+    // A snapshot is written to the file on SIGUSR1
+    kill(getpid(), SIGUSR1);
+    FILE *file = NULL;
+    for (int i = 0; (i < 100) && (length = 0, file = fopen(file_path, "r")) != NULL; i++)
+    {
+        length = fread(buffer, 1, sizeof(buffer) - 1, file);
+        fclose(file);
+        if (length > 0)
+            break;
+        usleep(10000);
+    }
+    buffer[length] = '\0';
+    ASSERT_EQ("dump file written", 1, strstr(buffer, "stage timer_lateness") != NULL);
+
+    report_stats_free(&stats);
+    unlink(file_path);
+    result = access(socket_path, F_OK);
+    ASSERT_EQ("socket removed", FAILURE, result);
+    channel_table_free(&channels);
+    return 0;
+}
+
+int main(void)
+{
+    RUN_TEST(test_stats_histogram);
+    RUN_TEST(test_stats_dump);
+    return 0;
+}
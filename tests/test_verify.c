@@ -0,0 +1,113 @@
+#include "test.h"
+#include "../src/protocol.h"
+
+#define TEST_VERIFY_REPORTS 5000
+#define TEST_VERIFY_VIOLATIONS_MAX 16
+
+// Collected violation lines
+typedef struct
+{
+    int count;
+    int types[TEST_VERIFY_VIOLATIONS_MAX];
+    long long lines[TEST_VERIFY_VIOLATIONS_MAX];
+} test_violations;
+
+static void test_collect_violation(void *context, const report_violation *violation)
+{
+    test_violations *violations = context;
+    if (violations->count < TEST_VERIFY_VIOLATIONS_MAX)
+    {
+        violations->types[violations->count] = violation->type;
+        violations->lines[violations->count] = violation->line;
+    }
+    violations->count++;
+}
+
+// Write a log with out3 toggling every 10 reports and out1 following it after the propagation delay,
+// a late report at the line 1001, out1 high with out3 low at the line 2016 and a malformed line 3001
+static size_t test_verify_log(char *buffer, size_t size)
+{
+    size_t length = 0;
+    long long timestamp = 1709898396500LL;
+    for (int n = 0; n < TEST_VERIFY_REPORTS; n++)
+    {
+        int high = (n / 10) % 2 == 0;
+        int previous_high = ((n - 1) / 10) % 2 == 0;
+        float out1 = (n > 0 && previous_high) ? 7.0f : 3.0f;
+        if (n == 2015)
+            out1 = -9.0f;
+        timestamp += (n == 1000) ? 150 : 100;
+        if (n == 3000)
+            length += snprintf(buffer + length, size - length, "{\"timestamp\": truncated\n");
+        length += snprintf(buffer + length, size - length, "{\"timestamp\": %lld, \"out1\": \"%.1f\", \"out2\": \"--\", \"out3\": \"%.1f\"}\n",
+                           timestamp, out1, high ? 5.0f : 0.0f);
+    }
+    return length;
+}
+
+int test_verify_stream(void)
+{
+    static char buffer[TEST_VERIFY_REPORTS * 96];
+    size_t length = test_verify_log(buffer, sizeof(buffer));
+    test_violations violations = {0};
+    report_verifier verifier;
+
+    // The log is fed in pieces splitting the lines
+    report_verifier_init(&verifier, REPORT_INTERVAL_100MS, test_collect_violation, &violations);
+    for (size_t offset = 0; offset < length; offset += 37)
+        report_verifier_feed(&verifier, buffer + offset, (length - offset < 37) ? length - offset : 37);
+    int result = report_verifier_finish(&verifier);
+    ASSERT_EQ("verify result", FAILURE, result);
+    ASSERT_EQ("all reports", TEST_VERIFY_REPORTS, (int)verifier.reports);
+    ASSERT_EQ("violation count", 3, violations.count);
+    ASSERT_EQ("timing violation", REPORT_VIOLATION_TIMING, violations.types[0]);
+    ASSERT_EQ("timing violation line", 1001, (int)violations.lines[0]);
+    ASSERT_EQ("control violation", REPORT_VIOLATION_CONTROL, violations.types[1]);
+    ASSERT_EQ("control violation line", 2016, (int)violations.lines[1]);
+    ASSERT_EQ("malformed line", 3001, (int)violations.lines[2]);
+    ASSERT_EQ("control effect seen", 1, verifier.control_effect_seen);
+    report_verifier_free(&verifier);
+
+    // The streaming check of a buffer longer than REPORT_COUNT_100 reports
+    result = check_timing_and_control(buffer, REPORT_INTERVAL_100MS);
+    ASSERT_EQ("check long buffer", FAILURE, result);
+    return 0;
+}
+
+int test_verify_threads(void)
+{
+    static char buffer[TEST_VERIFY_REPORTS * 96];
+    size_t length = test_verify_log(buffer, sizeof(buffer));
+    char path[] = "/tmp/test_verify_XXXXXX";
+    int fd = mkstemp(path);
+    write(fd, buffer, length);
+    unlink(path);
+
+    // The chunks of a mapped file give the same violations in the same order as a single thread
+    for (int threads = 1; threads <= 7; threads += 3)
+    {
+        test_violations violations = {0};
+        report_verifier verifier;
+        report_verifier_init(&verifier, REPORT_INTERVAL_100MS, test_collect_violation, &violations);
+        lseek(fd, 0, SEEK_SET);
+        int result = report_verify_fd(fd, &verifier, threads);
+        printf("threads: %d reports: %lld violations: %d\n", threads, verifier.reports, violations.count);
+        ASSERT_EQ("threads result", FAILURE, result);
+        ASSERT_EQ("threads reports", TEST_VERIFY_REPORTS, (int)verifier.reports);
+        ASSERT_EQ("threads lines", TEST_VERIFY_REPORTS + 1, (int)verifier.lines);
+        ASSERT_EQ("threads violations", 3, violations.count);
+        ASSERT_EQ("threads control line", 2016, (int)violations.lines[1]);
+        ASSERT_EQ("threads malformed line", 3001, (int)violations.lines[2]);
+        ASSERT_EQ("threads timing line", 1001, (int)violations.lines[0]);
+        report_verifier_free(&verifier);
+    }
+    close(fd);
+    return 0;
+}
+
+int main(void)
+{
+    RUN_TEST(test_verify_stream);
+    RUN_TEST(test_verify_threads);
+    return 0;
+}
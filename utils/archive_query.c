@@ -0,0 +1,83 @@
+/**
+ * @file archive_query.c
+ * @brief Prints the reports of a time range of the archive segments as JSON report lines.
+ *
+ * Usage: archive_query [--timestamp-ns] directory from_us to_us
+ *
+ * The range is in epoch microseconds, both ends included, e.g. from date +%s%6N. The
+ * segments of the range are memory-mapped and their indexes binary-searched, so only
+ * the blocks of the range are decoded.
+ */
+#include "protocol.h"
+
+// Channel table of the segment being printed, rebuilt when the channels change
+typedef struct
+{
+    channel_table channels;
+    char *report_buffer;
+    size_t report_size;
+    int timestamp_ns_enable;
+} archive_query_output;
+
+static int archive_query_channels(archive_query_output *output, const archive_reader *reader)
+{
+    int same = output->channels.count == reader->channel_count;
+    for (int i = 0; same && (i < reader->channel_count); i++)
+        same = strcmp(output->channels.configs[i].name, reader->names[i]) == 0;
+    if (same)
+        return 0;
+    channel_table_free(&output->channels);
+    memset(&output->channels, 0, sizeof(output->channels));
+    for (int i = 0; i < reader->channel_count; i++)
+        channel_table_add(&output->channels, CHANNEL_HOST_DEFAULT, TCP_PORT_OUT1, reader->names[i]);
+    free(output->report_buffer);
+    output->report_size = report_buffer_size(&output->channels);
+    output->report_buffer = malloc(output->report_size);
+    return output->report_buffer == NULL ? -1 : 0;
+}
+
+static void archive_query_print(void *context, const archive_reader *reader, long long timestamp_ns, const float *values)
+{
+    archive_query_output *output = context;
+    if (archive_query_channels(output, reader) < 0)
+        return;
+    for (int i = 0; i < reader->channel_count; i++)
+    {
+        char value[CHANNEL_VALUE_SIZE];
+        format_report_value(value, sizeof(value), values[i]);
+        channel_set_value(&output->channels.states[i], value);
+    }
+    int length = output->timestamp_ns_enable
+                     ? format_report_at_ns(output->report_buffer, output->report_size, &output->channels, timestamp_ns)
+                     : format_report_at(output->report_buffer, output->report_size, &output->channels, report_timestamp_ms(timestamp_ns));
+    if (length > 0)
+        printf("%s\n", output->report_buffer);
+}
+
+int main(int argc, char *argv[])
+{
+    archive_query_output output = {0};
+    int argument = 1;
+
+    if ((argc > argument) && (strcmp(argv[argument], "--timestamp-ns") == 0))
+    {
+        output.timestamp_ns_enable = 1;
+        argument++;
+    }
+    if (argc != argument + 3)
+    {
+        fprintf(stderr, "Usage: %s [--timestamp-ns] directory from_us to_us\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *directory = argv[argument];
+    long long from_ns = atoll(argv[argument + 1]) * 1000;
+    long long to_ns = atoll(argv[argument + 2]) * 1000;
+
+    long long rows = archive_segments_query(directory, from_ns, to_ns, archive_query_print, &output);
+    if (rows < 0)
+        fprintf(stderr, "%s: archive segments not read\n", directory);
+
+    free(output.report_buffer);
+    channel_table_free(&output.channels);
+    return (rows < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file archive_reader.c
+ * @brief Decodes a compressed report archive to the JSON report lines.
+ *
+ * Usage: archive_reader [--timestamp-ns] [file]
+ *
+ * The archive is read from the standard input when no file is given, and decoded a
+ * block at a time. With --timestamp-ns, the epoch nanosecond timestamp of the archive
+ * follows the millisecond timestamp, as in the client reports.
+ */
+#include "protocol.h"
+
+int main(int argc, char *argv[])
+{
+    archive_reader reader;
+    channel_table channels = {0};
+    FILE *file = stdin;
+    int timestamp_ns_enable = 0;
+    int argument = 1;
+
+    if ((argc > argument) && (strcmp(argv[argument], "--timestamp-ns") == 0))
+    {
+        timestamp_ns_enable = 1;
+        argument++;
+    }
+    if ((argc > argument) && (strcmp(argv[argument], "-") != 0))
+    {
+        file = fopen(argv[argument], "rb");
+        if (file == NULL)
+        {
+            perror(argv[argument]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (archive_reader_open(&reader, file) < 0)
+    {
+        fprintf(stderr, "invalid archive header\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < reader.channel_count; i++)
+        channel_table_add(&channels, CHANNEL_HOST_DEFAULT, TCP_PORT_OUT1, reader.names[i]);
+
+    size_t report_size = report_buffer_size(&channels);
+    char *report_buffer = malloc(report_size);
+    float *values = malloc(reader.channel_count * sizeof(float));
+    if ((report_buffer == NULL) || (values == NULL))
+        return EXIT_FAILURE;
+
+    long long timestamp_ns;
+    int result;
+    while ((result = archive_reader_next(&reader, &timestamp_ns, values)) == 1)
+    {
+        for (int i = 0; i < reader.channel_count; i++)
+        {
+            char value[CHANNEL_VALUE_SIZE];
+            format_report_value(value, sizeof(value), values[i]);
+            channel_set_value(&channels.states[i], value);
+        }
+        int length = timestamp_ns_enable ? format_report_at_ns(report_buffer, report_size, &channels, timestamp_ns)
+                                         : format_report_at(report_buffer, report_size, &channels, report_timestamp_ms(timestamp_ns));
+        if (length > 0)
+            printf("%s\n", report_buffer);
+    }
+    if (result < 0)
+        fprintf(stderr, "truncated or invalid archive block\n");
+
+    free(values);
+    free(report_buffer);
+    channel_table_free(&channels);
+    archive_reader_close(&reader);
+    if (file != stdin)
+        fclose(file);
+    return (result < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,84 @@
+/**
+ * @file binary_report_reader.c
+ * @brief Converts a binary report back to the JSON report lines.
+ *
+ * Usage: binary_report_reader [file] [first record] [record count]
+ *
+ * The report is read from the standard input when no file is given. With a file,
+ * the first record is located by the record number without reading the preceding records.
+ */
+#include "protocol.h"
+
+int main(int argc, char *argv[])
+{
+    binary_report_header header;
+    channel_table channels = {0};
+    FILE *file = stdin;
+    long long first = 0;
+    long long count = -1;
+
+    if ((argc > 1) && (strcmp(argv[1], "-") != 0))
+    {
+        file = fopen(argv[1], "rb");
+        if (file == NULL)
+        {
+            perror(argv[1]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc > 2)
+        first = atoll(argv[2]);
+    if (argc > 3)
+        count = atoll(argv[3]);
+
+    if (binary_report_read_header(file, &header) < 0)
+    {
+        fprintf(stderr, "invalid binary report header\n");
+        return EXIT_FAILURE;
+    }
+    // The channel count comes from the file, so the values are on the heap
+    float *values = malloc(header.channel_count * sizeof(float));
+    if (values == NULL)
+        return EXIT_FAILURE;
+    if ((first > 0) && (fseeko(file, (off_t)(header.header_size + first * header.record_size), SEEK_SET) != 0))
+    {
+        // A stream is skipped up to the first record
+        long long timestamp;
+        for (long long i = 0; i < first; i++)
+        {
+            if (binary_report_read_record(file, &header, &timestamp, values) != 1)
+                return EXIT_FAILURE;
+        }
+    }
+
+    for (int i = 0; i < header.channel_count; i++)
+        channel_table_add(&channels, CHANNEL_HOST_DEFAULT, TCP_PORT_OUT1, header.names[i]);
+
+    size_t report_size = report_buffer_size(&channels);
+    char *report_buffer = malloc(report_size);
+    if (report_buffer == NULL)
+        return EXIT_FAILURE;
+
+    int result = 0;
+    while ((count != 0) && ((result = binary_report_read_record(file, &header, &report_timestamp, values)) == 1))
+    {
+        for (int i = 0; i < header.channel_count; i++)
+        {
+            char value[CHANNEL_VALUE_SIZE];
+            format_report_value(value, sizeof(value), values[i]);
+            channel_set_value(&channels.states[i], value);
+        }
+        if (format_report(report_buffer, report_size, &channels) > 0)
+            printf("%s\n", report_buffer);
+        if (count > 0)
+            count--;
+    }
+
+    free(values);
+    free(report_buffer);
+    channel_table_free(&channels);
+    binary_report_header_free(&header);
+    if (file != stdin)
+        fclose(file);
+    return (count != 0 && result < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,64 @@
+/**
+ * @file report_verify.c
+ * @brief Verifies the timing and control effects of a JSON report log.
+ *
+ * Usage: report_verify [-i interval_ms] [-t threads] [file]
+ *
+ * The log is read from the standard input when no file is given. A file is
+ * memory-mapped, and with more than one thread split on newline-aligned chunks.
+ * Every violation is printed with the line number and byte offset, followed by
+ * a summary, and the exit status is 0 only without violations.
+ */
+#include "protocol.h"
+
+int main(int argc, char *argv[])
+{
+    long interval_ms = REPORT_INTERVAL_100MS;
+    int threads = 1;
+    int option;
+
+    while ((option = getopt(argc, argv, "i:t:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'i':
+            interval_ms = atol(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i interval_ms] [-t threads 1..%d] [file]\n", argv[0], REPORT_VERIFY_THREADS_MAX);
+            return EXIT_FAILURE;
+        }
+    }
+    if ((interval_ms <= 0) || (threads < 1))
+    {
+        fprintf(stderr, "invalid interval or thread count\n");
+        return EXIT_FAILURE;
+    }
+
+    int fd = STDIN_FILENO;
+    if ((optind < argc) && (strcmp(argv[optind], "-") != 0))
+    {
+        fd = open(argv[optind], O_RDONLY);
+        if (fd < 0)
+        {
+            perror(argv[optind]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    report_verifier verifier;
+    if (report_verifier_init(&verifier, interval_ms, report_violation_print, stdout) < 0)
+        return EXIT_FAILURE;
+    int result = report_verify_fd(fd, &verifier, threads);
+    printf("lines: %lld reports: %lld timing violations: %lld control violations: %lld malformed lines: %lld control effect seen: %d\n",
+           verifier.lines, verifier.reports, verifier.timing_violations, verifier.control_violations,
+           verifier.malformed_lines, verifier.control_effect_seen);
+
+    report_verifier_free(&verifier);
+    if (fd != STDIN_FILENO)
+        close(fd);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,67 @@
+/**
+ * @file shm_report_reader.c
+ * @brief Prints the latest report of a shared-memory segment as JSON report lines.
+ *
+ * Usage: shm_report_reader [name] [report count] [poll interval ms]
+ *
+ * The segment is SHM_REPORT_NAME_DEFAULT when no name is given. By default the latest
+ * report is printed once, and with a report count, each new report is printed until
+ * the count is reached, polling the segment at the interval, by default 1 ms.
+ */
+#include "protocol.h"
+
+int main(int argc, char *argv[])
+{
+    const char *name = (argc > 1) ? argv[1] : SHM_REPORT_NAME_DEFAULT;
+    long long count = (argc > 2) ? atoll(argv[2]) : 1;
+    long interval_us = (argc > 3) ? atol(argv[3]) * 1000 : 1000;
+    shm_report_reader reader;
+
+    if (shm_report_reader_open(&reader, name) < 0)
+    {
+        fprintf(stderr, "%s: no report segment\n", name);
+        return EXIT_FAILURE;
+    }
+
+    channel_table channels = {0};
+    for (int i = 0; i < reader.channel_count; i++)
+        channel_table_add(&channels, CHANNEL_HOST_DEFAULT, TCP_PORT_OUT1, reader.names[i]);
+    size_t report_size = report_buffer_size(&channels);
+    char *report_buffer = malloc(report_size);
+    float *values = malloc((reader.channel_count > 0 ? reader.channel_count : 1) * sizeof(float));
+    if ((report_buffer == NULL) || (values == NULL))
+        return EXIT_FAILURE;
+
+    unsigned long long printed = 0;
+    int result = 0;
+    while (count != 0)
+    {
+        unsigned long long sequence;
+        result = shm_report_read(&reader, &report_timestamp, values, &sequence);
+        if (result < 0)
+            break;
+        if ((result == 0) || (sequence == printed))
+        {
+            usleep(interval_us);
+            continue;
+        }
+        printed = sequence;
+        for (int i = 0; i < reader.channel_count; i++)
+        {
+            char value[CHANNEL_VALUE_SIZE];
+            format_report_value(value, sizeof(value), values[i]);
+            channel_set_value(&channels.states[i], value);
+        }
+        if (format_report(report_buffer, report_size, &channels) > 0)
+            printf("%s\n", report_buffer);
+        fflush(stdout);
+        if (count > 0)
+            count--;
+    }
+
+    free(values);
+    free(report_buffer);
+    channel_table_free(&channels);
+    shm_report_reader_close(&reader);
+    return (result < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
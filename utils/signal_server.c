@@ -0,0 +1,492 @@
+/**
+ * @file signal_server.c
+ * @brief Local stand-in for the assignment signal server.
+ *
+ * Serves the sine, triangle and binary waveforms on the TCP signal ports and
+ * honours the UDP control protocol, so the clients and tests can be run and
+ * load tested without the undisclosed server image.
+ *
+ * The port index k serves the waveform k % 3, i.e. out1 sine, out2 triangle and
+ * out3 binary, repeated over the ports. The control object of the port index k is k + 1.
+ * The line rate is per port and the lines sent within one tick share the same sample.
+ */
+#include "protocol.h"
+#include <math.h>
+#include <sys/resource.h>
+
+#define SIGNAL_PORT_BASE TCP_PORT_OUT1
+#define SIGNAL_PORT_COUNT 3
+#define SIGNAL_LINE_RATE 50.0 // lines per second per port, close to the assignment server
+#define SIGNAL_TICK_US 1000
+#define SIGNAL_PORT_CLIENTS_MAX 8
+#define SIGNAL_CLIENT_BUFFER_MIN 4096
+#define SIGNAL_CLIENT_BUFFER_MAX (1 << 20)
+#define SIGNAL_LINE_SIZE 16
+#define SIGNAL_EVENTS_MAX 64
+#define SIGNAL_EVENT_TIMER UINT32_MAX
+#define SIGNAL_EVENT_SIGNAL (UINT32_MAX - 1)
+#define SIGNAL_EVENT_CONTROL (UINT32_MAX - 2)
+#define SIGNAL_SHAPE_SINE 0
+#define SIGNAL_SHAPE_TRIANGLE 1
+#define SIGNAL_SHAPE_BINARY 2
+#define SIGNAL_SHAPE_COUNT 3
+#define PROPERTY_ENABLED 14
+#define PROPERTY_MIN_DURATION 42
+#define PROPERTY_MAX_DURATION 43
+
+// Connected client with the pending output
+typedef struct
+{
+    int sockfd;
+    size_t length;
+    size_t capacity;
+    char *buffer;
+} signal_client;
+
+// Signal port with the control properties and the waveform state
+typedef struct
+{
+    int listen_fd;
+    int shape;
+    int enabled;
+    int frequency_mhz;
+    int amplitude;
+    int min_duration_ms;
+    int max_duration_ms;
+    double binary_value;
+    double binary_toggle_time;
+    double lines_due;
+    int client_count;
+    signal_client clients[SIGNAL_PORT_CLIENTS_MAX];
+} signal_port;
+
+// Server configuration from the command line
+typedef struct
+{
+    const char *address;
+    int port_base;
+    int port_count;
+    int control_port;
+    double line_rate;
+    int tick_us;
+    unsigned int seed;
+    int quiet;
+} signal_server_options;
+
+static signal_port *ports;
+static unsigned int random_state;
+
+static double monotonic_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Random binary duration within the min and max duration properties
+static double binary_duration(const signal_port *port)
+{
+    int range = port->max_duration_ms - port->min_duration_ms;
+    int duration_ms = port->min_duration_ms + (range > 0 ? rand_r(&random_state) % (range + 1) : 0);
+    return duration_ms / 1000.0;
+}
+
+static void signal_port_defaults(signal_port *port, int index, double now)
+{
+    port->shape = index % SIGNAL_SHAPE_COUNT;
+    port->enabled = 1;
+    port->frequency_mhz = (port->shape == SIGNAL_SHAPE_SINE) ? 500 : 250;
+    port->amplitude = 5000;
+    port->min_duration_ms = 1000;
+    port->max_duration_ms = 5000;
+    port->binary_value = 0.0;
+    port->binary_toggle_time = now + binary_duration(port);
+    port->lines_due = 0.0;
+    port->client_count = 0;
+}
+
+// Waveform sample at the given time
+static double signal_sample(signal_port *port, double now)
+{
+    double amplitude = port->amplitude / 1000.0;
+    double phase = fmod(now * port->frequency_mhz / 1000.0, 1.0);
+
+    switch (port->shape)
+    {
+    case SIGNAL_SHAPE_SINE:
+        return amplitude * sin(2.0 * M_PI * phase);
+    case SIGNAL_SHAPE_TRIANGLE:
+        return amplitude * (phase < 0.5 ? 2.0 * phase : 2.0 - 2.0 * phase);
+    default:
+        while (now >= port->binary_toggle_time)
+        {
+            port->binary_value = (port->binary_value == 0.0) ? 5.0 : 0.0;
+            port->binary_toggle_time += binary_duration(port);
+        }
+        return port->binary_value;
+    }
+}
+
+static int open_listen_socket(const char *address, int port)
+{
+    struct sockaddr_in addr;
+    int enable = 1;
+
+    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0)
+        return -1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(address);
+    if ((bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(sockfd, SOMAXCONN) < 0))
+    {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+static int open_control_socket(const char *address, int port)
+{
+    struct sockaddr_in addr;
+
+    int sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0)
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(address);
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+static void accept_clients(signal_port *port, size_t buffer_capacity)
+{
+    int sockfd;
+    while ((sockfd = accept4(port->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        if (port->client_count == SIGNAL_PORT_CLIENTS_MAX)
+        {
+            close(sockfd);
+            continue;
+        }
+        signal_client *client = &port->clients[port->client_count];
+        client->buffer = malloc(buffer_capacity);
+        if (client->buffer == NULL)
+        {
+            close(sockfd);
+            continue;
+        }
+        client->sockfd = sockfd;
+        client->length = 0;
+        client->capacity = buffer_capacity;
+        port->client_count++;
+    }
+}
+
+static void remove_client(signal_port *port, int index)
+{
+    close(port->clients[index].sockfd);
+    free(port->clients[index].buffer);
+    port->clients[index] = port->clients[--port->client_count];
+}
+
+// Send the pending output, returns -1 when the client has gone
+static int flush_client(signal_client *client)
+{
+    while (client->length > 0)
+    {
+        ssize_t sent = send(client->sockfd, client->buffer, client->length, MSG_NOSIGNAL);
+        if (sent < 0)
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+        memmove(client->buffer, client->buffer + sent, client->length - sent);
+        client->length -= sent;
+    }
+    return 0;
+}
+
+// Emit the lines due on a port since the previous tick
+static void emit_lines(signal_port *port, double now, double lines_per_tick)
+{
+    char line[SIGNAL_LINE_SIZE];
+
+    port->lines_due += lines_per_tick;
+    long lines = (long)port->lines_due;
+    if (lines == 0)
+        return;
+    port->lines_due -= lines;
+    if (!port->enabled || (port->client_count == 0))
+        return;
+
+    int line_length = snprintf(line, sizeof(line), "%.1f\n", signal_sample(port, now));
+    for (int i = port->client_count - 1; i >= 0; i--)
+    {
+        signal_client *client = &port->clients[i];
+        // A slow client loses the whole lines that do not fit in its buffer
+        long room = (client->capacity - client->length) / line_length;
+        long count = lines < room ? lines : room;
+        for (long n = 0; n < count; n++)
+        {
+            memcpy(client->buffer + client->length, line, line_length);
+            client->length += line_length;
+        }
+        if (flush_client(client) < 0)
+            remove_client(port, i);
+    }
+}
+
+static void handle_control(int control_fd, int port_count, int quiet)
+{
+    control_message msg;
+    while (recv(control_fd, &msg, sizeof(msg), 0) == sizeof(msg))
+    {
+        int operation = ntohs(msg.operation);
+        int object = ntohs(msg.object);
+        int property = ntohs(msg.property);
+        int value = ntohs(msg.value);
+        if ((object < 1) || (object > port_count))
+        {
+            if (!quiet)
+                fprintf(stderr, "object %d not found\n", object);
+            continue;
+        }
+        signal_port *port = &ports[object - 1];
+        int *target = NULL;
+        switch (property)
+        {
+        case PROPERTY_ENABLED:
+            target = &port->enabled;
+            break;
+        case CONTROL_OBJECT_OUT1_PROPERTY_FREQUENCY_INDEX:
+            target = (port->shape != SIGNAL_SHAPE_BINARY) ? &port->frequency_mhz : NULL;
+            break;
+        case CONTROL_OBJECT_OUT1_PROPERTY_AMPLITUDE_INDEX:
+            target = (port->shape != SIGNAL_SHAPE_BINARY) ? &port->amplitude : NULL;
+            break;
+        case PROPERTY_MIN_DURATION:
+            target = (port->shape == SIGNAL_SHAPE_BINARY) ? &port->min_duration_ms : NULL;
+            break;
+        case PROPERTY_MAX_DURATION:
+            target = (port->shape == SIGNAL_SHAPE_BINARY) ? &port->max_duration_ms : NULL;
+            break;
+        }
+        if (target == NULL)
+        {
+            if (!quiet)
+                fprintf(stderr, "object %d property %d not found\n", object, property);
+            continue;
+        }
+        if (operation == CONTROL_OPERATION_WRITE)
+            *target = value;
+        if (!quiet)
+            fprintf(stderr, "%s object %d property %d value %d\n",
+                    operation == CONTROL_OPERATION_WRITE ? "write" : "read", object, property, *target);
+    }
+}
+
+static void raise_file_limit(void)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [options]\n"
+                    "  -a, --address ADDR   listen address, default 127.0.0.1\n"
+                    "  -p, --port PORT      first signal port, default %d\n"
+                    "  -n, --ports N        signal port count, default %d\n"
+                    "  -u, --control PORT   UDP control port, default %d\n"
+                    "  -r, --rate LINES     lines per second per port, default %.0f\n"
+                    "  -t, --tick US        output tick in microseconds, default %d\n"
+                    "  -s, --seed SEED      binary duration random seed\n"
+                    "  -q, --quiet          no control log on stderr\n",
+            program, SIGNAL_PORT_BASE, SIGNAL_PORT_COUNT, CONTROL_UDP_PORT, SIGNAL_LINE_RATE, SIGNAL_TICK_US);
+}
+
+static int parse_options(int argc, char *argv[], signal_server_options *options)
+{
+    static const struct option long_options[] = {
+        {"address", required_argument, NULL, 'a'},
+        {"port", required_argument, NULL, 'p'},
+        {"ports", required_argument, NULL, 'n'},
+        {"control", required_argument, NULL, 'u'},
+        {"rate", required_argument, NULL, 'r'},
+        {"tick", required_argument, NULL, 't'},
+        {"seed", required_argument, NULL, 's'},
+        {"quiet", no_argument, NULL, 'q'},
+        {NULL, 0, NULL, 0}};
+    int option;
+
+    while ((option = getopt_long(argc, argv, "a:p:n:u:r:t:s:q", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'a':
+            options->address = optarg;
+            break;
+        case 'p':
+            options->port_base = atoi(optarg);
+            break;
+        case 'n':
+            options->port_count = atoi(optarg);
+            break;
+        case 'u':
+            options->control_port = atoi(optarg);
+            break;
+        case 'r':
+            options->line_rate = atof(optarg);
+            break;
+        case 't':
+            options->tick_us = atoi(optarg);
+            break;
+        case 's':
+            options->seed = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'q':
+            options->quiet = 1;
+            break;
+        default:
+            return -1;
+        }
+    }
+    if ((options->port_count <= 0) || (options->line_rate <= 0.0) || (options->tick_us <= 0) ||
+        (options->port_base + options->port_count > 65536))
+        return -1;
+    return 0;
+}
+
+static int epoll_add(int epoll_fd, int fd, uint32_t tag)
+{
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = tag;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+int main(int argc, char *argv[])
+{
+    signal_server_options options = {"127.0.0.1", SIGNAL_PORT_BASE, SIGNAL_PORT_COUNT, CONTROL_UDP_PORT,
+                                     SIGNAL_LINE_RATE, SIGNAL_TICK_US, (unsigned int)time(NULL), 0};
+    if (parse_options(argc, argv, &options) < 0)
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    random_state = options.seed;
+    raise_file_limit();
+
+    // Buffer for about 50 ms of lines per client
+    size_t buffer_capacity = (size_t)(options.line_rate * SIGNAL_LINE_SIZE / 20.0);
+    if (buffer_capacity < SIGNAL_CLIENT_BUFFER_MIN)
+        buffer_capacity = SIGNAL_CLIENT_BUFFER_MIN;
+    if (buffer_capacity > SIGNAL_CLIENT_BUFFER_MAX)
+        buffer_capacity = SIGNAL_CLIENT_BUFFER_MAX;
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int control_fd = open_control_socket(options.address, options.control_port);
+    if ((epoll_fd < 0) || (signal_fd < 0) || (control_fd < 0))
+    {
+        perror("control socket");
+        return EXIT_FAILURE;
+    }
+    epoll_add(epoll_fd, signal_fd, SIGNAL_EVENT_SIGNAL);
+    epoll_add(epoll_fd, control_fd, SIGNAL_EVENT_CONTROL);
+
+    double now = monotonic_seconds();
+    ports = calloc(options.port_count, sizeof(signal_port));
+    if (ports == NULL)
+        return EXIT_FAILURE;
+    for (int i = 0; i < options.port_count; i++)
+    {
+        signal_port_defaults(&ports[i], i, now);
+        ports[i].listen_fd = open_listen_socket(options.address, options.port_base + i);
+        if ((ports[i].listen_fd < 0) || epoll_add(epoll_fd, ports[i].listen_fd, i))
+        {
+            fprintf(stderr, "listen port %d: %s\n", options.port_base + i, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct itimerspec its;
+    its.it_value.tv_sec = options.tick_us / 1000000;
+    its.it_value.tv_nsec = (options.tick_us % 1000000) * 1000L;
+    its.it_interval = its.it_value;
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if ((timer_fd < 0) || timerfd_settime(timer_fd, 0, &its, NULL) || epoll_add(epoll_fd, timer_fd, SIGNAL_EVENT_TIMER))
+    {
+        perror("timer");
+        return EXIT_FAILURE;
+    }
+    if (!options.quiet)
+        fprintf(stderr, "serving %d ports from %d at %.0f lines/s, control on %d\n",
+                options.port_count, options.port_base, options.line_rate, options.control_port);
+
+    struct epoll_event events[SIGNAL_EVENTS_MAX];
+    double previous_tick = now;
+    int running = 1;
+    while (running)
+    {
+        int event_count = epoll_wait(epoll_fd, events, SIGNAL_EVENTS_MAX, -1);
+        for (int e = 0; e < event_count; e++)
+        {
+            uint32_t tag = events[e].data.u32;
+            if (tag == SIGNAL_EVENT_SIGNAL)
+            {
+                running = 0;
+            }
+            else if (tag == SIGNAL_EVENT_CONTROL)
+            {
+                handle_control(control_fd, options.port_count, options.quiet);
+            }
+            else if (tag == SIGNAL_EVENT_TIMER)
+            {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                    continue;
+                // Lines due by the elapsed time, so a late tick catches up
+                now = monotonic_seconds();
+                double lines_per_tick = options.line_rate * (now - previous_tick);
+                previous_tick = now;
+                for (int i = 0; i < options.port_count; i++)
+                    emit_lines(&ports[i], now, lines_per_tick);
+            }
+            else
+            {
+                accept_clients(&ports[tag], buffer_capacity);
+            }
+        }
+    }
+
+    for (int i = 0; i < options.port_count; i++)
+    {
+        while (ports[i].client_count > 0)
+            remove_client(&ports[i], 0);
+        close(ports[i].listen_fd);
+    }
+    free(ports);
+    close(timer_fd);
+    close(control_fd);
+    close(epoll_fd);
+    close(signal_fd);
+    return EXIT_SUCCESS;
+}